@@ -0,0 +1,194 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mjlib {
+namespace base {
+
+/// The available implementations of CRC-CCITT.  All produce
+/// identical results, they differ only in speed and table size.
+enum class CrcCcittMethod {
+  /// 16 entry table (32 bytes), processes 4 bits at a time.
+  kNibble,
+  /// 256 entry table (512 bytes), processes a byte at a time.
+  kTable,
+  /// 8 256 entry tables (4KB), processes 8 bytes at a time.
+  kSlice8,
+};
+
+#if defined(__arm__) && !defined(__linux__)
+constexpr CrcCcittMethod kDefaultCrcCcittMethod = CrcCcittMethod::kTable;
+#else
+constexpr CrcCcittMethod kDefaultCrcCcittMethod = CrcCcittMethod::kSlice8;
+#endif
+
+namespace detail {
+constexpr uint16_t kCrcCcittPoly = 0x1021;
+
+struct CrcCcittNibbleTable {
+  uint16_t data[16] = {};
+};
+
+struct CrcCcittTable {
+  uint16_t data[256] = {};
+};
+
+struct CrcCcittSliceTables {
+  uint16_t data[8][256] = {};
+};
+
+constexpr CrcCcittNibbleTable MakeCrcCcittNibbleTable() {
+  CrcCcittNibbleTable result;
+  for (int i = 0; i < 16; i++) {
+    uint16_t crc = i << 12;
+    for (int bit = 0; bit < 4; bit++) {
+      crc = (crc & 0x8000) ? ((crc << 1) ^ kCrcCcittPoly) : (crc << 1);
+    }
+    result.data[i] = crc;
+  }
+  return result;
+}
+
+constexpr CrcCcittTable MakeCrcCcittTable() {
+  CrcCcittTable result;
+  for (int i = 0; i < 256; i++) {
+    uint16_t crc = i << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? ((crc << 1) ^ kCrcCcittPoly) : (crc << 1);
+    }
+    result.data[i] = crc;
+  }
+  return result;
+}
+
+inline constexpr CrcCcittNibbleTable kCrcCcittNibbleTable =
+    MakeCrcCcittNibbleTable();
+
+// The byte table is an object of its own, so that kTable users link
+// in only its 512 bytes, and not all of the slice tables.
+inline constexpr CrcCcittTable kCrcCcittTable = MakeCrcCcittTable();
+
+constexpr CrcCcittSliceTables MakeCrcCcittSliceTables() {
+  CrcCcittSliceTables result;
+  for (int i = 0; i < 256; i++) {
+    result.data[0][i] = kCrcCcittTable.data[i];
+  }
+
+  // Table N gives the effect of a byte followed by N zero bytes.
+  for (int table = 1; table < 8; table++) {
+    for (int i = 0; i < 256; i++) {
+      const uint16_t prev = result.data[table - 1][i];
+      result.data[table][i] =
+          static_cast<uint16_t>(prev << 8) ^ kCrcCcittTable.data[prev >> 8];
+    }
+  }
+  return result;
+}
+
+inline constexpr CrcCcittSliceTables kCrcCcittSliceTables =
+    MakeCrcCcittSliceTables();
+
+inline uint16_t UpdateCrcCcittNibble(
+    uint16_t crc, const uint8_t* data, size_t size) {
+  const auto& table = kCrcCcittNibbleTable.data;
+  for (size_t i = 0; i < size; i++) {
+    crc = static_cast<uint16_t>(crc << 4) ^
+        table[(crc >> 12) ^ (data[i] >> 4)];
+    crc = static_cast<uint16_t>(crc << 4) ^
+        table[(crc >> 12) ^ (data[i] & 0x0f)];
+  }
+  return crc;
+}
+
+inline uint16_t UpdateCrcCcittTable(
+    uint16_t crc, const uint8_t* data, size_t size) {
+  const auto& table = kCrcCcittTable.data;
+  for (size_t i = 0; i < size; i++) {
+    crc = static_cast<uint16_t>(crc << 8) ^ table[(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
+
+inline uint16_t UpdateCrcCcittSlice8(
+    uint16_t crc, const uint8_t* data, size_t size) {
+  const auto& t = kCrcCcittSliceTables.data;
+  while (size >= 8) {
+    // The existing CRC only overlaps the first two bytes.  Each byte
+    // is then looked up in the table which accounts for how many
+    // bytes follow it in this block.
+    crc = t[7][data[0] ^ (crc >> 8)] ^
+        t[6][data[1] ^ (crc & 0xff)] ^
+        t[5][data[2]] ^
+        t[4][data[3]] ^
+        t[3][data[4]] ^
+        t[2][data[5]] ^
+        t[1][data[6]] ^
+        t[0][data[7]];
+    data += 8;
+    size -= 8;
+  }
+  return UpdateCrcCcittTable(crc, data, size);
+}
+}
+
+/// Calculates the CRC-CCITT (polynomial 0x1021, initial value 0xffff,
+/// not reflected, no final xor) of a sequence of bytes.  This is the
+/// checksum used by the multiplex protocol, and is identical to
+/// boost::crc_ccitt_type, which this can replace.
+///
+/// Data may be provided incrementally through process_bytes.
+template <CrcCcittMethod Method = kDefaultCrcCcittMethod>
+class CrcCcittT {
+ public:
+  using value_type = uint16_t;
+
+  static constexpr uint16_t kInitial = 0xffff;
+
+  explicit CrcCcittT(uint16_t initial = kInitial) : crc_(initial) {}
+
+  void process_bytes(const void* data, size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    if constexpr (Method == CrcCcittMethod::kNibble) {
+      crc_ = detail::UpdateCrcCcittNibble(crc_, bytes, size);
+    } else if constexpr (Method == CrcCcittMethod::kTable) {
+      crc_ = detail::UpdateCrcCcittTable(crc_, bytes, size);
+    } else {
+      crc_ = detail::UpdateCrcCcittSlice8(crc_, bytes, size);
+    }
+  }
+
+  uint16_t checksum() const { return crc_; }
+
+  void reset(uint16_t initial = kInitial) { crc_ = initial; }
+
+ private:
+  uint16_t crc_;
+};
+
+using CrcCcitt = CrcCcittT<>;
+
+/// Calculate the CRC-CCITT of the given block of data in one call.
+template <CrcCcittMethod Method = kDefaultCrcCcittMethod>
+uint16_t CalculateCrcCcitt(const void* data, size_t size) {
+  CrcCcittT<Method> crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+}
+}
@@ -0,0 +1,126 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "mjlib/base/assert.h"
+
+namespace mjlib {
+namespace base {
+
+/// Counts non-negative integer samples, like latencies in
+/// microseconds, in log-linear buckets after the fashion of
+/// HdrHistogram.
+///
+/// Values below 2**significant_bits are counted exactly.  Above that,
+/// each power of two range is split into 2**(significant_bits - 1)
+/// equal buckets, so any reported value is within a relative
+/// 2**-(significant_bits - 1) of a sample.  Memory use is fixed at
+/// construction, and Add() does not allocate.
+class HdrHistogram {
+ public:
+  /// @param max_bits values of 2**max_bits or more are counted as if
+  /// they were 2**max_bits - 1.
+  HdrHistogram(int significant_bits = 5, int max_bits = 32)
+      : significant_bits_(significant_bits),
+        max_value_((uint64_t(1) << max_bits) - 1),
+        counts_(Index(max_value_) + 1) {
+    MJ_ASSERT(significant_bits >= 1);
+    MJ_ASSERT(max_bits > significant_bits && max_bits < 64);
+  }
+
+  void Add(uint64_t value) {
+    counts_[Index(std::min(value, max_value_))]++;
+    count_++;
+    total_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void Reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    total_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const {
+    return count_ ? static_cast<double>(total_) / count_ : 0.0;
+  }
+
+  /// @return a value which at least @p fraction of samples are less
+  /// than or equal to, being the largest value which shares a bucket
+  /// with that sample.
+  uint64_t Percentile(double fraction) const {
+    if (count_ == 0) { return 0; }
+
+    const uint64_t rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(fraction * count_)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::max(min_, std::min(max_, Highest(i)));
+      }
+    }
+    return max_;
+  }
+
+ private:
+  size_t Index(uint64_t value) const {
+    const uint64_t sub_count = uint64_t(1) << significant_bits_;
+    if (value < sub_count) { return value; }
+
+    int width = 0;
+    for (uint64_t v = value; v; v >>= 1) { width++; }
+
+    const int shift = width - significant_bits_;
+    const uint64_t half = sub_count >> 1;
+    const uint64_t mantissa = value >> shift;
+    return sub_count + (shift - 1) * half + (mantissa - half);
+  }
+
+  uint64_t Highest(size_t index) const {
+    const uint64_t sub_count = uint64_t(1) << significant_bits_;
+    if (index < sub_count) { return index; }
+
+    const uint64_t half = sub_count >> 1;
+    const uint64_t offset = index - sub_count;
+    const int shift = offset / half + 1;
+    const uint64_t mantissa = half + offset % half;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+  const int significant_bits_;
+  const uint64_t max_value_;
+  std::vector<uint64_t> counts_;
+
+  uint64_t count_ = 0;
+  uint64_t total_ = 0;
+  uint64_t min_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_ = 0;
+};
+
+}
+}
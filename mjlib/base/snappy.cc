@@ -0,0 +1,329 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// The snappy raw format is:
+///
+///  * varint - uncompressed length, 7 bits at a time, least
+///    significant first
+///  * N elements, each starting with a tag byte whose low 2 bits are
+///    * 0 - literal
+///      * upper 6 bits are length - 1, or if 60-63, then 1-4 bytes
+///        of little endian length - 1 follow
+///      * length bytes of data
+///    * 1 - copy with a 1 byte offset
+///      * bits 2-4 are length - 4, bits 5-7 the upper 3 bits of the
+///        offset
+///      * 1 byte lower 8 bits of the offset
+///    * 2 - copy with a 2 byte offset
+///      * upper 6 bits are length - 1
+///      * 2 byte little endian offset
+///    * 3 - copy with a 4 byte offset
+///      * upper 6 bits are length - 1
+///      * 4 byte little endian offset
+///
+/// A copy repeats length bytes starting offset bytes before the
+/// current end of the output, and may overlap itself.
+
+#include "mjlib/base/snappy.h"
+
+#include <cstring>
+
+#include "mjlib/base/assert.h"
+#include "mjlib/base/fast_stream.h"
+
+namespace mjlib {
+namespace base {
+
+namespace {
+constexpr size_t kBlockSize = 1 << 16;
+constexpr size_t kMaxHashTableSize = 1 << 14;
+constexpr size_t kMinHashTableSize = 1 << 8;
+
+// Fragments shorter than this are emitted as a single literal, and
+// matching stops this far from the end, so that 4 byte loads never
+// overrun.
+constexpr size_t kInputMarginBytes = 15;
+
+uint32_t Load32(const char* data) {
+  uint32_t result = 0;
+  std::memcpy(&result, data, sizeof(result));
+  return result;
+}
+
+uint32_t Hash(uint32_t bytes, int shift) {
+  return (bytes * 0x1e35a7bd) >> shift;
+}
+
+char* EmitLiteral(char* op, const char* literal, size_t size) {
+  const size_t n = size - 1;
+  if (n < 60) {
+    *op++ = static_cast<char>(n << 2);
+  } else {
+    char* const tag = op++;
+    int count = 0;
+    for (size_t value = n; value > 0; value >>= 8) {
+      *op++ = static_cast<char>(value & 0xff);
+      count++;
+    }
+    *tag = static_cast<char>((59 + count) << 2);
+  }
+  std::memcpy(op, literal, size);
+  return op + size;
+}
+
+char* EmitCopyAtMost64(char* op, size_t offset, size_t size) {
+  if (size < 12 && offset < 2048) {
+    *op++ = static_cast<char>(1 | ((size - 4) << 2) | ((offset >> 8) << 5));
+    *op++ = static_cast<char>(offset & 0xff);
+  } else {
+    *op++ = static_cast<char>(2 | ((size - 1) << 2));
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>((offset >> 8) & 0xff);
+  }
+  return op;
+}
+
+char* EmitCopy(char* op, size_t offset, size_t size) {
+  // Every piece must be at least 4 long to use the short form.
+  while (size >= 68) {
+    op = EmitCopyAtMost64(op, offset, 64);
+    size -= 64;
+  }
+  if (size > 64) {
+    op = EmitCopyAtMost64(op, offset, 60);
+    size -= 60;
+  }
+  return EmitCopyAtMost64(op, offset, size);
+}
+
+/// No element can expand by more than this.  The best case is a 3
+/// byte copy of 64 bytes.
+constexpr uint64_t kMaxExpansion = 22;
+
+/// @return the uncompressed length, and set @p header_size to the
+/// number of bytes it took.  A length which could not have come from
+/// the rest of @p input is rejected, so that corrupt data can't make
+/// the caller allocate gigabytes.
+std::optional<size_t> ParseLength(std::string_view input,
+                                  size_t* header_size) {
+  uint32_t result = 0;
+  for (size_t i = 0; i < 5 && i < input.size(); i++) {
+    const uint8_t c = static_cast<uint8_t>(input[i]);
+    if (i == 4 && c > 0x0f) { return {}; }
+    result |= static_cast<uint32_t>(c & 0x7f) << (7 * i);
+    if ((c & 0x80) == 0) {
+      const uint64_t remaining = input.size() - (i + 1);
+      if (result > remaining * kMaxExpansion) { return {}; }
+      *header_size = i + 1;
+      return result;
+    }
+  }
+  return {};
+}
+}
+
+void SnappyCompressor::Compress(std::string_view input, WriteStream& output) {
+  MJ_ASSERT(input.size() <= 0xffffffffu);
+
+  char header[5] = {};
+  size_t header_size = 0;
+  uint32_t value = input.size();
+  do {
+    header[header_size++] =
+        static_cast<char>((value & 0x7f) | (value > 0x7f ? 0x80 : 0x00));
+    value >>= 7;
+  } while (value);
+  output.write({header, header_size});
+
+  for (size_t position = 0; position < input.size();
+       position += kBlockSize) {
+    CompressFragment(input.substr(position, kBlockSize), output);
+  }
+}
+
+std::string SnappyCompressor::Compress(std::string_view input) {
+  FastOStringStream ostr;
+  Compress(input, ostr);
+  return ostr.str();
+}
+
+void SnappyCompressor::CompressFragment(std::string_view input,
+                                        WriteStream& output) {
+  const char* const base = input.data();
+  const size_t size = input.size();
+
+  buffer_.resize(MaxCompressedLength(size));
+  char* op = buffer_.data();
+
+  size_t next_emit = 0;
+  if (size >= kInputMarginBytes) {
+    size_t table_size = kMinHashTableSize;
+    int shift = 32 - 8;
+    while (table_size < kMaxHashTableSize && table_size < size) {
+      table_size <<= 1;
+      shift--;
+    }
+    table_.assign(table_size, 0);
+
+    const size_t limit = size - kInputMarginBytes;
+    size_t ip = 1;
+
+    // Look for matches less often the longer it has been since the
+    // last one, so that incompressible data goes by quickly.
+    uint32_t skip = 32;
+
+    while (ip < limit) {
+      const uint32_t bytes = Load32(base + ip);
+      const uint32_t hash = Hash(bytes, shift);
+      const size_t candidate = table_[hash];
+      table_[hash] = static_cast<uint16_t>(ip);
+
+      if (Load32(base + candidate) != bytes) {
+        ip += skip++ >> 5;
+        continue;
+      }
+
+      if (ip > next_emit) {
+        op = EmitLiteral(op, base + next_emit, ip - next_emit);
+      }
+
+      size_t match = 4;
+      while (ip + match < size && base[candidate + match] == base[ip + match]) {
+        match++;
+      }
+      op = EmitCopy(op, ip - candidate, match);
+
+      ip += match;
+      next_emit = ip;
+      skip = 32;
+      if (ip >= limit) { break; }
+
+      table_[Hash(Load32(base + ip - 1), shift)] =
+          static_cast<uint16_t>(ip - 1);
+    }
+  }
+
+  if (next_emit < size) {
+    op = EmitLiteral(op, base + next_emit, size - next_emit);
+  }
+
+  output.write({buffer_.data(), static_cast<size_t>(op - buffer_.data())});
+}
+
+std::optional<size_t> SnappyUncompressedLength(std::string_view input) {
+  size_t header_size = 0;
+  return ParseLength(input, &header_size);
+}
+
+bool SnappyUncompress(std::string_view input, char* output, size_t size) {
+  size_t header_size = 0;
+  const auto maybe_length = ParseLength(input, &header_size);
+  if (!maybe_length || *maybe_length != size) { return false; }
+
+  const uint8_t* ip = reinterpret_cast<const uint8_t*>(input.data()) +
+      header_size;
+  const uint8_t* const end =
+      reinterpret_cast<const uint8_t*>(input.data()) + input.size();
+  char* op = output;
+  char* const op_end = output + size;
+
+  while (ip < end) {
+    const uint8_t tag = *ip++;
+
+    size_t length = 0;
+    size_t offset = 0;
+    switch (tag & 0x03) {
+      case 0: {
+        length = (tag >> 2) + 1;
+        if (length > 60) {
+          const size_t count = length - 60;
+          if (static_cast<size_t>(end - ip) < count) { return false; }
+          length = 0;
+          for (size_t i = 0; i < count; i++) {
+            length |= static_cast<size_t>(ip[i]) << (8 * i);
+          }
+          length += 1;
+          ip += count;
+        }
+        if (static_cast<size_t>(end - ip) < length ||
+            static_cast<size_t>(op_end - op) < length) {
+          return false;
+        }
+        std::memcpy(op, ip, length);
+        ip += length;
+        op += length;
+        continue;
+      }
+      case 1: {
+        if (end - ip < 1) { return false; }
+        length = ((tag >> 2) & 0x07) + 4;
+        offset = (static_cast<size_t>(tag >> 5) << 8) | ip[0];
+        ip += 1;
+        break;
+      }
+      case 2: {
+        if (end - ip < 2) { return false; }
+        length = (tag >> 2) + 1;
+        offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        break;
+      }
+      case 3: {
+        if (end - ip < 4) { return false; }
+        length = (tag >> 2) + 1;
+        offset = Load32(reinterpret_cast<const char*>(ip));
+        ip += 4;
+        break;
+      }
+    }
+
+    if (offset == 0 ||
+        offset > static_cast<size_t>(op - output) ||
+        length > static_cast<size_t>(op_end - op)) {
+      return false;
+    }
+
+    const char* const src = op - offset;
+    if (offset >= length) {
+      std::memcpy(op, src, length);
+    } else {
+      // The copy overlaps its own output, repeating the last offset
+      // bytes.  Whole words can still be moved at a time when the
+      // repeat is at least that long.
+      size_t i = 0;
+      if (offset >= 8) {
+        for (; i + 8 <= length; i += 8) {
+          std::memcpy(op + i, src + i, 8);
+        }
+      }
+      for (; i < length; i++) { op[i] = src[i]; }
+    }
+    op += length;
+  }
+
+  return op == op_end;
+}
+
+bool SnappyUncompress(std::string_view input, std::string* output) {
+  const auto maybe_length = SnappyUncompressedLength(input);
+  if (!maybe_length) { return false; }
+  output->resize(*maybe_length);
+  if (*maybe_length == 0) { return SnappyUncompress(input, nullptr, 0); }
+  return SnappyUncompress(input, &(*output)[0], output->size());
+}
+
+}
+}
@@ -0,0 +1,70 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mjlib/base/stream.h"
+
+namespace mjlib {
+namespace base {
+
+/// Compresses data in the raw (unframed) format of the "snappy"
+/// algorithm, so that any snappy implementation can decompress it.
+///
+/// Like snappy, input is matched against at most the preceding 64kB
+/// using a single hash probe per position, trading compression ratio
+/// for speed.  One instance should be kept and reused, so that the
+/// hash table is not reallocated for each call.
+class SnappyCompressor {
+ public:
+  /// Write the compressed form of @p input to @p output.  At most
+  /// MaxCompressedLength(input.size()) bytes are written.
+  void Compress(std::string_view input, WriteStream& output);
+
+  std::string Compress(std::string_view input);
+
+  static size_t MaxCompressedLength(size_t input_size) {
+    return 32 + input_size + input_size / 6;
+  }
+
+ private:
+  void CompressFragment(std::string_view input, WriteStream& output);
+
+  std::vector<uint16_t> table_;
+  std::vector<char> buffer_;
+};
+
+/// @return the decompressed size of the snappy data @p input, or an
+/// empty optional if it is corrupt.
+std::optional<size_t> SnappyUncompressedLength(std::string_view input);
+
+/// Decompress @p input into @p output, which must be exactly
+/// SnappyUncompressedLength(input) bytes long.
+///
+/// @return false if @p input is corrupt
+bool SnappyUncompress(std::string_view input, char* output, size_t size);
+
+/// Decompress @p input, replacing the contents of @p output.
+///
+/// @return false if @p input is corrupt
+bool SnappyUncompress(std::string_view input, std::string* output);
+
+}
+}
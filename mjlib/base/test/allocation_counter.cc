@@ -0,0 +1,107 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/base/test/allocation_counter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+size_t g_allocations = 0;
+
+void* Allocate(size_t size) {
+  g_allocations++;
+  void* const result = std::malloc(size == 0 ? 1 : size);
+  if (result == nullptr) { throw std::bad_alloc(); }
+  return result;
+}
+
+void* AllocateAligned(size_t size, std::align_val_t align) {
+  g_allocations++;
+  const size_t alignment = static_cast<size_t>(align);
+  // aligned_alloc requires the size to be a multiple of the alignment.
+  const size_t rounded =
+      (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+  void* const result = std::aligned_alloc(alignment, rounded);
+  if (result == nullptr) { throw std::bad_alloc(); }
+  return result;
+}
+}
+
+namespace mjlib {
+namespace base {
+
+size_t AllocationCount() {
+  return g_allocations;
+}
+
+}
+}
+
+// Every form is replaced, so that whichever of them the compiler
+// picks, memory is always returned to the allocator it came from.
+
+void* operator new(size_t size) {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return Allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch (std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch (std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+  return AllocateAligned(size, align);
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  return AllocateAligned(size, align);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
@@ -0,0 +1,31 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+
+namespace mjlib {
+namespace base {
+
+/// Linking in allocation_counter.cc replaces every form of the global
+/// operator new and delete, so that benchmarks can verify a code path
+/// does not touch the heap.
+///
+/// @return the number of allocations made so far, by any form of
+/// operator new.
+size_t AllocationCount();
+
+}
+}
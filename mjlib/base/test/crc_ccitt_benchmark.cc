@@ -0,0 +1,104 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Compares the throughput of each CrcCcittMethod against
+/// boost::crc_ccitt_type for a range of buffer sizes.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <boost/crc.hpp>
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/crc_ccitt.h"
+#include "mjlib/base/program_options_archive.h"
+
+namespace base = mjlib::base;
+namespace po = boost::program_options;
+
+namespace {
+struct Options {
+  int total_bytes = 100000000;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(total_bytes));
+  }
+};
+
+template <typename Crc>
+void Run(const std::string& name, const std::string& data, int total_bytes) {
+  const int iterations = std::max<int>(1, total_bytes / data.size());
+  uint32_t result = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    Crc crc;
+    crc.process_bytes(data.data(), data.size());
+    result += crc.checksum();
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  const double elapsed_s = std::chrono::duration<double>(end - start).count();
+  std::cout << "  " << name << ": "
+            << static_cast<double>(iterations) * data.size() /
+                  elapsed_s / 1e6 << " MB/s  "
+            << elapsed_s * 1e9 / iterations << " ns/buffer"
+            << "  (" << std::hex << result << std::dec << ")\n";
+}
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> byte(0, 255);
+
+  // Roughly a register command, a status reply, and a large tunnel
+  // frame.
+  for (const size_t size : { 16, 64, 256, 4096 }) {
+    std::string data;
+    for (size_t i = 0; i < size; i++) {
+      data.push_back(static_cast<char>(byte(rng)));
+    }
+
+    std::cout << "size " << size << ":\n";
+    Run<boost::crc_ccitt_type>("boost", data, options.total_bytes);
+    Run<base::CrcCcittT<base::CrcCcittMethod::kNibble>>(
+        "nibble", data, options.total_bytes);
+    Run<base::CrcCcittT<base::CrcCcittMethod::kTable>>(
+        "table", data, options.total_bytes);
+    Run<base::CrcCcittT<base::CrcCcittMethod::kSlice8>>(
+        "slice8", data, options.total_bytes);
+  }
+
+  return 0;
+}
@@ -0,0 +1,92 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/base/crc_ccitt.h"
+
+#include <random>
+#include <string>
+
+#include <boost/crc.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjlib::base;
+
+namespace {
+uint16_t BoostCrc(const std::string& data) {
+  boost::crc_ccitt_type crc;
+  crc.process_bytes(data.data(), data.size());
+  return crc.checksum();
+}
+
+template <CrcCcittMethod Method>
+void CheckMethod() {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> byte(0, 255);
+
+  for (size_t size = 0; size < 100; size++) {
+    std::string data;
+    for (size_t i = 0; i < size; i++) {
+      data.push_back(static_cast<char>(byte(rng)));
+    }
+
+    const auto expected = BoostCrc(data);
+    BOOST_TEST(CalculateCrcCcitt<Method>(data.data(), data.size()) ==
+               expected);
+
+    // Splitting the data at any point should make no difference.
+    for (size_t split = 0; split <= size; split++) {
+      CrcCcittT<Method> dut;
+      dut.process_bytes(data.data(), split);
+      dut.process_bytes(data.data() + split, size - split);
+      BOOST_TEST(dut.checksum() == expected);
+    }
+  }
+}
+}
+
+BOOST_AUTO_TEST_CASE(CrcCcittKnownTest) {
+  // The standard check value for CRC-16/CCITT-FALSE.
+  const std::string data = "123456789";
+  BOOST_TEST(CalculateCrcCcitt(data.data(), data.size()) == 0x29b1);
+  BOOST_TEST(CalculateCrcCcitt(data.data(), 0) == 0xffff);
+  BOOST_TEST(BoostCrc(data) == 0x29b1);
+}
+
+BOOST_AUTO_TEST_CASE(CrcCcittNibbleTest) {
+  CheckMethod<CrcCcittMethod::kNibble>();
+}
+
+BOOST_AUTO_TEST_CASE(CrcCcittTableTest) {
+  CheckMethod<CrcCcittMethod::kTable>();
+
+  // The byte table stands alone, and is the first of the slice
+  // tables.
+  BOOST_TEST(sizeof(detail::kCrcCcittTable) == 512);
+  for (int i = 0; i < 256; i++) {
+    BOOST_TEST(detail::kCrcCcittSliceTables.data[0][i] ==
+               detail::kCrcCcittTable.data[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(CrcCcittSlice8Test) {
+  CheckMethod<CrcCcittMethod::kSlice8>();
+}
+
+BOOST_AUTO_TEST_CASE(CrcCcittResetTest) {
+  CrcCcitt dut;
+  dut.process_bytes("abc", 3);
+  BOOST_TEST(dut.checksum() != 0xffff);
+  dut.reset();
+  BOOST_TEST(dut.checksum() == 0xffff);
+}
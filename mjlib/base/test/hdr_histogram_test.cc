@@ -0,0 +1,68 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/base/hdr_histogram.h"
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjlib::base;
+
+BOOST_AUTO_TEST_CASE(HdrHistogramTest) {
+  HdrHistogram dut;
+  BOOST_TEST(dut.count() == 0);
+  BOOST_TEST(dut.Percentile(0.5) == 0);
+
+  // Small values are exact.
+  for (uint64_t i = 1; i <= 10; i++) { dut.Add(i); }
+  BOOST_TEST(dut.count() == 10);
+  BOOST_TEST(dut.min() == 1);
+  BOOST_TEST(dut.max() == 10);
+  BOOST_TEST(dut.mean() == 5.5);
+  BOOST_TEST(dut.Percentile(0.5) == 5);
+  BOOST_TEST(dut.Percentile(0.9) == 9);
+  BOOST_TEST(dut.Percentile(1.0) == 10);
+  BOOST_TEST(dut.Percentile(0.0) == 1);
+
+  dut.Reset();
+  BOOST_TEST(dut.count() == 0);
+  BOOST_TEST(dut.min() == 0);
+  BOOST_TEST(dut.max() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(HdrHistogramPrecisionTest) {
+  HdrHistogram dut;
+
+  // Large values land in buckets no wider than 1/16 of their value.
+  for (uint64_t value : { 100u, 1000u, 12345u, 1000000u }) {
+    dut.Reset();
+    dut.Add(1);
+    dut.Add(value);
+    dut.Add(value * 4);
+    const auto result = dut.Percentile(0.5);
+    BOOST_TEST(result >= value);
+    BOOST_TEST(result <= value + value / 16);
+  }
+
+  // The top percentile never exceeds what was seen.
+  dut.Reset();
+  dut.Add(1001);
+  BOOST_TEST(dut.Percentile(1.0) == 1001);
+
+  // Values beyond the range are clamped into the last bucket.
+  HdrHistogram small(5, 10);
+  small.Add(5000);
+  small.Add(1);
+  BOOST_TEST(small.max() == 5000);
+  BOOST_TEST(small.Percentile(1.0) == 1023);
+}
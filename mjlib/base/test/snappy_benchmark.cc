@@ -0,0 +1,135 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measures the compression ratio and throughput of SnappyCompressor
+/// and SnappyUncompress on telemetry-like and random data, for a
+/// range of block sizes.
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/base/snappy.h"
+
+namespace base = mjlib::base;
+namespace po = boost::program_options;
+
+namespace {
+struct Options {
+  int total_bytes = 100000000;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(total_bytes));
+  }
+};
+
+/// Binary records shaped like a servo status: a counter, a handful of
+/// slowly varying floats, and a block of PID state which is mostly
+/// constant.
+std::string MakeTelemetry(size_t size) {
+  std::string result;
+  for (int i = 0; result.size() < size; i++) {
+    float values[24] = {};
+    values[0] = std::sin(i * 0.001f);
+    values[1] = std::cos(i * 0.001f);
+    values[2] = 24.0f;
+    values[3] = 40.0f;
+    result.append(reinterpret_cast<const char*>(&i), sizeof(i));
+    result.append(reinterpret_cast<const char*>(values), sizeof(values));
+  }
+  result.resize(size);
+  return result;
+}
+
+std::string MakeRandom(size_t size) {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string result;
+  for (size_t i = 0; i < size; i++) {
+    result.push_back(static_cast<char>(byte(rng)));
+  }
+  return result;
+}
+
+void Run(const std::string& name, const std::string& data, int total_bytes) {
+  const int iterations = std::max<int>(1, total_bytes / data.size());
+
+  base::SnappyCompressor compressor;
+  base::FastOStringStream ostr;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    ostr.data()->clear();
+    compressor.Compress(data, ostr);
+  }
+  const auto compressed_end = std::chrono::steady_clock::now();
+
+  const std::string compressed = ostr.str();
+  std::string output(data.size(), '\0');
+  bool ok = true;
+  for (int i = 0; i < iterations; i++) {
+    ok = base::SnappyUncompress(compressed, &output[0], output.size()) && ok;
+  }
+  const auto end = std::chrono::steady_clock::now();
+  ok = ok && output == data;
+
+  const double compress_s =
+      std::chrono::duration<double>(compressed_end - start).count();
+  const double uncompress_s =
+      std::chrono::duration<double>(end - compressed_end).count();
+  const double bytes = static_cast<double>(iterations) * data.size();
+  std::cout << "  " << name << ": "
+            << "ratio " << static_cast<double>(data.size()) /
+                  compressed.size() << "  "
+            << "compress " << bytes / compress_s / 1e6 << " MB/s  "
+            << "uncompress " << bytes / uncompress_s / 1e6 << " MB/s"
+            << (ok ? "" : "  MISMATCH") << "\n";
+}
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  // A single record, a small batch, and a large block.
+  for (const size_t size : { 100, 1000, 16384, 262144 }) {
+    std::cout << "size " << size << ":\n";
+    Run("telemetry", MakeTelemetry(size), options.total_bytes);
+    Run("random", MakeRandom(size), options.total_bytes);
+  }
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/base/snappy.h"
+
+#include <random>
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjlib::base;
+
+namespace {
+std::string RoundTrip(SnappyCompressor* compressor, const std::string& input) {
+  const auto compressed = compressor->Compress(input);
+  BOOST_TEST(compressed.size() <=
+             SnappyCompressor::MaxCompressedLength(input.size()));
+  BOOST_TEST(*SnappyUncompressedLength(compressed) == input.size());
+
+  std::string result;
+  BOOST_TEST(SnappyUncompress(compressed, &result));
+  BOOST_TEST(result == input);
+  return compressed;
+}
+}
+
+BOOST_AUTO_TEST_CASE(SnappyRoundTripTest) {
+  SnappyCompressor dut;
+
+  BOOST_TEST(RoundTrip(&dut, "") == std::string(1, '\0'));
+  RoundTrip(&dut, "a");
+  RoundTrip(&dut, "short string");
+
+  {
+    // Long runs compress to almost nothing, and cross the 64kB
+    // fragment boundary.
+    const auto compressed = RoundTrip(&dut, std::string(200000, 'z'));
+    BOOST_TEST(compressed.size() < 20000);
+  }
+
+  {
+    std::string text;
+    for (int i = 0; i < 2000; i++) {
+      text += "position: " + std::to_string(i % 17) + " velocity: 0.25\n";
+    }
+    const auto compressed = RoundTrip(&dut, text);
+    BOOST_TEST(compressed.size() * 4 < text.size());
+  }
+
+  {
+    // Random data can't be compressed, but must not grow by much.
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::string random;
+    for (int i = 0; i < 100000; i++) {
+      random.push_back(static_cast<char>(byte(rng)));
+    }
+    const auto compressed = RoundTrip(&dut, random);
+    BOOST_TEST(compressed.size() < random.size() + 100);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(SnappyFormatTest) {
+  // Hand assembled, with one of each kind of element.
+  const char kElements[] =
+      "\x57"  // 87 bytes
+      "\x0c" "abcd"  // literal
+      "\x11\x04"  // 8 bytes from 4 back, with a 1 byte offset
+      "\x06\x0c\x00"  // 2 bytes from 12 back, with a 2 byte offset
+      "\x0b\x0e\x00\x00\x00"  // 3 bytes from 14 back, with a 4 byte offset
+      "\xf0\x45";  // literal with a 1 byte length
+  const std::string compressed =
+      std::string(kElements, sizeof(kElements) - 1) + std::string(70, 'x');
+
+  std::string result;
+  BOOST_TEST_REQUIRE(SnappyUncompress(compressed, &result));
+  BOOST_TEST(result == "abcdabcdabcd" "ab" "abc" + std::string(70, 'x'));
+}
+
+BOOST_AUTO_TEST_CASE(SnappyCorruptTest) {
+  std::string result;
+
+  // Truncated length.
+  BOOST_TEST(!SnappyUncompress("\x80", &result));
+
+  // Truncated literal.
+  BOOST_TEST(!SnappyUncompress("\x04\x0c" "abc", &result));
+
+  // The copy reaches back before the start of the output.
+  BOOST_TEST(!SnappyUncompress(std::string("\x08\x00" "a" "\x11\x02", 5),
+                               &result));
+
+  // The output is shorter than its header claims.
+  BOOST_TEST(!SnappyUncompress(std::string("\x05\x00" "a", 3), &result));
+
+  // And longer.
+  BOOST_TEST(!SnappyUncompress(std::string("\x01\x04" "ab", 4), &result));
+
+  // A length of nearly 4GB, which the input is far too short to hold,
+  // is rejected before anything is allocated.
+  const std::string huge("\xfe\xff\xff\xff\x0f" "\x00" "a", 7);
+  BOOST_TEST(!SnappyUncompressedLength(huge));
+  result = "abc";
+  BOOST_TEST(!SnappyUncompress(huge, &result));
+  BOOST_TEST(result == "abc");
+}
+
+BOOST_AUTO_TEST_CASE(SnappyMaxExpansionTest) {
+  // Long runs compress as close to the limit as snappy gets, and must
+  // still be accepted.
+  SnappyCompressor compressor;
+  const std::string input(1 << 20, 'x');
+  const auto compressed = compressor.Compress(input);
+  BOOST_TEST(compressed.size() < input.size() / 20);
+
+  std::string result;
+  BOOST_TEST_REQUIRE(SnappyUncompress(compressed, &result));
+  BOOST_TEST(result == input);
+}
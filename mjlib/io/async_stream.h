@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
 
 #include <boost/asio/io_service.hpp>
@@ -46,6 +47,18 @@ class AsyncStream : public AsyncReadStream, public AsyncWriteStream {
   virtual void cancel() = 0;
 };
 
+/// Optionally implemented by streams which know when the data they
+/// return actually arrived, which may be well before the read handler
+/// is invoked.
+class ReadTimestampSource {
+ public:
+  virtual ~ReadTimestampSource() {}
+
+  /// @return the time at which the data returned by the most recently
+  /// completed read was first seen by this process.
+  virtual std::chrono::steady_clock::time_point last_read_time() const = 0;
+};
+
 using SharedStream = std::shared_ptr<AsyncStream>;
 using StreamHandler = std::function<void (const base::error_code&, SharedStream)>;
 
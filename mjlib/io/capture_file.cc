@@ -0,0 +1,156 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/io/capture_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "mjlib/base/system_error.h"
+
+namespace mjlib {
+namespace io {
+
+namespace {
+constexpr char kHeader[] = "MJCAPT01";
+constexpr size_t kHeaderSize = sizeof(kHeader) - 1;
+
+struct FileCloser {
+  void operator()(FILE* file) const { ::fclose(file); }
+};
+
+using FilePtr = std::unique_ptr<FILE, FileCloser>;
+
+FilePtr Open(const std::string& filename, const char* mode) {
+  FilePtr result(::fopen(filename.c_str(), mode));
+  if (!result) {
+    throw base::system_error::syserrno("opening " + filename);
+  }
+  return result;
+}
+
+size_t EncodeVaruint(uint64_t value, char* buffer) {
+  size_t size = 0;
+  do {
+    uint8_t this_byte = value & 0x7f;
+    value >>= 7;
+    this_byte |= ((value != 0) ? 0x80 : 0x00);
+    buffer[size++] = static_cast<char>(this_byte);
+  } while (value);
+  return size;
+}
+
+std::optional<uint64_t> ReadVaruint(FILE* file) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    const int c = ::fgetc(file);
+    if (c == EOF) { return {}; }
+    result |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) { return result; }
+  }
+  return {};
+}
+}
+
+class CaptureWriter::Impl {
+ public:
+  Impl(const std::string& filename) : file_(Open(filename, "wb")) {
+    ::fwrite(kHeader, kHeaderSize, 1, file_.get());
+    ::fflush(file_.get());
+  }
+
+  void Write(CaptureRecord::Direction direction,
+             std::chrono::steady_clock::time_point timestamp,
+             std::string_view data) {
+    if (!started_) {
+      started_ = true;
+      last_ = timestamp;
+    }
+    const int64_t delta_us = std::max<int64_t>(
+        0, std::chrono::duration_cast<std::chrono::microseconds>(
+            timestamp - last_).count());
+    last_ = std::max(last_, timestamp);
+
+    char header[20] = {};
+    size_t size = EncodeVaruint((static_cast<uint64_t>(delta_us) << 1) |
+                                static_cast<uint64_t>(direction), header);
+    size += EncodeVaruint(data.size(), header + size);
+
+    ::fwrite(header, size, 1, file_.get());
+    ::fwrite(data.data(), data.size(), 1, file_.get());
+    ::fflush(file_.get());
+  }
+
+ private:
+  FilePtr file_;
+  bool started_ = false;
+  std::chrono::steady_clock::time_point last_;
+};
+
+CaptureWriter::CaptureWriter(const std::string& filename)
+    : impl_(std::make_unique<Impl>(filename)) {}
+
+CaptureWriter::~CaptureWriter() {}
+
+void CaptureWriter::Write(CaptureRecord::Direction direction,
+                          std::chrono::steady_clock::time_point timestamp,
+                          std::string_view data) {
+  impl_->Write(direction, timestamp, data);
+}
+
+class CaptureReader::Impl {
+ public:
+  Impl(const std::string& filename) : file_(Open(filename, "rb")) {
+    char header[kHeaderSize] = {};
+    if (::fread(header, kHeaderSize, 1, file_.get()) != 1 ||
+        std::memcmp(header, kHeader, kHeaderSize) != 0) {
+      throw base::system_error::einval("not a capture: " + filename);
+    }
+  }
+
+  std::optional<CaptureRecord> Read() {
+    const auto maybe_header = ReadVaruint(file_.get());
+    const auto maybe_size = ReadVaruint(file_.get());
+    if (!maybe_header || !maybe_size) { return {}; }
+
+    CaptureRecord result;
+    timestamp_us_ += *maybe_header >> 1;
+    result.timestamp_us = timestamp_us_;
+    result.direction = static_cast<CaptureRecord::Direction>(
+        *maybe_header & 0x01);
+    result.data.resize(*maybe_size);
+    if (*maybe_size &&
+        ::fread(&result.data[0], *maybe_size, 1, file_.get()) != 1) {
+      return {};
+    }
+    return result;
+  }
+
+ private:
+  FilePtr file_;
+  int64_t timestamp_us_ = 0;
+};
+
+CaptureReader::CaptureReader(const std::string& filename)
+    : impl_(std::make_unique<Impl>(filename)) {}
+
+CaptureReader::~CaptureReader() {}
+
+std::optional<CaptureRecord> CaptureReader::Read() {
+  return impl_->Read();
+}
+
+}
+}
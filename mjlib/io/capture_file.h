@@ -0,0 +1,90 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mjlib {
+namespace io {
+
+/// A single chunk of data which passed through a stream.
+struct CaptureRecord {
+  enum Direction {
+    kRead = 0,
+    kWrite = 1,
+  };
+
+  /// Microseconds since the first record of the capture.
+  int64_t timestamp_us = 0;
+  Direction direction = kRead;
+  std::string data;
+};
+
+/// Captures are stored in a compact binary file.
+///
+/// # Format #
+///
+///  * Header
+///     - 8 bytes => "MJCAPT01"
+///  * Records, until the end of the file
+///     - varuint => (microseconds since the previous record << 1) |
+///                  direction, where 0 is read and 1 is write
+///     - varuint => size
+///     - bytes => data
+///
+/// Each read or write is one record, so the chunking of the original
+/// data is preserved.  A record which was only partially written is
+/// ignored.
+class CaptureWriter {
+ public:
+  /// Throws base::system_error if @p filename cannot be created.
+  CaptureWriter(const std::string& filename);
+  ~CaptureWriter();
+
+  /// Append a record.  Records are flushed as they are written, so
+  /// that nothing is lost if the process dies.  @p timestamp is
+  /// clamped to be no earlier than that of the previous record.
+  void Write(CaptureRecord::Direction,
+             std::chrono::steady_clock::time_point timestamp,
+             std::string_view data);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+class CaptureReader {
+ public:
+  /// Throws base::system_error if @p filename cannot be opened or is
+  /// not a capture.
+  CaptureReader(const std::string& filename);
+  ~CaptureReader();
+
+  /// @return the next record, or an empty optional at the end of the
+  /// capture.
+  std::optional<CaptureRecord> Read();
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
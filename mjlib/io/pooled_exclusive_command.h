@@ -0,0 +1,175 @@
+// Copyright 2015-2019 Josh Pieper, jjp@pobox.com.  All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "mjlib/micro/static_function.h"
+
+namespace mjlib {
+namespace io {
+
+/// Like ExclusiveCommand, but without any per-command allocation,
+/// and which starts each queued command directly from the completion
+/// of the one before it.  Only the first command after the resource
+/// goes idle is started through io_service::post.
+///
+/// Commands and handlers are stored in place in a slot, and may
+/// capture no more than kCaptureSize words.  Slots are recycled
+/// through a free list, so new ones are only allocated when more
+/// commands are queued at once than ever before.
+///
+/// Each handler is invoked with @p Args.
+template <typename... Args>
+class PooledExclusiveCommand : boost::noncopyable {
+ private:
+  struct Slot;
+
+ public:
+  static constexpr size_t kCaptureSize = 8;
+
+  /// This is passed to each command, which must invoke it exactly
+  /// once when complete.  It is trivially copyable and two pointers
+  /// in size, so it fits in a std::function without allocating.
+  class Done {
+   public:
+    void operator()(Args... args) const {
+      parent_->Complete(slot_, args...);
+    }
+
+   private:
+    friend class PooledExclusiveCommand;
+
+    Done(PooledExclusiveCommand* parent, Slot* slot)
+        : parent_(parent), slot_(slot) {}
+
+    PooledExclusiveCommand* parent_;
+    Slot* slot_;
+  };
+
+  using Command = micro::StaticFunction<void (Done), kCaptureSize>;
+  using Handler = micro::StaticFunction<void (Args...), kCaptureSize>;
+
+  PooledExclusiveCommand(boost::asio::io_service& service)
+      : service_(service) {}
+
+  /// Invoke @p command when the resource is idle.
+  ///
+  /// @p handler is invoked with the arguments that @p command passes
+  /// to its Done, after which the next queued command is started.
+  void Invoke(const Command& command, const Handler& handler) {
+    Slot* const slot = Allocate();
+    slot->command = command;
+    slot->handler = handler;
+
+    if (tail_) {
+      tail_->next = slot;
+    } else {
+      head_ = slot;
+    }
+    tail_ = slot;
+
+    // Like any asio initiating function, we never start anything
+    // from within Invoke itself.
+    if (!active_ && !dispatching_ && !start_posted_) {
+      start_posted_ = true;
+      service_.post([this]() {
+          start_posted_ = false;
+          Dispatch();
+        });
+    }
+  }
+
+  boost::asio::io_service& get_io_service() { return service_; }
+
+  /// @return the number of slots which have been allocated.
+  size_t slots() const { return storage_.size(); }
+
+ private:
+  struct Slot {
+    Command command;
+    Handler handler;
+    Slot* next = nullptr;
+  };
+
+  Slot* Allocate() {
+    if (!free_) {
+      storage_.push_back(std::make_unique<Slot>());
+      return storage_.back().get();
+    }
+    Slot* const result = free_;
+    free_ = result->next;
+    result->next = nullptr;
+    return result;
+  }
+
+  void Release(Slot* slot) {
+    // Captured state is released now, not when the slot is reused.
+    slot->command = {};
+    slot->handler = {};
+    slot->next = free_;
+    free_ = slot;
+  }
+
+  void Dispatch() {
+    // Commands which complete from within their own invocation would
+    // otherwise recurse once for every queued command.  Instead, the
+    // outermost Dispatch starts them one after the other.
+    if (dispatching_) { return; }
+    dispatching_ = true;
+
+    while (!active_ && head_) {
+      active_ = head_;
+      head_ = head_->next;
+      if (!head_) { tail_ = nullptr; }
+      // The slot may be released before the command returns, so it
+      // is moved out first.
+      const Command command = std::move(active_->command);
+      command(Done(this, active_));
+    }
+
+    dispatching_ = false;
+  }
+
+  void Complete(Slot* slot, Args... args) {
+    BOOST_ASSERT(slot == active_);
+    slot->handler(args...);
+
+    active_ = nullptr;
+    Release(slot);
+    Dispatch();
+  }
+
+  boost::asio::io_service& service_;
+
+  std::vector<std::unique_ptr<Slot>> storage_;
+  Slot* free_ = nullptr;
+
+  // The queue of commands which have not yet been started.
+  Slot* head_ = nullptr;
+  Slot* tail_ = nullptr;
+
+  Slot* active_ = nullptr;
+  bool dispatching_ = false;
+  bool start_posted_ = false;
+};
+
+}
+}
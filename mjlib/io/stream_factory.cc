@@ -14,6 +14,8 @@
 
 #include "mjlib/io/stream_factory.h"
 
+#include "mjlib/io/stream_factory_capture.h"
+#include "mjlib/io/stream_factory_raw_serial.h"
 #include "mjlib/io/stream_factory_serial.h"
 #include "mjlib/io/stream_factory_stdio.h"
 #include "mjlib/io/stream_factory_tcp_client.h"
@@ -27,9 +29,12 @@ std::map<StreamFactory::Type, const char*> StreamFactory::TypeMapper() {
   return {
     { Type::kStdio, "stdio" },
     { Type::kSerial, "serial" },
+    { Type::kRawSerial, "raw_serial" },
     { Type::kTcpClient, "tcp" },
     { Type::kTcpServer, "tcp_server" },
     { Type::kPipe, "pipe" },
+    { Type::kCapture, "capture" },
+    { Type::kReplay, "replay" },
   };
 }
 
@@ -56,6 +61,10 @@ void StreamFactory::AsyncCreate(const Options& options, StreamHandler handler) {
       detail::AsyncCreateSerial(impl_->service_, options, handler);
       return;
     }
+    case Type::kRawSerial: {
+      detail::AsyncCreateRawSerial(impl_->service_, options, handler);
+      return;
+    }
     case Type::kTcpClient: {
       detail::AsyncCreateTcpClient(impl_->service_, options, handler);
       return;
@@ -71,6 +80,26 @@ void StreamFactory::AsyncCreate(const Options& options, StreamHandler handler) {
           std::bind(handler, base::error_code(), stream));
       return;
     }
+    case Type::kCapture: {
+      auto base_options = options;
+      base_options.type = options.capture_type;
+      BOOST_ASSERT(base_options.type != Type::kCapture);
+      AsyncCreate(
+          base_options,
+          [options, handler](const base::error_code& ec,
+                             SharedStream stream) {
+            if (ec) {
+              handler(ec, {});
+              return;
+            }
+            handler(ec, detail::MakeCaptureStream(stream, options));
+          });
+      return;
+    }
+    case Type::kReplay: {
+      detail::AsyncCreateReplay(impl_->service_, options, handler);
+      return;
+    }
   }
 }
 
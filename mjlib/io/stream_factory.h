@@ -29,9 +29,25 @@ class StreamFactory : boost::noncopyable {
   enum class Type {
     kStdio,
     kSerial,
+
+    /// Like kSerial, but drives the tty directly with termios, epoll
+    /// and writev rather than through boost::asio::serial_port.  Each
+    /// write goes to the kernel as a single syscall no matter how
+    /// many buffers it spans, and the stream implements
+    /// ReadTimestampSource.  Linux only.
+    kRawSerial,
+
     kTcpClient,
     kTcpServer,
     kPipe,
+
+    /// Create a stream of type capture_type, and record everything
+    /// which passes through it to capture_file.
+    kCapture,
+
+    /// Read back the data from replay_file.  Writes are accepted
+    /// and discarded.
+    kReplay,
   };
 
   static std::map<Type, const char*> TypeMapper();
@@ -47,6 +63,12 @@ class StreamFactory : boost::noncopyable {
     std::string serial_parity = "n";
     int serial_data_bits = 8;
     bool serial_low_latency = true;
+    /// Used only by kRawSerial.  The tty reports readable once this
+    /// many bytes are buffered, or if serial_vtime is non-zero, after
+    /// serial_vtime tenths of a second.  Note the kernel only applies
+    /// VMIN to readiness when VTIME is 0.
+    int serial_vmin = 1;
+    int serial_vtime = 0;
 
     std::string tcp_target;
     int tcp_target_port = 0;
@@ -56,6 +78,18 @@ class StreamFactory : boost::noncopyable {
     std::string pipe_key;
     int pipe_direction = 0;
 
+    Type capture_type = Type::kSerial;
+    std::string capture_file;
+
+    std::string replay_file;
+    /// Each chunk of data is delivered at its original time divided
+    /// by this.  If 0, everything is delivered as fast as it is read.
+    double replay_speed = 1.0;
+    /// If true, the data which the capturing program wrote is
+    /// replayed, rather than what it read.  That is, the replay takes
+    /// the part of the far end of the stream.
+    bool replay_writes = false;
+
     template <typename Archive>
     void Serialize(Archive* a) {
       a->Visit(MJ_ENUM(type, TypeMapper));
@@ -66,11 +100,18 @@ class StreamFactory : boost::noncopyable {
       a->Visit(MJ_NVP(serial_parity));
       a->Visit(MJ_NVP(serial_data_bits));
       a->Visit(MJ_NVP(serial_low_latency));
+      a->Visit(MJ_NVP(serial_vmin));
+      a->Visit(MJ_NVP(serial_vtime));
       a->Visit(MJ_NVP(tcp_target));
       a->Visit(MJ_NVP(tcp_target_port));
       a->Visit(MJ_NVP(tcp_server_port));
       a->Visit(MJ_NVP(pipe_key));
       a->Visit(MJ_NVP(pipe_direction));
+      a->Visit(MJ_ENUM(capture_type, TypeMapper));
+      a->Visit(MJ_NVP(capture_file));
+      a->Visit(MJ_NVP(replay_file));
+      a->Visit(MJ_NVP(replay_speed));
+      a->Visit(MJ_NVP(replay_writes));
     }
   };
 
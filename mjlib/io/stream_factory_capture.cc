@@ -0,0 +1,218 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/io/stream_factory_capture.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "mjlib/io/capture_file.h"
+#include "mjlib/io/deadline_timer.h"
+
+namespace mjlib {
+namespace io {
+namespace detail {
+
+namespace {
+namespace pl = std::placeholders;
+
+class CaptureStream : public AsyncStream {
+ public:
+  CaptureStream(SharedStream base, const StreamFactory::Options& options)
+      : base_(base),
+        writer_(std::make_shared<CaptureWriter>(options.capture_file)) {}
+
+  ~CaptureStream() override {}
+
+  boost::asio::io_service& get_io_service() override {
+    return base_->get_io_service();
+  }
+
+  void async_read_some(MutableBufferSequence buffers,
+                       ReadHandler handler) override {
+    base_->async_read_some(
+        buffers,
+        [writer = writer_, buffers, handler](
+            const base::error_code& ec, size_t size) {
+          Record(writer.get(), CaptureRecord::kRead, buffers, size);
+          handler(ec, size);
+        });
+  }
+
+  void async_write_some(ConstBufferSequence buffers,
+                        WriteHandler handler) override {
+    base_->async_write_some(
+        buffers,
+        [writer = writer_, buffers, handler](
+            const base::error_code& ec, size_t size) {
+          Record(writer.get(), CaptureRecord::kWrite, buffers, size);
+          handler(ec, size);
+        });
+  }
+
+  void cancel() override {
+    base_->cancel();
+  }
+
+ private:
+  template <typename Buffers>
+  static void Record(CaptureWriter* writer,
+                     CaptureRecord::Direction direction,
+                     const Buffers& buffers,
+                     size_t size) {
+    if (size == 0) { return; }
+
+    std::string data(size, '\0');
+    boost::asio::buffer_copy(boost::asio::buffer(data), buffers);
+    writer->Write(direction, std::chrono::steady_clock::now(), data);
+  }
+
+  SharedStream base_;
+  std::shared_ptr<CaptureWriter> writer_;
+};
+
+class ReplayStream : public AsyncStream,
+                     public std::enable_shared_from_this<ReplayStream> {
+ public:
+  ReplayStream(boost::asio::io_service& service,
+               const StreamFactory::Options& options)
+      : service_(service),
+        options_(options),
+        reader_(options.replay_file),
+        direction_(options.replay_writes ?
+                   CaptureRecord::kWrite : CaptureRecord::kRead) {}
+
+  ~ReplayStream() override {}
+
+  boost::asio::io_service& get_io_service() override { return service_; }
+
+  void async_read_some(MutableBufferSequence buffers,
+                       ReadHandler handler) override {
+    BOOST_ASSERT(!read_handler_);
+    read_buffers_ = buffers;
+    read_handler_ = handler;
+
+    if (!pending_.empty()) {
+      // The rest of a record which didn't fit last time.
+      CompleteRead();
+      return;
+    }
+
+    std::optional<CaptureRecord> record;
+    do {
+      record = reader_.Read();
+    } while (record && record->direction != direction_);
+
+    if (!record) {
+      service_.post(std::bind(std::exchange(read_handler_, {}),
+                              boost::asio::error::eof, 0));
+      return;
+    }
+
+    pending_ = std::move(record->data);
+
+    const auto now = Now();
+    if (!started_) {
+      started_ = true;
+      start_ = now;
+      start_us_ = record->timestamp_us;
+    }
+
+    if (options_.replay_speed <= 0.0) {
+      CompleteRead();
+      return;
+    }
+
+    const auto due = start_ + boost::posix_time::microseconds(
+        static_cast<int64_t>(
+            (record->timestamp_us - start_us_) / options_.replay_speed));
+    if (due <= now) {
+      CompleteRead();
+      return;
+    }
+
+    timer_.expires_at(due);
+    timer_.async_wait(
+        std::bind(&ReplayStream::HandleTimer, shared_from_this(), pl::_1));
+  }
+
+  void async_write_some(ConstBufferSequence buffers,
+                        WriteHandler handler) override {
+    // Whatever we are sent has no influence on what was captured.
+    service_.post(std::bind(handler, base::error_code(),
+                            boost::asio::buffer_size(buffers)));
+  }
+
+  void cancel() override {
+    timer_.cancel();
+  }
+
+ private:
+  boost::posix_time::ptime Now() const {
+    return boost::asio::use_service<VirtualDeadlineTimerServiceHolder>(
+        service_).now();
+  }
+
+  void HandleTimer(const base::error_code& ec) {
+    if (!read_handler_) { return; }
+    if (ec == boost::asio::error::operation_aborted) {
+      // The data remains pending for the next read.
+      service_.post(std::bind(std::exchange(read_handler_, {}), ec, 0));
+      return;
+    }
+    CompleteRead();
+  }
+
+  void CompleteRead() {
+    const auto size = boost::asio::buffer_copy(
+        read_buffers_, boost::asio::buffer(pending_));
+    pending_.erase(0, size);
+
+    service_.post(std::bind(std::exchange(read_handler_, {}),
+                            base::error_code(), size));
+  }
+
+  boost::asio::io_service& service_;
+  const StreamFactory::Options options_;
+  CaptureReader reader_;
+  const CaptureRecord::Direction direction_;
+  DeadlineTimer timer_{service_};
+
+  bool started_ = false;
+  boost::posix_time::ptime start_;
+  int64_t start_us_ = 0;
+
+  std::string pending_;
+  MutableBufferSequence read_buffers_;
+  ReadHandler read_handler_;
+};
+}
+
+SharedStream MakeCaptureStream(SharedStream base,
+                               const StreamFactory::Options& options) {
+  return std::make_shared<CaptureStream>(base, options);
+}
+
+void AsyncCreateReplay(boost::asio::io_service& service,
+                       const StreamFactory::Options& options,
+                       StreamHandler handler) {
+  service.post(
+      std::bind(handler, base::error_code(),
+                std::make_shared<ReplayStream>(service, options)));
+}
+
+}
+}
+}
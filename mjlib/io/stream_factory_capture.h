@@ -0,0 +1,33 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "mjlib/io/stream_factory.h"
+
+namespace mjlib {
+namespace io {
+namespace detail {
+
+/// @return a stream which passes everything through to @p base,
+/// recording each completed read and write to options.capture_file.
+SharedStream MakeCaptureStream(SharedStream base,
+                               const StreamFactory::Options&);
+
+void AsyncCreateReplay(boost::asio::io_service&,
+                       const StreamFactory::Options&, StreamHandler);
+
+}
+}
+}
@@ -0,0 +1,391 @@
+// Copyright 2015-2019 Josh Pieper, jjp@pobox.com.  All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/io/stream_factory_raw_serial.h"
+
+#include <linux/serial.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <termios.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "mjlib/base/system_error.h"
+
+namespace mjlib {
+namespace io {
+namespace detail {
+
+namespace {
+using namespace std::placeholders;
+
+speed_t MakeBaud(int baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 576000: return B576000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 2500000: return B2500000;
+    case 3000000: return B3000000;
+    case 3500000: return B3500000;
+    case 4000000: return B4000000;
+  }
+  throw base::system_error::einval(
+      "unsupported baud rate: " + std::to_string(baud));
+}
+
+tcflag_t MakeDataBits(int data_bits) {
+  switch (data_bits) {
+    case 5: return CS5;
+    case 6: return CS6;
+    case 7: return CS7;
+    case 8: return CS8;
+  }
+  throw base::system_error::einval(
+      "unsupported data bits: " + std::to_string(data_bits));
+}
+
+tcflag_t MakeParity(std::string string) {
+  boost::to_lower(string);
+  if (string == "n" || string == "none") {
+    return 0;
+  } else if (string == "e" || string == "even") {
+    return PARENB;
+  } else if (string == "o" || string == "odd") {
+    return PARENB | PARODD;
+  }
+  throw base::system_error::einval("unknown parity: " + string);
+}
+
+cc_t MakeControlChar(int value, const char* name) {
+  if (value < 0 || value > 255) {
+    throw base::system_error::einval(
+        std::string(name) + " out of range: " + std::to_string(value));
+  }
+  return static_cast<cc_t>(value);
+}
+
+/// Fill @p iov from an asio buffer sequence, returning the number of
+/// entries used.  Anything past the end of @p iov is left for a
+/// later call.
+template <typename Sequence, size_t N>
+int MakeIovec(const Sequence& buffers, struct iovec (&iov)[N]) {
+  size_t count = 0;
+  for (const auto& buffer : buffers) {
+    if (count == N) { break; }
+    if (buffer.size() == 0) { continue; }
+    iov[count].iov_base = const_cast<void*>(
+        static_cast<const void*>(buffer.data()));
+    iov[count].iov_len = buffer.size();
+    count++;
+  }
+  return static_cast<int>(count);
+}
+
+class RawSerialStream
+    : public AsyncStream,
+      public ReadTimestampSource,
+      public std::enable_shared_from_this<RawSerialStream> {
+ public:
+  RawSerialStream(boost::asio::io_service& service,
+                  const StreamFactory::Options& options)
+      : service_(service),
+        epoll_(service) {
+    BOOST_ASSERT(options.type == StreamFactory::Type::kRawSerial);
+
+    fd_ = ::open(options.serial_port.c_str(),
+                 O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+      throw base::system_error::syserrno(
+          "opening " + options.serial_port);
+    }
+
+    try {
+      Configure(options);
+
+      const int epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd < 0) {
+        throw base::system_error::syserrno("epoll_create1");
+      }
+      epoll_.assign(epoll_fd);
+
+      SetEvents(EPOLL_CTL_ADD, EPOLLIN);
+    } catch (...) {
+      ::close(fd_);
+      throw;
+    }
+  }
+
+  ~RawSerialStream() override {
+    ::close(fd_);
+  }
+
+  boost::asio::io_service& get_io_service() override { return service_; }
+
+  void async_read_some(MutableBufferSequence buffers,
+                       ReadHandler handler) override {
+    BOOST_ASSERT(!read_handler_);
+    read_buffers_ = buffers;
+    read_handler_ = handler;
+
+    // Nothing is read until epoll says so, so that VMIN and VTIME
+    // apply and every read has a timestamp.
+    Arm();
+  }
+
+  void async_write_some(ConstBufferSequence buffers,
+                        WriteHandler handler) override {
+    BOOST_ASSERT(!write_handler_);
+    write_buffers_ = buffers;
+    write_handler_ = handler;
+
+    // The output queue is almost never full, so try right away.
+    if (TryWrite()) { return; }
+
+    SetEvents(EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+    Arm();
+  }
+
+  void cancel() override {
+    epoll_.cancel();
+    if (read_handler_) {
+      Complete(&read_handler_, boost::asio::error::operation_aborted, 0);
+    }
+    if (write_handler_) {
+      SetEvents(EPOLL_CTL_MOD, EPOLLIN);
+      Complete(&write_handler_, boost::asio::error::operation_aborted, 0);
+    }
+  }
+
+  std::chrono::steady_clock::time_point last_read_time() const override {
+    return last_read_time_;
+  }
+
+ private:
+  void Configure(const StreamFactory::Options& options) {
+    struct termios tio = {};
+    if (::tcgetattr(fd_, &tio) < 0) {
+      throw base::system_error::syserrno("tcgetattr");
+    }
+
+    ::cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag |= MakeDataBits(options.serial_data_bits);
+    const auto parity = MakeParity(options.serial_parity);
+    tio.c_cflag |= parity;
+    if (parity) { tio.c_iflag |= INPCK; }
+
+    const auto baud = MakeBaud(options.serial_baud);
+    ::cfsetispeed(&tio, baud);
+    ::cfsetospeed(&tio, baud);
+
+    tio.c_cc[VMIN] = MakeControlChar(options.serial_vmin, "serial_vmin");
+    tio.c_cc[VTIME] = MakeControlChar(options.serial_vtime, "serial_vtime");
+
+    if (::tcsetattr(fd_, TCSANOW, &tio) < 0) {
+      throw base::system_error::syserrno("tcsetattr");
+    }
+
+    {
+      // Not every tty supports this, ptys for instance, so failures
+      // are ignored just as in kSerial.
+      struct serial_struct serial = {};
+      if (::ioctl(fd_, TIOCGSERIAL, &serial) == 0) {
+        if (options.serial_low_latency) {
+          serial.flags |= ASYNC_LOW_LATENCY;
+        } else {
+          serial.flags &= ~ASYNC_LOW_LATENCY;
+        }
+        ::ioctl(fd_, TIOCSSERIAL, &serial);
+      }
+    }
+  }
+
+  void SetEvents(int op, uint32_t events) {
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd_;
+    if (::epoll_ctl(epoll_.native_handle(), op, fd_, &event) < 0) {
+      throw base::system_error::syserrno("epoll_ctl");
+    }
+  }
+
+  void Arm() {
+    if (!wait_pending_) {
+      wait_pending_ = true;
+      std::weak_ptr<RawSerialStream> weak = shared_from_this();
+      epoll_.async_read_some(
+          boost::asio::null_buffers(),
+          [weak](const base::error_code& ec, size_t) {
+            if (auto self = weak.lock()) { self->HandleWait(ec); }
+          });
+    }
+
+    // asio only reports new edges on the epoll descriptor, so
+    // anything which was ready before the wait was queued has to be
+    // looked for here.
+    Poll();
+
+    if (!read_handler_ && !write_handler_) {
+      // An idle wait would keep io_service::run() from returning.
+      epoll_.cancel();
+    }
+  }
+
+  void HandleWait(const base::error_code& ec) {
+    wait_pending_ = false;
+    if (ec == boost::asio::error::operation_aborted) {
+      // cancel() has already completed anything which was
+      // outstanding at the time.
+      if (read_handler_ || write_handler_) { Arm(); }
+      return;
+    }
+    if (ec) {
+      Fail(ec);
+      return;
+    }
+
+    Poll();
+    if (read_handler_ || write_handler_) { Arm(); }
+  }
+
+  void Poll() {
+    struct epoll_event event = {};
+    const int count = ::epoll_wait(epoll_.native_handle(), &event, 1, 0);
+    // This is as close as a tty gets to a receive timestamp.
+    const auto now = std::chrono::steady_clock::now();
+
+    if (count < 0) {
+      if (errno == EINTR) { return; }
+      Fail(base::error_code::syserrno("epoll_wait"));
+      return;
+    }
+    if (count == 0) { return; }
+
+    const uint32_t error_events = EPOLLERR | EPOLLHUP;
+    if (read_handler_ && (event.events & (EPOLLIN | error_events))) {
+      TryRead(now);
+    }
+    if (write_handler_ && (event.events & (EPOLLOUT | error_events))) {
+      if (TryWrite()) { SetEvents(EPOLL_CTL_MOD, EPOLLIN); }
+    }
+  }
+
+  bool TryRead(std::chrono::steady_clock::time_point timestamp) {
+    struct iovec iov[kMaxIovec];
+    const int count = MakeIovec(read_buffers_, iov);
+    if (count == 0) {
+      Complete(&read_handler_, {}, 0);
+      return true;
+    }
+
+    const ssize_t result = ::readv(fd_, iov, count);
+    if (result < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return false;
+      }
+      Complete(&read_handler_, base::error_code::syserrno("readv"), 0);
+      return true;
+    }
+    if (result == 0) {
+      Complete(&read_handler_, boost::asio::error::eof, 0);
+      return true;
+    }
+
+    last_read_time_ = timestamp;
+    Complete(&read_handler_, {}, result);
+    return true;
+  }
+
+  /// Issue the whole buffer sequence, typically a frame's header,
+  /// payload and checksum, as a single writev.
+  bool TryWrite() {
+    struct iovec iov[kMaxIovec];
+    const int count = MakeIovec(write_buffers_, iov);
+    if (count == 0) {
+      Complete(&write_handler_, {}, 0);
+      return true;
+    }
+
+    const ssize_t result = ::writev(fd_, iov, count);
+    if (result < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return false;
+      }
+      Complete(&write_handler_, base::error_code::syserrno("writev"), 0);
+      return true;
+    }
+
+    Complete(&write_handler_, {}, result);
+    return true;
+  }
+
+  void Fail(const base::error_code& ec) {
+    if (read_handler_) { Complete(&read_handler_, ec, 0); }
+    if (write_handler_) { Complete(&write_handler_, ec, 0); }
+  }
+
+  void Complete(SizeCallback* handler, const base::error_code& ec,
+                size_t size) {
+    service_.post(std::bind(*handler, ec, size));
+    *handler = {};
+  }
+
+  static constexpr size_t kMaxIovec = 16;
+
+  boost::asio::io_service& service_;
+  int fd_ = -1;
+  boost::asio::posix::stream_descriptor epoll_;
+  bool wait_pending_ = false;
+
+  MutableBufferSequence read_buffers_;
+  ReadHandler read_handler_;
+  ConstBufferSequence write_buffers_;
+  WriteHandler write_handler_;
+
+  std::chrono::steady_clock::time_point last_read_time_;
+};
+}
+
+void AsyncCreateRawSerial(
+    boost::asio::io_service& service,
+    const StreamFactory::Options& options,
+    StreamHandler handler) {
+  service.post(
+      std::bind(handler, base::error_code(),
+                std::make_shared<RawSerialStream>(service, options)));
+}
+
+}
+}
+}
@@ -0,0 +1,168 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/io/capture_file.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+
+#include <boost/asio/write.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/io/stream_factory.h"
+
+using namespace mjlib::io;
+namespace base = mjlib::base;
+
+namespace {
+std::string TempFile(const std::string& name) {
+  return "/tmp/mjlib_capture_test_" + std::to_string(::getpid()) + "_" + name;
+}
+
+SharedStream Create(StreamFactory* factory,
+                    boost::asio::io_service* service,
+                    const StreamFactory::Options& options) {
+  SharedStream result;
+  factory->AsyncCreate(options, [&](const base::error_code& ec,
+                                    SharedStream stream) {
+      BOOST_TEST(!ec);
+      result = stream;
+    });
+  service->poll();
+  service->reset();
+  return result;
+}
+
+std::string ReadOnce(AsyncStream* stream, boost::asio::io_service* service,
+                     bool* eof = nullptr) {
+  char buffer[64] = {};
+  size_t read_size = 0;
+  bool done = false;
+  stream->async_read_some(
+      boost::asio::buffer(buffer),
+      [&](const base::error_code& ec, size_t size) {
+        if (eof) { *eof = (ec == boost::asio::error::eof); }
+        read_size = size;
+        done = true;
+      });
+  service->run();
+  service->reset();
+  BOOST_TEST(done);
+  return std::string(buffer, read_size);
+}
+}
+
+BOOST_AUTO_TEST_CASE(CaptureFileTest) {
+  const auto filename = TempFile("file");
+  const auto start = std::chrono::steady_clock::now();
+  {
+    CaptureWriter dut(filename);
+    dut.Write(CaptureRecord::kRead, start, "abc");
+    dut.Write(CaptureRecord::kWrite, start + std::chrono::microseconds(250),
+              std::string("\x00\x01", 2));
+    // Out of order timestamps are clamped.
+    dut.Write(CaptureRecord::kRead, start, "de");
+  }
+
+  {
+    // A record which was cut off part way is ignored.
+    std::ofstream out(filename, std::ios::binary | std::ios::app);
+    out.write("\x02\x10xyz", 5);
+  }
+
+  CaptureReader dut(filename);
+  auto record = dut.Read();
+  BOOST_TEST_REQUIRE(!!record);
+  BOOST_TEST(record->timestamp_us == 0);
+  BOOST_TEST(record->direction == CaptureRecord::kRead);
+  BOOST_TEST(record->data == "abc");
+
+  record = dut.Read();
+  BOOST_TEST_REQUIRE(!!record);
+  BOOST_TEST(record->timestamp_us == 250);
+  BOOST_TEST(record->direction == CaptureRecord::kWrite);
+  BOOST_TEST(record->data == std::string("\x00\x01", 2));
+
+  record = dut.Read();
+  BOOST_TEST_REQUIRE(!!record);
+  BOOST_TEST(record->timestamp_us == 250);
+  BOOST_TEST(record->data == "de");
+
+  BOOST_TEST(!dut.Read());
+
+  ::unlink(filename.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(CaptureReplayTest) {
+  const auto filename = TempFile("replay");
+
+  boost::asio::io_service service;
+  StreamFactory factory{service};
+
+  {
+    StreamFactory::Options options;
+    options.type = StreamFactory::Type::kCapture;
+    options.capture_type = StreamFactory::Type::kPipe;
+    options.capture_file = filename;
+    options.pipe_key = "test";
+    options.pipe_direction = 0;
+    auto dut = Create(&factory, &service, options);
+    BOOST_TEST_REQUIRE(!!dut);
+
+    options.type = StreamFactory::Type::kPipe;
+    options.pipe_direction = 1;
+    auto other = Create(&factory, &service, options);
+
+    // Two separate chunks come in, and we send one out.
+    for (std::string data : { "first", "second" }) {
+      boost::asio::async_write(
+          *other, boost::asio::buffer(data),
+          [](const base::error_code& ec, size_t) { BOOST_TEST(!ec); });
+      BOOST_TEST(ReadOnce(dut.get(), &service) == data);
+    }
+
+    const std::string reply = "reply";
+    boost::asio::async_write(
+        *dut, boost::asio::buffer(reply),
+        [](const base::error_code& ec, size_t) { BOOST_TEST(!ec); });
+    BOOST_TEST(ReadOnce(other.get(), &service) == "reply");
+  }
+
+  StreamFactory::Options options;
+  options.type = StreamFactory::Type::kReplay;
+  options.replay_file = filename;
+  options.replay_speed = 0.0;
+
+  {
+    // The chunking of what was originally read is preserved.
+    auto dut = Create(&factory, &service, options);
+    BOOST_TEST(ReadOnce(dut.get(), &service) == "first");
+    BOOST_TEST(ReadOnce(dut.get(), &service) == "second");
+
+    bool eof = false;
+    BOOST_TEST(ReadOnce(dut.get(), &service, &eof) == "");
+    BOOST_TEST(eof);
+  }
+
+  {
+    options.replay_writes = true;
+    options.replay_speed = 100.0;
+    auto dut = Create(&factory, &service, options);
+    BOOST_TEST(ReadOnce(dut.get(), &service) == "reply");
+  }
+
+  ::unlink(filename.c_str());
+}
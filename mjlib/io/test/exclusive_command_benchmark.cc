@@ -0,0 +1,120 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measures how many commands per second ExclusiveCommand and
+/// PooledExclusiveCommand can sequence, and how many memory
+/// allocations each command costs.  Each command completes with a
+/// single post to the io_service, as if it were a write which
+/// finished immediately, and its handler queues another, so that
+/// queue_depth commands are always waiting.
+
+#include <chrono>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/error_code.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/base/test/allocation_counter.h"
+#include "mjlib/io/exclusive_command.h"
+#include "mjlib/io/pooled_exclusive_command.h"
+
+namespace base = mjlib::base;
+namespace io = mjlib::io;
+namespace po = boost::program_options;
+
+namespace {
+struct Options {
+  int commands = 1000000;
+  int queue_depth = 4;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(commands));
+    a->Visit(MJ_NVP(queue_depth));
+  }
+};
+
+template <typename Lock>
+class Benchmark {
+ public:
+  Benchmark(const Options& options) : options_(options) {}
+
+  void Run(const std::string& name) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto start_allocations = base::AllocationCount();
+
+    for (int i = 0; i < options_.queue_depth; i++) { Invoke(); }
+    service_.run();
+
+    const auto end = std::chrono::steady_clock::now();
+    const double elapsed_s =
+        std::chrono::duration<double>(end - start).count();
+
+    std::cout << name << ":\n"
+              << "  commands: " << completed_ << "\n"
+              << "  commands_per_s: " << completed_ / elapsed_s << "\n"
+              << "  allocations_per_command: "
+              << static_cast<double>(
+                  base::AllocationCount() - start_allocations) /
+                 completed_ << "\n";
+  }
+
+ private:
+  void Invoke() {
+    if (issued_ >= options_.commands) { return; }
+    issued_++;
+
+    lock_.Invoke(
+        [this](auto done) {
+          service_.post([done]() mutable { done(base::error_code()); });
+        },
+        [this](const base::error_code&) {
+          completed_++;
+          Invoke();
+        });
+  }
+
+  const Options options_;
+  boost::asio::io_service service_;
+  Lock lock_{service_};
+  int issued_ = 0;
+  int completed_ = 0;
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  Benchmark<io::ExclusiveCommand>(options).Run("ExclusiveCommand");
+  Benchmark<io::PooledExclusiveCommand<const base::error_code&>>(
+      options).Run("PooledExclusiveCommand");
+
+  return 0;
+}
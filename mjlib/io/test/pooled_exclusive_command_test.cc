@@ -0,0 +1,122 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/io/pooled_exclusive_command.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <boost/test/auto_unit_test.hpp>
+
+namespace io = mjlib::io;
+
+namespace {
+using Dut = io::PooledExclusiveCommand<int>;
+}
+
+BOOST_AUTO_TEST_CASE(PooledExclusiveCommandTest) {
+  boost::asio::io_service service;
+  Dut dut{service};
+
+  int item1_started = 0;
+  int item1_result = 0;
+  std::vector<Dut::Done> done;
+  dut.Invoke(
+      [&](Dut::Done callback) {
+        item1_started++;
+        done.push_back(callback);
+      },
+      [&](int value) {
+        item1_result = value;
+      });
+
+  int item2_started = 0;
+  int item2_result = 0;
+  dut.Invoke(
+      [&](Dut::Done callback) {
+        item2_started++;
+        done.push_back(callback);
+      },
+      [&](int value) {
+        item2_result = value;
+      });
+
+  // Nothing should have been kicked off yet since we haven't polled.
+  BOOST_TEST(item1_started == 0);
+  BOOST_TEST(item2_started == 0);
+
+  service.poll();
+  service.reset();
+
+  BOOST_TEST(item1_started == 1);
+  BOOST_TEST(item2_started == 0);
+
+  // The second item starts as soon as the first is done, without
+  // needing another trip through the io_service.
+  done.at(0)(4);
+  BOOST_TEST(item1_result == 4);
+  BOOST_TEST(item2_started == 1);
+  BOOST_TEST(item2_result == 0);
+
+  done.at(1)(5);
+  BOOST_TEST(item2_result == 5);
+  BOOST_TEST(dut.slots() == 2);
+
+  // Once idle, the next command is posted again.
+  int item3_result = 0;
+  dut.Invoke(
+      [&](Dut::Done callback) { callback(6); },
+      [&](int value) { item3_result = value; });
+  BOOST_TEST(item3_result == 0);
+  service.poll();
+  service.reset();
+  BOOST_TEST(item3_result == 6);
+
+  // And the existing slots were reused.
+  BOOST_TEST(dut.slots() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(PooledExclusiveCommandSynchronousTest) {
+  boost::asio::io_service service;
+  Dut dut{service};
+
+  // Commands which complete immediately, and handlers which queue
+  // more, run one after another rather than recursing.
+  int depth = 0;
+  int max_depth = 0;
+  int completed = 0;
+  std::function<void ()> invoke = [&]() {
+    dut.Invoke(
+        [&](Dut::Done callback) {
+          depth++;
+          max_depth = std::max(max_depth, depth);
+          callback(completed);
+          depth--;
+        },
+        [&](int value) {
+          BOOST_TEST(value == completed);
+          completed++;
+          if (completed < 1000) { invoke(); }
+        });
+  };
+  invoke();
+
+  service.poll();
+  BOOST_TEST(completed == 1000);
+  BOOST_TEST(max_depth == 1);
+  // Each handler queues the next command while its own slot is still
+  // in use.
+  BOOST_TEST(dut.slots() == 2);
+}
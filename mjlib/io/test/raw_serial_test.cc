@@ -0,0 +1,211 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/io/stream_factory.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <array>
+
+#include <boost/asio/write.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjlib::io;
+namespace base = mjlib::base;
+
+namespace {
+/// The slave end of a pty looks enough like a serial port for
+/// termios, epoll and writev.
+class Pty {
+ public:
+  Pty() {
+    master_ = ::posix_openpt(O_RDWR | O_NOCTTY);
+    BOOST_REQUIRE(master_ >= 0);
+    BOOST_REQUIRE(::grantpt(master_) == 0);
+    BOOST_REQUIRE(::unlockpt(master_) == 0);
+    slave_name_ = ::ptsname(master_);
+  }
+
+  ~Pty() {
+    ::close(master_);
+  }
+
+  void Write(const std::string& data) {
+    BOOST_REQUIRE(::write(master_, data.data(), data.size()) ==
+                  static_cast<ssize_t>(data.size()));
+  }
+
+  std::string Read(size_t size) {
+    std::string result;
+    while (result.size() < size) {
+      char buffer[256] = {};
+      const auto count = ::read(
+          master_, buffer, std::min(sizeof(buffer), size - result.size()));
+      BOOST_REQUIRE(count > 0);
+      result += std::string(buffer, count);
+    }
+    return result;
+  }
+
+  int master_ = -1;
+  std::string slave_name_;
+};
+
+SharedStream Create(boost::asio::io_service* service,
+                    const std::string& port, int vmin = 1) {
+  StreamFactory factory{*service};
+  StreamFactory::Options options;
+  options.type = StreamFactory::Type::kRawSerial;
+  options.serial_port = port;
+  options.serial_baud = 3000000;
+  options.serial_vmin = vmin;
+
+  SharedStream result;
+  factory.AsyncCreate(options, [&](const base::error_code& ec,
+                                   SharedStream stream) {
+      BOOST_TEST(!ec);
+      result = stream;
+    });
+  service->poll();
+  service->reset();
+  return result;
+}
+}
+
+BOOST_AUTO_TEST_CASE(RawSerialReadTest) {
+  boost::asio::io_service service;
+  Pty pty;
+  auto dut = Create(&service, pty.slave_name_);
+  BOOST_REQUIRE(!!dut);
+
+  auto* const timestamps = dynamic_cast<ReadTimestampSource*>(dut.get());
+  BOOST_REQUIRE(timestamps != nullptr);
+
+  char buffer[16] = {};
+  size_t read_size = 0;
+  bool done = false;
+  dut->async_read_some(
+      boost::asio::buffer(buffer),
+      [&](const base::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        read_size = size;
+        done = true;
+      });
+
+  const auto before = std::chrono::steady_clock::now();
+  pty.Write("hello");
+  service.run();
+  service.reset();
+  const auto after = std::chrono::steady_clock::now();
+
+  BOOST_TEST(done);
+  BOOST_TEST(std::string(buffer, read_size) == "hello");
+  BOOST_TEST((timestamps->last_read_time() >= before));
+  BOOST_TEST((timestamps->last_read_time() <= after));
+}
+
+BOOST_AUTO_TEST_CASE(RawSerialWriteTest) {
+  boost::asio::io_service service;
+  Pty pty;
+  auto dut = Create(&service, pty.slave_name_);
+  BOOST_REQUIRE(!!dut);
+
+  // Like a frame, with a header, payload and checksum.
+  const std::string header = "\x54\xab";
+  const std::string payload = "payload";
+  const std::string crc = "\x12\x34";
+  const std::array<boost::asio::const_buffer, 3> buffers = {{
+    boost::asio::buffer(header),
+    boost::asio::buffer(payload),
+    boost::asio::buffer(crc),
+  }};
+
+  bool done = false;
+  boost::asio::async_write(
+      *dut, buffers,
+      [&](const base::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(size == 11);
+        done = true;
+      });
+  service.run();
+  service.reset();
+
+  BOOST_TEST(done);
+  BOOST_TEST(pty.Read(11) == header + payload + crc);
+}
+
+BOOST_AUTO_TEST_CASE(RawSerialVminTest) {
+  boost::asio::io_service service;
+  Pty pty;
+  auto dut = Create(&service, pty.slave_name_, 4);
+  BOOST_REQUIRE(!!dut);
+
+  char buffer[16] = {};
+  size_t read_size = 0;
+  bool done = false;
+  dut->async_read_some(
+      boost::asio::buffer(buffer),
+      [&](const base::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        read_size = size;
+        done = true;
+      });
+
+  pty.Write("ab");
+  ::usleep(20000);
+  service.poll();
+  service.reset();
+  BOOST_TEST(!done);
+
+  pty.Write("cd");
+  service.run();
+  service.reset();
+  BOOST_TEST(done);
+  BOOST_TEST(std::string(buffer, read_size) == "abcd");
+}
+
+BOOST_AUTO_TEST_CASE(RawSerialCancelTest) {
+  boost::asio::io_service service;
+  Pty pty;
+  auto dut = Create(&service, pty.slave_name_);
+  BOOST_REQUIRE(!!dut);
+
+  char buffer[16] = {};
+  bool done = false;
+  dut->async_read_some(
+      boost::asio::buffer(buffer),
+      [&](const base::error_code& ec, size_t) {
+        BOOST_TEST((ec == boost::asio::error::operation_aborted));
+        done = true;
+      });
+  dut->cancel();
+  service.run();
+  service.reset();
+  BOOST_TEST(done);
+
+  // The stream is still usable afterwards.
+  size_t read_size = 0;
+  dut->async_read_some(
+      boost::asio::buffer(buffer),
+      [&](const base::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        read_size = size;
+      });
+  pty.Write("x");
+  service.run();
+  BOOST_TEST(read_size == 1);
+}
@@ -0,0 +1,240 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measures the round trip latency of frames sent through a serial
+/// StreamFactory type to an echoing device on the far side of a pty.
+/// A pty has no baud rate, so this isolates the overhead of the
+/// stream implementation and kernel tty layer, which is what
+/// differs between "serial" and "raw_serial".
+///
+/// Each frame is written as a header, payload and checksum, just as
+/// multiplex::FrameStream does.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <iostream>
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/hdr_histogram.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/base/system_error.h"
+#include "mjlib/io/deadline_timer.h"
+#include "mjlib/io/stream_factory.h"
+
+namespace base = mjlib::base;
+namespace io = mjlib::io;
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+
+namespace {
+struct Options {
+  bool raw = true;
+  int frames = 5000;
+  int payload_size = 24;
+  int serial_vmin = 1;
+
+  // If non-zero, frames are started this often rather than back to
+  // back.
+  int period_us = 0;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(raw));
+    a->Visit(MJ_NVP(frames));
+    a->Visit(MJ_NVP(payload_size));
+    a->Visit(MJ_NVP(serial_vmin));
+    a->Visit(MJ_NVP(period_us));
+  }
+};
+
+using Clock = std::chrono::steady_clock;
+
+int64_t ToNs(Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      duration).count();
+}
+
+void Report(const std::string& name, const base::HdrHistogram& histogram) {
+  std::cout << name << "_us: p50 p90 p99 max\n"
+            << "  " << histogram.Percentile(0.50) / 1000.0
+            << " " << histogram.Percentile(0.90) / 1000.0
+            << " " << histogram.Percentile(0.99) / 1000.0
+            << " " << histogram.max() / 1000.0 << "\n";
+}
+
+class Benchmark {
+ public:
+  Benchmark(const Options& options)
+      : options_(options),
+        device_(service_),
+        timer_(service_),
+        header_(3, '\x54'),
+        payload_(options.payload_size, '\x01'),
+        crc_(2, '\x55') {
+    const int master = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || ::grantpt(master) != 0 || ::unlockpt(master) != 0) {
+      throw base::system_error::syserrno("opening pty");
+    }
+    device_.assign(master);
+
+    io::StreamFactory::Options stream_options;
+    stream_options.type = options.raw ?
+        io::StreamFactory::Type::kRawSerial :
+        io::StreamFactory::Type::kSerial;
+    stream_options.serial_port = ::ptsname(master);
+    stream_options.serial_baud = 3000000;
+    stream_options.serial_vmin = options.serial_vmin;
+
+    io::StreamFactory factory{service_};
+    factory.AsyncCreate(stream_options, [&](const base::error_code& ec,
+                                            io::SharedStream stream) {
+        base::FailIf(ec);
+        stream_ = stream;
+      });
+    service_.poll();
+    service_.reset();
+
+    timestamps_ = dynamic_cast<io::ReadTimestampSource*>(stream_.get());
+    received_.resize(header_.size() + payload_.size() + crc_.size());
+  }
+
+  void Run() {
+    StartDeviceRead();
+    StartFrame();
+    service_.run();
+
+    std::cout << "type: " << (options_.raw ? "raw_serial" : "serial") << "\n"
+              << "frames: " << round_trip_ns_.count() << "\n"
+              << "frame_bytes: " << received_.size() << "\n";
+    Report("round_trip", round_trip_ns_);
+    if (timestamps_) {
+      Report("timestamp_to_handler", timestamp_to_handler_ns_);
+    }
+  }
+
+ private:
+  void StartDeviceRead() {
+    device_.async_read_some(
+        boost::asio::buffer(device_buffer_),
+        [this](const base::error_code& ec, size_t size) {
+          if (ec) { return; }
+          device_echo_.assign(device_buffer_, size);
+          boost::asio::async_write(
+              device_, boost::asio::buffer(device_echo_),
+              [this](const base::error_code& ec, size_t) {
+                base::FailIf(ec);
+                StartDeviceRead();
+              });
+        });
+  }
+
+  void StartFrame() {
+    frame_start_ = Clock::now();
+    if (options_.period_us) {
+      timer_.expires_from_now(pt::microseconds(options_.period_us));
+    }
+
+    const std::array<boost::asio::const_buffer, 3> buffers = {{
+      boost::asio::buffer(header_),
+      boost::asio::buffer(payload_),
+      boost::asio::buffer(crc_),
+    }};
+    boost::asio::async_write(
+        *stream_, buffers,
+        [](const base::error_code& ec, size_t) {
+          base::FailIf(ec);
+        });
+    boost::asio::async_read(
+        *stream_, boost::asio::buffer(received_),
+        [this](const base::error_code& ec, size_t) {
+          base::FailIf(ec);
+          HandleFrame();
+        });
+  }
+
+  void HandleFrame() {
+    const auto now = Clock::now();
+    round_trip_ns_.Add(ToNs(now - frame_start_));
+    if (timestamps_) {
+      timestamp_to_handler_ns_.Add(ToNs(now - timestamps_->last_read_time()));
+    }
+
+    if (static_cast<int>(round_trip_ns_.count()) >= options_.frames) {
+      device_.cancel();
+      return;
+    }
+
+    if (options_.period_us) {
+      timer_.async_wait([this](const base::error_code& ec) {
+          base::FailIf(ec);
+          StartFrame();
+        });
+    } else {
+      StartFrame();
+    }
+  }
+
+  const Options options_;
+  boost::asio::io_service service_;
+  boost::asio::posix::stream_descriptor device_;
+  io::DeadlineTimer timer_;
+  io::SharedStream stream_;
+  io::ReadTimestampSource* timestamps_ = nullptr;
+
+  const std::string header_;
+  const std::string payload_;
+  const std::string crc_;
+  std::string received_;
+
+  char device_buffer_[256] = {};
+  std::string device_echo_;
+
+  Clock::time_point frame_start_;
+  base::HdrHistogram round_trip_ns_;
+  base::HdrHistogram timestamp_to_handler_ns_;
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  Benchmark benchmark{options};
+  benchmark.Run();
+
+  return 0;
+}
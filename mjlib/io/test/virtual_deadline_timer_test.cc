@@ -14,6 +14,9 @@
 
 #include "mjlib/io/deadline_timer.h"
 
+#include <functional>
+#include <vector>
+
 #include <boost/test/auto_unit_test.hpp>
 
 using namespace mjlib;
@@ -24,3 +27,88 @@ BOOST_AUTO_TEST_CASE(BasicVirtualDeadlineTimer) {
   timer.expires_from_now(boost::posix_time::milliseconds(1));
   timer.wait();
 }
+
+BOOST_AUTO_TEST_CASE(SimulatedTimerOrderTest) {
+  boost::asio::io_service service;
+  auto* const sim = io::SimulatedTimerService::Install(service);
+  const auto start = sim->now();
+
+  std::vector<int> done;
+  io::DeadlineTimer timer1(service);
+  io::DeadlineTimer timer2(service);
+  io::DeadlineTimer timer3(service);
+  timer1.expires_from_now(boost::posix_time::milliseconds(3));
+  timer2.expires_from_now(boost::posix_time::milliseconds(1));
+  timer3.expires_from_now(boost::posix_time::milliseconds(1));
+  timer1.async_wait([&](const boost::system::error_code& ec) {
+      BOOST_TEST(!ec);
+      done.push_back(1);
+    });
+  timer3.async_wait([&](const boost::system::error_code& ec) {
+      BOOST_TEST(!ec);
+      done.push_back(3);
+    });
+  timer2.async_wait([&](const boost::system::error_code& ec) {
+      BOOST_TEST(!ec);
+      done.push_back(2);
+    });
+  BOOST_TEST(sim->pending() == 3);
+  BOOST_TEST((sim->next_expiration() ==
+              start + boost::posix_time::milliseconds(1)));
+
+  // Those which expire together complete in the order they were
+  // started.
+  sim->Advance(boost::posix_time::milliseconds(2));
+  BOOST_TEST((done == std::vector<int>{3, 2}));
+  BOOST_TEST((sim->now() == start + boost::posix_time::milliseconds(2)));
+
+  sim->Run();
+  BOOST_TEST((done == std::vector<int>{3, 2, 1}));
+  BOOST_TEST((sim->now() == start + boost::posix_time::milliseconds(3)));
+  BOOST_TEST(sim->pending() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(SimulatedTimerCancelTest) {
+  boost::asio::io_service service;
+  auto* const sim = io::SimulatedTimerService::Install(service);
+
+  io::DeadlineTimer timer(service);
+  timer.expires_from_now(boost::posix_time::seconds(1));
+  int aborted = 0;
+  timer.async_wait([&](const boost::system::error_code& ec) {
+      BOOST_TEST((ec == boost::asio::error::operation_aborted));
+      aborted++;
+    });
+
+  // Restarting the timer cancels the outstanding wait.
+  timer.expires_from_now(boost::posix_time::seconds(2));
+  BOOST_TEST(sim->pending() == 0);
+  sim->Run();
+  BOOST_TEST(aborted == 1);
+}
+
+BOOST_AUTO_TEST_CASE(SimulatedTimerPeriodicTest) {
+  boost::asio::io_service service;
+  auto* const sim = io::SimulatedTimerService::Install(service);
+  const auto start = sim->now();
+
+  // A day of 10ms ticks goes by in no real time at all.
+  io::DeadlineTimer timer(service);
+  int ticks = 0;
+  std::function<void ()> start_timer = [&]() {
+    timer.expires_from_now(boost::posix_time::milliseconds(10));
+    timer.async_wait([&](const boost::system::error_code& ec) {
+        BOOST_TEST(!ec);
+        ticks++;
+        // Each handler sees the time its own timer expired.
+        BOOST_TEST((sim->now() ==
+                    start + boost::posix_time::milliseconds(10 * ticks)));
+        start_timer();
+      });
+  };
+  start_timer();
+
+  sim->Advance(boost::posix_time::hours(24));
+  BOOST_TEST(ticks == 24 * 3600 * 100);
+  BOOST_TEST((sim->now() == start + boost::posix_time::hours(24)));
+}
@@ -14,10 +14,179 @@
 
 #include "mjlib/io/virtual_deadline_timer.h"
 
+#include <algorithm>
+#include <functional>
+
+#include <boost/asio/error.hpp>
+
 namespace mjlib {
 namespace io {
 
 boost::asio::io_service::id VirtualDeadlineTimerServiceHolder::id;
 
+class SimulatedTimerService::Impl : public VirtualDeadlineTimerImpl {
+ public:
+  ~Impl() override {}
+
+  boost::posix_time::ptime expires;
+  std::vector<Key> waits;
+};
+
+SimulatedTimerService::SimulatedTimerService(
+    boost::asio::io_service& service,
+    boost::posix_time::ptime start)
+    : service_(service),
+      now_(start) {}
+
+SimulatedTimerService::~SimulatedTimerService() {}
+
+SimulatedTimerService* SimulatedTimerService::Install(
+    boost::asio::io_service& service,
+    boost::posix_time::ptime start) {
+  auto result = std::make_unique<SimulatedTimerService>(service, start);
+  auto* const ptr = result.get();
+  boost::asio::use_service<VirtualDeadlineTimerServiceHolder>(
+      service).Reset(std::move(result));
+  return ptr;
+}
+
+std::size_t SimulatedTimerService::AdvanceTo(boost::posix_time::ptime time) {
+  std::size_t count = Poll();
+  while (!waits_.empty() && waits_.begin()->first.first <= time) {
+    now_ = waits_.begin()->first.first;
+    PostDue();
+    count += Poll();
+  }
+  now_ = std::max(now_, time);
+  return count;
+}
+
+std::size_t SimulatedTimerService::Run() {
+  std::size_t count = Poll();
+  while (!waits_.empty()) {
+    now_ = waits_.begin()->first.first;
+    PostDue();
+    count += Poll();
+  }
+  return count;
+}
+
+boost::posix_time::ptime SimulatedTimerService::next_expiration() const {
+  if (waits_.empty()) { return boost::posix_time::not_a_date_time; }
+  return waits_.begin()->first.first;
+}
+
+void SimulatedTimerService::construct(implementation_type& impl) {
+  auto* const result = new Impl();
+  result->expires = now_;
+  impl = result;
+}
+
+void SimulatedTimerService::destroy(implementation_type& impl) {
+  boost::system::error_code ec;
+  cancel(impl, ec);
+  delete get(impl);
+  impl = nullptr;
+}
+
+std::size_t SimulatedTimerService::cancel(implementation_type& impl,
+                                          boost::system::error_code& ec) {
+  ec = {};
+  auto* const timer = get(impl);
+  for (const auto& key : timer->waits) {
+    auto it = waits_.find(key);
+    service_.post(std::bind(std::move(it->second.handler),
+                            boost::asio::error::operation_aborted));
+    waits_.erase(it);
+  }
+  const auto result = timer->waits.size();
+  timer->waits.clear();
+  return result;
+}
+
+boost::posix_time::ptime SimulatedTimerService::expires_at(
+    const implementation_type& impl) const {
+  return get(impl)->expires;
+}
+
+std::size_t SimulatedTimerService::expires_at(
+    implementation_type& impl,
+    boost::posix_time::ptime timestamp,
+    boost::system::error_code& ec) {
+  const auto result = cancel(impl, ec);
+  get(impl)->expires = timestamp;
+  return result;
+}
+
+boost::posix_time::time_duration SimulatedTimerService::expires_from_now(
+    const implementation_type& impl) const {
+  return get(impl)->expires - now_;
+}
+
+std::size_t SimulatedTimerService::expires_from_now(
+    implementation_type& impl,
+    boost::posix_time::time_duration duration,
+    boost::system::error_code& ec) {
+  return expires_at(impl, now_ + duration, ec);
+}
+
+boost::system::error_code SimulatedTimerService::wait(
+    implementation_type& impl,
+    boost::system::error_code& ec) {
+  // Nothing can happen while we block, so just skip ahead.
+  ec = {};
+  const auto expires = get(impl)->expires;
+  if (expires > now_) { AdvanceTo(expires); }
+  return ec;
+}
+
+void SimulatedTimerService::async_wait(implementation_type& impl,
+                                       ErrorCallback handler) {
+  auto* const timer = get(impl);
+  if (timer->expires <= now_) {
+    service_.post(std::bind(std::move(handler), base::error_code()));
+    return;
+  }
+
+  const Key key{timer->expires, next_sequence_++};
+  waits_[key] = Wait{timer, std::move(handler)};
+  timer->waits.push_back(key);
+}
+
+void SimulatedTimerService::shutdown_service() {
+  // Like asio, handlers which are still outstanding at shutdown are
+  // destroyed without being invoked.
+  for (auto& pair : waits_) {
+    pair.second.impl->waits.clear();
+  }
+  waits_.clear();
+}
+
+SimulatedTimerService::Impl* SimulatedTimerService::get(
+    const implementation_type& impl) const {
+  return dynamic_cast<Impl*>(impl);
+}
+
+std::size_t SimulatedTimerService::PostDue() {
+  std::size_t count = 0;
+  while (!waits_.empty() && waits_.begin()->first.first <= now_) {
+    auto it = waits_.begin();
+    auto& timer_waits = it->second.impl->waits;
+    timer_waits.erase(
+        std::find(timer_waits.begin(), timer_waits.end(), it->first));
+    service_.post(std::bind(std::move(it->second.handler),
+                            base::error_code()));
+    waits_.erase(it);
+    count++;
+  }
+  return count;
+}
+
+std::size_t SimulatedTimerService::Poll() {
+  const auto result = service_.poll();
+  service_.reset();
+  return result;
+}
+
 }
 }
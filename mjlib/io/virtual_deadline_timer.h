@@ -14,6 +14,12 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include <boost/asio/basic_deadline_timer.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
@@ -154,6 +160,102 @@ class AsioTimerService : public VirtualDeadlineTimerService {
   boost::asio::io_service& service_;
 };
 
+/// A VirtualDeadlineTimerService whose clock only moves when told
+/// to, so that simulations can cover a long span of time in very
+/// little real time.
+///
+/// Timers are completed in order of their expiration, and those
+/// which expire at the same time in the order their waits were
+/// started.  Thus a given sequence of operations always produces the
+/// same result.
+///
+/// Pending timers are not work as far as the io_service is
+/// concerned, so io_service::run() returns as soon as nothing else
+/// is ready.  Use Run() or AdvanceTo() instead.
+class SimulatedTimerService : public VirtualDeadlineTimerService {
+ public:
+  SimulatedTimerService(boost::asio::io_service&,
+                        boost::posix_time::ptime start = DefaultStart());
+  ~SimulatedTimerService() override;
+
+  /// Replace the timer service of @p service with a new
+  /// SimulatedTimerService, and return it.  This must be done before
+  /// any timers are constructed on @p service.
+  static SimulatedTimerService* Install(
+      boost::asio::io_service& service,
+      boost::posix_time::ptime start = DefaultStart());
+
+  static boost::posix_time::ptime DefaultStart() {
+    return boost::posix_time::ptime(boost::gregorian::date(2000, 1, 1));
+  }
+
+  /// Run handlers while moving the clock forward to @p time.  The
+  /// io_service is polled with now() at the expiration of each timer
+  /// in turn, so that handlers which start new timers see the right
+  /// time.
+  ///
+  /// @return the number of handlers run
+  std::size_t AdvanceTo(boost::posix_time::ptime time);
+  std::size_t Advance(boost::posix_time::time_duration duration) {
+    return AdvanceTo(now_ + duration);
+  }
+
+  /// Like AdvanceTo, but continue until no timers remain.  This does
+  /// not return if timers are always being restarted.
+  std::size_t Run();
+
+  /// @return the time at which the next timer expires, or
+  /// not_a_date_time if none are pending.
+  boost::posix_time::ptime next_expiration() const;
+
+  /// @return the number of outstanding asynchronous waits.
+  std::size_t pending() const { return waits_.size(); }
+
+  void construct(implementation_type&) override;
+  void destroy(implementation_type&) override;
+  std::size_t cancel(implementation_type&,
+                     boost::system::error_code&) override;
+  boost::posix_time::ptime expires_at(
+      const implementation_type&) const override;
+  std::size_t expires_at(
+      implementation_type&,
+      boost::posix_time::ptime,
+      boost::system::error_code&) override;
+  boost::posix_time::time_duration expires_from_now(
+      const implementation_type&) const override;
+  std::size_t expires_from_now(
+      implementation_type&,
+      boost::posix_time::time_duration,
+      boost::system::error_code&) override;
+  boost::system::error_code wait(
+      implementation_type&,
+      boost::system::error_code&) override;
+  void async_wait(implementation_type&, ErrorCallback) override;
+  void shutdown_service() override;
+  boost::posix_time::ptime now() const override { return now_; }
+
+ private:
+  class Impl;
+
+  // Waits are ordered by expiration, then by the order in which they
+  // were started.
+  using Key = std::pair<boost::posix_time::ptime, uint64_t>;
+
+  struct Wait {
+    Impl* impl = nullptr;
+    ErrorCallback handler;
+  };
+
+  Impl* get(const implementation_type&) const;
+  std::size_t PostDue();
+  std::size_t Poll();
+
+  boost::asio::io_service& service_;
+  boost::posix_time::ptime now_;
+  uint64_t next_sequence_ = 0;
+  std::map<Key, Wait> waits_;
+};
+
 class VirtualDeadlineTimerServiceHolder
     : public boost::asio::io_service::service {
  public:
@@ -0,0 +1,177 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+#include "mjlib/base/assert.h"
+#include "mjlib/base/string_span.h"
+
+namespace mjlib {
+namespace micro {
+
+/// A byte FIFO over caller provided storage.  Data is never moved
+/// once written, except by an explicit call to Linearize.
+///
+/// Both the readable data and the free space may wrap around the end
+/// of the storage.  'data' and 'space' return the first contiguous
+/// piece of each, so that callers can read or write in place without
+/// an intermediate copy.
+class RingBuffer {
+ public:
+  RingBuffer(char* data, std::size_t capacity)
+      : data_(data), capacity_(capacity) {}
+
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const { return size_; }
+  std::size_t available() const { return capacity_ - size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == capacity_; }
+
+  /// @return the first contiguous run of readable data.  If it is
+  /// shorter than size(), the remainder starts at the beginning of
+  /// the storage.
+  std::string_view data() const {
+    return std::string_view(
+        &data_[head_], std::min(size_, capacity_ - head_));
+  }
+
+  /// @return the first contiguous run of free space.
+  base::string_span space() const {
+    const auto tail = Wrap(head_ + size_);
+    const auto end = (tail < head_ || full()) ? head_ : capacity_;
+    return base::string_span(&data_[tail], &data_[end]);
+  }
+
+  /// Mark @p size bytes at the start of space() as readable.
+  void commit(std::size_t size) {
+    MJ_ASSERT(size <= static_cast<std::size_t>(space().size()));
+    size_ += size;
+  }
+
+  /// Discard @p size bytes from the front of the readable data.
+  void consume(std::size_t size) {
+    MJ_ASSERT(size <= size_);
+    size_ -= size;
+    // When we go empty, start over at the front so that the next
+    // write has the whole buffer available contiguously.
+    head_ = (size_ == 0) ? 0 : Wrap(head_ + size);
+  }
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  /// Copy as much of @p data as fits.
+  ///
+  /// @return the number of bytes copied.
+  std::size_t Write(std::string_view data) {
+    std::size_t total = 0;
+    while (!data.empty() && !full()) {
+      const auto dest = space();
+      const auto to_copy = std::min<std::size_t>(dest.size(), data.size());
+      std::memcpy(dest.data(), data.data(), to_copy);
+      commit(to_copy);
+      data.remove_prefix(to_copy);
+      total += to_copy;
+    }
+    return total;
+  }
+
+  /// Copy as much readable data as fits into @p output and consume
+  /// it.
+  ///
+  /// @return the number of bytes copied.
+  std::size_t Read(base::string_span output) {
+    std::size_t total = 0;
+    while (total < static_cast<std::size_t>(output.size()) && !empty()) {
+      const auto source = data();
+      const auto to_copy = std::min<std::size_t>(
+          source.size(), output.size() - total);
+      std::memcpy(&output[total], source.data(), to_copy);
+      consume(to_copy);
+      total += to_copy;
+    }
+    return total;
+  }
+
+  /// Rearrange the storage so that all readable data is contiguous,
+  /// i.e. data().size() == size().
+  void Linearize() {
+    const auto first = capacity_ - head_;
+    if (size_ <= first) { return; }
+
+    const auto second = size_ - first;
+    if (available() >= first) {
+      // There is room to slide the wrapped part up and drop the first
+      // part in front of it without the two overlapping.
+      std::memmove(&data_[first], &data_[0], second);
+      std::memcpy(&data_[0], &data_[head_], first);
+    } else if (first <= kMaxLinearizeTemporary) {
+      char temporary[kMaxLinearizeTemporary];
+      std::memcpy(temporary, &data_[head_], first);
+      std::memmove(&data_[first], &data_[0], second);
+      std::memcpy(&data_[0], temporary, first);
+    } else {
+      std::rotate(&data_[0], &data_[head_], &data_[capacity_]);
+    }
+    head_ = 0;
+  }
+
+  /// Move all readable data to the very front of the storage, so that
+  /// space() covers all of available().
+  void MoveToFront() {
+    if (head_ == 0) { return; }
+    if (head_ + size_ > capacity_) {
+      Linearize();
+      return;
+    }
+    std::memmove(&data_[0], &data_[head_], size_);
+    head_ = 0;
+  }
+
+ private:
+  static constexpr std::size_t kMaxLinearizeTemporary = 64;
+
+  std::size_t Wrap(std::size_t index) const {
+    return index >= capacity_ ? index - capacity_ : index;
+  }
+
+  char* const data_;
+  const std::size_t capacity_;
+
+  std::size_t head_ = 0;
+  std::size_t size_ = 0;
+};
+
+/// A RingBuffer which has a user-defined size and owns its storage.
+template <std::size_t N>
+class SizedRingBuffer : public RingBuffer {
+ public:
+  SizedRingBuffer() : RingBuffer(storage_, N) {}
+
+ private:
+  char storage_[N] = {};
+};
+
+}
+}
@@ -14,11 +14,14 @@
 
 #include "mjlib/micro/telemetry_manager.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 #include "mjlib/base/buffer_stream.h"
 #include "mjlib/base/stream.h"
 #include "mjlib/base/tokenizer.h"
+#include "mjlib/telemetry/telemetry_delta.h"
 
 #include "mjlib/micro/pool_map.h"
 
@@ -26,6 +29,15 @@ namespace mjlib {
 namespace micro {
 
 namespace {
+class SizeStream : public base::WriteStream {
+ public:
+  void write(const std::string_view& data) override {
+    size += data.size();
+  }
+
+  std::size_t size = 0;
+};
+
 // Rates requested faster than this will result in a message being
 // emitted per-update.
 constexpr int kMinRateMs = 10;
@@ -43,6 +55,16 @@ class TelemetryManager::Impl {
     bool to_send = false;
     bool text = false;
     SerializableHandlerBase* base = nullptr;
+
+    // When non-zero, records are sent as deltas against the previous
+    // one, with a full record at least this often.
+    int keyframe_interval = 0;
+    int since_keyframe = 0;
+
+    // The last record sent, which deltas are relative to.
+    char* previous = nullptr;
+    std::size_t previous_capacity = 0;
+    std::size_t previous_size = 0;
   };
 
   using ElementPool = PoolMap<std::string_view, Element>;
@@ -71,6 +93,8 @@ class TelemetryManager::Impl {
       Rate(tokenizer.remaining(), response);
     } else if (cmd == "fmt") {
       Format(tokenizer.remaining(), response);
+    } else if (cmd == "delta") {
+      Delta(tokenizer.remaining(), response);
     } else if (cmd == "stop") {
       Stop(response);
     } else if (cmd == "text") {
@@ -144,7 +168,7 @@ class TelemetryManager::Impl {
       return;
     }
 
-    EmitData(&it->second, response);
+    EmitData(&it->second, response, kForceKeyframe);
   }
 
   void Enumerate(Element* element,
@@ -161,10 +185,18 @@ class TelemetryManager::Impl {
         });
   }
 
+  enum KeyframePolicy {
+    kAllowDelta,
+    kForceKeyframe,
+  };
+
   void EmitData(Element* element,
-                const CommandManager::Response& response) {
+                const CommandManager::Response& response,
+                KeyframePolicy policy = kAllowDelta) {
     if (element->text) {
       Enumerate(element, response);
+    } else if (element->keyframe_interval) {
+      EmitDelta(element, response, policy);
     } else {
       Emit(
           "emit ",
@@ -204,6 +236,76 @@ class TelemetryManager::Impl {
         response.callback);
   }
 
+  void EmitDelta(Element* element,
+                 const CommandManager::Response& response,
+                 KeyframePolicy policy) {
+    constexpr std::string_view kKeyframePrefix = "emit ";
+    constexpr std::string_view kDeltaPrefix = "delta ";
+    const std::size_t delta_header_size =
+        kDeltaPrefix.size() + element->name.size() + 2 + sizeof(uint32_t);
+
+    // The record is serialized far enough into the send buffer that a
+    // delta can be written in front of it, over the top of the parts
+    // which have already been compared.
+    const std::size_t record_offset =
+        delta_header_size + telemetry::TelemetryDelta::kHeaderSize +
+        telemetry::TelemetryDelta::BitmapSize(sizeof(send_buffer_));
+    char* const record = send_buffer_ + record_offset;
+    base::BufferWriteStream record_stream{
+      {record, static_cast<std::ptrdiff_t>(
+            sizeof(send_buffer_) - record_offset)}};
+    element->base->WriteBinary(record_stream);
+    const std::size_t size = record_stream.offset();
+
+    const bool keyframe =
+        policy == kForceKeyframe ||
+        element->previous_size != size ||
+        element->since_keyframe >= element->keyframe_interval;
+
+    std::size_t total = 0;
+    if (keyframe) {
+      const auto header_size =
+          WriteHeader(kKeyframePrefix, element->name, size);
+      std::memmove(send_buffer_ + header_size, record, size);
+      total = header_size + size;
+
+      if (size <= element->previous_capacity) {
+        std::memcpy(element->previous, send_buffer_ + header_size, size);
+        element->previous_size = size;
+      } else {
+        element->previous_size = 0;
+      }
+      element->since_keyframe = 1;
+    } else {
+      const auto delta_size = telemetry::TelemetryDelta::Encode(
+          record, size, element->previous, send_buffer_ + delta_header_size);
+      WriteHeader(kDeltaPrefix, element->name, delta_size);
+      total = delta_header_size + delta_size;
+      element->since_keyframe++;
+    }
+
+    AsyncWrite(
+        *response.stream,
+        std::string_view(send_buffer_, total),
+        response.callback);
+  }
+
+  /// Write the "prefix name\r\n<size>" which precedes every binary
+  /// record.
+  ///
+  /// @return the number of bytes written
+  std::size_t WriteHeader(const std::string_view& prefix,
+                          const std::string_view& name,
+                          std::size_t size) {
+    base::BufferWriteStream ostream{send_buffer_};
+    ostream.write(prefix);
+    ostream.write(name);
+    ostream.write("\r\n");
+    mjlib::telemetry::TelemetryWriteStream tstream(ostream);
+    tstream.Write(static_cast<uint32_t>(size));
+    return ostream.offset();
+  }
+
   void List(const CommandManager::Response& response) {
     current_response_ = response;
     current_list_index_ = 0;
@@ -315,6 +417,45 @@ class TelemetryManager::Impl {
     WriteOK(response);
   }
 
+  void Delta(const std::string_view& command,
+             const CommandManager::Response& response) {
+    base::Tokenizer tokenizer(command, " ");
+    auto name = tokenizer.next();
+    auto interval_str = tokenizer.next();
+
+    const auto element_it = elements_.find(name);
+    if (element_it == elements_.end()) {
+      WriteMessage("unknown name\r\n", response);
+      return;
+    }
+
+    auto& element = element_it->second;
+
+    char buffer[12] = {};
+    MJ_ASSERT(interval_str.size() < (sizeof(buffer) - 1));
+    std::copy(interval_str.begin(), interval_str.end(), buffer);
+    const long interval = strtol(buffer, nullptr, 0);
+
+    if (interval > 0 && element.previous == nullptr) {
+      // Records can vary in size, but most don't, so whatever size it
+      // is now is probably what it will remain.
+      SizeStream size_stream;
+      element.base->WriteBinary(size_stream);
+      if (pool_->available() < size_stream.size) {
+        WriteMessage("out of memory\r\n", response);
+        return;
+      }
+      element.previous = static_cast<char*>(
+          pool_->Allocate(size_stream.size, 1));
+      element.previous_capacity = size_stream.size;
+    }
+
+    element.keyframe_interval = std::max<long>(0, interval);
+    element.previous_size = 0;
+
+    WriteOK(response);
+  }
+
   void Stop(const CommandManager::Response& response) {
     for (auto& item_pair : elements_) {
       auto& element = item_pair.second;
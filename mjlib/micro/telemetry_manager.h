@@ -26,6 +26,17 @@ namespace micro {
 
 /// The telemetry manager enables live introspection into arbitrary
 /// serializable structures.
+///
+/// After "tel delta <name> <N>", binary records for that name are
+/// sent as either:
+///  * "emit <name>\r\n" <uint32 size> <record>, which replaces the
+///    host's copy of the record, or
+///  * "delta <name>\r\n" <uint32 size> <delta>, which is applied to
+///    the host's copy with telemetry::TelemetryDelta::Apply
+///
+/// A full "emit" is sent at least every N records, whenever the
+/// record changes size, and for every "tel get".  N of 0 restores
+/// plain "emit" records.
 class TelemetryManager {
  public:
   TelemetryManager(Pool*,
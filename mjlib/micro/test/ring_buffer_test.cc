@@ -0,0 +1,128 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/micro/ring_buffer.h"
+
+#include <string>
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjlib::micro;
+
+namespace {
+std::string ReadAll(RingBuffer* ring) {
+  std::string result(ring->size(), '\0');
+  const auto size = ring->Read({&result[0], &result[0] + result.size()});
+  BOOST_TEST(size == result.size());
+  return result;
+}
+}
+
+BOOST_AUTO_TEST_CASE(RingBufferBasic) {
+  SizedRingBuffer<8> dut;
+  BOOST_TEST(dut.empty());
+  BOOST_TEST(dut.capacity() == 8);
+  BOOST_TEST(dut.space().size() == 8);
+
+  BOOST_TEST(dut.Write("abc") == 3);
+  BOOST_TEST(dut.size() == 3);
+  BOOST_TEST(dut.available() == 5);
+  BOOST_TEST(dut.data() == "abc");
+
+  dut.consume(1);
+  BOOST_TEST(dut.data() == "bc");
+
+  BOOST_TEST(dut.Write("defghijk") == 6);
+  BOOST_TEST(dut.full());
+  BOOST_TEST(dut.space().size() == 0);
+  BOOST_TEST(ReadAll(&dut) == "bcdefghi");
+  BOOST_TEST(dut.empty());
+}
+
+BOOST_AUTO_TEST_CASE(RingBufferWrap) {
+  SizedRingBuffer<8> dut;
+  BOOST_TEST(dut.Write("012345") == 6);
+  dut.consume(4);
+
+  // The free space is now split in two, with the first piece at the
+  // end of the storage.
+  BOOST_TEST(dut.space().size() == 2);
+  BOOST_TEST(dut.Write("abcd") == 4);
+  BOOST_TEST(dut.size() == 6);
+  BOOST_TEST(dut.data() == "45ab");
+  BOOST_TEST(dut.space().size() == 2);
+
+  // Writing in place through space() continues where Write left off.
+  auto space = dut.space();
+  space[0] = 'e';
+  dut.commit(1);
+
+  char out[3] = {};
+  BOOST_TEST(dut.Read(out) == 3);
+  BOOST_TEST(std::string(out, 3) == "45a");
+  BOOST_TEST(ReadAll(&dut) == "bcde");
+
+  // Going empty starts back over at the front.
+  BOOST_TEST(dut.space().size() == 8);
+}
+
+BOOST_AUTO_TEST_CASE(RingBufferLinearize) {
+  struct Case {
+    size_t consumed;
+    size_t written;
+  };
+
+  // The first cases leave room to move the pieces around without
+  // overlap, the later ones do not.
+  for (const auto& test_case : { Case{6, 3}, Case{7, 1},
+                                 Case{2, 2}, Case{5, 4} }) {
+    SizedRingBuffer<8> dut;
+    BOOST_TEST(dut.Write("01234567") == 8);
+    dut.consume(test_case.consumed);
+
+    const std::string wrapped =
+        std::string("abcdefgh").substr(0, test_case.written);
+    BOOST_TEST(dut.Write(wrapped) == test_case.written);
+    const std::string expected =
+        std::string("01234567").substr(test_case.consumed) + wrapped;
+    BOOST_TEST(dut.data().size() == 8 - test_case.consumed);
+
+    dut.Linearize();
+    BOOST_TEST(dut.data() == expected);
+
+    // Linearizing an already contiguous buffer does nothing.
+    dut.Linearize();
+    BOOST_TEST(dut.data() == expected);
+    BOOST_TEST(ReadAll(&dut) == expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(RingBufferMoveToFront) {
+  SizedRingBuffer<8> dut;
+  BOOST_TEST(dut.Write("0123456") == 7);
+  dut.consume(5);
+  BOOST_TEST(dut.space().size() == 1);
+
+  dut.MoveToFront();
+  BOOST_TEST(dut.data() == "56");
+  BOOST_TEST(dut.space().size() == 6);
+
+  // Wrapped data ends up at the front too.
+  BOOST_TEST(dut.Write("abcdef") == 6);
+  dut.consume(7);
+  BOOST_TEST(dut.Write("gh") == 2);
+  BOOST_TEST(dut.data() == "f");
+  dut.MoveToFront();
+  BOOST_TEST(dut.data() == "fgh");
+}
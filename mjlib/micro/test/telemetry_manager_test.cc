@@ -94,3 +94,54 @@ BOOST_FIXTURE_TEST_CASE(TelemetryManagerText, Fixture) {
   Command("tel get my_data\n");
   ExpectResponse("my_data.value 0\r\nOK\r\n");
 }
+
+BOOST_FIXTURE_TEST_CASE(TelemetryManagerDelta, Fixture) {
+  Command("tel delta unknown 3\n");
+  ExpectResponse("unknown name\r\n");
+
+  Command("tel delta my_data 3\n");
+  ExpectResponse("OK\r\n");
+
+  Command("tel rate my_data 10\n");
+  ExpectResponse("OK\r\n");
+
+  auto poll = [&]() {
+    for (int i = 0; i < 10; i++) {
+      dut.PollMillisecond();
+      event_queue.Poll();
+    }
+  };
+
+  // The first record is always sent in full.
+  poll();
+  ExpectResponse(str("emit my_data\r\n\x04\x00\x00\x00\x00\x00\x00\x00"));
+
+  // Nothing changed, so only the size and an empty bitmap are sent.
+  poll();
+  ExpectResponse(str("delta my_data\r\n\x05\x00\x00\x00"
+                     "\x04\x00\x00\x00\x00"));
+
+  my_data.value = 0x01020304;
+  poll();
+  ExpectResponse(str("delta my_data\r\n\x09\x00\x00\x00"
+                     "\x04\x00\x00\x00\x01\x04\x03\x02\x01"));
+
+  // Then every third record is a keyframe.
+  poll();
+  ExpectResponse(str("emit my_data\r\n\x04\x00\x00\x00\x04\x03\x02\x01"));
+
+  poll();
+  ExpectResponse(str("delta my_data\r\n\x05\x00\x00\x00"
+                     "\x04\x00\x00\x00\x00"));
+
+  // An explicit get is always a keyframe.
+  Command("tel get my_data\n");
+  ExpectResponse(str("emit my_data\r\n\x04\x00\x00\x00\x04\x03\x02\x01"));
+
+  // And disabling deltas returns to plain records.
+  Command("tel delta my_data 0\n");
+  ExpectResponse("OK\r\n");
+
+  poll();
+  ExpectResponse(str("emit my_data\r\n\x04\x00\x00\x00\x04\x03\x02\x01"));
+}
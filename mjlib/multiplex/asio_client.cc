@@ -14,7 +14,24 @@
 
 #include "mjlib/multiplex/asio_client.h"
 
-#include "mjlib/io/exclusive_command.h"
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <optional>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/io/deadline_timer.h"
+#include "mjlib/io/pooled_exclusive_command.h"
+#include "mjlib/multiplex/format.h"
+#include "mjlib/multiplex/frame_stream.h"
+#include "mjlib/multiplex/stream.h"
+
+namespace pl = std::placeholders;
 
 namespace mjlib {
 namespace multiplex {
@@ -28,25 +45,597 @@ class AsioClient::Impl {
   void AsyncRegister(uint8_t id,
                      const RegisterRequest& request,
                      RegisterHandler handler) {
-    lock_.Invoke([id, request](RegisterHandler handler) {
-        // Create our full frame.
+    AsyncTransaction(
+        id, request.request_reply(), request.buffer(),
+        [handler, presets = request.presets()](
+            const base::error_code& ec, const std::string& payload) {
+          base::BufferReadStream payload_stream{payload};
+          handler(ec, ParseRegisterReply(payload_stream, presets));
+        });
+  }
+
+  void AsyncGroup(const GroupRequest& request, GroupHandler handler) {
+    auto transaction = MakeTransaction(
+        Format::kBroadcastId, request.request_reply(), request.buffer());
+
+    if (!request.request_reply()) {
+      transaction->handler =
+          [handler](const base::error_code& ec, const std::string&) {
+        handler(ec, {});
+      };
+      Send(transaction);
+      return;
+    }
+
+    struct State {
+      size_t remaining = 0;
+      std::optional<base::error_code> error;
+      GroupReply reply;
+      GroupHandler handler;
+    };
+    auto state = std::make_shared<State>();
+    state->remaining = request.reply_ids().size();
+    state->handler = handler;
 
-        // Send it.
+    // Each device which replies is waited on separately, as if it
+    // were a request of its own.
+    for (size_t i = 0; i < request.reply_ids().size(); i++) {
+      const auto id = request.reply_ids()[i];
+      auto reply = std::make_shared<Transaction>();
+      reply->reply_id = id;
+      reply->group = true;
+      reply->slot_delay = boost::posix_time::microseconds(
+          static_cast<int64_t>(i) * request.reply_slot_us());
+      reply->handler =
+          [state, id, presets = request.reply_presets()[i]](
+              const base::error_code& ec, const std::string& payload) {
+        if (ec) {
+          if (!state->error) { state->error.emplace(ec); }
+        } else {
+          base::BufferReadStream payload_stream{payload};
+          state->reply.emplace_back(
+              id, ParseRegisterReply(payload_stream, presets));
+        }
 
-        // Read a reply.
-        handler(base::error_code(), RegisterReply());
-      },
-      handler);
+        state->remaining--;
+        if (state->remaining == 0) {
+          state->handler(state->error ? *state->error : base::error_code(),
+                         state->reply);
+        }
+      };
+      transaction->group_replies.push_back(reply);
+    }
+
+    // This is only invoked if the write itself fails.
+    transaction->handler =
+        [state](const base::error_code& ec, const std::string&) {
+      state->handler(ec, state->reply);
+    };
+
+    Send(transaction);
   }
 
-  io::SharedStream MakeTunnel(uint8_t, uint32_t, const TunnelOptions&) {
-    return {};
+  io::SharedStream MakeTunnel(uint8_t id, uint32_t channel,
+                              const TunnelOptions& options) {
+    return std::make_shared<Tunnel>(this, id, channel, options);
+  }
+
+  Stats stats_;
+
+ private:
+  using PayloadHandler = std::function<
+    void (const base::error_code&, const std::string&)>;
+
+  struct Transaction;
+  using TransactionPtr = std::shared_ptr<Transaction>;
+
+  struct Transaction {
+    Frame frame;
+    PayloadHandler handler;
+
+    // The device which is expected to reply.
+    uint8_t reply_id = 0;
+
+    // True if this is waiting on one reply to a broadcast.
+    bool group = false;
+
+    // For a broadcast, one entry for each device which will reply,
+    // in slot order.
+    std::vector<TransactionPtr> group_replies;
+
+    // When we began writing the request.
+    boost::posix_time::ptime write_start;
+
+    // For a reply to a broadcast, how long after the frame its slot
+    // begins.
+    boost::posix_time::time_duration slot_delay;
+
+    // The reply must be received by this time.
+    boost::posix_time::ptime deadline;
+  };
+
+  class Tunnel : public io::AsyncStream,
+                 public std::enable_shared_from_this<Tunnel> {
+   public:
+    Tunnel(Impl* parent, uint8_t id, uint32_t channel,
+           const TunnelOptions& options)
+        : parent_(parent),
+          id_(id),
+          channel_(channel),
+          options_(options) {}
+
+    ~Tunnel() override {}
+
+    boost::asio::io_service& get_io_service() override {
+      return parent_->stream_->get_io_service();
+    }
+
+    void async_read_some(io::MutableBufferSequence buffers,
+                         io::ReadHandler handler) override {
+      BOOST_ASSERT(!read_handler_);
+      read_buffers_ = buffers;
+      read_handler_ = handler;
+
+      if (MaybeCompleteRead()) { return; }
+      MaybePoll();
+    }
+
+    void async_write_some(io::ConstBufferSequence buffers,
+                          io::WriteHandler handler) override {
+      BOOST_ASSERT(!write_handler_);
+      write_buffers_ = buffers;
+      write_handler_ = handler;
+
+      // Outgoing data shouldn't have to wait out an idle backoff.
+      poll_period_s_ = 0.0;
+      if (timer_outstanding_) {
+        timer_.cancel();
+        return;
+      }
+      MaybePoll();
+    }
+
+    void cancel() override {
+      if (read_handler_) {
+        get_io_service().post(
+            std::bind(read_handler_, boost::asio::error::operation_aborted, 0));
+        read_handler_ = {};
+      }
+      if (write_handler_ && !write_in_poll_) {
+        get_io_service().post(
+            std::bind(write_handler_, boost::asio::error::operation_aborted, 0));
+        write_handler_ = {};
+      }
+      timer_.cancel();
+    }
+
+   private:
+    void MaybePoll() {
+      if (poll_outstanding_ || timer_outstanding_) { return; }
+
+      // We only poll when someone is interested in the result.
+      // Otherwise, the device is left to buffer its output.
+      if (!read_handler_ && !write_handler_) { return; }
+
+      if (poll_period_s_ > 0.0) {
+        timer_outstanding_ = true;
+        timer_.expires_from_now(
+            boost::posix_time::microseconds(
+                static_cast<int64_t>(poll_period_s_ * 1e6)));
+        timer_.async_wait(
+            std::bind(&Tunnel::HandleTimer, shared_from_this(), pl::_1));
+        return;
+      }
+
+      StartPoll();
+    }
+
+    void HandleTimer(const base::error_code&) {
+      // Whether we expired or were canceled for outgoing data, the
+      // right thing is to poll now if anyone is still waiting.
+      timer_outstanding_ = false;
+      if (!read_handler_ && !write_handler_) { return; }
+      StartPoll();
+    }
+
+    void StartPoll() {
+      base::FastOStringStream ostr;
+      WriteStream stream{ostr};
+      stream.WriteVaruint(
+          static_cast<uint32_t>(
+              options_.flow_control ?
+              Format::Subframe::kClientToServerWindowed :
+              Format::Subframe::kClientToServer));
+      stream.WriteVaruint(channel_);
+      if (options_.flow_control) {
+        // Whatever the reader hasn't consumed yet counts against the
+        // window.
+        const size_t max_read_size = std::max(0, options_.max_read_size);
+        stream.WriteVaruint(
+            max_read_size - std::min(max_read_size, received_.size()));
+      }
+
+      write_size_ = 0;
+      write_in_poll_ = false;
+      if (write_handler_) {
+        const auto wanted = std::min<size_t>(
+            boost::asio::buffer_size(write_buffers_),
+            std::max(0, options_.max_write_size));
+        write_size_ =
+            options_.flow_control ? std::min(wanted, credit_) : wanted;
+        // Without any credit, the write waits for a later poll.
+        write_in_poll_ = write_size_ > 0 || wanted == 0;
+      }
+      stream.WriteVaruint(write_size_);
+
+      const auto offset = ostr.data()->size();
+      ostr.data()->resize(offset + write_size_);
+      boost::asio::buffer_copy(
+          boost::asio::buffer(ostr.data()->data() + offset, write_size_),
+          write_buffers_);
+
+      poll_outstanding_ = true;
+      parent_->AsyncTransaction(
+          id_, true, ostr.view(),
+          std::bind(&Tunnel::HandlePoll, shared_from_this(), pl::_1, pl::_2));
+    }
+
+    void HandlePoll(const base::error_code& ec, const std::string& payload) {
+      poll_outstanding_ = false;
+
+      if (ec && ec != boost::asio::error::operation_aborted) {
+        // Something is wrong with the underlying stream.  Report it
+        // to whomever is waiting and stop polling.
+        if (read_handler_) {
+          get_io_service().post(std::bind(read_handler_, ec, 0));
+          read_handler_ = {};
+        }
+        if (write_handler_) {
+          get_io_service().post(std::bind(write_handler_, ec, 0));
+          write_handler_ = {};
+        }
+        write_in_poll_ = false;
+        return;
+      }
+
+      if (write_in_poll_) {
+        // A timeout doesn't tell us whether the device saw our data
+        // or not, and retransmitting could duplicate it.  Like a UART
+        // which has lost a byte, we just carry on.
+        write_in_poll_ = false;
+        get_io_service().post(
+            std::bind(write_handler_, base::error_code(), write_size_));
+        write_handler_ = {};
+      }
+
+      // A timeout is treated the same as a poll which returned
+      // nothing.  We can't know how much of any data we sent was
+      // received, so wait to hear about credit again before sending
+      // more.
+      if (ec) { credit_ = 0; }
+      const size_t received = ec ? 0 : ParseReply(payload);
+
+      if (received > 0 || (write_handler_ && credit_ > 0)) {
+        poll_period_s_ = 0.0;
+      } else {
+        poll_period_s_ = std::min(
+            options_.max_poll_period_s,
+            std::max(options_.min_poll_period_s, poll_period_s_ * 2.0));
+      }
+
+      MaybeCompleteRead();
+      MaybePoll();
+    }
+
+    size_t ParseReply(const std::string& payload) {
+      base::BufferReadStream buffer_stream{payload};
+      ReadStream stream{buffer_stream};
+
+      const auto maybe_subframe = stream.ReadVaruint();
+      const auto maybe_channel = stream.ReadVaruint();
+      if (!maybe_subframe || !maybe_channel) { return 0; }
+      if (*maybe_channel != channel_) { return 0; }
+
+      if (*maybe_subframe == static_cast<uint32_t>(
+              Format::Subframe::kServerToClientWindowed)) {
+        const auto maybe_credit = stream.ReadVaruint();
+        if (!maybe_credit) { return 0; }
+        credit_ = *maybe_credit;
+      } else if (*maybe_subframe != static_cast<uint32_t>(
+                     Format::Subframe::kServerToClient)) {
+        return 0;
+      }
+
+      const auto maybe_size = stream.ReadVaruint();
+      if (!maybe_size) { return 0; }
+
+      const auto size = std::min<size_t>(
+          *maybe_size, buffer_stream.remaining());
+      received_.append(buffer_stream.position(), size);
+      return size;
+    }
+
+    bool MaybeCompleteRead() {
+      if (!read_handler_ || received_.empty()) { return false; }
+
+      const auto size = boost::asio::buffer_copy(
+          read_buffers_, boost::asio::buffer(received_));
+      received_.erase(0, size);
+
+      get_io_service().post(
+          std::bind(read_handler_, base::error_code(), size));
+      read_handler_ = {};
+      return true;
+    }
+
+    Impl* const parent_;
+    const uint8_t id_;
+    const uint32_t channel_;
+    const TunnelOptions options_;
+
+    io::DeadlineTimer timer_{get_io_service()};
+    bool timer_outstanding_ = false;
+    bool poll_outstanding_ = false;
+    double poll_period_s_ = 0.0;
+
+    io::MutableBufferSequence read_buffers_;
+    io::ReadHandler read_handler_;
+    std::string received_;
+
+    io::ConstBufferSequence write_buffers_;
+    io::WriteHandler write_handler_;
+    bool write_in_poll_ = false;
+    size_t write_size_ = 0;
+
+    // How much the device said it could accept in its last reply.
+    size_t credit_ = 0;
+  };
+
+  void AsyncTransaction(uint8_t id,
+                        bool request_reply,
+                        std::string_view payload,
+                        PayloadHandler handler) {
+    auto transaction = MakeTransaction(id, request_reply, payload);
+    transaction->handler = handler;
+    Send(transaction);
+  }
+
+  TransactionPtr MakeTransaction(uint8_t id,
+                                 bool request_reply,
+                                 std::string_view payload) {
+    // Create our full frame now, so that it is ready to go the
+    // moment the bus is available.
+    auto transaction = std::make_shared<Transaction>();
+    transaction->frame.source_id = options_.source_id;
+    transaction->frame.dest_id = id;
+    transaction->frame.request_reply = request_reply;
+    transaction->frame.payload = std::string(payload);
+    transaction->reply_id = id;
+    return transaction;
+  }
+
+  void Send(TransactionPtr transaction) {
+    // Only the transmit side is exclusive.  Replies are collected
+    // independently, so that the next write may start while we are
+    // still waiting on the previous reply.
+    lock_.Invoke(
+        [this, transaction](WriteLock::Done done) {
+          StartWrite(transaction, done);
+        },
+        std::bind(&Impl::HandleWrite, this, transaction, pl::_1));
+  }
+
+  bool CanSend(const Transaction& transaction) const {
+    // Devices replying to a broadcast own the bus until their slots
+    // are over.
+    for (const auto& item : in_flight_) {
+      if (item->group) { return false; }
+    }
+    if (!transaction.frame.request_reply) { return true; }
+    if (!transaction.group_replies.empty()) { return in_flight_.empty(); }
+    if (static_cast<int>(in_flight_.size()) >=
+        std::max(1, options_.max_in_flight)) {
+      return false;
+    }
+    for (const auto& item : in_flight_) {
+      if (item->reply_id == transaction.reply_id) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void StartWrite(TransactionPtr transaction, io::ErrorCallback done) {
+    if (!CanSend(*transaction)) {
+      // We'll try again as soon as something comes back.
+      BOOST_ASSERT(!blocked_write_);
+      blocked_write_ = [this, transaction, done]() {
+        StartWrite(transaction, done);
+      };
+      return;
+    }
+
+    const auto now = Now();
+    transaction->write_start = now;
+    if (transaction->frame.request_reply) {
+      if (transaction->group_replies.empty()) {
+        stats_.destinations[transaction->reply_id].requests++;
+      }
+      for (auto& reply : transaction->group_replies) {
+        reply->write_start = now;
+        stats_.destinations[reply->reply_id].requests++;
+      }
+    }
+
+    frame_stream_.AsyncWrite(&transaction->frame, done);
+  }
+
+  boost::posix_time::ptime Now() const {
+    return boost::asio::use_service<io::VirtualDeadlineTimerServiceHolder>(
+        stream_->get_io_service()).now();
+  }
+
+  void UpdateReceiveErrors() {
+    // The parser can't tell who sent something it couldn't parse, so
+    // we blame whoever we were waiting to hear from next.
+    const auto& parser = frame_stream_.stats();
+    const auto checksum_mismatch =
+        parser.checksum_mismatch - last_parser_stats_.checksum_mismatch;
+    const auto resyncs = parser.resyncs - last_parser_stats_.resyncs;
+    last_parser_stats_ = parser;
+
+    if (in_flight_.empty()) {
+      stats_.checksum_mismatch += checksum_mismatch;
+      stats_.resyncs += resyncs;
+    } else {
+      auto& destination = stats_.destinations[in_flight_.front()->reply_id];
+      destination.checksum_mismatch += checksum_mismatch;
+      destination.resyncs += resyncs;
+    }
+  }
+
+  void HandleWrite(TransactionPtr transaction, const base::error_code& ec) {
+    if (ec) {
+      transaction->handler(ec, {});
+      return;
+    }
+
+    if (!transaction->frame.request_reply) {
+      // Nothing more to wait for.
+      transaction->handler(ec, {});
+      return;
+    }
+
+    const auto now = Now();
+    if (transaction->group_replies.empty()) {
+      transaction->deadline = now + options_.timeout;
+      in_flight_.push_back(transaction);
+    } else {
+      for (auto& reply : transaction->group_replies) {
+        reply->deadline = now + reply->slot_delay + options_.timeout;
+      }
+      in_flight_.insert(in_flight_.end(),
+                        transaction->group_replies.begin(),
+                        transaction->group_replies.end());
+    }
+    MaybeStartRead();
+  }
+
+  void MaybeStartRead() {
+    if (read_outstanding_) { return; }
+    if (in_flight_.empty()) { return; }
+
+    // Each request has its own deadline, so frames which don't
+    // satisfy anything can't extend how long we wait.
+    const auto deadline = (*std::min_element(
+        in_flight_.begin(), in_flight_.end(),
+        [](const auto& lhs, const auto& rhs) {
+          return lhs->deadline < rhs->deadline;
+        }))->deadline;
+
+    // FrameStream treats a zero timeout as none at all.
+    const auto timeout = std::max(
+        deadline - Now(), boost::posix_time::time_duration(
+            boost::posix_time::microseconds(1)));
+
+    read_outstanding_ = true;
+    frame_stream_.AsyncRead(
+        &read_frame_, timeout,
+        std::bind(&Impl::HandleRead, this, pl::_1));
+  }
+
+  void HandleRead(const base::error_code& ec) {
+    read_outstanding_ = false;
+
+    TransactionPtr done;
+    std::string payload;
+    std::vector<TransactionPtr> failed;
+    const bool stream_error =
+        ec && ec != boost::asio::error::operation_aborted;
+
+    UpdateReceiveErrors();
+
+    if (stream_error) {
+      // Something is wrong with the stream itself, so nothing we are
+      // waiting on is going to arrive.
+      failed.assign(in_flight_.begin(), in_flight_.end());
+      in_flight_.clear();
+    } else if (ec) {
+      // A timeout, which ExpireTransactions below takes care of.
+    } else if (read_frame_.dest_id == options_.source_id) {
+      const auto it = std::find_if(
+          in_flight_.begin(), in_flight_.end(),
+          [&](const auto& item) {
+            return item->reply_id == read_frame_.source_id;
+          });
+      if (it != in_flight_.end()) {
+        done = *it;
+        in_flight_.erase(it);
+
+        // The next read may land in read_frame_ before we invoke our
+        // handler.
+        payload.swap(read_frame_.payload);
+
+        auto& destination = stats_.destinations[done->reply_id];
+        destination.replies++;
+        destination.latency_us.Add(
+            (Now() - done->write_start).total_microseconds());
+      } else {
+        stats_.unexpected_frames++;
+      }
+    } else {
+      stats_.unexpected_frames++;
+    }
+
+    ExpireTransactions(&failed);
+
+    // Get the next request onto the wire before doing anything else,
+    // so the bus is busy while our caller processes this reply.
+    if (blocked_write_) {
+      auto copy = blocked_write_;
+      blocked_write_ = {};
+      copy();
+    }
+
+    MaybeStartRead();
+
+    for (auto& transaction : failed) {
+      transaction->handler(
+          stream_error ? ec :
+          base::error_code(boost::asio::error::operation_aborted), {});
+    }
+    if (done) {
+      done->handler(ec, payload);
+    }
+  }
+
+  void ExpireTransactions(std::vector<TransactionPtr>* expired) {
+    const auto now = Now();
+    for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+      if ((*it)->deadline > now) {
+        ++it;
+        continue;
+      }
+      stats_.destinations[(*it)->reply_id].timeouts++;
+      expired->push_back(*it);
+      it = in_flight_.erase(it);
+    }
   }
 
   io::AsyncStream* const stream_;
   const Options options_;
 
-  io::ExclusiveCommand lock_{stream_->get_io_service()};
+  FrameStream frame_stream_{stream_};
+  using WriteLock = io::PooledExclusiveCommand<const base::error_code&>;
+  WriteLock lock_{stream_->get_io_service()};
+
+  std::function<void ()> blocked_write_;
+  std::deque<TransactionPtr> in_flight_;
+
+  bool read_outstanding_ = false;
+  Frame read_frame_;
+
+  FrameParser::Stats last_parser_stats_;
 };
 
 AsioClient::AsioClient(io::AsyncStream* stream, const Options& options)
@@ -60,10 +649,48 @@ void AsioClient::AsyncRegister(uint8_t id,
   impl_->AsyncRegister(id, request, handler);
 }
 
+void AsioClient::AsyncGroup(const GroupRequest& request,
+                            GroupHandler handler) {
+  impl_->AsyncGroup(request, handler);
+}
+
 io::SharedStream AsioClient::MakeTunnel(
     uint8_t id, uint32_t channel, const TunnelOptions& options) {
   return impl_->MakeTunnel(id, channel, options);
 }
 
+const AsioClient::Stats& AsioClient::stats() const {
+  return impl_->stats_;
+}
+
+void AsioClient::ResetStats() {
+  impl_->stats_ = {};
+}
+
+void AsioClient::WriteStats(std::ostream& ostr) const {
+  const auto& stats = impl_->stats_;
+  ostr << " id requests  replies timeouts checksum  resyncs"
+       << "    p50_us    p90_us    p99_us    max_us\n";
+  for (const auto& pair : stats.destinations) {
+    const auto& item = pair.second;
+    const auto& latency = item.latency_us;
+    ostr << std::setw(3) << static_cast<int>(pair.first)
+         << std::setw(9) << item.requests
+         << std::setw(9) << item.replies
+         << std::setw(9) << item.timeouts
+         << std::setw(9) << item.checksum_mismatch
+         << std::setw(9) << item.resyncs
+         << std::setw(10) << latency.Percentile(0.50)
+         << std::setw(10) << latency.Percentile(0.90)
+         << std::setw(10) << latency.Percentile(0.99)
+         << std::setw(10) << latency.max() << "\n";
+  }
+  if (stats.unexpected_frames || stats.checksum_mismatch || stats.resyncs) {
+    ostr << "unexpected_frames: " << stats.unexpected_frames
+         << " checksum: " << stats.checksum_mismatch
+         << " resyncs: " << stats.resyncs << "\n";
+  }
+}
+
 }
 }
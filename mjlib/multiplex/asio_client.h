@@ -14,9 +14,14 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <ostream>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include "mjlib/base/error_code.h"
+#include "mjlib/base/hdr_histogram.h"
 #include "mjlib/io/async_stream.h"
 #include "mjlib/multiplex/register.h"
 
@@ -24,11 +29,31 @@ namespace mjlib {
 namespace multiplex {
 
 /// A client for the MultiplexProtocol based on boost::asio
+///
+/// Requests are transmitted in the order they are issued.  Replies
+/// are matched to outstanding requests by the source id of the reply
+/// frame, so that more than one request may be in flight on the bus
+/// at once.
 class AsioClient {
  public:
   struct Options {
     uint8_t source_id = 0;
 
+    /// Each reply must be received within this long of its request
+    /// being written, otherwise the handler is invoked with
+    /// boost::asio::error::operation_aborted.  For a broadcast, this
+    /// is measured from the start of each device's reply slot.
+    boost::posix_time::time_duration timeout =
+        boost::posix_time::milliseconds(10);
+
+    /// The maximum number of requests which may be awaiting a reply
+    /// at once.  When larger than 1, the transmission of the next
+    /// request begins as soon as the previous one has been written,
+    /// overlapping with the turnaround and reply of the previous
+    /// device.  Requests to the same device are never outstanding
+    /// more than once at a time.
+    int max_in_flight = 1;
+
     Options() {}
   };
   AsioClient(io::AsyncStream*, const Options& = Options());
@@ -43,20 +68,96 @@ class AsioClient {
   /// invoked once the write has been completed.
   void AsyncRegister(uint8_t id, const RegisterRequest&, RegisterHandler);
 
+  using GroupHandler = std::function<
+    void (const base::error_code&, const GroupReply&)>;
+
+  /// Send a single broadcast frame carrying requests for several
+  /// devices.  The handler is invoked once every expected reply has
+  /// arrived or timed out, or once the frame has been written if no
+  /// replies were requested.  If any reply was missed, the error is
+  /// boost::asio::error::operation_aborted, and only the replies
+  /// which did arrive are reported.
+  ///
+  /// Nothing else is transmitted while replies to a broadcast are
+  /// outstanding, as it could collide with their reply slots.
+  void AsyncGroup(const GroupRequest&, GroupHandler);
+
   struct TunnelOptions {
-    // Poll this often for data to be received.
-    double poll_rate_s = 0.01;
+    /// While the device keeps returning data, it is polled again
+    /// immediately.  Once a poll comes back empty, the next poll is
+    /// delayed by this much, doubling for each subsequent empty poll.
+    double min_poll_period_s = 0.001;
+
+    /// The delay between polls will never exceed this.
+    double max_poll_period_s = 0.05;
+
+    /// At most this many bytes of outgoing data are included in each
+    /// poll.
+    int max_write_size = 100;
+
+    /// If true, each poll uses the flow controlled subframes, so the
+    /// device is never sent more than it has room for.  Devices
+    /// which predate them need this to be false.
+    bool flow_control = true;
+
+    /// With flow_control, no more than this many bytes are buffered
+    /// for the reader, and thus returned by any one poll.  A small
+    /// value keeps a bulk channel from holding the bus for long at a
+    /// time.
+    int max_read_size = 128;
 
     TunnelOptions() {}
   };
 
   /// Allocate a tunnel which can be used to send and receive serial
   /// stream data.
+  ///
+  /// The device is only polled while a read or write is outstanding
+  /// on the returned stream.  Outgoing data is sent as part of the
+  /// next poll.
   io::SharedStream MakeTunnel(
       uint8_t id,
       uint32_t channel,
       const TunnelOptions& options = TunnelOptions());
 
+  struct DestinationStats {
+    /// Frames written which expected a reply from this device.
+    uint64_t requests = 0;
+    uint64_t replies = 0;
+    uint64_t timeouts = 0;
+
+    /// Receive errors seen while a reply from this device was the
+    /// next one expected.  They may have been caused by some other
+    /// device on the bus.
+    uint64_t checksum_mismatch = 0;
+    uint64_t resyncs = 0;
+
+    /// The time from starting to write each request until its reply
+    /// was received with a valid checksum.
+    base::HdrHistogram latency_us;
+  };
+
+  struct Stats {
+    std::map<uint8_t, DestinationStats> destinations;
+
+    /// Valid frames which did not match any outstanding request.
+    uint64_t unexpected_frames = 0;
+
+    /// Receive errors seen while no reply was expected.
+    uint64_t checksum_mismatch = 0;
+    uint64_t resyncs = 0;
+  };
+
+  const Stats& stats() const;
+
+  /// Clear all counters and histograms, for instance after each
+  /// periodic dump.
+  void ResetStats();
+
+  /// Write a human readable table of stats(), with one line for
+  /// each device.
+  void WriteStats(std::ostream&) const;
+
  private:
   class Impl;
   std::unique_ptr<Impl> impl_;
@@ -97,11 +97,49 @@
 ///     - varuint => register #
 ///     - varuint => error #
 ///
+///   0x2a - define preset
+///     - varuint => preset #
+///     - varuint => number of registers
+///     - N x (varuint => register #, uint8_t => type 0-3)
+///   0x2b - read preset
+///     - varuint => preset #
+///   0x2c - reply preset
+///     - varuint => preset #
+///     - varuint => number of registers
+///     - N x (int8_t|int16_t|int32_t|float) => values, in the order
+///       and types of the preset definition
+///   0x2d - read packed
+///     - varuint => base register #
+///     - varuint => number of registers spanned (at most 32)
+///     - bitmap => one bit per spanned register, LSB first
+///     - types => 2 bits per set bit, LSB first, giving the type 0-3
+///   0x2e - reply packed
+///     - the base, span, bitmap and types of the read packed request
+///     - M x (int8_t|int16_t|int32_t|float) => values, one for each
+///       set bit in register order
+///
 /// Any frame that contains a "read" command will have a response
 /// frame where each requested register is named exactly once.  It is
 /// not required that the responses use the exact same single/multiple
 /// formulation as long as each is mentioned once.
 ///
+/// A preset names a set of registers which are read together often.
+/// Once defined, the whole set can be read with a 2 byte subframe,
+/// and the values are reported without per-register headers.  The
+/// client must remember the definition in order to decode the
+/// reply.  Registers of a preset which cannot be read are reported
+/// with a zero value, followed by a read error for each.  Reading a
+/// preset which is not defined yields a reply with 0 registers.
+/// Presets are not persisted, and are lost when the server resets.
+///
+/// A packed read names an arbitrary set of registers, of mixed
+/// types, near one another in a single subframe, and gets all their
+/// values back in a single subframe with no per-register headers.
+/// Clients opt into this per request, by sending a read packed
+/// rather than read single or multiple subframes.  As with presets,
+/// registers which cannot be read are reported with a zero value and
+/// a following read error.
+///
 /// # Service: Tunneled Stream #
 ///
 /// The tunneled stream service models a simple byte stream, where the
@@ -118,12 +156,61 @@
 ///    - varuint => number of bytes sent from server
 ///    - N x uint8_t bytes
 ///
+///  0x42 - client data on channel, with flow control
+///    - varuint => channel
+///    - varuint => window, the most bytes the client will accept
+///    - varuint => number of bytes sent from client
+///    - N x uint8_t bytes
+///  0x43 - server data on channel, with flow control
+///    - varuint => channel
+///    - varuint => credit, the bytes the server has room for
+///    - varuint => number of bytes sent from server
+///    - N x uint8_t bytes
+///
 /// In response to receiving a frame with the 0x40 subframe, the slave
 /// should respond with a 0x41 subframe whether or not it currently
-/// has data.
+/// has data, and similarly 0x43 for 0x42.
+///
+/// A frame that contains a 0x40 subframe may contain exactly 1
+/// subframe total.
+///
+/// The 0x42 form lets each channel be flow controlled in both
+/// directions, so that neither end ever has to drop data.  The server
+/// sends no more than the window, and the client sends no more than
+/// the credit in the most recent reply on that channel, which is
+/// measured after the data in the request was received.  Since the
+/// window also bounds the size of each reply, a frame may carry 0x42
+/// subframes for several channels, along with other subframes.
 ///
-/// A frame that contains a tunneled stream subframe may contain
-/// exactly 1 subframe total.
+/// # Service: Group Addressing #
+///
+/// A frame sent to the broadcast ID, 0x7f, is processed by every
+/// server.  It may carry a separate block of subframes for each of
+/// several servers, so that one frame can command all of them at
+/// once.  Subframes outside of any block are processed by every
+/// server, and never generate a response.
+///
+/// ## Subframes ##
+///
+///  0x50 - group block
+///    - varuint => server ID
+///    - varuint => reply slot
+///       > 0 means no reply; slot N replies (N - 1) x slot length
+///         microseconds after the frame
+///    - varuint => number of bytes in block
+///    - N x uint8_t => subframes for this server
+///  0x51 - reply slot length
+///    - varuint => microseconds
+///
+/// A server processes the subframes of the block bearing its own ID
+/// as if they had arrived in a frame addressed to it, and skips all
+/// others.  If a reply slot was given, the response frame is
+/// transmitted (slot - 1) x slot length microseconds after the
+/// broadcast frame was received, so that the replies of different
+/// servers do not collide on the bus.  The slot length must cover
+/// the longest reply plus any bus turnaround time.
+///
+/// A block may not contain another 0x50 or a 0x51 subframe.
 
 #include <cstdint>
 #include <variant>
@@ -137,6 +224,8 @@ struct Format {
   static constexpr int kMaxVaruintSize = 5;
   static constexpr int kMinVaruintSize = 1;
   static constexpr int kCrcSize = 2;
+  static constexpr uint8_t kBroadcastId = 0x7f;
+  static constexpr uint32_t kMaxPackedRegisters = 32;
 
   enum class Subframe : uint8_t {
     // # Register RPC #
@@ -169,9 +258,21 @@ struct Format {
     kWriteError = 0x28,
     kReadError = 0x29,
 
+    kDefinePreset = 0x2a,
+    kReadPreset = 0x2b,
+    kReplyPreset = 0x2c,
+    kReadPacked = 0x2d,
+    kReplyPacked = 0x2e,
+
     // # Tunneled Stream #
     kClientToServer = 0x40,
     kServerToClient = 0x41,
+    kClientToServerWindowed = 0x42,
+    kServerToClientWindowed = 0x43,
+
+    // # Group Addressing #
+    kGroupBlock = 0x50,
+    kReplySlot = 0x51,
   };
 
   using Register = uint32_t;
@@ -14,29 +14,67 @@
 
 #include "mjlib/multiplex/frame.h"
 
-#include <boost/crc.hpp>
+#include <cstring>
 
-#include "mjlib/base/crc_stream.h"
-#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/assert.h"
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/crc_ccitt.h"
 #include "mjlib/multiplex/format.h"
 #include "mjlib/multiplex/stream.h"
 
 namespace mjlib {
 namespace multiplex {
 
-std::string Frame::encode() const {
-  base::FastOStringStream stream;
-  base::CrcWriteStream<boost::crc_ccitt_type> crc_stream{stream};
-  WriteStream writer{crc_stream};
+namespace {
+/// Write the header, returning its size.
+size_t EncodeHeader(const FrameView& frame, char* output) {
+  base::BufferWriteStream stream{
+    base::string_span(output, FrameEnvelope::kMaxHeaderSize)};
+  WriteStream writer{stream};
 
   writer.Write<uint16_t>(Format::kHeader);
-  writer.Write<uint8_t>(source_id | (request_reply ? 0x80 : 0x00));
-  writer.Write<uint8_t>(dest_id);
-  writer.WriteVaruint(payload.size());
-  const uint16_t checksum = crc_stream.checksum();
-  writer.Write(checksum);
+  writer.Write<uint8_t>(frame.source_id | (frame.request_reply ? 0x80 : 0x00));
+  writer.Write<uint8_t>(frame.dest_id);
+  writer.WriteVaruint(frame.payload.size());
+
+  return stream.offset();
+}
+
+void EncodeCrc(const char* header, size_t header_size,
+               std::string_view payload, char* output) {
+  base::CrcCcitt crc;
+  crc.process_bytes(header, header_size);
+  crc.process_bytes(payload.data(), payload.size());
+  const uint16_t checksum = crc.checksum();
+  std::memcpy(output, &checksum, sizeof(checksum));
+}
+}
+
+size_t FrameView::encoded_size() const {
+  return 4 + GetVaruintSize(payload.size()) + payload.size() +
+      FrameEnvelope::kCrcSize;
+}
 
-  return std::string(stream.str());
+size_t FrameView::encode(const base::string_span& output) const {
+  MJ_ASSERT(output.size() >= static_cast<std::ptrdiff_t>(encoded_size()));
+
+  char* const ptr = output.data();
+  const size_t header_size = EncodeHeader(*this, ptr);
+  std::memcpy(&ptr[header_size], payload.data(), payload.size());
+  EncodeCrc(ptr, header_size, payload, &ptr[header_size + payload.size()]);
+
+  return header_size + payload.size() + FrameEnvelope::kCrcSize;
+}
+
+void FrameView::encode(FrameEnvelope* envelope) const {
+  envelope->header_size = EncodeHeader(*this, envelope->header);
+  EncodeCrc(envelope->header, envelope->header_size, payload, envelope->crc);
+}
+
+std::string Frame::encode() const {
+  std::string result(encoded_size(), '\0');
+  encode(base::string_span(&result[0], result.size()));
+  return result;
 }
 
 }
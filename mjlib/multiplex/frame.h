@@ -16,10 +16,58 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
+
+#include "mjlib/base/string_span.h"
 
 namespace mjlib {
 namespace multiplex {
 
+/// The portions of an encoded frame which surround the payload.
+/// Together with the payload itself, these can be handed to a
+/// scatter-gather write so that the payload never needs to be
+/// copied.
+struct FrameEnvelope {
+  // header (2), source (1), dest (1), and a varuint size (up to 5)
+  static constexpr size_t kMaxHeaderSize = 9;
+  static constexpr size_t kCrcSize = 2;
+
+  char header[kMaxHeaderSize] = {};
+  size_t header_size = 0;
+  char crc[kCrcSize] = {};
+};
+
+/// A multiplex frame whose payload refers to memory owned by someone
+/// else.
+struct FrameView {
+  FrameView() {}
+  FrameView(uint8_t source_id_in,
+            bool request_reply_in,
+            uint8_t dest_id_in,
+            std::string_view payload_in)
+      : source_id(source_id_in),
+        request_reply(request_reply_in),
+        dest_id(dest_id_in),
+        payload(payload_in) {}
+
+  /// @return the number of bytes required to encode this frame.
+  size_t encoded_size() const;
+
+  /// Encode the entire frame into @p output, which must be at least
+  /// encoded_size() bytes long.
+  ///
+  /// @return the number of bytes used
+  size_t encode(const base::string_span& output) const;
+
+  /// Encode everything but the payload into @p envelope.
+  void encode(FrameEnvelope* envelope) const;
+
+  uint8_t source_id = 0;
+  bool request_reply = false;
+  uint8_t dest_id = 0;
+  std::string_view payload;
+};
+
 struct Frame {
   Frame() {}
   Frame(uint8_t source_id_in,
@@ -31,8 +79,18 @@ struct Frame {
         dest_id(dest_id_in),
         payload(payload_in) {}
 
+  FrameView view() const {
+    return FrameView(source_id, request_reply, dest_id, payload);
+  }
+
   std::string encode() const;
 
+  size_t encoded_size() const { return view().encoded_size(); }
+  size_t encode(const base::string_span& output) const {
+    return view().encode(output);
+  }
+  void encode(FrameEnvelope* envelope) const { view().encode(envelope); }
+
   uint8_t source_id = 0;
   bool request_reply = false;
   uint8_t dest_id = 0;
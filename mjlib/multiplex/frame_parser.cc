@@ -0,0 +1,165 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/multiplex/frame_parser.h"
+
+#include <cstring>
+
+#include "mjlib/base/assert.h"
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/crc_ccitt.h"
+#include "mjlib/multiplex/format.h"
+#include "mjlib/multiplex/stream.h"
+
+namespace mjlib {
+namespace multiplex {
+
+namespace {
+constexpr uint8_t kHeader0 = Format::kHeader & 0xff;
+constexpr uint8_t kHeader1 = (Format::kHeader >> 8) & 0xff;
+
+// When less than this much space remains at the end of the buffer,
+// we move any partial frame back to the beginning.
+constexpr size_t kMinPrepareSize = 256;
+}
+
+FrameParser::FrameParser(size_t capacity)
+    : capacity_(capacity),
+      buffer_(new char[capacity]) {
+  MJ_ASSERT(capacity_ >= 2 * kMinPrepareSize);
+}
+
+FrameParser::~FrameParser() {}
+
+base::string_span FrameParser::prepare() {
+  if (start_ == end_) {
+    // The common case, everything has been consumed, so we can start
+    // back at the beginning for free.
+    start_ = end_ = 0;
+  } else if ((capacity_ - end_) < kMinPrepareSize && start_ != 0) {
+    std::memmove(&buffer_[0], &buffer_[start_], end_ - start_);
+    end_ -= start_;
+    start_ = 0;
+  }
+
+  if (end_ == capacity_) {
+    // We are full, and Parse() has not been able to make any sense of
+    // it.  The only thing to do is to throw it all away.
+    Discard(end_ - start_);
+    start_ = end_ = 0;
+  }
+
+  return base::string_span(&buffer_[end_], &buffer_[capacity_]);
+}
+
+void FrameParser::commit(size_t size) {
+  MJ_ASSERT(size <= (capacity_ - end_));
+  end_ += size;
+}
+
+void FrameParser::Discard(size_t size) {
+  if (size == 0) { return; }
+  stats_.discarded_bytes += size;
+  if (synchronized_) {
+    synchronized_ = false;
+    stats_.resyncs++;
+  }
+}
+
+std::optional<FrameView> FrameParser::Parse() {
+  while (true) {
+    const char* const start = &buffer_[start_];
+    const size_t available = end_ - start_;
+
+    const char* const found = static_cast<const char*>(
+        std::memchr(start, kHeader0, available));
+    if (found == nullptr) {
+      // Nothing here could be the start of a frame.
+      Discard(available);
+      start_ = end_;
+      return {};
+    }
+
+    Discard(found - start);
+    start_ += found - start;
+
+    const size_t remaining = end_ - start_;
+    if (remaining < 2) { return {}; }
+
+    if (static_cast<uint8_t>(found[1]) != kHeader1) {
+      // A false start.  Skip just the one byte, as the second may
+      // itself be the first byte of a real header.
+      Discard(1);
+      start_++;
+      continue;
+    }
+
+    if (remaining < (Format::kHeaderSize + Format::kMinVaruintSize +
+                     Format::kCrcSize)) {
+      return {};
+    }
+
+    base::BufferReadStream data({found + 2, remaining - 2});
+    ReadStream read_stream{data};
+
+    const auto maybe_source_id = read_stream.Read<uint8_t>();
+    const auto maybe_dest_id = read_stream.Read<uint8_t>();
+    const auto maybe_size = read_stream.ReadVaruint();
+    if (!maybe_size) {
+      // We don't have the whole size yet.
+      return {};
+    }
+
+    const size_t header_size = data.position() - found;
+    const size_t payload_size = *maybe_size;
+    if (payload_size > (capacity_ - header_size - Format::kCrcSize)) {
+      // This can never fit, so it must not really be a header.
+      Discard(1);
+      start_++;
+      continue;
+    }
+
+    const size_t total_size = header_size + payload_size + Format::kCrcSize;
+    if (remaining < total_size) { return {}; }
+
+    base::CrcCcitt crc;
+    crc.process_bytes(found, header_size + payload_size);
+
+    uint16_t actual_crc = 0;
+    std::memcpy(&actual_crc, &found[header_size + payload_size],
+                sizeof(actual_crc));
+
+    if (crc.checksum() != actual_crc) {
+      stats_.checksum_mismatch++;
+      Discard(1);
+      start_++;
+      continue;
+    }
+
+    FrameView result;
+    result.source_id = *maybe_source_id & 0x7f;
+    result.request_reply = (*maybe_source_id & 0x80) != 0;
+    result.dest_id = *maybe_dest_id;
+    result.payload = std::string_view(&found[header_size], payload_size);
+
+    start_ += total_size;
+    stats_.frames++;
+    synchronized_ = true;
+
+    return result;
+  }
+}
+
+}
+}
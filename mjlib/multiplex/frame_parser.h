@@ -0,0 +1,88 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "mjlib/base/string_span.h"
+#include "mjlib/multiplex/frame.h"
+
+namespace mjlib {
+namespace multiplex {
+
+/// Locates multiplex frames in a stream of bytes.
+///
+/// Received data is placed directly into a fixed size receive buffer
+/// owned by the parser, and complete frames are returned as views
+/// into that buffer.  No memory is allocated after construction.
+///
+/// The buffer is used as a ring, except that rather than wrapping
+/// mid-frame, whatever partial frame remains at the end is moved back
+/// to the beginning.  Thus every frame is contiguous, and the
+/// checksum can be computed in one pass.
+class FrameParser {
+ public:
+  /// @param capacity is the size of the receive buffer.  Frames whose
+  /// encoded size exceeds this are discarded as corrupt.
+  FrameParser(size_t capacity = 8192);
+  ~FrameParser();
+
+  /// @return a non-empty region into which new data may be placed.
+  /// This may invalidate any previously returned FrameView.
+  base::string_span prepare();
+
+  /// Mark @p size bytes of the most recently prepared region as
+  /// valid.
+  void commit(size_t size);
+
+  /// Search for the next complete frame, discarding any data which
+  /// cannot be part of one.
+  ///
+  /// @return the frame, which remains valid until the next call to
+  /// prepare(), or an empty optional if more data is required.
+  std::optional<FrameView> Parse();
+
+  /// @return the number of bytes which are buffered but not yet
+  /// parsed.
+  size_t size() const { return end_ - start_; }
+
+  struct Stats {
+    uint64_t frames = 0;
+    uint64_t checksum_mismatch = 0;
+    uint64_t discarded_bytes = 0;
+
+    /// The number of times data was discarded after the previous
+    /// byte had completed a valid frame.
+    uint64_t resyncs = 0;
+  };
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  void Discard(size_t size);
+
+  const size_t capacity_;
+  std::unique_ptr<char[]> buffer_;
+  size_t start_ = 0;
+  size_t end_ = 0;
+
+  Stats stats_;
+  bool synchronized_ = true;
+};
+
+}
+}
@@ -14,36 +14,35 @@
 
 #include "mjlib/multiplex/frame_stream.h"
 
+#include <array>
 #include <functional>
 
 #include <boost/asio/write.hpp>
-#include <boost/crc.hpp>
 
-#include "mjlib/base/crc_stream.h"
 #include "mjlib/base/fail.h"
 #include "mjlib/io/deadline_timer.h"
-#include "mjlib/io/streambuf_read_stream.h"
-#include "mjlib/multiplex/format.h"
-#include "mjlib/multiplex/stream.h"
 
 namespace pl = std::placeholders;
 
 namespace mjlib {
 namespace multiplex {
 
-namespace {
-constexpr size_t kBlockSize = 4096;
-}
-
 class FrameStream::Impl {
  public:
   Impl(io::AsyncStream* stream) : stream_(stream) {}
 
-  void AsyncWrite(const Frame* frame, io::ErrorCallback callback) {
-    write_buffer_ = frame->encode();
+  void AsyncWrite(const FrameView& frame, io::ErrorCallback callback) {
+    // Only the header and checksum are encoded here.  The payload is
+    // written directly from wherever the caller keeps it.
+    frame.encode(&write_envelope_);
+    const std::array<boost::asio::const_buffer, 3> buffers = {{
+        boost::asio::buffer(write_envelope_.header,
+                            write_envelope_.header_size),
+        boost::asio::buffer(frame.payload.data(), frame.payload.size()),
+        boost::asio::buffer(write_envelope_.crc),
+      }};
     boost::asio::async_write(
-        *stream_,
-        boost::asio::buffer(write_buffer_),
+        *stream_, buffers,
         [callback](auto&& ec, auto&&) { callback(ec); });
   }
 
@@ -51,9 +50,25 @@ class FrameStream::Impl {
                  boost::posix_time::time_duration timeout,
                  io::ErrorCallback callback) {
     BOOST_ASSERT(current_frame_ == nullptr);
+    current_frame_ = frame;
+    StartRead(timeout, callback);
+  }
+
+  void AsyncRead(FrameView* frame,
+                 boost::posix_time::time_duration timeout,
+                 io::ErrorCallback callback) {
+    BOOST_ASSERT(current_view_ == nullptr);
+    current_view_ = frame;
+    StartRead(timeout, callback);
+  }
+
+  const FrameParser::Stats& stats() const { return parser_.stats(); }
+
+ private:
+  void StartRead(boost::posix_time::time_duration timeout,
+                 io::ErrorCallback callback) {
     BOOST_ASSERT(!current_callback_);
 
-    current_frame_ = frame;
     current_callback_ = callback;
 
     if (timeout == boost::posix_time::time_duration()) {
@@ -66,7 +81,6 @@ class FrameStream::Impl {
     MaybeStartRead();
   }
 
- private:
   void MaybeStartRead() {
     if (read_outstanding_) { return; }
     if (!current_callback_) { return; }
@@ -79,17 +93,30 @@ class FrameStream::Impl {
     if (!current_callback_) { return; }
 
     read_outstanding_ = true;
+    const auto buffer = parser_.prepare();
     stream_->async_read_some(
-        streambuf_.prepare(kBlockSize),
+        boost::asio::buffer(buffer.data(), buffer.size()),
         std::bind(&Impl::HandleRead, this, pl::_1, pl::_2));
   }
 
   void HandleRead(const base::error_code& ec, size_t size) {
-    base::FailIf(ec);
-
-    streambuf_.commit(size);
+    parser_.commit(size);
     read_outstanding_ = false;
 
+    if (ec) {
+      // The stream has failed, so whoever is waiting on a frame gets
+      // the error rather than a timeout.
+      if (current_callback_) {
+        timer_.cancel();
+        current_frame_ = nullptr;
+        current_view_ = nullptr;
+        auto copy = *current_callback_;
+        current_callback_ = {};
+        copy(ec);
+      }
+      return;
+    }
+
     if (current_callback_) {
       ParseFrame();
     }
@@ -98,77 +125,32 @@ class FrameStream::Impl {
   }
 
   void ParseFrame() {
-    BOOST_ASSERT(current_frame_);
-
-    while (true) {
-      // Try to find a complete frame in our input buffer, discarding
-      // anything that doesn't look like a frame.
-      DiscardUntil(Format::kHeader & 0xff);
-
-      io::StreambufReadStream stream{&streambuf_};
-      base::CrcReadStream<boost::crc_ccitt_type> crc_stream{stream};
-      ReadStream reader{crc_stream};
-
-      auto maybe_header = reader.Read<uint16_t>();
-      if (!maybe_header) { return; }
-      if (*maybe_header != Format::kHeader) {
-        // Discard two bytes and try again.
-        streambuf_.consume(2);
-        continue;
-      }
+    BOOST_ASSERT(current_frame_ || current_view_);
 
-      auto maybe_source_id = reader.Read<uint8_t>();
-      if (!maybe_source_id) { return; }
-      current_frame_->source_id = *maybe_source_id & 0x7f;
-      current_frame_->request_reply = (*maybe_source_id & 0x80) != 0;
+    const auto maybe_frame = parser_.Parse();
+    if (!maybe_frame) { return; }
 
-      auto maybe_dest_id = reader.Read<uint8_t>();
-      if (!maybe_dest_id) { return; }
-      current_frame_->dest_id = *maybe_dest_id;
-
-      auto maybe_payload_size = reader.ReadVaruint();
-      if (!maybe_payload_size) { return; }
-
-      if (stream.remaining() < (*maybe_payload_size + 2)) {
-        return;
-      }
-
-      current_frame_->payload.resize(*maybe_payload_size);
-      crc_stream.read(base::string_span(&current_frame_->payload[0],
-                                        *maybe_payload_size));
-
-      const auto calculated_checksum = crc_stream.checksum();
-      const auto read_checksum = reader.Read<uint16_t>();
-
-      // We have enough data. Lets see if the checksum matches.
-      if (calculated_checksum != read_checksum) {
-        // Nope.  Skip this header and try again.
-        streambuf_.consume(2);
-        continue;
-
-        // Maybe we should instead report this as an error?
-      }
+    // Woot!  We have a full functioning frame.  Let's report that.
+    const auto& frame = *maybe_frame;
+    if (current_view_) {
+      *current_view_ = frame;
+    } else {
+      current_frame_->source_id = frame.source_id;
+      current_frame_->request_reply = frame.request_reply;
+      current_frame_->dest_id = frame.dest_id;
+      current_frame_->payload.assign(
+          frame.payload.data(), frame.payload.size());
+    }
 
-      // Woot!  We have a full functioning frame.  Let's report that.
-      current_frame_ = nullptr;
-      auto copy = *current_callback_;
-      current_callback_ = {};
+    timer_.cancel();
 
-      stream_->get_io_service().post(
-          std::bind(copy, base::error_code()));
+    current_frame_ = nullptr;
+    current_view_ = nullptr;
+    auto copy = *current_callback_;
+    current_callback_ = {};
 
-      return;
-    }
-  }
-
-  void DiscardUntil(uint8_t value) {
-    auto buffers = streambuf_.data();
-    const auto begin = iterator::begin(buffers);
-    const auto end = iterator::end(buffers);
-    const auto it = std::find_if(
-        begin, end, [&](char c) { return static_cast<uint8_t>(c) == value; });
-    const auto to_discard = it - begin;
-    streambuf_.consume(to_discard);
+    stream_->get_io_service().post(
+        std::bind(copy, base::error_code()));
   }
 
   void HandleTimer(const base::error_code& ec) {
@@ -180,8 +162,9 @@ class FrameStream::Impl {
     base::FailIf(ec);
 
     if (current_callback_) {
-      BOOST_ASSERT(current_frame_);
+      BOOST_ASSERT(current_frame_ || current_view_);
       current_frame_ = nullptr;
+      current_view_ = nullptr;
       auto copy = *current_callback_;
       current_callback_ = {};
       copy(boost::asio::error::operation_aborted);
@@ -189,16 +172,15 @@ class FrameStream::Impl {
   }
 
   io::AsyncStream* const stream_;
-  std::string write_buffer_;
+  FrameEnvelope write_envelope_;
 
   bool read_outstanding_ = false;
-  boost::asio::streambuf streambuf_;
-  using const_buffers_type = boost::asio::streambuf::const_buffers_type;
-  using iterator = boost::asio::buffers_iterator<const_buffers_type>;
+  FrameParser parser_;
 
   io::DeadlineTimer timer_{stream_->get_io_service()};
 
   Frame* current_frame_ = nullptr;
+  FrameView* current_view_ = nullptr;
   std::optional<io::ErrorCallback> current_callback_;
 };
 
@@ -207,7 +189,12 @@ FrameStream::FrameStream(io::AsyncStream* stream)
 FrameStream::~FrameStream() {}
 
 void FrameStream::AsyncWrite(const Frame* frame, io::ErrorCallback callback) {
-  impl_->AsyncWrite(frame, callback);
+  impl_->AsyncWrite(frame->view(), callback);
+}
+
+void FrameStream::AsyncWrite(const FrameView* frame,
+                             io::ErrorCallback callback) {
+  impl_->AsyncWrite(*frame, callback);
 }
 
 void FrameStream::AsyncRead(Frame* frame,
@@ -216,5 +203,15 @@ void FrameStream::AsyncRead(Frame* frame,
   impl_->AsyncRead(frame, timeout, callback);
 }
 
+void FrameStream::AsyncRead(FrameView* frame,
+                            boost::posix_time::time_duration timeout,
+                            io::ErrorCallback callback) {
+  impl_->AsyncRead(frame, timeout, callback);
+}
+
+const FrameParser::Stats& FrameStream::stats() const {
+  return impl_->stats();
+}
+
 }
 }
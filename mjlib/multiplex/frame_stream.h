@@ -19,6 +19,7 @@
 #include "mjlib/io/async_stream.h"
 #include "mjlib/io/async_types.h"
 #include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/frame_parser.h"
 
 namespace mjlib {
 namespace multiplex {
@@ -30,14 +31,27 @@ class FrameStream {
   FrameStream(io::AsyncStream*);
   ~FrameStream();
 
+  /// Write a frame.  The frame, including its payload, must remain
+  /// valid until @p callback is invoked.
   void AsyncWrite(const Frame*, io::ErrorCallback);
+  void AsyncWrite(const FrameView*, io::ErrorCallback);
 
   /// If @p timeout is not-special, @p callback will be invoked with
   /// boost::asio::error::operation_aborted after that much time has
-  /// elapsed.
+  /// elapsed.  An error from the underlying stream is passed to
+  /// @p callback.
   void AsyncRead(Frame*, boost::posix_time::time_duration timeout,
                  io::ErrorCallback callback);
 
+  /// Identical to the above, except that no copy of the payload is
+  /// made.  The FrameView refers to the internal receive buffer and
+  /// remains valid until the next call to AsyncRead.
+  void AsyncRead(FrameView*, boost::posix_time::time_duration timeout,
+                 io::ErrorCallback callback);
+
+  /// @return statistics about the received data.
+  const FrameParser::Stats& stats() const;
+
  private:
   class Impl;
   std::unique_ptr<Impl> impl_;
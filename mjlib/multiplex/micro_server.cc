@@ -14,14 +14,17 @@
 
 #include "mjlib/multiplex/micro_server.h"
 
+#include <algorithm>
 #include <functional>
-
-#include <boost/crc.hpp>
+#include <new>
 
 #include "mjlib/base/assert.h"
 #include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/crc_ccitt.h"
 #include "mjlib/base/visitor.h"
 
+#include "mjlib/micro/ring_buffer.h"
+
 #include "mjlib/multiplex/stream.h"
 
 namespace mjlib {
@@ -51,7 +54,8 @@ class MicroServer::Impl {
 
   class TunnelStream : public micro::AsyncStream {
    public:
-    void set_parent(Impl* impl) { parent_ = impl; }
+    TunnelStream(char* data, size_t size) : read_data_(data, size) {}
+
     uint32_t id() const { return id_; }
     void set_id(uint32_t id) { id_ = id; }
 
@@ -79,15 +83,11 @@ class MicroServer::Impl {
 
     void DoReadTransfer() {
       if (read_buffer_.empty() ||
-          read_data_size_ == 0) {
+          read_data_.empty()) {
         return;
       }
 
-      const auto to_copy = std::min<std::streamsize>(
-          read_buffer_.size(), read_data_size_);
-      std::memcpy(read_buffer_.data(), read_data_, to_copy);
-      std::memmove(read_data_, &read_data_[to_copy], read_data_size_ - to_copy);
-      read_data_size_ -= to_copy;
+      const auto to_copy = read_data_.Read(read_buffer_);
 
       read_buffer_ = {};
 
@@ -97,14 +97,12 @@ class MicroServer::Impl {
       callback({}, to_copy);
     }
 
-    Impl* parent_ = nullptr;
     uint32_t id_ = 0;
 
     base::string_span read_buffer_;
     micro::SizeCallback read_callback_;
 
-    char read_data_[128] = {};
-    ssize_t read_data_size_ = 0;
+    micro::RingBuffer read_data_;
 
     std::string_view write_buffer_;
     micro::SizeCallback write_callback_;
@@ -116,18 +114,54 @@ class MicroServer::Impl {
       : options_(options),
         stream_(stream),
         read_buffer_(static_cast<char*>(
-                         pool->Allocate(options.buffer_size, 1))),
+                         pool->Allocate(options.buffer_size, 1)),
+                     options.buffer_size),
         write_buffer_(static_cast<char*>(
-                          pool->Allocate(options.buffer_size, 1))) {
-    config_.id = options.default_id;
-    for (auto& tunnel : tunnels_) {
-      tunnel.set_parent(this);
+                          pool->Allocate(options.buffer_size, 1))),
+        presets_(static_cast<Preset*>(
+                     pool->Allocate(sizeof(Preset) * options.max_presets,
+                                    alignof(Preset)))),
+        preset_entries_(static_cast<PresetEntry*>(
+                            pool->Allocate(sizeof(PresetEntry) *
+                                           options.max_presets *
+                                           options.max_preset_size,
+                                           alignof(PresetEntry)))),
+        packed_entries_(static_cast<PresetEntry*>(
+                            pool->Allocate(sizeof(PresetEntry) *
+                                           Format::kMaxPackedRegisters,
+                                           alignof(PresetEntry)))),
+        packed_results_(static_cast<ReadResult*>(
+                            pool->Allocate(sizeof(ReadResult) *
+                                           std::max<size_t>(
+                                               options.max_preset_size,
+                                               Format::kMaxPackedRegisters),
+                                           alignof(ReadResult)))),
+        tunnels_(static_cast<TunnelStream*>(
+                     pool->Allocate(sizeof(TunnelStream) *
+                                    options.max_tunnel_streams,
+                                    alignof(TunnelStream)))) {
+    for (int i = 0; i < options.max_presets; i++) {
+      presets_[i].entries = &preset_entries_[i * options.max_preset_size];
+      presets_[i].size = 0;
+    }
+    for (size_t i = 0; i < std::max<size_t>(options.max_preset_size,
+                                            Format::kMaxPackedRegisters);
+         i++) {
+      new (&packed_results_[i]) ReadResult();
+    }
+    for (int i = 0; i < options.max_tunnel_streams; i++) {
+      new (&tunnels_[i]) TunnelStream(
+          static_cast<char*>(pool->Allocate(options.tunnel_buffer_size, 1)),
+          options.tunnel_buffer_size);
     }
+    config_.id = options.default_id;
   }
 
   micro::AsyncStream* MakeTunnel(uint32_t id) {
     MJ_ASSERT(id != 0);
-    for (auto& tunnel : tunnels_) {
+    MJ_ASSERT(FindTunnel(id) == nullptr);
+    for (int i = 0; i < options_.max_tunnel_streams; i++) {
+      auto& tunnel = tunnels_[i];
       if (tunnel.id() == 0) {
         // This one is unallocated.
         tunnel.set_id(id);
@@ -161,13 +195,37 @@ class MicroServer::Impl {
   Config* config() { return &config_; }
 
  private:
+  struct PresetEntry {
+    Register reg = 0;
+    uint8_t type = 0;
+  };
+
+  struct Preset {
+    PresetEntry* entries = nullptr;
+    size_t size = 0;
+  };
+
   void MaybeStartReadFrame() {
     if (read_outstanding_) { return; }
 
+    if (read_buffer_.full()) {
+      // We are full and nothing in here was a frame.  Start over.
+      ResetRead();
+    }
+
+    // If only a scrap of a frame is left at the end of the ring, the
+    // next read would land in front of it and the frame would
+    // straddle the end.  Moving the scrap now is cheaper than
+    // linearizing the whole thing later.
+    if (read_buffer_.size() < read_buffer_.available() / 4 &&
+        read_buffer_.space().data() < read_buffer_.data().data()) {
+      read_buffer_.MoveToFront();
+    }
+
+    // New data goes directly into the next free piece of the ring.
     read_outstanding_ = true;
     stream_->AsyncReadSome(
-        base::string_span(&read_buffer_[read_start_],
-                          read_buffer_ + options_.buffer_size),
+        read_buffer_.space(),
         std::bind(&Impl::HandleReadFrame, this,
                   std::placeholders::_1, std::placeholders::_2));
   }
@@ -178,13 +236,12 @@ class MicroServer::Impl {
     if (ec) {
       // We don't really have a way to log or do anything here.  So
       // lets just bail and start over.
-      read_start_ = 0;
+      ResetRead();
       MaybeStartReadFrame();
       return;
     }
 
-    // Advance read_start_ to where our next invalid byte is.
-    read_start_ += size;
+    read_buffer_.commit(size);
 
     for (;;) {
       if (!HandleMaybeFrame()) {
@@ -202,24 +259,32 @@ class MicroServer::Impl {
     // calling StartReadFrame until we get there.
 
     // Work to start our buffer out with the frame header.
+    if (read_buffer_.empty()) { return false; }
 
-    char* const found = static_cast<char*>(
-        std::memchr(read_buffer_, (kHeader & 0xff), read_start_));
+    const auto before_header = read_buffer_.data();
+    const char* const found = static_cast<const char*>(
+        std::memchr(before_header.data(), (kHeader & 0xff),
+                    before_header.size()));
     if (found == nullptr) {
-      // We don't have anything which could be a header in our
-      // buffer.  Just wipe it all out and start over.
-      read_start_ = 0;
-      return false;
+      // We don't have anything which could be a header in this piece
+      // of the buffer.  Wipe it out and look at whatever follows.
+      Consume(before_header.size());
+      return !read_buffer_.empty();
     }
 
-    Consume(found - read_buffer_);
+    Consume(found - before_header.data());
+
+    // Parse in place from the first contiguous piece of the ring.
+    const char* const frame = found;
+    const std::streamsize available =
+        before_header.data() + before_header.size() - found;
 
-    if (read_start_ < 2) {
+    if (available < 2) {
       // We need more to even have a header.
-      return false;
+      return NeedMore();
     }
 
-    if (static_cast<uint8_t>(read_buffer_[1]) != ((kHeader >> 8) & 0xff)) {
+    if (static_cast<uint8_t>(frame[1]) != ((kHeader >> 8) & 0xff)) {
       // We had the first byte of a header, but not the second byte.
 
       // Move out this false start and try again.
@@ -228,13 +293,13 @@ class MicroServer::Impl {
     }
 
     // We need at least 7 bytes to have a minimal frame.
-    if (read_start_ < (kHeaderSize + kCrcSize + kMinVaruintSize)) {
-      return false;
+    if (available < (kHeaderSize + kCrcSize + kMinVaruintSize)) {
+      return NeedMore();
     }
 
     // See if we have enough data to have a valid varuint for size.
-    base::BufferReadStream data({&read_buffer_[2],
-            static_cast<size_t>(read_start_ - 2)});
+    base::BufferReadStream data({&frame[2],
+            static_cast<size_t>(available - 2)});
     ReadStream read_stream{data};
 
     const auto maybe_source_id = read_stream.Read<uint8_t>();
@@ -243,40 +308,42 @@ class MicroServer::Impl {
 
     if (!maybe_size) {
       // We don't have enough for the size yet.
-      return false;
+      return NeedMore();
     }
 
     const auto payload_size = *maybe_size;
     if (payload_size > 4096) {
       // We'll claim this is guaranteed to be too big.  Just wipe
       // everything out and start over.
-      read_start_ = 0;
+      ResetRead();
       return false;
     }
 
     if (payload_size > (options_.buffer_size - 7))  {
       // We can't fit this either.
-      read_start_ = 0;
+      ResetRead();
       return false;
     }
 
-    // Do we have enough data yet?
     const char* const payload_start = data.position();
-    const auto data_we_have =
-        &read_buffer_[read_start_] - data.position();
+    const char* const crc_location = payload_start + payload_size;
+
+    // Advance our running checksum over whatever has arrived since we
+    // last looked, so that the cost of validation is spread out over
+    // reception instead of all landing after the final byte.
+    UpdateCrc(frame, std::min<std::streamsize>(
+                  available, crc_location - frame));
+
+    // Do we have enough data yet?
+    const auto data_we_have = frame + available - payload_start;
     if (data_we_have < static_cast<ssize_t>(payload_size + 2)) {
       // We need more still.
-      return false;
+      return NeedMore();
     }
 
-    const char* const crc_location =
-        data.position() + payload_size;
-
     // Woohoo.  We nominally have enough for a whole frame.  Verify
     // the checksum!
-    boost::crc_ccitt_type crc;
-    crc.process_bytes(read_buffer_, crc_location - read_buffer_);
-    const uint16_t expected_crc = crc.checksum();
+    const uint16_t expected_crc = crc_.checksum();
 
     data.ignore(payload_size);
     const auto maybe_actual_crc = read_stream.Read<uint16_t>();
@@ -285,19 +352,24 @@ class MicroServer::Impl {
 
     if (expected_crc != actual_crc) {
       // Whoops, we should log this checksum mismatch somewhere.
-      // Assume that we are no longer synchronized and start from the
-      // next header possibility.
+      // Skip the whole of the rejected frame, rather than looking for
+      // another header inside it.  Otherwise, a payload full of
+      // header bytes would have its checksum computed once for each
+      // of them.  A real frame which began inside of this one is
+      // lost, and left for the client to retry.
       stats_.checksum_mismatch++;
-      Consume(2);
+      Consume(data.position() - frame);
       return true;
     }
 
-    if (*maybe_dest_id != config_.id) {
+    const bool broadcast = *maybe_dest_id == kBroadcastId;
+
+    if (!broadcast && *maybe_dest_id != config_.id) {
       stats_.wrong_id++;
-      const auto total_size = data.position() - read_buffer_;
+      const auto total_size = data.position() - frame;
 
       if (!unknown_buffer_.empty()) {
-        std::memcpy(unknown_buffer_.data(), read_buffer_, total_size);
+        std::memcpy(unknown_buffer_.data(), frame, total_size);
         auto callback = unknown_callback_;
 
         unknown_buffer_ = {};
@@ -315,29 +387,75 @@ class MicroServer::Impl {
       base::string_span(write_buffer_, options_.buffer_size)};
     WriteStream write_stream{buffer_write_stream};
     const bool need_response =
+        !broadcast &&
         ((*maybe_source_id) & 0x80) != 0 &&
         !write_outstanding_;
 
+    // In a broadcast frame, only our own group block may write to the
+    // response, and only if it asks for a reply.
+    group_ = {};
+    group_.response =
+        (broadcast && !write_outstanding_) ? &write_stream : nullptr;
+
     // Everything checked out.  Now we we can process our subframes.
+    server_->StartFrame();
     ProcessSubframes(
         std::string_view(payload_start, payload_size),
         &buffer_write_stream,
         need_response ? &write_stream : nullptr);
-    const auto to_consume = crc_location - read_buffer_ + 2;
+    server_->FinishFrame();
+    const auto to_consume = crc_location - frame + 2;
     Consume(to_consume);
 
+    group_.response = nullptr;
+
     if (need_response) {
       WriteResponse(*maybe_source_id & 0x7f, buffer_write_stream.offset());
+    } else if (group_.reply_slot != 0) {
+      StartGroupResponse(*maybe_source_id & 0x7f,
+                         buffer_write_stream.offset());
+    }
+
+    return true;
+  }
+
+  // Called when the frame at the head of the ring is incomplete.
+  //
+  // @return true if it should be parsed again.
+  bool NeedMore() {
+    if (read_buffer_.data().size() == read_buffer_.size()) {
+      // Everything we have is already contiguous, so we really do
+      // need to wait for more data.
+      return false;
     }
 
+    // This frame straddles the end of the ring, and has to be made
+    // contiguous before it can be parsed in place.  That happens at
+    // most once per trip around the buffer.
+    read_buffer_.Linearize();
     return true;
   }
 
   void Consume(std::streamsize size) {
-    MJ_ASSERT(read_start_ >= size);
     if (size == 0) { return; }
-    std::memmove(read_buffer_, &read_buffer_[size], read_start_ - size);
-    read_start_ -= size;
+
+    read_buffer_.consume(size);
+
+    // Any checksum we had was for a frame starting at the old head.
+    crc_.reset();
+    crc_size_ = 0;
+  }
+
+  void ResetRead() {
+    read_buffer_.clear();
+    crc_.reset();
+    crc_size_ = 0;
+  }
+
+  void UpdateCrc(const char* frame, std::streamsize size) {
+    if (size <= crc_size_) { return; }
+    crc_.process_bytes(&frame[crc_size_], size - crc_size_);
+    crc_size_ = size;
   }
 
   void WriteResponse(uint8_t client_id, std::streamsize response_size) {
@@ -363,7 +481,7 @@ class MicroServer::Impl {
 
     // Now figure out the checksum.
     const auto crc_location = header_size + response_size;
-    boost::crc_ccitt_type crc;
+    base::CrcCcitt crc;
     crc.process_bytes(write_buffer_, crc_location);
     const uint16_t actual_crc = crc.checksum();
 
@@ -379,6 +497,24 @@ class MicroServer::Impl {
                std::bind(&Impl::HandleWrite, this, std::placeholders::_1));
   }
 
+  void StartGroupResponse(uint8_t client_id, std::streamsize response_size) {
+    const uint32_t delay_us = (group_.reply_slot - 1) * group_.slot_us;
+    if (delay_us == 0 || !options_.reply_delay.valid()) {
+      WriteResponse(client_id, response_size);
+      return;
+    }
+
+    // The response stays in write_buffer_ until our slot comes up, so
+    // nothing else may be written in the meantime.
+    write_outstanding_ = true;
+    delayed_client_id_ = client_id;
+    delayed_size_ = response_size;
+    options_.reply_delay(delay_us, [this]() {
+        write_outstanding_ = false;
+        WriteResponse(delayed_client_id_, delayed_size_);
+      });
+  }
+
   void HandleWrite(micro::error_code ec) {
     if (ec) {
       stats_.write_error++;
@@ -400,7 +536,8 @@ class MicroServer::Impl {
 
   void ProcessSubframes(const std::string_view& subframes,
                         base::BufferWriteStream* response_buffer_stream,
-                        WriteStream* response_stream) {
+                        WriteStream* response_stream,
+                        bool in_group_block = false) {
     base::BufferReadStream buffer_stream(subframes);
     ReadStream str(buffer_stream);
 
@@ -430,9 +567,11 @@ class MicroServer::Impl {
 
       const auto subframe_type = *maybe_subframe_type;
 
-      if (subframe_type == u8(Subframe::kClientToServer)) {
+      if (subframe_type == u8(Subframe::kClientToServer) ||
+          subframe_type == u8(Subframe::kClientToServerWindowed)) {
         // The client sent us some data.
         if (ProcessSubframeClientToServer(
+                subframe_type == u8(Subframe::kClientToServerWindowed),
                 buffer_stream, str,
                 response_buffer_stream,
                 response_stream)) {
@@ -442,6 +581,60 @@ class MicroServer::Impl {
         continue;
       }
 
+      if (subframe_type == u8(Subframe::kDefinePreset)) {
+        if (ProcessSubframeDefinePreset(str)) {
+          stats_.malformed_subframe++;
+          return;
+        }
+        continue;
+      }
+
+      if (subframe_type == u8(Subframe::kReadPreset)) {
+        if (ProcessSubframeReadPreset(
+                str, response_buffer_stream, response_stream)) {
+          stats_.malformed_subframe++;
+          return;
+        }
+        continue;
+      }
+
+      if (subframe_type == u8(Subframe::kReadPacked)) {
+        if (ProcessSubframeReadPacked(
+                str, response_buffer_stream, response_stream)) {
+          stats_.malformed_subframe++;
+          return;
+        }
+        continue;
+      }
+
+      if (in_group_block &&
+          (subframe_type == u8(Subframe::kGroupBlock) ||
+           subframe_type == u8(Subframe::kReplySlot))) {
+        // Blocks don't nest, and the slot length applies to the
+        // whole frame.
+        stats_.malformed_subframe++;
+        return;
+      }
+
+      if (subframe_type == u8(Subframe::kGroupBlock)) {
+        if (ProcessSubframeGroupBlock(
+                buffer_stream, str, response_buffer_stream)) {
+          stats_.malformed_subframe++;
+          return;
+        }
+        continue;
+      }
+
+      if (subframe_type == u8(Subframe::kReplySlot)) {
+        const auto maybe_slot_us = str.ReadVaruint();
+        if (!maybe_slot_us) {
+          stats_.malformed_subframe++;
+          return;
+        }
+        group_.slot_us = *maybe_slot_us;
+        continue;
+      }
+
       bool register_handler_found = false;
       for (const auto& handler : register_handlers) {
         if ((subframe_type & ~0x03) == handler.base_register) {
@@ -464,15 +657,50 @@ class MicroServer::Impl {
     }
   }
 
+  // @return true if malformed
+  bool ProcessSubframeGroupBlock(
+      base::BufferReadStream& buffer_stream,
+      ReadStream& str,
+      base::BufferWriteStream* response_buffer_stream) {
+    const auto maybe_id = str.ReadVaruint();
+    const auto maybe_slot = str.ReadVaruint();
+    const auto maybe_bytes = str.ReadVaruint();
+    if (!maybe_id || !maybe_slot || !maybe_bytes ||
+        buffer_stream.remaining() < static_cast<std::streamsize>(*maybe_bytes)) {
+      return true;
+    }
+
+    const std::string_view block(buffer_stream.position(), *maybe_bytes);
+    buffer_stream.ignore(*maybe_bytes);
+
+    if (*maybe_id != config_.id) { return false; }
+
+    // The response stream is handed out at most once per frame, to
+    // the first of our blocks which asks for a reply.
+    WriteStream* response = nullptr;
+    if (*maybe_slot != 0 && group_.response) {
+      response = group_.response;
+      group_.response = nullptr;
+      group_.reply_slot = *maybe_slot;
+    }
+
+    ProcessSubframes(block, response_buffer_stream, response, true);
+
+    return false;
+  }
+
   // @return true if malformed
   bool ProcessSubframeClientToServer(
+      bool windowed,
       base::BufferReadStream& buffer_stream,
       ReadStream& str,
       base::BufferWriteStream* response_buffer_stream,
       WriteStream* response_stream) {
     const auto maybe_channel = str.ReadVaruint();
+    const auto maybe_window =
+        windowed ? str.ReadVaruint() : std::optional<uint32_t>(0);
     const auto maybe_bytes = str.ReadVaruint();
-    if (!maybe_channel || !maybe_bytes ||
+    if (!maybe_channel || !maybe_window || !maybe_bytes ||
         buffer_stream.remaining() < static_cast<std::streamsize>(*maybe_bytes)) {
       // Malformed.
       return true;
@@ -485,30 +713,63 @@ class MicroServer::Impl {
 
     auto& tunnel = *maybe_tunnel;
 
-    const auto remaining_space =
-        sizeof(tunnel.read_data_) - tunnel.read_data_size_;
-
-    if (*maybe_bytes > remaining_space) {
+    if (*maybe_bytes > tunnel.read_data_.available()) {
+      // A windowed client never sends more than we last said we had
+      // room for, so this only happens to those which aren't.
       stats_.receive_overrun++;
+      buffer_stream.ignore(*maybe_bytes);
     } else {
-      str.base()->read({&tunnel.read_data_[tunnel.read_data_size_],
-              static_cast<ssize_t>(*maybe_bytes)});
-      tunnel.read_data_size_ += *maybe_bytes;
+      // This may wrap around the end of the ring, in which case it
+      // arrives in two pieces.
+      std::streamsize remaining = *maybe_bytes;
+      while (remaining > 0) {
+        const auto space = tunnel.read_data_.space();
+        const auto to_read = std::min<std::streamsize>(
+            space.size(), remaining);
+        str.base()->read({space.data(), to_read});
+        tunnel.read_data_.commit(to_read);
+        remaining -= to_read;
+      }
     }
 
     tunnel.DoReadTransfer();
 
     // Send our response if necessary.
     if (response_stream) {
-      response_stream->WriteVaruint(static_cast<uint8_t>(Subframe::kServerToClient));
+      const auto reply_type = static_cast<uint8_t>(
+          windowed ?
+          Subframe::kServerToClientWindowed :
+          Subframe::kServerToClient);
+      const auto available = tunnel.read_data_.available();
+
+      // Earlier subframes may have used up most of the response, so
+      // work out what room is left before writing anything.
+      const ssize_t kExtraPadding = 16;
+      const std::streamsize header_size =
+          GetVaruintSize(reply_type) +
+          GetVaruintSize(*maybe_channel) +
+          (windowed ? GetVaruintSize(available) : 0) +
+          kMaxVaruintSize;
+      const std::streamsize room =
+          response_buffer_stream->remaining() -
+          (header_size + kCrcSize + kExtraPadding);
+      if (room < 0) {
+        // There isn't even space to report our credit.  The client
+        // will poll again.
+        return false;
+      }
+
+      response_stream->WriteVaruint(reply_type);
       response_stream->WriteVaruint(*maybe_channel);
+      if (windowed) {
+        response_stream->WriteVaruint(available);
+      }
 
-      const ssize_t kExtraPadding = 16;
-      const auto to_copy =
-          std::min<std::streamsize>(
-              tunnel.write_buffer_.size(),
-              response_buffer_stream->remaining() -
-              (kMaxVaruintSize + kCrcSize + kExtraPadding));
+      auto to_copy =
+          std::min<std::streamsize>(tunnel.write_buffer_.size(), room);
+      if (windowed) {
+        to_copy = std::min<std::streamsize>(to_copy, *maybe_window);
+      }
       response_stream->WriteVaruint(to_copy);
       if (to_copy > 0) {
         response_stream->base()->write(tunnel.write_buffer_.substr(0, to_copy));
@@ -569,17 +830,36 @@ class MicroServer::Impl {
     const auto num_registers = str.ReadVaruint();
     if (!num_registers) { return true; }
 
-    auto current_register = *start_register;
+    // Values are decoded and handed to the server a block at a time,
+    // so that it can service a contiguous range in one pass.
+    Value values[kMaxBlockSize] = {};
+    uint32_t errors[kMaxBlockSize] = {};
 
-    for (size_t i = 0; i < *num_registers; i++) {
-      const auto maybe_value = ReadValue(type, str);
-      if (!maybe_value) { return true; }
+    auto current_register = *start_register;
+    size_t remaining = *num_registers;
+
+    while (remaining) {
+      const size_t block_size = std::min(remaining, kMaxBlockSize);
+      size_t decoded = 0;
+      for (; decoded < block_size; decoded++) {
+        const auto maybe_value = ReadValue(type, str);
+        if (!maybe_value) { break; }
+        values[decoded] = *maybe_value;
+      }
 
-      const auto error = server_->Write(current_register, *maybe_value);
-      if (error) {
-        EmitWriteError(response, current_register, error);
+      // Anything which was decoded before a malformed value is still
+      // written.
+      server_->WriteMultiple(current_register, values, decoded, errors);
+      for (size_t i = 0; i < decoded; i++) {
+        if (errors[i]) {
+          EmitWriteError(response, current_register + i, errors[i]);
+        }
       }
-      current_register++;
+
+      if (decoded != block_size) { return true; }
+
+      current_register += block_size;
+      remaining -= block_size;
     }
 
     return false;
@@ -636,28 +916,238 @@ class MicroServer::Impl {
     const auto num_registers = str.ReadVaruint();
     if (!num_registers) { return true; }
 
+    ReadResult results[kMaxBlockSize] = {};
+
     auto current_register = *start_register;
+    size_t remaining = *num_registers;
 
-    for (size_t i = 0; i < *num_registers; i++) {
-      const auto read_result = server_->Read(current_register, type);
+    while (remaining) {
+      const size_t block_size = std::min(remaining, kMaxBlockSize);
+      server_->ReadMultiple(current_register, block_size, type, results);
 
       // For now, we will emit reads as individual responses rather
       // than coalescing them into a kReplyMultiple.
-      EmitRead(response, current_register, read_result);
+      for (size_t i = 0; i < block_size; i++) {
+        EmitRead(response, current_register + i, results[i]);
+      }
 
-      current_register++;
+      current_register += block_size;
+      remaining -= block_size;
     }
 
-    return true;
+    return false;
+  }
+
+  bool ProcessSubframeDefinePreset(ReadStream& str) {
+    const auto maybe_index = str.ReadVaruint();
+    const auto maybe_count = str.ReadVaruint();
+    if (!maybe_index || !maybe_count) { return true; }
+    if (*maybe_index >= static_cast<uint32_t>(options_.max_presets) ||
+        *maybe_count > static_cast<uint32_t>(options_.max_preset_size)) {
+      return true;
+    }
+
+    auto& preset = presets_[*maybe_index];
+    // Until the whole definition has been read, this preset is
+    // empty.
+    preset.size = 0;
+    for (uint32_t i = 0; i < *maybe_count; i++) {
+      const auto maybe_register = str.ReadVaruint();
+      const auto maybe_type = str.Read<uint8_t>();
+      if (!maybe_register || !maybe_type || *maybe_type > 3) { return true; }
+      preset.entries[i].reg = *maybe_register;
+      preset.entries[i].type = *maybe_type;
+    }
+    preset.size = *maybe_count;
+
+    return false;
+  }
+
+  bool ProcessSubframeReadPreset(
+      ReadStream& str,
+      base::BufferWriteStream* response_buffer_stream,
+      WriteStream* response) {
+    const auto maybe_index = str.ReadVaruint();
+    if (!maybe_index) { return true; }
+    if (!response) { return false; }
+
+    const auto* const preset =
+        (*maybe_index < static_cast<uint32_t>(options_.max_presets)) ?
+        &presets_[*maybe_index] : nullptr;
+    const size_t size = preset ? preset->size : 0;
+
+    const auto values_size =
+        size ? ReadPackedValues(preset->entries, size) : 0;
+    if (!ResponseFits(response_buffer_stream,
+                      1 + GetVaruintSize(*maybe_index) +
+                      GetVaruintSize(size) + values_size)) {
+      return false;
+    }
+
+    response->WriteVaruint(static_cast<uint8_t>(Subframe::kReplyPreset));
+    response->WriteVaruint(*maybe_index);
+    response->WriteVaruint(size);
+
+    if (size) {
+      EmitPackedValues(response, preset->entries, size);
+    }
+
+    return false;
+  }
+
+  bool ProcessSubframeReadPacked(
+      ReadStream& str,
+      base::BufferWriteStream* response_buffer_stream,
+      WriteStream* response) {
+    const auto maybe_base = str.ReadVaruint();
+    const auto maybe_span = str.ReadVaruint();
+    if (!maybe_base || !maybe_span) { return true; }
+    const uint32_t span = *maybe_span;
+    if (span > Format::kMaxPackedRegisters) { return true; }
+
+    uint8_t bitmap[Format::kMaxPackedRegisters / 8] = {};
+    const size_t bitmap_size = (span + 7) / 8;
+    size_t count = 0;
+    for (size_t i = 0; i < bitmap_size; i++) {
+      const auto maybe_byte = str.Read<uint8_t>();
+      if (!maybe_byte) { return true; }
+      bitmap[i] = *maybe_byte;
+    }
+    for (uint32_t i = 0; i < span; i++) {
+      if (bitmap[i / 8] & (1 << (i % 8))) {
+        packed_entries_[count].reg = *maybe_base + i;
+        count++;
+      }
+    }
+
+    uint8_t types[Format::kMaxPackedRegisters / 4] = {};
+    const size_t types_size = (count + 3) / 4;
+    for (size_t i = 0; i < types_size; i++) {
+      const auto maybe_byte = str.Read<uint8_t>();
+      if (!maybe_byte) { return true; }
+      types[i] = *maybe_byte;
+    }
+    for (size_t i = 0; i < count; i++) {
+      packed_entries_[i].type = (types[i / 4] >> ((i % 4) * 2)) & 0x03;
+    }
+
+    if (!response) { return false; }
+
+    const auto values_size =
+        count ? ReadPackedValues(packed_entries_, count) : 0;
+    if (!ResponseFits(response_buffer_stream,
+                      1 + GetVaruintSize(*maybe_base) + GetVaruintSize(span) +
+                      bitmap_size + types_size + values_size)) {
+      return false;
+    }
+
+    response->WriteVaruint(static_cast<uint8_t>(Subframe::kReplyPacked));
+    response->WriteVaruint(*maybe_base);
+    response->WriteVaruint(span);
+    for (size_t i = 0; i < bitmap_size; i++) { response->Write(bitmap[i]); }
+    for (size_t i = 0; i < types_size; i++) { response->Write(types[i]); }
+
+    if (count) {
+      EmitPackedValues(response, packed_entries_, count);
+    }
+
+    return false;
+  }
+
+  /// Read the value of each of @p entries into packed_results_.
+  ///
+  /// @return the number of bytes EmitPackedValues will write
+  std::streamsize ReadPackedValues(const PresetEntry* entries, size_t size) {
+    // Runs of consecutive registers of the same type are read from
+    // the server in one go.
+    size_t i = 0;
+    while (i < size) {
+      const auto& first = entries[i];
+      size_t count = 1;
+      while (i + count < size &&
+             count < kMaxBlockSize &&
+             entries[i + count].reg == first.reg + count &&
+             entries[i + count].type == first.type) {
+        count++;
+      }
+
+      server_->ReadMultiple(first.reg, count, first.type, &packed_results_[i]);
+      i += count;
+    }
+
+    std::streamsize result = 0;
+    for (size_t j = 0; j < size; j++) {
+      result += kTypeSizes[entries[j].type];
+      if (packed_results_[j].index() != 0) {
+        result += 1 + GetVaruintSize(entries[j].reg) +
+            GetVaruintSize(std::get<uint32_t>(packed_results_[j]));
+      }
+    }
+    return result;
+  }
+
+  /// Write the values read by ReadPackedValues back to back, then a
+  /// read error for each which failed.
+  void EmitPackedValues(WriteStream* response,
+                        const PresetEntry* entries, size_t size) {
+    for (size_t j = 0; j < size; j++) {
+      if (packed_results_[j].index() == 0) {
+        std::visit([&](auto value) {
+            response->Write(value);
+          }, std::get<0>(packed_results_[j]));
+      } else {
+        // Every register has to take up its space, error or not.
+        WriteZero(response, entries[j].type);
+      }
+    }
+
+    for (size_t j = 0; j < size; j++) {
+      if (packed_results_[j].index() != 0) {
+        EmitReadError(response, entries[j].reg,
+                      std::get<uint32_t>(packed_results_[j]));
+      }
+    }
+  }
+
+  /// @return true if @p size more bytes of response leave room for
+  /// the frame header and checksum.  If not, the overrun is counted.
+  bool ResponseFits(base::BufferWriteStream* response_buffer_stream,
+                    std::streamsize size) {
+    if (size + kResponseReserve <= response_buffer_stream->remaining()) {
+      return true;
+    }
+    stats_.response_overrun++;
+    return false;
+  }
+
+  void WriteZero(WriteStream* response, uint8_t type) {
+    switch (type) {
+      case 0: { response->Write(static_cast<int8_t>(0)); break; }
+      case 1: { response->Write(static_cast<int16_t>(0)); break; }
+      case 2: { response->Write(static_cast<int32_t>(0)); break; }
+      case 3: { response->Write(0.0f); break; }
+    }
   }
 
   TunnelStream* FindTunnel(uint32_t id) {
-    for (auto& tunnel : tunnels_) {
-      if (tunnel.id() == id) { return &tunnel; }
+    for (int i = 0; i < options_.max_tunnel_streams; i++) {
+      if (tunnels_[i].id() == id) { return &tunnels_[i]; }
     }
     return nullptr;
   }
 
+  // The most registers which are passed to Server::ReadMultiple or
+  // Server::WriteMultiple at once.
+  static constexpr size_t kMaxBlockSize = 16;
+
+  // The size of each register type when packed.
+  static constexpr int kTypeSizes[] = { 1, 2, 4, 4 };
+
+  // WriteResponse needs this much of write_buffer_ beyond the
+  // response for the frame header and checksum.
+  static constexpr std::streamsize kResponseReserve =
+      kHeaderSize + kMaxVaruintSize + kCrcSize;
+
   const Options options_;
   micro::AsyncStream* const stream_;
   Server* server_ = nullptr;
@@ -666,19 +1156,39 @@ class MicroServer::Impl {
 
   RawStream raw_write_stream_{this};
 
-  std::streamsize read_start_ = 0;
-  char* const read_buffer_ = {};
+  // Data which has been received but not yet consumed.
+  micro::RingBuffer read_buffer_;
+
+  // The checksum of the first crc_size_ bytes of read_buffer_.
+  base::CrcCcitt crc_;
+  std::streamsize crc_size_ = 0;
   bool read_outstanding_ = false;
 
   char* const write_buffer_ = {};
   bool write_outstanding_ = false;
 
+  // State for the broadcast frame currently being processed.
+  struct Group {
+    WriteStream* response = nullptr;
+    uint32_t slot_us = 0;
+    uint32_t reply_slot = 0;
+  };
+  Group group_;
+
+  uint8_t delayed_client_id_ = 0;
+  std::streamsize delayed_size_ = 0;
+
+  Preset* const presets_;
+  PresetEntry* const preset_entries_;
+  PresetEntry* const packed_entries_;
+  ReadResult* const packed_results_;
+
   base::string_span unknown_buffer_;
   micro::SizeCallback unknown_callback_;
 
   micro::SizeCallback raw_write_callback_;
 
-  TunnelStream tunnels_[1];
+  TunnelStream* const tunnels_;
   Stats stats_;
 };
 
@@ -20,6 +20,7 @@
 #include "mjlib/micro/async_stream.h"
 #include "mjlib/micro/persistent_config.h"
 #include "mjlib/micro/pool_ptr.h"
+#include "mjlib/micro/static_function.h"
 
 namespace mjlib {
 namespace multiplex {
@@ -45,19 +46,72 @@ class MicroServer : public Format {
     /// @param type_index is an index into the Value variant
     /// describing what type to return.
     virtual ReadResult Read(Register, size_t type_index) const = 0;
+
+    /// Store @p count values to consecutive registers beginning at
+    /// @p start, placing the result of each in @p errors.
+    ///
+    /// The default implementation calls Write for each register.
+    /// Applications may override it to service a contiguous range in
+    /// one pass.
+    virtual void WriteMultiple(Register start, const Value* values,
+                               size_t count, uint32_t* errors) {
+      for (size_t i = 0; i < count; i++) {
+        errors[i] = Write(start + i, values[i]);
+      }
+    }
+
+    /// Read @p count consecutive registers beginning at @p start into
+    /// @p results.
+    ///
+    /// The default implementation calls Read for each register.
+    virtual void ReadMultiple(Register start, size_t count,
+                              size_t type_index, ReadResult* results) const {
+      for (size_t i = 0; i < count; i++) {
+        results[i] = Read(start + i, type_index);
+      }
+    }
+
+    /// Invoked before the first Write or Read of each frame addressed
+    /// to this node.  Applications may use it to take a single
+    /// consistent snapshot of their state to serve every Read in the
+    /// frame.
+    virtual void StartFrame() {}
+
+    /// Invoked after the last Write or Read of each frame addressed
+    /// to this node.
+    virtual void FinishFrame() {}
   };
 
+  /// Arrange for the callback to be invoked once the given number of
+  /// microseconds have elapsed.
+  using DelayFunction = micro::StaticFunction<
+    void (uint32_t delay_us, const micro::VoidCallback&)>;
+
   struct Options {
     size_t buffer_size = 256;
     int max_tunnel_streams = 1;
+    /// Each tunnel can hold this many bytes received from the client
+    /// which have not yet been read.
+    size_t tunnel_buffer_size = 128;
     uint8_t default_id = 1;
+
+    /// Storage is reserved for this many presets, each of up to
+    /// max_preset_size registers.
+    int max_presets = 2;
+    int max_preset_size = 16;
+
+    /// Used to hold the response to a broadcast frame until this
+    /// node's reply slot comes up.  If not set, the response is sent
+    /// immediately.
+    DelayFunction reply_delay;
   };
 
   MicroServer(micro::Pool*, micro::AsyncStream*, const Options&);
   ~MicroServer();
 
   /// Allocate a "tunnel", where an AsyncStream is tunneled over the
-  /// multiplex connection.
+  /// multiplex connection.  Up to Options::max_tunnel_streams may be
+  /// allocated, each with its own channel @p id.
   micro::AsyncStream* MakeTunnel(uint32_t id);
 
   void Start(Server*);
@@ -76,6 +130,7 @@ class MicroServer : public Format {
     uint32_t wrong_id = 0;
     uint32_t checksum_mismatch = 0;
     uint32_t receive_overrun = 0;
+    uint32_t response_overrun = 0;
     uint32_t unknown_subframe = 0;
     uint32_t missing_subframe = 0;
     uint32_t malformed_subframe = 0;
@@ -87,6 +142,7 @@ class MicroServer : public Format {
       a->Visit(MJ_NVP(wrong_id));
       a->Visit(MJ_NVP(checksum_mismatch));
       a->Visit(MJ_NVP(receive_overrun));
+      a->Visit(MJ_NVP(response_overrun));
       a->Visit(MJ_NVP(unknown_subframe));
       a->Visit(MJ_NVP(missing_subframe));
       a->Visit(MJ_NVP(malformed_subframe));
@@ -14,6 +14,9 @@
 
 #include "mjlib/multiplex/register.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 #include "mjlib/base/assert.h"
 #include "mjlib/base/fail.h"
 
@@ -29,6 +32,18 @@ uint32_t u32(T value) {
 }
 }
 
+void RegisterPreset::Add(Register reg, size_t type_index) {
+  MJ_ASSERT(type_index <= 3);
+  entries_.push_back({reg, type_index});
+}
+
+void RegisterPreset::AddRange(Register start, uint32_t count,
+                              size_t type_index) {
+  for (uint32_t i = 0; i < count; i++) {
+    Add(start + i, type_index);
+  }
+}
+
 void RegisterRequest::ExpectResponse(bool value) {
   request_reply_ = value;
 }
@@ -79,10 +94,92 @@ void RegisterRequest::WriteMultiple(Register start_reg,
   }
 }
 
+void RegisterRequest::DefinePreset(uint8_t index,
+                                   const RegisterPreset& preset) {
+  stream_.WriteVaruint(u32(Format::Subframe::kDefinePreset));
+  stream_.WriteVaruint(index);
+  stream_.WriteVaruint(preset.entries().size());
+  for (const auto& entry : preset.entries()) {
+    stream_.WriteVaruint(entry.reg);
+    stream_.Write(static_cast<uint8_t>(entry.type_index));
+  }
+}
+
+void RegisterRequest::ReadPacked(const RegisterPreset& registers) {
+  MJ_ASSERT(!registers.entries().empty());
+
+  auto entries = registers.entries();
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.reg < rhs.reg; });
+
+  const Register base = entries.front().reg;
+  const uint32_t span = entries.back().reg - base + 1;
+  MJ_ASSERT(span <= Format::kMaxPackedRegisters);
+
+  uint8_t bitmap[Format::kMaxPackedRegisters / 8] = {};
+  uint8_t types[Format::kMaxPackedRegisters / 4] = {};
+  for (size_t i = 0; i < entries.size(); i++) {
+    const auto offset = entries[i].reg - base;
+    MJ_ASSERT(i == 0 || entries[i].reg != entries[i - 1].reg);
+    bitmap[offset / 8] |= (1 << (offset % 8));
+    types[i / 4] |= (entries[i].type_index << ((i % 4) * 2));
+  }
+
+  stream_.WriteVaruint(u32(Format::Subframe::kReadPacked));
+  stream_.WriteVaruint(base);
+  stream_.WriteVaruint(span);
+  for (size_t i = 0; i < (span + 7) / 8; i++) { stream_.Write(bitmap[i]); }
+  for (size_t i = 0; i < (entries.size() + 3) / 4; i++) {
+    stream_.Write(types[i]);
+  }
+
+  request_reply_ = true;
+}
+
+void RegisterRequest::ReadPreset(uint8_t index,
+                                 const RegisterPreset* preset) {
+  stream_.WriteVaruint(u32(Format::Subframe::kReadPreset));
+  stream_.WriteVaruint(index);
+  presets_.emplace_back(index, preset);
+
+  request_reply_ = true;
+}
+
 std::string_view RegisterRequest::buffer() const {
   return std::string_view(buffer_.data()->data(), buffer_.data()->size());
 }
 
+void GroupRequest::SetReplySlot(uint32_t slot_us) {
+  stream_.WriteVaruint(u32(Format::Subframe::kReplySlot));
+  stream_.WriteVaruint(slot_us);
+  reply_slot_us_ = slot_us;
+}
+
+void GroupRequest::Add(uint8_t id, const RegisterRequest& request) {
+  MJ_ASSERT(id != Format::kBroadcastId);
+  MJ_ASSERT(!ids_.test(id));
+  ids_.set(id);
+  const auto block = request.buffer();
+
+  // Reply slots are numbered from 1, with 0 meaning no reply.
+  uint32_t slot = 0;
+  if (request.request_reply()) {
+    reply_ids_.push_back(id);
+    reply_presets_.push_back(request.presets());
+    slot = reply_ids_.size();
+  }
+
+  stream_.WriteVaruint(u32(Format::Subframe::kGroupBlock));
+  stream_.WriteVaruint(id);
+  stream_.WriteVaruint(slot);
+  stream_.WriteVaruint(block.size());
+  stream_.base()->write(block);
+}
+
+std::string_view GroupRequest::buffer() const {
+  return std::string_view(buffer_.data()->data(), buffer_.data()->size());
+}
+
 namespace {
 std::optional<Format::Value> ReadValue(ReadStream& stream, size_t type_index) {
   MJ_ASSERT(type_index <= 3);
@@ -98,66 +195,130 @@ std::optional<Format::Value> ReadValue(ReadStream& stream, size_t type_index) {
   base::AssertNotReached();
 }
 
-std::optional<RegisterReply> ParseSubframe(ReadStream& stream) {
+// @return false if there was nothing more which could be parsed.
+bool ParseSubframe(ReadStream& stream,
+                   const RegisterRequest::PresetList& presets,
+                   RegisterReply* result) {
   const auto maybe_subframe_id = stream.ReadVaruint();
-  if (!maybe_subframe_id) { return {}; }
+  if (!maybe_subframe_id) { return false; }
   const auto subframe_id = *maybe_subframe_id;
 
-  RegisterReply this_result;
+  if (subframe_id == u32(Format::Subframe::kReplyPacked)) {
+    const auto maybe_base = stream.ReadVaruint();
+    const auto maybe_span = stream.ReadVaruint();
+    if (!maybe_base || !maybe_span) { return false; }
+    const uint32_t span = *maybe_span;
+    if (span > Format::kMaxPackedRegisters) { return false; }
+
+    uint8_t bitmap[Format::kMaxPackedRegisters / 8] = {};
+    for (size_t i = 0; i < (span + 7) / 8; i++) {
+      const auto maybe_byte = stream.Read<uint8_t>();
+      if (!maybe_byte) { return false; }
+      bitmap[i] = *maybe_byte;
+    }
+
+    Format::Register regs[Format::kMaxPackedRegisters] = {};
+    size_t count = 0;
+    for (uint32_t i = 0; i < span; i++) {
+      if (bitmap[i / 8] & (1 << (i % 8))) {
+        regs[count++] = *maybe_base + i;
+      }
+    }
+
+    uint8_t types[Format::kMaxPackedRegisters / 4] = {};
+    for (size_t i = 0; i < (count + 3) / 4; i++) {
+      const auto maybe_byte = stream.Read<uint8_t>();
+      if (!maybe_byte) { return false; }
+      types[i] = *maybe_byte;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      const size_t type_index = (types[i / 4] >> ((i % 4) * 2)) & 0x03;
+      const auto maybe_value = ReadValue(stream, type_index);
+      if (!maybe_value) { return false; }
+      result->Set(regs[i], *maybe_value);
+    }
+  } else if (subframe_id == u32(Format::Subframe::kReplyPreset)) {
+    const auto maybe_index = stream.ReadVaruint();
+    const auto maybe_count = stream.ReadVaruint();
+    if (!maybe_index || !maybe_count) { return false; }
+
+    if (*maybe_count == 0) { return true; }
+
+    // Without the definition, there is no way to know how large each
+    // value is, so nothing after this can be parsed either.
+    const auto it = std::find_if(
+        presets.begin(), presets.end(),
+        [&](const auto& pair) { return pair.first == *maybe_index; });
+    if (it == presets.end()) { return false; }
+    const auto& entries = it->second->entries();
+    if (entries.size() != *maybe_count) { return false; }
 
-  if ((subframe_id & ~0x03) == u32(Format::Subframe::kReplySingleBase)) {
+    for (const auto& entry : entries) {
+      const auto maybe_value = ReadValue(stream, entry.type_index);
+      if (!maybe_value) { return false; }
+      result->Set(entry.reg, *maybe_value);
+    }
+  } else if ((subframe_id & ~0x03) == u32(Format::Subframe::kReplySingleBase)) {
     const auto maybe_this_reg = stream.ReadVaruint();
-    if (!maybe_this_reg) { return {}; }
+    if (!maybe_this_reg) { return false; }
 
     const auto maybe_value = ReadValue(stream, subframe_id & 0x03);
-    if (!maybe_value) { return {}; }
+    if (!maybe_value) { return false; }
 
-    this_result[*maybe_this_reg] = *maybe_value;
+    result->Set(*maybe_this_reg, *maybe_value);
   } else if ((subframe_id & ~0x03) == u32(Format::Subframe::kReplyMultipleBase)) {
     const auto maybe_start_reg = stream.ReadVaruint();
-    if (!maybe_start_reg) { return {}; }
+    if (!maybe_start_reg) { return false; }
     const auto start_reg = *maybe_start_reg;
 
     const auto maybe_num_registers = stream.ReadVaruint();
-    if (!maybe_num_registers) { return {}; }
+    if (!maybe_num_registers) { return false; }
     const auto num_registers = *maybe_num_registers;
 
     for (size_t i = 0; i < num_registers; i++) {
       const auto maybe_value = ReadValue(stream, subframe_id & 0x03);
-      if (!maybe_value) { return {}; }
-      this_result[start_reg + i] = *maybe_value;
+      if (!maybe_value) { return false; }
+      result->Set(start_reg + i, *maybe_value);
     }
   } else if (subframe_id == u32(Format::Subframe::kWriteError) ||
              subframe_id == u32(Format::Subframe::kReadError)) {
     const auto maybe_this_reg = stream.ReadVaruint();
     const auto maybe_this_err = stream.ReadVaruint();
     if (!maybe_this_reg || !maybe_this_err) {
-      return {};
+      return false;
     }
-    this_result[*maybe_this_reg] = *maybe_this_err;
+    result->Set(*maybe_this_reg, *maybe_this_err);
   } else {
     // We could report an error someday.  For now, we'll just call
     // ourselves done.
-    return {};
+    return false;
   }
 
-  return this_result;
+  return true;
 }
 }
 
+const RegisterReply::ReadResult& RegisterReply::at(Register reg) const {
+  const auto it = find(reg);
+  if (it == end()) {
+    throw std::out_of_range("RegisterReply::at");
+  }
+  return it->second;
+}
+
 RegisterReply ParseRegisterReply(base::ReadStream& read_stream) {
+  return ParseRegisterReply(read_stream, {});
+}
+
+RegisterReply ParseRegisterReply(
+    base::ReadStream& read_stream,
+    const RegisterRequest::PresetList& presets) {
   multiplex::ReadStream stream{read_stream};
 
   RegisterReply result;
-  while (true) {
-    const auto maybe_result = ParseSubframe(stream);
-    if (!maybe_result) { return result; }
-
-    // Merge the current result into our final.
-    for (const auto& pair : *maybe_result) {
-      result.insert(pair);
-    }
-  }
+  while (ParseSubframe(stream, presets, &result)) {}
+  return result;
 }
 
 }
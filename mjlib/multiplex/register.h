@@ -14,7 +14,12 @@
 
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <bitset>
+#include <utility>
+#include <vector>
+
+#include <boost/container/small_vector.hpp>
 
 #include "mjlib/base/fast_stream.h"
 #include "mjlib/multiplex/format.h"
@@ -23,12 +28,40 @@
 namespace mjlib {
 namespace multiplex {
 
+/// A list of registers, each with the type it is to be read as.  A
+/// device may be asked to store this as a numbered preset, after
+/// which the whole set can be read with one short subframe.
+class RegisterPreset {
+ public:
+  using Register = Format::Register;
+
+  struct Entry {
+    Register reg = 0;
+    size_t type_index = 0;
+  };
+
+  void Add(Register, size_t type_index);
+
+  /// Add @p count consecutive registers beginning at @p start.
+  void AddRange(Register start, uint32_t count, size_t type_index);
+
+  const std::vector<Entry>& entries() const { return entries_; }
+
+ private:
+  std::vector<Entry> entries_;
+};
+
 /// Build up a request to read or write from one or more registers.
 class RegisterRequest {
  public:
   using Register = Format::Register;
   using Value = Format::Value;
 
+  /// The presets read by a request, which are needed to decode its
+  /// reply.
+  using PresetList = boost::container::small_vector<
+    std::pair<uint8_t, const RegisterPreset*>, 2>;
+
   /// By default a response is only requested if a read operation is
   /// made.  If you wish to have a response even for write-only
   /// operations (so as to see errors), set this to true.
@@ -41,19 +74,149 @@ class RegisterRequest {
   void WriteSingle(Register, Value);
   void WriteMultiple(Register, const std::vector<Value>&);
 
+  /// Store @p preset on the device as number @p index, replacing any
+  /// previous definition.  Presets do not survive a device reset.
+  void DefinePreset(uint8_t index, const RegisterPreset& preset);
+
+  /// Read every register of @p registers in one packed subframe,
+  /// whose reply carries no per-register headers.  The registers may
+  /// be in any order, but must all lie within
+  /// Format::kMaxPackedRegisters of one another.
+  void ReadPacked(const RegisterPreset& registers);
+
+  /// Read every register of a preset.  @p preset must match what the
+  /// device has stored as @p index, and must outlive the request and
+  /// the parsing of its reply.
+  void ReadPreset(uint8_t index, const RegisterPreset* preset);
+
   std::string_view buffer() const;
   bool request_reply() const { return request_reply_; }
+  const PresetList& presets() const { return presets_; }
 
  private:
   base::FastOStringStream buffer_;
   WriteStream stream_{buffer_};
   bool request_reply_ = false;
+  PresetList presets_;
+};
+
+/// Build up a single broadcast frame which carries a separate
+/// RegisterRequest for each of several devices.  Each device acts on
+/// only its own block.
+///
+/// Devices whose request expects a response reply in consecutive
+/// time slots, in the order they were added, so that their replies
+/// do not collide on the bus.
+class GroupRequest {
+ public:
+  /// Set the length of each reply slot.  It must be long enough for
+  /// the largest reply plus any bus turnaround time.
+  void SetReplySlot(uint32_t slot_us);
+  uint32_t reply_slot_us() const { return reply_slot_us_; }
+
+  /// Add the block for device @p id.  Each device may appear at most
+  /// once in a group.
+  void Add(uint8_t id, const RegisterRequest&);
+
+  std::string_view buffer() const;
+  bool request_reply() const { return !reply_ids_.empty(); }
+
+  /// @return the ids of the devices which will reply, in slot order.
+  const std::vector<uint8_t>& reply_ids() const { return reply_ids_; }
+
+  /// @return the presets read from each device which will reply, in
+  /// slot order.
+  const std::vector<RegisterRequest::PresetList>& reply_presets() const {
+    return reply_presets_;
+  }
+
+ private:
+  base::FastOStringStream buffer_;
+  WriteStream stream_{buffer_};
+  std::vector<uint8_t> reply_ids_;
+  std::vector<RegisterRequest::PresetList> reply_presets_;
+  uint32_t reply_slot_us_ = 0;
+  std::bitset<256> ids_;
 };
 
 /// The possible reply to a register operation.
-using RegisterReply = std::map<Format::Register, Format::ReadResult>;
+///
+/// This is a flat map, sorted by register, with enough inline storage
+/// for a typical reply.  Decoding and iterating over such a reply
+/// never touches the heap.
+class RegisterReply {
+ public:
+  using Register = Format::Register;
+  using ReadResult = Format::ReadResult;
+  using value_type = std::pair<Register, ReadResult>;
+
+  static constexpr size_t kInlineSize = 32;
+  using Storage = boost::container::small_vector<value_type, kInlineSize>;
+  using const_iterator = Storage::const_iterator;
+
+  const_iterator begin() const { return data_.begin(); }
+  const_iterator end() const { return data_.end(); }
+  size_t size() const { return data_.size(); }
+  bool empty() const { return data_.empty(); }
+  void clear() { data_.clear(); }
+
+  /// @return the entry for @p reg, or end() if there is none.
+  const_iterator find(Register reg) const {
+    const auto it = lower_bound(reg);
+    if (it == data_.end() || it->first != reg) { return data_.end(); }
+    return it;
+  }
+
+  size_t count(Register reg) const { return find(reg) == end() ? 0 : 1; }
+
+  /// @return the result for @p reg, throwing std::out_of_range if
+  /// there is none.
+  const ReadResult& at(Register reg) const;
+
+  /// Set the result for @p reg, replacing any existing one.
+  void Set(Register reg, const ReadResult& result) {
+    // Replies nearly always arrive in ascending register order.
+    if (data_.empty() || data_.back().first < reg) {
+      data_.emplace_back(reg, result);
+      return;
+    }
+
+    auto it = lower_bound(reg);
+    if (it != data_.end() && it->first == reg) {
+      it->second = result;
+    } else {
+      data_.emplace(it, reg, result);
+    }
+  }
+
+  bool operator==(const RegisterReply& rhs) const {
+    return data_ == rhs.data_;
+  }
+
+ private:
+  Storage::iterator lower_bound(Register reg) {
+    return std::lower_bound(
+        data_.begin(), data_.end(), reg,
+        [](const auto& item, Register value) { return item.first < value; });
+  }
+
+  const_iterator lower_bound(Register reg) const {
+    return std::lower_bound(
+        data_.begin(), data_.end(), reg,
+        [](const auto& item, Register value) { return item.first < value; });
+  }
+
+  Storage data_;
+};
 
 RegisterReply ParseRegisterReply(base::ReadStream&);
 
+/// Parse a reply which may contain presets from @p presets.
+RegisterReply ParseRegisterReply(base::ReadStream&,
+                                 const RegisterRequest::PresetList& presets);
+
+/// The replies to a GroupRequest, in the order they were received.
+using GroupReply = std::vector<std::pair<uint8_t, RegisterReply>>;
+
 }
 }
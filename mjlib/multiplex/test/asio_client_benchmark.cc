@@ -0,0 +1,289 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measures how many full command+query cycles per second AsioClient
+/// can complete against a set of MicroServer instances connected by
+/// a loopback bus.  There is no bus timing model in the loop, so this
+/// measures only the host and server processing cost.
+///
+/// Separately, the time the same traffic would occupy a half-duplex
+/// bus is estimated from the bytes and frames written each cycle.
+/// With --group, each cycle is sent as one broadcast frame and the
+/// servos reply in consecutive slots.
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/micro/pool_ptr.h"
+#include "mjlib/multiplex/asio_client.h"
+#include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/micro_server.h"
+#include "mjlib/multiplex/test/micro_bus.h"
+
+namespace base = mjlib::base;
+namespace micro = mjlib::micro;
+namespace po = boost::program_options;
+using namespace mjlib::multiplex;
+
+namespace {
+struct Options {
+  int servos = 12;
+  int cycles = 20000;
+  int max_in_flight = 1;
+  bool group = false;
+
+  // Parameters of the bus timing estimate.
+  double baud_rate = 3000000;
+  // From the end of a request until the servo starts replying.
+  double node_turnaround_us = 100;
+  // From the end of a reply until the host starts its next write.
+  double host_turnaround_us = 200;
+  // Slack between consecutive reply slots.
+  double slot_guard_us = 10;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(servos));
+    a->Visit(MJ_NVP(cycles));
+    a->Visit(MJ_NVP(max_in_flight));
+    a->Visit(MJ_NVP(group));
+    a->Visit(MJ_NVP(baud_rate));
+    a->Visit(MJ_NVP(node_turnaround_us));
+    a->Visit(MJ_NVP(host_turnaround_us));
+    a->Visit(MJ_NVP(slot_guard_us));
+  }
+};
+
+/// A register file sized like the status and command registers of a
+/// typical servo.
+class Server : public MicroServer::Server {
+ public:
+  uint32_t Write(MicroServer::Register reg,
+                 const MicroServer::Value& value) override {
+    if (reg >= kNumRegisters) { return 1; }
+    values_[reg] = std::visit([](auto v) { return static_cast<float>(v); },
+                              value);
+    return 0;
+  }
+
+  MicroServer::ReadResult Read(
+      MicroServer::Register reg, size_t type_index) const override {
+    if (reg >= kNumRegisters) { return static_cast<uint32_t>(1); }
+    const float value = values_[reg];
+    switch (type_index) {
+      case 0: return MicroServer::Value(static_cast<int8_t>(value));
+      case 1: return MicroServer::Value(static_cast<int16_t>(value));
+      case 2: return MicroServer::Value(static_cast<int32_t>(value));
+      case 3: return MicroServer::Value(value);
+    }
+    return static_cast<uint32_t>(2);
+  }
+
+ private:
+  static constexpr uint32_t kNumRegisters = 0x30;
+  float values_[kNumRegisters] = {};
+};
+
+struct Node {
+  Node(micro::Pool* pool, test::MicroBus* bus, uint8_t id)
+      : dut(pool, bus->AddNode(), [&]() {
+          MicroServer::Options options;
+          options.default_id = id;
+          // Room for a broadcast frame commanding every servo.
+          options.buffer_size = 512;
+          return options;
+        }()) {
+    dut.Start(&server);
+  }
+
+  Server server;
+  MicroServer dut;
+};
+
+class Benchmark {
+ public:
+  Benchmark(const Options& options)
+      : options_(options),
+        client_(&bus_, [&]() {
+            AsioClient::Options client_options;
+            client_options.max_in_flight = options.max_in_flight;
+            return client_options;
+          }()) {
+    for (int i = 0; i < options_.servos; i++) {
+      nodes_.emplace_back(std::make_unique<Node>(&pool_, &bus_, i + 1));
+    }
+
+    // A position command followed by a query of mode, position,
+    // velocity, temperature, current, voltage and fault.
+    request_.WriteSingle(0x000, MicroServer::Value(static_cast<int8_t>(10)));
+    request_.WriteMultiple(0x020, {
+        MicroServer::Value(0.5f),
+        MicroServer::Value(0.0f),
+        MicroServer::Value(3.0f),
+      });
+    request_.ReadMultiple(0x000, 7, 1);
+
+    // Each reply names 7 int16 registers individually.
+    const double reply_bytes =
+        Frame(1, false, 0, std::string(7 * 4, '\0')).encode().size();
+    slot_us_ = static_cast<uint32_t>(
+        std::ceil(ByteTimeUs(reply_bytes) + options_.slot_guard_us));
+
+    group_request_.SetReplySlot(slot_us_);
+    for (int i = 0; i < options_.servos; i++) {
+      group_request_.Add(i + 1, request_);
+    }
+  }
+
+  void Run() {
+    StartCycle();
+    const auto start = std::chrono::steady_clock::now();
+    service_.run();
+    const auto end = std::chrono::steady_clock::now();
+
+    const double elapsed_s =
+        std::chrono::duration<double>(end - start).count();
+    std::cout << "servos: " << options_.servos << "\n"
+              << "max_in_flight: " << options_.max_in_flight << "\n"
+              << "cycles: " << cycles_ << "\n"
+              << "errors: " << errors_ << "\n"
+              << "elapsed_s: " << elapsed_s << "\n"
+              << "cycles_per_s: " << cycles_ / elapsed_s << "\n"
+              << "transactions_per_s: "
+              << cycles_ * options_.servos / elapsed_s << "\n";
+
+    const auto& stats = bus_.stats();
+    const double host_writes =
+        static_cast<double>(stats.host_writes) / cycles_;
+    const double node_writes =
+        static_cast<double>(stats.node_writes) / cycles_;
+    const double bytes_us = ByteTimeUs(
+        static_cast<double>(stats.host_bytes + stats.node_bytes) / cycles_);
+
+    // With individual requests, every frame waits out a turnaround.
+    // With a broadcast, only the first reply does, and the rest
+    // follow in back to back slots.
+    const double bus_us = options_.group ?
+        (ByteTimeUs(static_cast<double>(stats.host_bytes) / cycles_) +
+         options_.node_turnaround_us +
+         node_writes * slot_us_ +
+         options_.host_turnaround_us) :
+        (bytes_us +
+         node_writes * options_.node_turnaround_us +
+         host_writes * options_.host_turnaround_us);
+
+    std::cout << "host_frames_per_cycle: " << host_writes << "\n"
+              << "bytes_per_cycle: "
+              << static_cast<double>(
+                  stats.host_bytes + stats.node_bytes) / cycles_ << "\n";
+    if (options_.group) {
+      std::cout << "slot_us: " << slot_us_ << "\n";
+    }
+    std::cout << "bus_us_per_cycle: " << bus_us << "\n";
+  }
+
+ private:
+  double ByteTimeUs(double bytes) const {
+    // 8N1 framing.
+    return bytes * 10.0 / options_.baud_rate * 1e6;
+  }
+
+  void StartCycle() {
+    if (options_.group) {
+      outstanding_ = 1;
+      client_.AsyncGroup(
+          group_request_,
+          std::bind(&Benchmark::HandleGroupReply, this,
+                    std::placeholders::_1, std::placeholders::_2));
+      return;
+    }
+
+    outstanding_ = options_.servos;
+    for (int i = 0; i < options_.servos; i++) {
+      client_.AsyncRegister(
+          i + 1, request_,
+          std::bind(&Benchmark::HandleReply, this,
+                    std::placeholders::_1, std::placeholders::_2));
+    }
+  }
+
+  void HandleGroupReply(const base::error_code& ec, const GroupReply& reply) {
+    if (ec || static_cast<int>(reply.size()) != options_.servos) { errors_++; }
+    for (const auto& pair : reply) {
+      if (pair.second.size() != 7) { errors_++; }
+    }
+
+    FinishRequest();
+  }
+
+  void HandleReply(const base::error_code& ec, const RegisterReply& reply) {
+    if (ec || reply.size() != 7) { errors_++; }
+
+    FinishRequest();
+  }
+
+  void FinishRequest() {
+    outstanding_--;
+    if (outstanding_ != 0) { return; }
+
+    cycles_++;
+    if (cycles_ < options_.cycles) {
+      StartCycle();
+    }
+  }
+
+  const Options options_;
+  boost::asio::io_service service_;
+  micro::SizedPool<65536> pool_;
+  test::MicroBus bus_{service_};
+  std::vector<std::unique_ptr<Node>> nodes_;
+  AsioClient client_;
+
+  RegisterRequest request_;
+  GroupRequest group_request_;
+  uint32_t slot_us_ = 0;
+  int outstanding_ = 0;
+  int cycles_ = 0;
+  int errors_ = 0;
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  Benchmark benchmark{options};
+  benchmark.Run();
+
+  return 0;
+}
@@ -0,0 +1,614 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/multiplex/asio_client.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/micro/pool_ptr.h"
+#include "mjlib/multiplex/micro_server.h"
+#include "mjlib/multiplex/test/micro_bus.h"
+
+namespace base = mjlib::base;
+namespace micro = mjlib::micro;
+using namespace mjlib::multiplex;
+
+namespace {
+class Server : public MicroServer::Server {
+ public:
+  Server(int32_t base) : base_(base) {}
+
+  uint32_t Write(MicroServer::Register reg,
+                 const MicroServer::Value& value) override {
+    writes_.push_back({reg, value});
+    return 0;
+  }
+
+  MicroServer::ReadResult Read(
+      MicroServer::Register reg, size_t type_index) const override {
+    if (type_index == 2) {
+      return MicroServer::Value(static_cast<int32_t>(base_ + reg));
+    }
+    return static_cast<uint32_t>(3);
+  }
+
+  struct WriteValue {
+    MicroServer::Register reg;
+    MicroServer::Value value;
+  };
+
+  const int32_t base_;
+  std::vector<WriteValue> writes_;
+};
+
+struct Node {
+  Node(micro::Pool* pool, test::MicroBus* bus, uint8_t id)
+      : server(id * 1000),
+        timer(bus->get_io_service()),
+        dut(pool, bus->AddNode(), [&]() {
+            MicroServer::Options options;
+            options.default_id = id;
+            options.max_tunnel_streams = 2;
+            options.reply_delay = [this](uint32_t delay_us,
+                                         const micro::VoidCallback& callback) {
+              timer.expires_from_now(
+                  boost::posix_time::microseconds(delay_us));
+              timer.async_wait([callback](const boost::system::error_code&) {
+                  callback();
+                });
+            };
+            return options;
+          }()) {
+    dut.Start(&server);
+  }
+
+  Server server;
+  boost::asio::deadline_timer timer;
+  MicroServer dut;
+};
+
+struct Fixture {
+  void Poll() {
+    service.poll();
+    service.reset();
+  }
+
+  boost::asio::io_service service;
+  micro::SizedPool<> pool;
+  test::MicroBus bus{service};
+  Node node1{&pool, &bus, 1};
+  Node node2{&pool, &bus, 2};
+  Node node3{&pool, &bus, 3};
+};
+
+/// Accepts every write, and completes reads only with an error once
+/// Fail() has been called.
+class BrokenStream : public mjlib::io::AsyncStream {
+ public:
+  BrokenStream(boost::asio::io_service& service) : service_(service) {}
+
+  boost::asio::io_service& get_io_service() override { return service_; }
+
+  void async_read_some(mjlib::io::MutableBufferSequence,
+                       mjlib::io::ReadHandler handler) override {
+    read_handler_ = handler;
+    MaybeFail();
+  }
+
+  void async_write_some(mjlib::io::ConstBufferSequence buffers,
+                        mjlib::io::WriteHandler handler) override {
+    service_.post(std::bind(handler, base::error_code(),
+                            boost::asio::buffer_size(buffers)));
+  }
+
+  void cancel() override {}
+
+  void Fail() {
+    failed_ = true;
+    MaybeFail();
+  }
+
+ private:
+  void MaybeFail() {
+    if (!failed_ || !read_handler_) { return; }
+    service_.post(std::bind(read_handler_, boost::asio::error::eof, 0));
+    read_handler_ = {};
+  }
+
+  boost::asio::io_service& service_;
+  mjlib::io::ReadHandler read_handler_;
+  bool failed_ = false;
+};
+
+using ReadResult = Format::ReadResult;
+using Value = Format::Value;
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientReadTest, Fixture) {
+  AsioClient dut(&bus);
+
+  RegisterRequest request;
+  request.ReadMultiple(5, 2, 2);
+
+  int done = 0;
+  dut.AsyncRegister(2, request, [&](const base::error_code& ec,
+                                    const RegisterReply& reply) {
+      BOOST_TEST(!ec);
+      BOOST_TEST(reply.size() == 2);
+      BOOST_TEST((reply.at(5) == ReadResult(Value(int32_t(2005)))));
+      BOOST_TEST((reply.at(6) == ReadResult(Value(int32_t(2006)))));
+      done++;
+    });
+
+  BOOST_TEST(done == 0);
+  Poll();
+  BOOST_TEST(done == 1);
+  BOOST_TEST(node1.dut.stats()->wrong_id == 1);
+  BOOST_TEST(node3.dut.stats()->wrong_id == 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientWriteTest, Fixture) {
+  AsioClient dut(&bus);
+
+  RegisterRequest request;
+  request.WriteSingle(7, Value(int8_t(4)));
+  BOOST_TEST(request.request_reply() == false);
+
+  int done = 0;
+  dut.AsyncRegister(3, request, [&](const base::error_code& ec,
+                                    const RegisterReply& reply) {
+      BOOST_TEST(!ec);
+      BOOST_TEST(reply.empty());
+      done++;
+    });
+
+  Poll();
+  BOOST_TEST(done == 1);
+  BOOST_TEST(node3.server.writes_.size() == 1);
+  BOOST_TEST(node3.server.writes_.at(0).reg == 7);
+  BOOST_TEST(node1.server.writes_.size() == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientTimeoutTest, Fixture) {
+  AsioClient::Options options;
+  options.timeout = boost::posix_time::milliseconds(1);
+  AsioClient dut(&bus, options);
+
+  RegisterRequest request;
+  request.ReadSingle(1, 2);
+
+  int done = 0;
+  dut.AsyncRegister(9, request, [&](const base::error_code& ec,
+                                    const RegisterReply& reply) {
+      BOOST_TEST(ec == boost::asio::error::operation_aborted);
+      BOOST_TEST(reply.empty());
+      done++;
+    });
+
+  int done2 = 0;
+  dut.AsyncRegister(1, request, [&](const base::error_code& ec,
+                                    const RegisterReply& reply) {
+      BOOST_TEST(!ec);
+      BOOST_TEST((reply.at(1) == ReadResult(Value(int32_t(1001)))));
+      done2++;
+    });
+
+  service.run();
+  BOOST_TEST(done == 1);
+  BOOST_TEST(done2 == 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientStatsTest, Fixture) {
+  AsioClient::Options options;
+  options.timeout = boost::posix_time::milliseconds(1);
+  AsioClient dut(&bus, options);
+
+  RegisterRequest request;
+  request.ReadSingle(1, 2);
+
+  int done = 0;
+  auto handler = [&](const base::error_code&, const RegisterReply&) {
+    done++;
+  };
+  dut.AsyncRegister(9, request, handler);
+  dut.AsyncRegister(1, request, handler);
+  dut.AsyncRegister(1, request, handler);
+
+  service.run();
+  BOOST_TEST(done == 3);
+
+  const auto& stats = dut.stats();
+  BOOST_TEST(stats.destinations.size() == 2);
+
+  const auto& missing = stats.destinations.at(9);
+  BOOST_TEST(missing.requests == 1);
+  BOOST_TEST(missing.replies == 0);
+  BOOST_TEST(missing.timeouts == 1);
+  BOOST_TEST(missing.latency_us.count() == 0);
+
+  const auto& present = stats.destinations.at(1);
+  BOOST_TEST(present.requests == 2);
+  BOOST_TEST(present.replies == 2);
+  BOOST_TEST(present.timeouts == 0);
+  BOOST_TEST(present.checksum_mismatch == 0);
+  BOOST_TEST(present.latency_us.count() == 2);
+  BOOST_TEST(stats.unexpected_frames == 0);
+
+  std::ostringstream ostr;
+  dut.WriteStats(ostr);
+  // A header and one line per device.
+  const auto text = ostr.str();
+  BOOST_TEST(std::count(text.begin(), text.end(), '\n') == 3);
+
+  dut.ResetStats();
+  BOOST_TEST(dut.stats().destinations.empty());
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientDeadlineTest, Fixture) {
+  AsioClient::Options options;
+  options.timeout = boost::posix_time::milliseconds(1);
+  options.max_in_flight = 2;
+  AsioClient dut(&bus, options);
+
+  RegisterRequest request;
+  request.ReadSingle(1, 2);
+
+  int missing_done = 0;
+  dut.AsyncRegister(9, request, [&](const base::error_code& ec,
+                                    const RegisterReply&) {
+      BOOST_TEST(ec == boost::asio::error::operation_aborted);
+      missing_done++;
+    });
+
+  // Replies from another device keep arriving the whole time, but
+  // they don't put off the timeout of the first request.
+  const int kMaxReplies = 100000;
+  int replies = 0;
+  std::function<void ()> start_present = [&]() {
+    dut.AsyncRegister(1, request, [&](const base::error_code& ec,
+                                      const RegisterReply&) {
+        BOOST_TEST(!ec);
+        replies++;
+        if (missing_done == 0 && replies < kMaxReplies) { start_present(); }
+      });
+  };
+  start_present();
+
+  service.run();
+  BOOST_TEST(missing_done == 1);
+  BOOST_TEST(replies < kMaxReplies);
+  BOOST_TEST(dut.stats().destinations.at(9).timeouts == 1);
+  BOOST_TEST(dut.stats().destinations.at(1).timeouts == 0);
+  BOOST_TEST(dut.stats().destinations.at(1).replies == replies);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientStreamErrorTest, Fixture) {
+  BrokenStream stream{service};
+  AsioClient::Options options;
+  options.max_in_flight = 2;
+  AsioClient dut(&stream, options);
+
+  RegisterRequest request;
+  request.ReadSingle(1, 2);
+
+  // One of these is still waiting to be written when the stream
+  // fails.
+  int register_errors = 0;
+  for (uint8_t id : { 1, 2, 3 }) {
+    dut.AsyncRegister(id, request, [&](const base::error_code& ec,
+                                       const RegisterReply&) {
+        BOOST_TEST(ec == boost::asio::error::eof);
+        register_errors++;
+      });
+  }
+
+  auto tunnel = dut.MakeTunnel(4, 1);
+  char read_data[16] = {};
+  int tunnel_errors = 0;
+  tunnel->async_read_some(
+      boost::asio::buffer(read_data), [&](const base::error_code& ec,
+                                          size_t) {
+        BOOST_TEST(ec == boost::asio::error::eof);
+        tunnel_errors++;
+      });
+
+  Poll();
+  BOOST_TEST(register_errors == 0);
+
+  stream.Fail();
+  Poll();
+  BOOST_TEST(register_errors == 3);
+  BOOST_TEST(tunnel_errors == 1);
+
+  // Nothing was charged as a timeout.
+  for (const auto& pair : dut.stats().destinations) {
+    BOOST_TEST(pair.second.timeouts == 0);
+  }
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientPipelineTest, Fixture) {
+  AsioClient::Options options;
+  options.max_in_flight = 3;
+  AsioClient dut(&bus, options);
+
+  std::vector<int> done;
+  for (int repeat = 0; repeat < 2; repeat++) {
+    for (uint8_t id : { 1, 2, 3 }) {
+      RegisterRequest request;
+      request.WriteSingle(0, Value(int8_t(1)));
+      request.ReadSingle(4, 2);
+      dut.AsyncRegister(id, request, [&done, id](const base::error_code& ec,
+                                                 const RegisterReply& reply) {
+          BOOST_TEST(!ec);
+          BOOST_TEST((reply.at(4) == ReadResult(Value(int32_t(id * 1000 + 4)))));
+          done.push_back(id);
+        });
+    }
+  }
+
+  Poll();
+  BOOST_TEST(done.size() == 6);
+  BOOST_TEST(node1.server.writes_.size() == 2);
+  BOOST_TEST(node2.server.writes_.size() == 2);
+  BOOST_TEST(node3.server.writes_.size() == 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientTunnelTest, Fixture) {
+  AsioClient dut(&bus);
+
+  auto* const server_tunnel = node2.dut.MakeTunnel(1);
+  char server_read[16] = {};
+  int server_read_done = 0;
+  server_tunnel->AsyncReadSome(
+      server_read, [&](const micro::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(std::string(server_read, size) == "hello");
+        server_read_done++;
+      });
+  int server_write_done = 0;
+  server_tunnel->AsyncWriteSome(
+      "world", [&](const micro::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(size == 5);
+        server_write_done++;
+      });
+
+  auto tunnel = dut.MakeTunnel(2, 1);
+
+  int write_done = 0;
+  tunnel->async_write_some(
+      boost::asio::buffer("hello", 5), [&](const base::error_code& ec,
+                                           size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(size == 5);
+        write_done++;
+      });
+
+  char read_data[16] = {};
+  int read_done = 0;
+  tunnel->async_read_some(
+      boost::asio::buffer(read_data), [&](const base::error_code& ec,
+                                          size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(std::string(read_data, size) == "world");
+        read_done++;
+      });
+
+  Poll();
+  BOOST_TEST(write_done == 1);
+  BOOST_TEST(read_done == 1);
+  BOOST_TEST(server_read_done == 1);
+  BOOST_TEST(server_write_done == 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientTunnelIdleTest, Fixture) {
+  AsioClient dut(&bus);
+
+  auto* const server_tunnel = node3.dut.MakeTunnel(2);
+
+  AsioClient::TunnelOptions options;
+  options.min_poll_period_s = 0.001;
+  options.max_poll_period_s = 0.004;
+  auto tunnel = dut.MakeTunnel(3, 2, options);
+
+  char read_data[16] = {};
+  int read_done = 0;
+  tunnel->async_read_some(
+      boost::asio::buffer(read_data), [&](const base::error_code& ec,
+                                          size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(std::string(read_data, size) == "later");
+        read_done++;
+      });
+
+  // Nothing is available, so the client should be backing off, but
+  // still polling.
+  Poll();
+  BOOST_TEST(read_done == 0);
+
+  boost::asio::deadline_timer timer(service);
+  timer.expires_from_now(boost::posix_time::milliseconds(20));
+  timer.async_wait([&](const boost::system::error_code&) {
+      server_tunnel->AsyncWriteSome(
+          "later", [](const micro::error_code&, size_t) {});
+    });
+
+  // The poll loop stops once the read has completed, so this will
+  // return.
+  service.run();
+  BOOST_TEST(read_done == 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientTunnelFlowControlTest, Fixture) {
+  AsioClient dut(&bus);
+
+  auto run_until = [&](auto condition) {
+    const auto end =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition() && std::chrono::steady_clock::now() < end) {
+      service.run_one();
+    }
+  };
+
+  auto* const server_console = node2.dut.MakeTunnel(1);
+  auto* const server_bulk = node2.dut.MakeTunnel(2);
+
+  AsioClient::TunnelOptions options;
+  options.max_poll_period_s = 0.002;
+  auto console = dut.MakeTunnel(2, 1, options);
+  auto bulk = dut.MakeTunnel(2, 2, options);
+
+  // Much more than the device can buffer.
+  std::string bulk_data;
+  for (int i = 0; i < 1000; i++) { bulk_data.push_back('a' + (i % 26)); }
+  bool bulk_done = false;
+  boost::asio::async_write(
+      *bulk, boost::asio::buffer(bulk_data),
+      [&](const base::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(size == bulk_data.size());
+        bulk_done = true;
+      });
+
+  // The console still gets through while the bulk channel is stuck.
+  char console_read[16] = {};
+  size_t console_size = 0;
+  server_console->AsyncReadSome(
+      console_read, [&](const micro::error_code& ec, size_t size) {
+        BOOST_TEST(!ec);
+        console_size = size;
+      });
+  console->async_write_some(
+      boost::asio::buffer("hello", 5),
+      [](const base::error_code& ec, size_t) { BOOST_TEST(!ec); });
+
+  run_until([&]() { return console_size != 0; });
+  BOOST_TEST(std::string(console_read, console_size) == "hello");
+  BOOST_TEST(!bulk_done);
+
+  // Now let the device drain the bulk channel.
+  std::string bulk_received;
+  char chunk[32] = {};
+  std::function<void ()> read_bulk = [&]() {
+    server_bulk->AsyncReadSome(
+        chunk, [&](const micro::error_code& ec, size_t size) {
+          BOOST_TEST(!ec);
+          bulk_received.append(chunk, size);
+          if (bulk_received.size() < bulk_data.size()) { read_bulk(); }
+        });
+  };
+  read_bulk();
+
+  run_until([&]() {
+      return bulk_done && bulk_received.size() == bulk_data.size();
+    });
+  BOOST_TEST(bulk_done);
+  BOOST_TEST(bulk_received == bulk_data);
+  BOOST_TEST(node2.dut.stats()->receive_overrun == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientGroupTest, Fixture) {
+  AsioClient dut(&bus);
+
+  GroupRequest group;
+  group.SetReplySlot(100);
+  {
+    RegisterRequest request;
+    request.WriteSingle(7, Value(int8_t(1)));
+    group.Add(1, request);
+  }
+  for (uint8_t id : { 3, 2 }) {
+    RegisterRequest request;
+    request.WriteSingle(8, Value(int8_t(id)));
+    request.ReadSingle(4, 2);
+    group.Add(id, request);
+  }
+  BOOST_TEST(group.request_reply());
+  BOOST_TEST((group.reply_ids() == std::vector<uint8_t>{3, 2}));
+
+  int done = 0;
+  dut.AsyncGroup(group, [&](const base::error_code& ec,
+                            const GroupReply& reply) {
+      BOOST_TEST(!ec);
+      BOOST_TEST(reply.size() == 2);
+      BOOST_TEST(reply.at(0).first == 3);
+      BOOST_TEST((reply.at(0).second.at(4) ==
+                  ReadResult(Value(int32_t(3004)))));
+      BOOST_TEST(reply.at(1).first == 2);
+      BOOST_TEST((reply.at(1).second.at(4) ==
+                  ReadResult(Value(int32_t(2004)))));
+      done++;
+    });
+
+  // Replies arrive in slot order, even though node 3 is last on the
+  // bus.
+  service.run();
+  BOOST_TEST(done == 1);
+
+  // Every node processed only its own block.
+  BOOST_TEST(node1.server.writes_.size() == 1);
+  BOOST_TEST(node1.server.writes_.at(0).reg == 7);
+  BOOST_TEST(node2.server.writes_.size() == 1);
+  BOOST_TEST(node2.server.writes_.at(0).reg == 8);
+  BOOST_TEST(node3.server.writes_.size() == 1);
+  BOOST_TEST(node3.server.writes_.at(0).reg == 8);
+  BOOST_TEST(node1.dut.stats()->wrong_id == 0);
+  BOOST_TEST(bus.stats().host_writes == 1);
+  BOOST_TEST(bus.stats().node_writes == 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(AsioClientGroupTimeoutTest, Fixture) {
+  AsioClient::Options options;
+  options.timeout = boost::posix_time::milliseconds(1);
+  AsioClient dut(&bus, options);
+
+  GroupRequest group;
+  for (uint8_t id : { 9, 1 }) {
+    RegisterRequest request;
+    request.ReadSingle(2, 2);
+    group.Add(id, request);
+  }
+
+  int done = 0;
+  dut.AsyncGroup(group, [&](const base::error_code& ec,
+                            const GroupReply& reply) {
+      BOOST_TEST(ec == boost::asio::error::operation_aborted);
+      BOOST_TEST(reply.size() == 1);
+      BOOST_TEST(reply.at(0).first == 1);
+      done++;
+    });
+
+  // Nothing else is sent until the broadcast is finished.
+  RegisterRequest request;
+  request.ReadSingle(3, 2);
+  int done2 = 0;
+  dut.AsyncRegister(2, request, [&](const base::error_code& ec,
+                                    const RegisterReply& reply) {
+      BOOST_TEST(!ec);
+      BOOST_TEST(done == 1);
+      BOOST_TEST((reply.at(3) == ReadResult(Value(int32_t(2003)))));
+      done2++;
+    });
+
+  service.run();
+  BOOST_TEST(done == 1);
+  BOOST_TEST(done2 == 1);
+}
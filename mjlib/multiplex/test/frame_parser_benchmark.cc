@@ -0,0 +1,200 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measures the throughput of FrameParser on a capture of bus
+/// traffic, and verifies that no memory is allocated per frame.
+///
+/// If no capture file is given, one is synthesized which resembles
+/// a 3Mbaud bus with 12 servos being commanded and queried in a
+/// loop.  In either case, noise is injected at the requested rate.
+///
+/// The capture may be a raw dump of bytes, which is fed in pieces of
+/// read_size, or a recording from the "capture" StreamFactory type,
+/// in which case what was read is fed in the original pieces.
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/base/test/allocation_counter.h"
+#include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/frame_parser.h"
+#include "mjlib/multiplex/test/load_capture.h"
+
+namespace base = mjlib::base;
+namespace po = boost::program_options;
+using namespace mjlib::multiplex;
+
+namespace {
+struct Options {
+  std::string capture;
+  int servos = 12;
+  int cycles = 1000;
+  int repeat = 200;
+  double noise_rate = 0.0005;
+  int read_size = 64;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(capture));
+    a->Visit(MJ_NVP(servos));
+    a->Visit(MJ_NVP(cycles));
+    a->Visit(MJ_NVP(repeat));
+    a->Visit(MJ_NVP(noise_rate));
+    a->Visit(MJ_NVP(read_size));
+  }
+};
+
+std::string SynthesizeCapture(const Options& options) {
+  std::string result;
+  for (int cycle = 0; cycle < options.cycles; cycle++) {
+    for (int servo = 1; servo <= options.servos; servo++) {
+      // A mode, position, velocity and torque command, with a query
+      // of 7 int16 registers.
+      result += Frame(0, true, servo, std::string(24, '\x11')).encode();
+      result += Frame(servo, false, 0, std::string(18, '\x22')).encode();
+    }
+  }
+  return result;
+}
+
+std::string InjectNoise(const std::string& input, double rate,
+                        std::mt19937* rng_ptr) {
+  auto& rng = *rng_ptr;
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  std::uniform_int_distribution<int> byte(0, 255);
+
+  std::string result;
+  result.reserve(input.size() + input.size() / 100);
+  for (const char c : input) {
+    if (chance(rng) < rate) {
+      // Either a spurious byte, or a corrupted one.
+      if (chance(rng) < 0.5) {
+        result.push_back(static_cast<char>(byte(rng)));
+        result.push_back(c);
+      } else {
+        result.push_back(static_cast<char>(c ^ (1 << (byte(rng) % 8))));
+      }
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  const auto clean = [&]() {
+    if (options.capture.empty()) {
+      test::LoadedCapture result;
+      result.data = SynthesizeCapture(options);
+      return result;
+    }
+    return test::LoadCapture(options.capture, false);
+  }();
+
+  // Noise is added to each original piece separately, so that the
+  // boundaries stay where they were.
+  std::mt19937 rng(1234);
+  std::string capture;
+  std::vector<size_t> chunks;
+  {
+    size_t offset = 0;
+    for (const auto size : clean.chunks) {
+      const auto noisy = InjectNoise(
+          clean.data.substr(offset, size), options.noise_rate, &rng);
+      offset += size;
+      capture += noisy;
+      chunks.push_back(noisy.size());
+    }
+    if (clean.chunks.empty()) {
+      capture = InjectNoise(clean.data, options.noise_rate, &rng);
+    }
+  }
+
+  FrameParser parser;
+  size_t payload_bytes = 0;
+
+  const size_t allocations_before = base::AllocationCount();
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < options.repeat; i++) {
+    size_t offset = 0;
+    size_t chunk = 0;
+    size_t chunk_remaining = 0;
+    while (offset < capture.size()) {
+      if (chunk_remaining == 0) {
+        chunk_remaining = chunks.empty() ?
+            options.read_size : chunks[chunk++];
+      }
+
+      auto span = parser.prepare();
+      const size_t to_copy = std::min<size_t>(
+          std::min<size_t>(span.size(), chunk_remaining),
+          capture.size() - offset);
+      std::memcpy(span.data(), &capture[offset], to_copy);
+      parser.commit(to_copy);
+      offset += to_copy;
+      chunk_remaining -= to_copy;
+
+      while (auto maybe_frame = parser.Parse()) {
+        payload_bytes += maybe_frame->payload.size();
+      }
+    }
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+  const size_t allocations = base::AllocationCount() - allocations_before;
+
+  const double elapsed_s = std::chrono::duration<double>(end - start).count();
+  const auto& stats = parser.stats();
+  const double total_bytes =
+      static_cast<double>(capture.size()) * options.repeat;
+
+  std::cout << "capture_bytes: " << capture.size() << "\n"
+            << "frames: " << stats.frames << "\n"
+            << "checksum_mismatch: " << stats.checksum_mismatch << "\n"
+            << "discarded_bytes: " << stats.discarded_bytes << "\n"
+            << "payload_bytes: " << payload_bytes << "\n"
+            << "elapsed_s: " << elapsed_s << "\n"
+            << "frames_per_s: " << stats.frames / elapsed_s << "\n"
+            << "MB_per_s: " << total_bytes / elapsed_s / 1e6 << "\n"
+            << "allocations_per_frame: "
+            << static_cast<double>(allocations) / stats.frames << "\n";
+
+  return 0;
+}
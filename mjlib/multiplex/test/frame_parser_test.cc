@@ -0,0 +1,131 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/multiplex/frame_parser.h"
+
+#include <cstring>
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/multiplex/frame.h"
+
+using mjlib::multiplex::Frame;
+using mjlib::multiplex::FrameParser;
+
+namespace {
+void Feed(FrameParser* parser, const std::string& data) {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    auto span = parser->prepare();
+    const size_t to_copy = std::min<size_t>(
+        span.size(), data.size() - offset);
+    std::memcpy(span.data(), &data[offset], to_copy);
+    parser->commit(to_copy);
+    offset += to_copy;
+  }
+}
+}
+
+BOOST_AUTO_TEST_CASE(FrameParserBasicTest) {
+  FrameParser dut;
+
+  BOOST_TEST(!dut.Parse());
+
+  // Deliver a frame one byte at a time.
+  const std::string data("\x54\xab\x84\x05\x01\x20\xd4\x55", 8);
+  BOOST_TEST(Frame(4, true, 5, " ").encode() == data);
+  for (size_t i = 0; i + 1 < data.size(); i++) {
+    Feed(&dut, data.substr(i, 1));
+    BOOST_TEST(!dut.Parse());
+  }
+  Feed(&dut, data.substr(data.size() - 1));
+
+  const auto maybe_frame = dut.Parse();
+  BOOST_TEST_REQUIRE(!!maybe_frame);
+  BOOST_TEST(maybe_frame->source_id == 4);
+  BOOST_TEST(maybe_frame->request_reply == true);
+  BOOST_TEST(maybe_frame->dest_id == 5);
+  BOOST_TEST(maybe_frame->payload == " ");
+
+  BOOST_TEST(!dut.Parse());
+  BOOST_TEST(dut.size() == 0);
+  BOOST_TEST(dut.stats().frames == 1);
+  BOOST_TEST(dut.stats().discarded_bytes == 0);
+}
+
+BOOST_AUTO_TEST_CASE(FrameParserNoiseTest) {
+  FrameParser dut;
+
+  const std::string frame1 = Frame(1, false, 2, "abc").encode();
+  const std::string frame2 = Frame(3, false, 4, "defg").encode();
+  std::string corrupt = frame1;
+  corrupt[6] ^= 0x10;
+
+  // Garbage, a false header, a frame with a bad checksum, a header
+  // preceded by a stray first header byte, and then a good frame.
+  Feed(&dut, std::string("\x01\x54\x02", 3) + corrupt + "\x54" + frame1 +
+       frame2);
+
+  auto maybe_frame = dut.Parse();
+  BOOST_TEST_REQUIRE(!!maybe_frame);
+  BOOST_TEST(maybe_frame->source_id == 1);
+  BOOST_TEST(maybe_frame->payload == "abc");
+
+  maybe_frame = dut.Parse();
+  BOOST_TEST_REQUIRE(!!maybe_frame);
+  BOOST_TEST(maybe_frame->source_id == 3);
+  BOOST_TEST(maybe_frame->payload == "defg");
+
+  BOOST_TEST(!dut.Parse());
+  BOOST_TEST(dut.stats().frames == 2);
+  BOOST_TEST(dut.stats().checksum_mismatch == 1);
+  BOOST_TEST(dut.stats().discarded_bytes == 4 + corrupt.size());
+  // All of that was one stretch without a valid frame.
+  BOOST_TEST(dut.stats().resyncs == 1);
+
+  Feed(&dut, "\x01" + frame1);
+  BOOST_TEST(!!dut.Parse());
+  BOOST_TEST(dut.stats().resyncs == 2);
+}
+
+BOOST_AUTO_TEST_CASE(FrameParserWrapTest) {
+  FrameParser dut(1024);
+
+  const std::string payload(100, 'x');
+  const std::string frame = Frame(1, false, 2, payload).encode();
+
+  // Feed enough data that frames end up straddling the end of the
+  // buffer many times over, delivering them in uneven pieces.
+  std::string data;
+  for (int i = 0; i < 50; i++) { data += frame; }
+
+  int count = 0;
+  size_t offset = 0;
+  while (offset < data.size()) {
+    auto span = dut.prepare();
+    const size_t to_copy = std::min<size_t>(
+        std::min<size_t>(span.size(), 77), data.size() - offset);
+    std::memcpy(span.data(), &data[offset], to_copy);
+    dut.commit(to_copy);
+    offset += to_copy;
+
+    while (auto maybe_frame = dut.Parse()) {
+      BOOST_TEST(maybe_frame->payload == payload);
+      count++;
+    }
+  }
+
+  BOOST_TEST(count == 50);
+  BOOST_TEST(dut.stats().discarded_bytes == 0);
+}
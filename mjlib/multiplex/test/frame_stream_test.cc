@@ -97,3 +97,67 @@ BOOST_FIXTURE_TEST_CASE(FrameStreamReadTest, Fixture) {
   BOOST_TEST(to_receive.dest_id == 5);
   BOOST_TEST(to_receive.payload == " ");
 }
+
+BOOST_FIXTURE_TEST_CASE(FrameStreamReadSequentialTest, Fixture) {
+  int write_done = 0;
+  boost::asio::async_write(
+      *server_side,
+      boost::asio::buffer(
+          "\x54\xab\x04\x05\x01\x20\xec\x88"
+          "\x54\xab\x06\x05\x00\x04\x34", 15),
+      [&](auto&& ec, size_t size) {
+        mjlib::base::FailIf(ec);
+        write_done++;
+      });
+
+  Frame to_receive;
+  int read_done = 0;
+
+  dut.AsyncRead(&to_receive, {}, [&](auto&& ec) {
+      mjlib::base::FailIf(ec);
+      read_done++;
+    });
+
+  Poll();
+  BOOST_TEST(write_done == 1);
+  BOOST_TEST(read_done == 1);
+  BOOST_TEST(to_receive.source_id == 4);
+
+  // The first frame should have been consumed, so that the next read
+  // sees the second one.
+  dut.AsyncRead(&to_receive, {}, [&](auto&& ec) {
+      mjlib::base::FailIf(ec);
+      read_done++;
+    });
+
+  Poll();
+  BOOST_TEST(read_done == 2);
+  BOOST_TEST(to_receive.source_id == 6);
+  BOOST_TEST(to_receive.payload.empty());
+}
+
+BOOST_FIXTURE_TEST_CASE(FrameStreamReadViewTest, Fixture) {
+  int write_done = 0;
+  boost::asio::async_write(
+      *server_side,
+      boost::asio::buffer("\x54\xab\x04\x05\x01\x20\xec\x88", 8),
+      [&](auto&& ec, size_t size) {
+        mjlib::base::FailIf(ec);
+        write_done++;
+      });
+
+  mjlib::multiplex::FrameView to_receive;
+  int read_done = 0;
+
+  dut.AsyncRead(&to_receive, {}, [&](auto&& ec) {
+      mjlib::base::FailIf(ec);
+      read_done++;
+    });
+
+  Poll();
+  BOOST_TEST(write_done == 1);
+  BOOST_TEST(read_done == 1);
+  BOOST_TEST(to_receive.source_id == 4);
+  BOOST_TEST(to_receive.dest_id == 5);
+  BOOST_TEST(to_receive.payload == " ");
+}
@@ -25,3 +25,27 @@ BOOST_AUTO_TEST_CASE(BasicFrameTest) {
   auto result = dut.encode();
   BOOST_TEST(result == std::string("\x54\xab\x01\x02\x00\x03\x28", 7));
 }
+
+BOOST_AUTO_TEST_CASE(PayloadFrameTest) {
+  mjlib::multiplex::Frame dut(4, false, 5, " ");
+  auto result = dut.encode();
+  BOOST_TEST(result == std::string("\x54\xab\x04\x05\x01\x20\xec\x88", 8));
+}
+
+BOOST_AUTO_TEST_CASE(BufferFrameTest) {
+  const std::string payload(200, 'x');
+  mjlib::multiplex::Frame dut(4, true, 5, payload);
+  const std::string expected = dut.encode();
+  BOOST_TEST(dut.encoded_size() == expected.size());
+
+  char buffer[256] = {};
+  const auto size = dut.encode(buffer);
+  BOOST_TEST(std::string(buffer, size) == expected);
+
+  // The envelope plus the payload should be identical.
+  mjlib::multiplex::FrameEnvelope envelope;
+  dut.encode(&envelope);
+  BOOST_TEST(envelope.header_size == 6);
+  BOOST_TEST(std::string(envelope.header, envelope.header_size) +
+             payload + std::string(envelope.crc, 2) == expected);
+}
@@ -0,0 +1,77 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/io/capture_file.h"
+
+namespace mjlib {
+namespace multiplex {
+namespace test {
+
+struct LoadedCapture {
+  std::string data;
+
+  /// The size of each chunk in which data originally arrived.  Empty
+  /// if that is not known.
+  std::vector<size_t> chunks;
+};
+
+/// Load either a raw dump of bus traffic, or a file recorded by the
+/// "capture" io::StreamFactory type.  For the latter, writes are only
+/// included if @p include_writes is true, as when the far end of the
+/// stream is sharing a bus with the recording side.
+inline LoadedCapture LoadCapture(const std::string& filename,
+                                 bool include_writes) {
+  LoadedCapture result;
+
+  {
+    std::ifstream inf(filename, std::ios::binary);
+    if (!inf.is_open()) {
+      base::Fail("could not open: " + filename);
+    }
+    char header[8] = {};
+    inf.read(header, sizeof(header));
+    if (!inf || std::memcmp(header, "MJCAPT01", sizeof(header)) != 0) {
+      inf.clear();
+      inf.seekg(0);
+      std::ostringstream ostr;
+      ostr << inf.rdbuf();
+      result.data = ostr.str();
+      return result;
+    }
+  }
+
+  io::CaptureReader reader(filename);
+  while (auto maybe_record = reader.Read()) {
+    if (maybe_record->direction == io::CaptureRecord::kWrite &&
+        !include_writes) {
+      continue;
+    }
+    result.data += maybe_record->data;
+    result.chunks.push_back(maybe_record->data.size());
+  }
+  return result;
+}
+
+}
+}
+}
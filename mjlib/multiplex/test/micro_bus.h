@@ -0,0 +1,173 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+#include "mjlib/io/async_stream.h"
+#include "mjlib/micro/async_stream.h"
+
+namespace mjlib {
+namespace multiplex {
+namespace test {
+
+/// Connects a single host side io::AsyncStream to any number of
+/// micro::AsyncStreams, as on a multi-drop bus.  Everything written
+/// by the host is delivered to every node, and everything written by
+/// any node is delivered to the host.  All callbacks are posted to
+/// the io_service, so that MicroServer instances run in the same
+/// event loop as the host side code.
+class MicroBus : public io::AsyncStream {
+ public:
+  MicroBus(boost::asio::io_service& service) : service_(service) {}
+  ~MicroBus() override {}
+
+  micro::AsyncStream* AddNode() {
+    nodes_.emplace_back(std::make_unique<Node>(this));
+    return nodes_.back().get();
+  }
+
+  /// Totals of everything written to the bus, for estimating how
+  /// long the same traffic would occupy a real one.
+  struct Stats {
+    uint64_t host_writes = 0;
+    uint64_t host_bytes = 0;
+    uint64_t node_writes = 0;
+    uint64_t node_bytes = 0;
+  };
+
+  const Stats& stats() const { return stats_; }
+
+  boost::asio::io_service& get_io_service() override { return service_; }
+
+  void async_read_some(io::MutableBufferSequence buffers,
+                       io::ReadHandler handler) override {
+    BOOST_ASSERT(!read_handler_);
+    read_buffers_ = buffers;
+    read_handler_ = handler;
+    MaybeCompleteRead();
+  }
+
+  void async_write_some(io::ConstBufferSequence buffers,
+                        io::WriteHandler handler) override {
+    const auto size = boost::asio::buffer_size(buffers);
+    std::string data(size, '\0');
+    boost::asio::buffer_copy(boost::asio::buffer(data), buffers);
+    stats_.host_writes++;
+    stats_.host_bytes += size;
+    for (auto& node : nodes_) {
+      node->Receive(data);
+    }
+    service_.post(std::bind(handler, base::error_code(), size));
+  }
+
+  void cancel() override {
+    if (read_handler_) {
+      service_.post(std::bind(read_handler_,
+                              boost::asio::error::operation_aborted, 0));
+      read_handler_ = {};
+    }
+  }
+
+ private:
+  class Node : public micro::AsyncStream {
+   public:
+    Node(MicroBus* parent) : parent_(parent) {}
+    ~Node() override {}
+
+    void AsyncReadSome(const base::string_span& buffer,
+                       const micro::SizeCallback& callback) override {
+      BOOST_ASSERT(!read_callback_.valid());
+      read_buffer_ = buffer;
+      read_callback_ = callback;
+      MaybeCompleteRead();
+    }
+
+    void AsyncWriteSome(const std::string_view& buffer,
+                        const micro::SizeCallback& callback) override {
+      parent_->Receive(buffer);
+      const ssize_t size = buffer.size();
+      parent_->stats_.node_writes++;
+      parent_->stats_.node_bytes += size;
+      parent_->service_.post([callback, size]() {
+          callback({}, size);
+        });
+    }
+
+    void Receive(const std::string_view& data) {
+      inbound_.append(data.data(), data.size());
+      MaybeCompleteRead();
+    }
+
+   private:
+    void MaybeCompleteRead() {
+      if (!read_callback_.valid() || inbound_.empty()) { return; }
+
+      const ssize_t size = std::min<ssize_t>(
+          read_buffer_.size(), inbound_.size());
+      std::memcpy(read_buffer_.data(), inbound_.data(), size);
+      inbound_.erase(0, size);
+
+      auto callback = read_callback_;
+      read_callback_ = {};
+      read_buffer_ = {};
+      parent_->service_.post([callback, size]() {
+          callback({}, size);
+        });
+    }
+
+    MicroBus* const parent_;
+    std::string inbound_;
+    base::string_span read_buffer_;
+    micro::SizeCallback read_callback_;
+  };
+
+  void Receive(const std::string_view& data) {
+    inbound_.append(data.data(), data.size());
+    MaybeCompleteRead();
+  }
+
+  void MaybeCompleteRead() {
+    if (!read_handler_ || inbound_.empty()) { return; }
+
+    const auto size = boost::asio::buffer_copy(
+        read_buffers_, boost::asio::buffer(inbound_));
+    inbound_.erase(0, size);
+
+    auto handler = read_handler_;
+    read_handler_ = {};
+    service_.post(std::bind(handler, base::error_code(), size));
+  }
+
+  boost::asio::io_service& service_;
+  std::vector<std::unique_ptr<Node>> nodes_;
+
+  std::string inbound_;
+  io::MutableBufferSequence read_buffers_;
+  io::ReadHandler read_handler_;
+
+  Stats stats_;
+};
+
+}
+}
+}
@@ -0,0 +1,294 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Replays a capture of multi-servo bus traffic through a single
+/// MicroServer, as one node on that bus would see it, and reports the
+/// CPU time spent per frame.
+///
+/// If no capture file is given, one is synthesized where the host
+/// commands and queries each of a number of servos in turn, and each
+/// servo replies.  The node under test answers to only one of those
+/// ids, so most frames exercise the path which discards frames for
+/// other nodes.
+///
+/// The capture may be a raw dump of bus bytes, which is fed in pieces
+/// of read_size, or a recording from the "capture" StreamFactory type
+/// taken on the host.  In the latter case, both what the host wrote
+/// and what it read are fed, as a node on the bus hears both, in the
+/// pieces in which they originally passed.
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/micro/async_stream.h"
+#include "mjlib/micro/pool_ptr.h"
+#include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/micro_server.h"
+#include "mjlib/multiplex/register.h"
+#include "mjlib/multiplex/stream.h"
+#include "mjlib/multiplex/test/load_capture.h"
+
+namespace base = mjlib::base;
+namespace micro = mjlib::micro;
+namespace po = boost::program_options;
+using namespace mjlib::multiplex;
+
+namespace {
+struct Options {
+  std::string capture;
+  int servos = 12;
+  int id = 1;
+  int cycles = 1000;
+  int repeat = 50;
+  int read_size = 64;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(capture));
+    a->Visit(MJ_NVP(servos));
+    a->Visit(MJ_NVP(id));
+    a->Visit(MJ_NVP(cycles));
+    a->Visit(MJ_NVP(repeat));
+    a->Visit(MJ_NVP(read_size));
+  }
+};
+
+std::string SynthesizeCapture(const Options& options) {
+  // A mode, position, velocity and torque command, with a query of 7
+  // int16 registers.
+  RegisterRequest request;
+  request.WriteSingle(0x000, Format::Value(static_cast<int8_t>(10)));
+  request.WriteMultiple(0x020, {
+      Format::Value(0.5f),
+      Format::Value(0.0f),
+      Format::Value(3.0f),
+    });
+  request.ReadMultiple(0x000, 7, 1);
+
+  base::FastOStringStream reply_stream;
+  {
+    WriteStream stream{reply_stream};
+    for (uint32_t reg = 0; reg < 7; reg++) {
+      stream.WriteVaruint(0x21);
+      stream.WriteVaruint(reg);
+      stream.Write(static_cast<int16_t>(reg * 100));
+    }
+  }
+  const std::string reply_payload = reply_stream.str();
+
+  std::string result;
+  for (int cycle = 0; cycle < options.cycles; cycle++) {
+    for (int servo = 1; servo <= options.servos; servo++) {
+      result += Frame(0, true, servo, std::string(request.buffer())).encode();
+      result += Frame(servo, false, 0, reply_payload).encode();
+    }
+  }
+  return result;
+}
+
+size_t CountFrames(const std::string& capture) {
+  size_t result = 0;
+  for (size_t i = 0; i + 1 < capture.size(); i++) {
+    if (static_cast<uint8_t>(capture[i]) == 0x54 &&
+        static_cast<uint8_t>(capture[i + 1]) == 0xab) {
+      result++;
+    }
+  }
+  return result;
+}
+
+/// Hands out the capture in fixed size pieces, as a UART DMA would,
+/// or in the pieces it was recorded in, and completes writes
+/// immediately.  All completions are driven from Poll so that the
+/// call stack never grows.
+class ReplayStream : public micro::AsyncStream {
+ public:
+  ReplayStream(const test::LoadedCapture& capture, size_t read_size)
+      : capture_(capture.data),
+        chunks_(capture.chunks),
+        read_size_(read_size) {}
+
+  ~ReplayStream() override {}
+
+  void AsyncReadSome(const base::string_span& buffer,
+                     const micro::SizeCallback& callback) override {
+    read_buffer_ = buffer;
+    read_callback_ = callback;
+  }
+
+  void AsyncWriteSome(const std::string_view& buffer,
+                      const micro::SizeCallback& callback) override {
+    write_size_ = buffer.size();
+    write_callback_ = callback;
+  }
+
+  void Rewind() {
+    offset_ = 0;
+    chunk_ = 0;
+    chunk_remaining_ = 0;
+  }
+
+  /// @return false once the capture has been exhausted.
+  bool Poll() {
+    if (write_callback_.valid()) {
+      auto callback = write_callback_;
+      write_callback_ = {};
+      written_bytes_ += write_size_;
+      callback({}, write_size_);
+    }
+
+    if (offset_ >= capture_.size()) { return false; }
+
+    if (read_callback_.valid()) {
+      if (chunk_remaining_ == 0) {
+        chunk_remaining_ = chunks_.empty() ? read_size_ : chunks_[chunk_++];
+      }
+      const size_t to_copy = std::min<size_t>(
+          std::min<size_t>(read_buffer_.size(), chunk_remaining_),
+          capture_.size() - offset_);
+      std::memcpy(read_buffer_.data(), &capture_[offset_], to_copy);
+      offset_ += to_copy;
+      chunk_remaining_ -= to_copy;
+      reads_++;
+
+      auto callback = read_callback_;
+      read_callback_ = {};
+      read_buffer_ = {};
+      callback({}, to_copy);
+    }
+
+    return true;
+  }
+
+  size_t reads() const { return reads_; }
+  size_t written_bytes() const { return written_bytes_; }
+
+ private:
+  const std::string& capture_;
+  const std::vector<size_t>& chunks_;
+  const size_t read_size_;
+  size_t offset_ = 0;
+  size_t chunk_ = 0;
+  size_t chunk_remaining_ = 0;
+  size_t reads_ = 0;
+
+  base::string_span read_buffer_;
+  micro::SizeCallback read_callback_;
+
+  ssize_t write_size_ = 0;
+  micro::SizeCallback write_callback_;
+  size_t written_bytes_ = 0;
+};
+
+class Server : public MicroServer::Server {
+ public:
+  uint32_t Write(MicroServer::Register reg,
+                 const MicroServer::Value& value) override {
+    if (reg >= kNumRegisters) { return 1; }
+    values_[reg] = std::visit([](auto v) { return static_cast<float>(v); },
+                              value);
+    return 0;
+  }
+
+  MicroServer::ReadResult Read(
+      MicroServer::Register reg, size_t type_index) const override {
+    if (reg >= kNumRegisters) { return static_cast<uint32_t>(1); }
+    const float value = values_[reg];
+    switch (type_index) {
+      case 0: return MicroServer::Value(static_cast<int8_t>(value));
+      case 1: return MicroServer::Value(static_cast<int16_t>(value));
+      case 2: return MicroServer::Value(static_cast<int32_t>(value));
+      case 3: return MicroServer::Value(value);
+    }
+    return static_cast<uint32_t>(2);
+  }
+
+ private:
+  static constexpr uint32_t kNumRegisters = 0x30;
+  float values_[kNumRegisters] = {};
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  const auto loaded = [&]() {
+    if (options.capture.empty()) {
+      test::LoadedCapture result;
+      result.data = SynthesizeCapture(options);
+      return result;
+    }
+    return test::LoadCapture(options.capture, true);
+  }();
+  const std::string& capture = loaded.data;
+  const size_t capture_frames = CountFrames(capture);
+
+  micro::SizedPool<> pool;
+  ReplayStream stream{loaded, static_cast<size_t>(options.read_size)};
+  Server server;
+  MicroServer dut{&pool, &stream, [&]() {
+      MicroServer::Options server_options;
+      server_options.default_id = options.id;
+      return server_options;
+    }()};
+  dut.Start(&server);
+
+  const std::clock_t start = std::clock();
+
+  for (int i = 0; i < options.repeat; i++) {
+    stream.Rewind();
+    while (stream.Poll());
+  }
+
+  const std::clock_t end = std::clock();
+
+  const double cpu_s = static_cast<double>(end - start) / CLOCKS_PER_SEC;
+  const double frames =
+      static_cast<double>(capture_frames) * options.repeat;
+  const auto& stats = *dut.stats();
+
+  std::cout << "capture_bytes: " << capture.size() << "\n"
+            << "frames: " << frames << "\n"
+            << "wrong_id: " << stats.wrong_id << "\n"
+            << "checksum_mismatch: " << stats.checksum_mismatch << "\n"
+            << "reads: " << stream.reads() << "\n"
+            << "reply_bytes: " << stream.written_bytes() << "\n"
+            << "cpu_s: " << cpu_s << "\n"
+            << "ns_per_frame: " << cpu_s * 1e9 / frames << "\n";
+
+  return 0;
+}
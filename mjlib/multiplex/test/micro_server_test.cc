@@ -14,11 +14,15 @@
 
 #include "mjlib/multiplex/micro_server.h"
 
+#include <functional>
+
 #include <boost/test/auto_unit_test.hpp>
 
 #include "mjlib/micro/stream_pipe.h"
 #include "mjlib/micro/test/persistent_config_fixture.h"
 #include "mjlib/micro/test/str.h"
+#include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/register.h"
 
 namespace base = mjlib::base;
 using namespace mjlib::multiplex;
@@ -31,12 +35,14 @@ class Server : public MicroServer::Server {
  public:
   uint32_t Write(MicroServer::Register reg,
                  const MicroServer::Value& value) override {
+    BOOST_TEST(in_frame_);
     writes_.push_back({reg, value});
     return next_write_error_;
   }
 
   MicroServer::ReadResult Read(
       MicroServer::Register reg, size_t type_index) const override {
+    BOOST_TEST(in_frame_);
     if (type_index == 2) {
       return MicroServer::Value(int32_values.at(reg));
     } else if (type_index == 3) {
@@ -45,14 +51,56 @@ class Server : public MicroServer::Server {
     return static_cast<uint32_t>(1);
   }
 
+  void WriteMultiple(MicroServer::Register start,
+                     const MicroServer::Value* values,
+                     size_t count, uint32_t* errors) override {
+    write_blocks_.push_back({start, count});
+    MicroServer::Server::WriteMultiple(start, values, count, errors);
+  }
+
+  void ReadMultiple(MicroServer::Register start, size_t count,
+                    size_t type_index,
+                    MicroServer::ReadResult* results) const override {
+    read_blocks_.push_back({start, count});
+    MicroServer::Server::ReadMultiple(start, count, type_index, results);
+  }
+
+  void StartFrame() override {
+    BOOST_TEST(!in_frame_);
+    in_frame_ = true;
+    frames_started_++;
+  }
+
+  void FinishFrame() override {
+    BOOST_TEST(in_frame_);
+    in_frame_ = false;
+    frames_finished_++;
+  }
+
   struct WriteValue {
     MicroServer::Register reg;
     MicroServer::Value value;
   };
 
+  struct Block {
+    MicroServer::Register start;
+    size_t count;
+
+    bool operator==(const Block& rhs) const {
+      return start == rhs.start && count == rhs.count;
+    }
+  };
+
   std::vector<WriteValue> writes_;
   uint32_t next_write_error_ = 0;
 
+  std::vector<Block> write_blocks_;
+  mutable std::vector<Block> read_blocks_;
+
+  bool in_frame_ = false;
+  int frames_started_ = 0;
+  int frames_finished_ = 0;
+
   std::map<uint32_t, int32_t> int32_values = {
     { 9, 0x09080706, },
   };
@@ -401,6 +449,31 @@ BOOST_FIXTURE_TEST_CASE(WriteMultipleTest, Fixture) {
 
   BOOST_TEST(server.writes_.at(2).reg == 7);
   BOOST_TEST(std::get<int16_t>(server.writes_.at(2).value) == 0x0305);
+
+  // The whole range was handed over at once.
+  BOOST_TEST(server.write_blocks_.size() == 1);
+  BOOST_TEST((server.write_blocks_.at(0) == Server::Block{5, 3}));
+}
+
+BOOST_FIXTURE_TEST_CASE(FrameHookTest, Fixture) {
+  // A frame for another node, then one for us.
+  const std::string data =
+      std::string(str(kClientToServer2)) + std::string(str(kWriteMultiple));
+  int write_count = 0;
+  AsyncWrite(*dut_stream.side_a(), data,
+             [&](micro::error_code ec) {
+               BOOST_TEST(!ec);
+               write_count++;
+             });
+
+  event_queue.Poll();
+  BOOST_TEST(write_count == 1);
+
+  // The hooks bracket only the frame which was addressed to us.
+  BOOST_TEST(server.frames_started_ == 1);
+  BOOST_TEST(server.frames_finished_ == 1);
+  BOOST_TEST(!server.in_frame_);
+  BOOST_TEST(server.writes_.size() == 3);
 }
 
 BOOST_FIXTURE_TEST_CASE(WriteErrorTest, Fixture) {
@@ -555,4 +628,612 @@ BOOST_FIXTURE_TEST_CASE(ReadMultipleTest, Fixture) {
 
   BOOST_TEST(std::string_view(receive_buffer, read_size) ==
              str(kExpectedResponse));
+
+  BOOST_TEST(server.read_blocks_.size() == 1);
+  BOOST_TEST((server.read_blocks_.at(0) == Server::Block{10, 2}));
+}
+
+BOOST_FIXTURE_TEST_CASE(ReadMultipleBlockTest, Fixture) {
+  // Long ranges are handed to the server in bounded blocks.
+  const std::string request =
+      Frame(2, true, 1, std::string("\x1c\x00\x14", 3)).encode();
+  int write_count = 0;
+  AsyncWrite(*dut_stream.side_a(), request,
+             [&](micro::error_code ec) {
+               BOOST_TEST(!ec);
+               write_count++;
+             });
+
+  event_queue.Poll();
+  BOOST_TEST(write_count == 1);
+
+  BOOST_TEST(server.read_blocks_.size() == 2);
+  BOOST_TEST((server.read_blocks_.at(0) == Server::Block{0, 16}));
+  BOOST_TEST((server.read_blocks_.at(1) == Server::Block{16, 4}));
+}
+
+BOOST_FIXTURE_TEST_CASE(ServerTestIncremental, Fixture) {
+  char read_buffer[100] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  tunnel->AsyncReadSome(read_buffer, [&](micro::error_code ec, ssize_t size) {
+      BOOST_TEST(!ec);
+      read_count++;
+      read_size = size;
+    });
+
+  // Some noise, a false start, and a complete frame with a bad
+  // checksum, followed by a valid frame delivered one byte at a time.
+  const std::string noise("\x11\x54\x01\x54\xab\x82\x01\x03\x40\x09\x00\x00\x00",
+                          13);
+  std::string data = noise + std::string(str(kClientToServer));
+
+  for (char c : data) {
+    int write_count = 0;
+    AsyncWrite(*dut_stream.side_a(), std::string_view(&c, 1),
+               [&](micro::error_code ec) {
+                 BOOST_TEST(!ec);
+                 write_count++;
+               });
+    event_queue.Poll();
+    BOOST_TEST(write_count == 1);
+  }
+
+  BOOST_TEST(read_count == 1);
+  BOOST_TEST(read_size == 8);
+  BOOST_TEST(std::string_view(read_buffer, 8) == "test and");
+  BOOST_TEST(dut.stats()->checksum_mismatch == 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(ServerTestDenseHeaders, Fixture) {
+  char read_buffer[100] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  tunnel->AsyncReadSome(read_buffer, [&](micro::error_code ec, ssize_t size) {
+      BOOST_TEST(!ec);
+      read_count++;
+      read_size = size;
+    });
+
+  // A frame with a bad checksum, whose payload is nothing but header
+  // bytes, each pair of which looks like the start of another frame.
+  std::string header_pairs;
+  for (int i = 0; i < 100; i++) { header_pairs += "\x54\xab"; }
+  std::string data =
+      Frame(2, false, 1, header_pairs).encode();
+  data[data.size() - 1] ^= 0x01;
+  data += std::string(str(kClientToServer));
+
+  AsyncWrite(*dut_stream.side_a(), data,
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+
+  // The bad frame was rejected as a whole, without trying any of the
+  // headers inside of it.
+  BOOST_TEST(dut.stats()->checksum_mismatch == 1);
+  BOOST_TEST(read_count == 1);
+  BOOST_TEST(std::string_view(read_buffer, read_size) == "test and");
+}
+
+BOOST_FIXTURE_TEST_CASE(ServerTestWrap, Fixture) {
+  // Feed enough frames, in pieces which don't line up with frame
+  // boundaries, that the receive buffer wraps around many times.
+  std::string received;
+  char read_buffer[16] = {};
+  std::function<void ()> start_read = [&]() {
+    tunnel->AsyncReadSome(read_buffer, [&](micro::error_code ec,
+                                           ssize_t size) {
+        BOOST_TEST(!ec);
+        received += std::string(read_buffer, size);
+        start_read();
+      });
+  };
+  start_read();
+
+  std::string data;
+  for (int i = 0; i < 40; i++) {
+    data += str(kClientToServer);
+    data += str(kClientToServer2);
+  }
+
+  for (size_t offset = 0; offset < data.size(); offset += 7) {
+    const auto chunk = std::string_view(data).substr(offset, 7);
+    int write_count = 0;
+    AsyncWrite(*dut_stream.side_a(), chunk,
+               [&](micro::error_code ec) {
+                 BOOST_TEST(!ec);
+                 write_count++;
+               });
+    event_queue.Poll();
+    BOOST_TEST(write_count == 1);
+  }
+
+  std::string expected;
+  for (int i = 0; i < 40; i++) { expected += "test and"; }
+  BOOST_TEST(received == expected);
+  BOOST_TEST(dut.stats()->wrong_id == 40);
+  BOOST_TEST(dut.stats()->checksum_mismatch == 0);
+}
+
+namespace {
+struct GroupFixture : test::PersistentConfigFixture {
+  micro::StreamPipe dut_stream{event_queue.MakePoster()};
+
+  Server server;
+
+  int delay_count = 0;
+  uint32_t delay_us = 0;
+  micro::VoidCallback delay_callback;
+
+  MicroServer dut{&pool, dut_stream.side_b(), [&]() {
+      MicroServer::Options options;
+      options.reply_delay = [this](uint32_t delay,
+                                   const micro::VoidCallback& callback) {
+        delay_count++;
+        delay_us = delay;
+        delay_callback = callback;
+      };
+      return options;
+    }()};
+
+  GroupFixture() {
+    dut.Start(&server);
+  }
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(GroupBlockTest, GroupFixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  dut_stream.side_a()->AsyncReadSome(
+      receive_buffer, [&](micro::error_code ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        read_count++;
+        read_size = size;
+      });
+
+  GroupRequest group;
+  group.SetReplySlot(50);
+  {
+    RegisterRequest request;
+    request.WriteSingle(3, MicroServer::Value(int8_t(7)));
+    request.ReadSingle(11, 3);
+    group.Add(5, request);
+  }
+  {
+    RegisterRequest request;
+    request.WriteSingle(4, MicroServer::Value(int8_t(2)));
+    request.ReadSingle(10, 3);
+    group.Add(1, request);
+  }
+
+  const std::string frame =
+      Frame(2, true, Format::kBroadcastId, std::string(group.buffer()))
+      .encode();
+  int write_count = 0;
+  AsyncWrite(*dut_stream.side_a(), frame,
+             [&](micro::error_code ec) {
+               BOOST_TEST(!ec);
+               write_count++;
+             });
+
+  event_queue.Poll();
+  BOOST_TEST(write_count == 1);
+  BOOST_TEST(dut.stats()->wrong_id == 0);
+  BOOST_TEST(server.frames_started_ == 1);
+
+  // Only our own block was processed.
+  BOOST_TEST(server.writes_.size() == 1);
+  BOOST_TEST(server.writes_.at(0).reg == 4);
+
+  // We are in the second slot, so our reply is held until the first
+  // has had its turn.
+  BOOST_TEST(delay_count == 1);
+  BOOST_TEST(delay_us == 50);
+  BOOST_TEST(read_count == 0);
+
+  delay_callback();
+  event_queue.Poll();
+  BOOST_TEST(read_count == 1);
+
+  const std::string expected =
+      Frame(1, false, 2, std::string("\x23\x0a\x00\x00\x80\x3f", 6))
+      .encode();
+  BOOST_TEST(std::string_view(receive_buffer, read_size) == expected);
+}
+
+BOOST_FIXTURE_TEST_CASE(GroupBlockFirstSlotTest, GroupFixture) {
+  GroupRequest group;
+  group.SetReplySlot(50);
+  {
+    RegisterRequest request;
+    request.ReadSingle(10, 3);
+    group.Add(1, request);
+  }
+  {
+    RegisterRequest request;
+    request.WriteSingle(4, MicroServer::Value(int8_t(2)));
+    group.Add(2, request);
+  }
+
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  dut_stream.side_a()->AsyncReadSome(
+      receive_buffer, [&](micro::error_code ec, ssize_t) {
+        BOOST_TEST(!ec);
+        read_count++;
+      });
+
+  const std::string frame =
+      Frame(2, true, Format::kBroadcastId, std::string(group.buffer()))
+      .encode();
+  AsyncWrite(*dut_stream.side_a(), frame,
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+
+  event_queue.Poll();
+
+  // The first slot replies right away.
+  BOOST_TEST(delay_count == 0);
+  BOOST_TEST(read_count == 1);
+  BOOST_TEST(server.writes_.size() == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(GroupBlockNestedTest, GroupFixture) {
+  auto send = [&](const std::string& payload) {
+    AsyncWrite(*dut_stream.side_a(),
+               Frame(2, false, Format::kBroadcastId, payload).encode(),
+               [&](micro::error_code ec) { BOOST_TEST(!ec); });
+    event_queue.Poll();
+  };
+
+  // A block inside of our block is malformed, and ends processing.
+  send(std::string("\x50\x01\x00\x0a"
+                   "\x10\x04\x02"
+                   "\x50\x01\x00\x03" "\x10\x05\x03", 14));
+  BOOST_TEST(dut.stats()->malformed_subframe == 1);
+  BOOST_TEST(server.writes_.size() == 1);
+  BOOST_TEST(server.writes_.at(0).reg == 4);
+
+  // As is a reply slot length.
+  send(std::string("\x50\x01\x00\x05"
+                   "\x51\x10" "\x10\x06\x01", 9));
+  BOOST_TEST(dut.stats()->malformed_subframe == 2);
+  BOOST_TEST(server.writes_.size() == 1);
+  BOOST_TEST(server.frames_started_ == 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(PresetTest, Fixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  dut_stream.side_a()->AsyncReadSome(
+      receive_buffer, [&](micro::error_code ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        read_count++;
+        read_size = size;
+      });
+
+  RegisterPreset preset;
+  preset.Add(9, 2);
+  preset.AddRange(10, 2, 3);
+  // The test server can't read int8 values.
+  preset.Add(5, 0);
+
+  {
+    RegisterRequest request;
+    request.DefinePreset(1, preset);
+    const std::string frame =
+        Frame(2, false, 1, std::string(request.buffer())).encode();
+    AsyncWrite(*dut_stream.side_a(), frame,
+               [&](micro::error_code ec) { BOOST_TEST(!ec); });
+    event_queue.Poll();
+  }
+
+  BOOST_TEST(read_count == 0);
+  BOOST_TEST(dut.stats()->malformed_subframe == 0);
+
+  RegisterRequest request;
+  request.ReadPreset(1, &preset);
+  BOOST_TEST(request.buffer() == std::string_view("\x2b\x01"));
+
+  const std::string frame =
+      Frame(2, true, 1, std::string(request.buffer())).encode();
+  AsyncWrite(*dut_stream.side_a(), frame,
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+  BOOST_TEST(read_count == 1);
+
+  // Values are packed without register numbers, with the failed one
+  // zero filled and reported separately.
+  const std::string expected =
+      Frame(1, false, 2,
+            std::string("\x2c\x01\x04"
+                        "\x06\x07\x08\x09"
+                        "\x00\x00\x80\x3f"
+                        "\x00\x00\x00\x40"
+                        "\x00"
+                        "\x29\x05\x01", 19)).encode();
+  BOOST_TEST(std::string_view(receive_buffer, read_size) == expected);
+
+  BOOST_TEST(server.read_blocks_.size() == 3);
+  BOOST_TEST((server.read_blocks_.at(0) == Server::Block{9, 1}));
+  BOOST_TEST((server.read_blocks_.at(1) == Server::Block{10, 2}));
+  BOOST_TEST((server.read_blocks_.at(2) == Server::Block{5, 1}));
+}
+
+BOOST_FIXTURE_TEST_CASE(PresetOverrunTest, Fixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  dut_stream.side_a()->AsyncReadSome(
+      receive_buffer, [&](micro::error_code ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        read_count++;
+        read_size = size;
+      });
+
+  // Each read of this preset expands to 67 bytes.
+  RegisterPreset preset;
+  for (int i = 0; i < 16; i++) { preset.Add(9, 2); }
+
+  RegisterRequest request;
+  request.DefinePreset(1, preset);
+  for (int i = 0; i < 5; i++) { request.ReadPreset(1, &preset); }
+
+  AsyncWrite(*dut_stream.side_a(),
+             Frame(2, true, 1, std::string(request.buffer())).encode(),
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+  BOOST_TEST(read_count == 1);
+
+  // Only as many as fit are returned.
+  std::string reply;
+  for (int i = 0; i < 3; i++) {
+    reply += std::string("\x2c\x01\x10", 3);
+    for (int j = 0; j < 16; j++) { reply += "\x06\x07\x08\x09"; }
+  }
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2, reply).encode());
+  BOOST_TEST(dut.stats()->response_overrun == 2);
+  BOOST_TEST(dut.stats()->malformed_subframe == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(ReadPackedTest, Fixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  dut_stream.side_a()->AsyncReadSome(
+      receive_buffer, [&](micro::error_code ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        read_count++;
+        read_size = size;
+      });
+
+  RegisterPreset registers;
+  registers.Add(11, 3);
+  registers.Add(9, 2);
+  registers.Add(10, 3);
+  // The test server can't read int8 values.
+  registers.Add(5, 0);
+
+  RegisterRequest request;
+  request.ReadPacked(registers);
+  BOOST_TEST(request.buffer() == std::string_view("\x2d\x05\x07\x71\xf8"));
+
+  const std::string frame =
+      Frame(2, true, 1, std::string(request.buffer())).encode();
+  AsyncWrite(*dut_stream.side_a(), frame,
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+  BOOST_TEST(read_count == 1);
+
+  const std::string expected =
+      Frame(1, false, 2,
+            std::string("\x2e\x05\x07\x71\xf8"
+                        "\x00"
+                        "\x06\x07\x08\x09"
+                        "\x00\x00\x80\x3f"
+                        "\x00\x00\x00\x40"
+                        "\x29\x05\x01", 21)).encode();
+  BOOST_TEST(std::string_view(receive_buffer, read_size) == expected);
+
+  BOOST_TEST(server.read_blocks_.size() == 3);
+  BOOST_TEST((server.read_blocks_.at(0) == Server::Block{5, 1}));
+  BOOST_TEST((server.read_blocks_.at(1) == Server::Block{9, 1}));
+  BOOST_TEST((server.read_blocks_.at(2) == Server::Block{10, 2}));
+}
+
+BOOST_FIXTURE_TEST_CASE(ReadPackedOverrunTest, Fixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  dut_stream.side_a()->AsyncReadSome(
+      receive_buffer, [&](micro::error_code ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        read_count++;
+        read_size = size;
+      });
+
+  // 32 int16 registers, all of which fail, expand to 175 bytes.
+  const std::string packed_header =
+      std::string("\x00\x20" "\xff\xff\xff\xff", 6) +
+      std::string(8, '\x55');
+  const std::string request =
+      "\x2d" + packed_header + "\x2d" + packed_header;
+
+  AsyncWrite(*dut_stream.side_a(),
+             Frame(2, true, 1, request).encode(),
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+  BOOST_TEST(read_count == 1);
+
+  // The second doesn't fit, and is left out.
+  std::string reply = "\x2e" + packed_header + std::string(64, '\0');
+  for (int i = 0; i < 32; i++) {
+    reply += std::string("\x29", 1) + static_cast<char>(i) + "\x01";
+  }
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2, reply).encode());
+  BOOST_TEST(dut.stats()->response_overrun == 1);
+  BOOST_TEST(dut.stats()->malformed_subframe == 0);
+}
+
+namespace {
+struct TunnelFixture : test::PersistentConfigFixture {
+  micro::StreamPipe dut_stream{event_queue.MakePoster()};
+
+  Server server;
+  MicroServer dut{&pool, dut_stream.side_b(), []() {
+      MicroServer::Options options;
+      options.max_tunnel_streams = 2;
+      options.tunnel_buffer_size = 8;
+      return options;
+    }()};
+
+  micro::AsyncStream* console{dut.MakeTunnel(1)};
+  micro::AsyncStream* bulk{dut.MakeTunnel(2)};
+
+  TunnelFixture() {
+    dut.Start(&server);
+  }
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(TunnelWindowTest, TunnelFixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  auto start_read = [&]() {
+    dut_stream.side_a()->AsyncReadSome(
+        receive_buffer, [&](micro::error_code ec, ssize_t size) {
+          BOOST_TEST(!ec);
+          read_count++;
+          read_size = size;
+        });
+  };
+  auto send = [&](const std::string& payload) {
+    AsyncWrite(*dut_stream.side_a(), Frame(2, true, 1, payload).encode(),
+               [&](micro::error_code ec) { BOOST_TEST(!ec); });
+    event_queue.Poll();
+  };
+
+  int bulk_write_done = 0;
+  bulk->AsyncWriteSome(
+      "0123456789", [&](const micro::error_code& ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(size == 4);
+        bulk_write_done++;
+      });
+
+  // Each channel gets its own subframe, and the bulk data is held to
+  // its window.
+  start_read();
+  send(std::string("\x42\x01\x10\x05" "hello"
+                   "\x42\x02\x04\x00", 13));
+  BOOST_TEST(read_count == 1);
+  BOOST_TEST(bulk_write_done == 1);
+
+  // Nobody is reading the console, so its credit is what is left of
+  // the 8 byte buffer.
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2,
+                   std::string("\x43\x01\x03\x00"
+                               "\x43\x02\x08\x04" "0123", 12)).encode());
+
+  // Sending exactly the remaining credit fits.
+  start_read();
+  send(std::string("\x42\x01\x00\x03" "abc", 7));
+  BOOST_TEST(read_count == 2);
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2, std::string("\x43\x01\x00\x00", 4)).encode());
+  BOOST_TEST(dut.stats()->receive_overrun == 0);
+
+  char console_read[16] = {};
+  ssize_t console_size = 0;
+  console->AsyncReadSome(
+      console_read, [&](const micro::error_code& ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        console_size = size;
+      });
+  BOOST_TEST(std::string_view(console_read, console_size) == "helloabc");
+
+  // Once read, the credit is back.
+  start_read();
+  send(std::string("\x42\x01\x00\x00", 4));
+  BOOST_TEST(read_count == 3);
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2, std::string("\x43\x01\x08\x00", 4)).encode());
+}
+
+BOOST_FIXTURE_TEST_CASE(TunnelFullResponseTest, Fixture) {
+  char receive_buffer[256] = {};
+  int read_count = 0;
+  ssize_t read_size = 0;
+  auto start_read = [&]() {
+    dut_stream.side_a()->AsyncReadSome(
+        receive_buffer, [&](micro::error_code ec, ssize_t size) {
+          BOOST_TEST(!ec);
+          read_count++;
+          read_size = size;
+        });
+  };
+
+  int write_done = 0;
+  ssize_t write_size = 0;
+  tunnel->AsyncWriteSome(
+      "0123456789", [&](const micro::error_code& ec, ssize_t size) {
+        BOOST_TEST(!ec);
+        write_done++;
+        write_size = size;
+      });
+
+  // Each register read adds 6 bytes to the response, which leaves
+  // little room for the tunnel.
+  auto make_request = [](int reads) {
+    std::string result;
+    for (int i = 0; i < reads; i++) { result += "\x1a\x09"; }
+    return result + std::string("\x42\x09\x10\x00", 4);
+  };
+  auto make_replies = [](int reads) {
+    std::string result;
+    for (int i = 0; i < reads; i++) {
+      result += "\x22\x09\x06\x07\x08\x09";
+    }
+    return result;
+  };
+
+  // Only one byte of data fits.
+  start_read();
+  AsyncWrite(*dut_stream.side_a(),
+             Frame(2, true, 1, make_request(38)).encode(),
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+  BOOST_TEST(read_count == 1);
+  BOOST_TEST(write_done == 1);
+  BOOST_TEST(write_size == 1);
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2,
+                   make_replies(38) +
+                   std::string("\x43\x09\x80\x01\x01" "0", 6)).encode());
+
+  // With less room than that, the tunnel is left out of the response
+  // entirely.
+  int write2_done = 0;
+  tunnel->AsyncWriteSome(
+      "abc", [&](const micro::error_code& ec, ssize_t) {
+        BOOST_TEST(!ec);
+        write2_done++;
+      });
+
+  start_read();
+  AsyncWrite(*dut_stream.side_a(),
+             Frame(2, true, 1, make_request(39)).encode(),
+             [&](micro::error_code ec) { BOOST_TEST(!ec); });
+  event_queue.Poll();
+  BOOST_TEST(read_count == 2);
+  BOOST_TEST(write2_done == 0);
+  BOOST_TEST(std::string_view(receive_buffer, read_size) ==
+             Frame(1, false, 2, make_replies(39)).encode());
+  BOOST_TEST(dut.stats()->malformed_subframe == 0);
 }
@@ -0,0 +1,103 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Measures how long it takes to decode a typical servo status reply,
+/// and how many allocations doing so requires.
+
+#include <chrono>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/base/test/allocation_counter.h"
+#include "mjlib/multiplex/register.h"
+#include "mjlib/multiplex/stream.h"
+
+namespace base = mjlib::base;
+namespace po = boost::program_options;
+using namespace mjlib::multiplex;
+
+namespace {
+struct Options {
+  int iterations = 1000000;
+  int registers = 12;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(iterations));
+    a->Visit(MJ_NVP(registers));
+  }
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  // A kReplyMultiple of float registers starting at register 0x001.
+  base::FastOStringStream ostr;
+  WriteStream stream{ostr};
+  stream.WriteVaruint(
+      static_cast<uint32_t>(Format::Subframe::kReplyMultipleBase) + 3);
+  stream.WriteVaruint(0x001);
+  stream.WriteVaruint(options.registers);
+  for (int i = 0; i < options.registers; i++) {
+    stream.Write(static_cast<float>(i));
+  }
+  const std::string reply = ostr.str();
+
+  double sum = 0.0;
+
+  const size_t allocations_before = base::AllocationCount();
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < options.iterations; i++) {
+    base::BufferReadStream read_stream{reply};
+    const auto result = ParseRegisterReply(read_stream);
+    for (const auto& pair : result) {
+      sum += std::get<float>(std::get<Format::Value>(pair.second));
+    }
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+  const size_t allocations = base::AllocationCount() - allocations_before;
+  const double elapsed_s = std::chrono::duration<double>(end - start).count();
+
+  std::cout << "registers: " << options.registers << "\n"
+            << "iterations: " << options.iterations << "\n"
+            << "checksum: " << sum << "\n"
+            << "elapsed_s: " << elapsed_s << "\n"
+            << "ns_per_decode: " << elapsed_s * 1e9 / options.iterations << "\n"
+            << "allocations_per_decode: "
+            << static_cast<double>(allocations) / options.iterations << "\n";
+
+  return 0;
+}
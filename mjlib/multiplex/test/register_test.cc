@@ -14,11 +14,18 @@
 
 #include "mjlib/multiplex/register.h"
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <boost/test/auto_unit_test.hpp>
 
 #include "mjlib/base/fast_stream.h"
 
 namespace base = mjlib::base;
+using mjlib::multiplex::GroupRequest;
+using mjlib::multiplex::RegisterPreset;
 using mjlib::multiplex::RegisterRequest;
 using mjlib::multiplex::ParseRegisterReply;
 using Value = mjlib::multiplex::Format::Value;
@@ -74,3 +81,148 @@ BOOST_AUTO_TEST_CASE(ParseRegisterReplyTest) {
     BOOST_TEST((dut.at(0x05) == ReadResult(Value(static_cast<int16_t>(0x0304)))));
   }
 }
+
+BOOST_AUTO_TEST_CASE(RegisterReplyTest) {
+  mjlib::multiplex::RegisterReply dut;
+  BOOST_TEST(dut.empty());
+
+  dut.Set(5, Value(static_cast<int8_t>(5)));
+  dut.Set(2, Value(static_cast<int8_t>(2)));
+  dut.Set(9, static_cast<uint32_t>(3));
+  dut.Set(5, Value(static_cast<int8_t>(6)));
+
+  BOOST_TEST(dut.size() == 3);
+  BOOST_TEST(dut.count(5) == 1);
+  BOOST_TEST(dut.count(6) == 0);
+  BOOST_TEST((dut.find(6) == dut.end()));
+  BOOST_TEST((dut.at(5) == ReadResult(Value(static_cast<int8_t>(6)))));
+  BOOST_TEST((dut.at(9) == ReadResult(static_cast<uint32_t>(3))));
+  BOOST_CHECK_THROW(dut.at(6), std::out_of_range);
+
+  // Iteration is in register order.
+  std::vector<uint32_t> regs;
+  for (const auto& pair : dut) { regs.push_back(pair.first); }
+  BOOST_TEST(regs == (std::vector<uint32_t>{2, 5, 9}));
+}
+
+BOOST_AUTO_TEST_CASE(ParseRegisterReplyMultipleSubframeTest) {
+  // A reply multiple, followed by a reply single and a read error.
+  base::FastIStringStream data(
+      std::string("\x24\x10\x02\x01\x02"
+                  "\x22\x01\x04\x03\x02\x01"
+                  "\x29\x20\x07", 14));
+  const auto dut = ParseRegisterReply(data);
+  BOOST_TEST(dut.size() == 4);
+  BOOST_TEST((dut.at(0x10) == ReadResult(Value(static_cast<int8_t>(1)))));
+  BOOST_TEST((dut.at(0x11) == ReadResult(Value(static_cast<int8_t>(2)))));
+  BOOST_TEST((dut.at(0x01) == ReadResult(Value(static_cast<int32_t>(0x01020304)))));
+  BOOST_TEST((dut.at(0x20) == ReadResult(static_cast<uint32_t>(7))));
+  BOOST_TEST(dut.begin()->first == 0x01);
+}
+
+BOOST_AUTO_TEST_CASE(RegisterPresetTest) {
+  RegisterPreset preset;
+  preset.Add(0x001, 1);
+  preset.AddRange(0x010, 2, 3);
+  BOOST_TEST(preset.entries().size() == 3);
+
+  {
+    RegisterRequest dut;
+    dut.DefinePreset(0, preset);
+    BOOST_TEST(dut.buffer() == std::string_view(
+                   "\x2a\x00\x03\x01\x01\x10\x03\x11\x03", 9));
+    BOOST_TEST(dut.request_reply() == false);
+  }
+
+  {
+    RegisterRequest dut;
+    dut.ReadPreset(0, &preset);
+    BOOST_TEST(dut.buffer() == std::string_view("\x2b\x00", 2));
+    BOOST_TEST(dut.request_reply() == true);
+    BOOST_TEST(dut.presets().size() == 1);
+
+    base::FastIStringStream data(
+        std::string("\x2c\x00\x03"
+                    "\x02\x01"
+                    "\x00\x00\x80\x3f"
+                    "\x00\x00\x00\x00"
+                    "\x29\x11\x05", 16));
+    const auto reply = ParseRegisterReply(data, dut.presets());
+    BOOST_TEST(reply.size() == 3);
+    BOOST_TEST((reply.at(0x01) ==
+                ReadResult(Value(static_cast<int16_t>(0x0102)))));
+    BOOST_TEST((reply.at(0x10) == ReadResult(Value(1.0f))));
+    BOOST_TEST((reply.at(0x11) == ReadResult(static_cast<uint32_t>(5))));
+  }
+
+  {
+    // Without the definition, nothing can be decoded.
+    base::FastIStringStream data(
+        std::string("\x2c\x00\x01\x02\x01", 5));
+    const auto reply = ParseRegisterReply(data);
+    BOOST_TEST(reply.empty());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ReadPackedRegisterTest) {
+  // A typical status query: mode, position, velocity, torque,
+  // voltage, temperature and fault.
+  RegisterPreset registers;
+  registers.Add(0x000, 0);
+  registers.AddRange(0x001, 3, 1);
+  registers.AddRange(0x00d, 3, 0);
+
+  RegisterRequest dut;
+  dut.ReadPacked(registers);
+  BOOST_TEST(dut.buffer() ==
+             std::string_view("\x2d\x00\x10\x0f\xe0\x54\x00", 7));
+  BOOST_TEST(dut.request_reply() == true);
+
+  // The reply needs no definition to decode.
+  base::FastIStringStream data(
+      std::string("\x2e\x00\x10\x0f\xe0\x54\x00"
+                  "\x0a"
+                  "\x01\x02" "\x03\x04" "\x05\x06"
+                  "\x18\x19\x00"
+                  "\x29\x0f\x03", 20));
+  const auto reply = ParseRegisterReply(data);
+  BOOST_TEST(reply.size() == 7);
+  BOOST_TEST((reply.at(0x000) == ReadResult(Value(static_cast<int8_t>(10)))));
+  BOOST_TEST((reply.at(0x001) ==
+              ReadResult(Value(static_cast<int16_t>(0x0201)))));
+  BOOST_TEST((reply.at(0x003) ==
+              ReadResult(Value(static_cast<int16_t>(0x0605)))));
+  BOOST_TEST((reply.at(0x00d) == ReadResult(Value(static_cast<int8_t>(0x18)))));
+  BOOST_TEST((reply.at(0x00e) == ReadResult(Value(static_cast<int8_t>(0x19)))));
+  BOOST_TEST((reply.at(0x00f) == ReadResult(static_cast<uint32_t>(3))));
+}
+
+BOOST_AUTO_TEST_CASE(GroupRequestTest) {
+  RegisterRequest read;
+  read.ReadSingle(0x001, 0);
+  RegisterRequest write;
+  write.WriteSingle(0x002, Value(static_cast<int8_t>(1)));
+
+  GroupRequest dut;
+  dut.Add(3, read);
+  dut.Add(1, write);
+  dut.Add(2, read);
+  BOOST_TEST(dut.request_reply() == true);
+  BOOST_TEST((dut.reply_ids() == std::vector<uint8_t>{3, 2}));
+
+  // Naming a device a second time is an error, even when the first
+  // block asked for no reply.
+  const pid_t pid = ::fork();
+  BOOST_TEST_REQUIRE(pid >= 0);
+  if (pid == 0) {
+    // Boost.Test would otherwise catch the abort itself.
+    ::signal(SIGABRT, SIG_DFL);
+    ::dup2(::open("/dev/null", O_WRONLY), 2);
+    dut.Add(1, read);
+    ::_exit(0);
+  }
+  int status = 0;
+  BOOST_TEST_REQUIRE(::waitpid(pid, &status, 0) == pid);
+  BOOST_TEST(WIFSIGNALED(status));
+  BOOST_TEST(WTERMSIG(status) == SIGABRT);
+}
@@ -0,0 +1,296 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/multiplex/test/simulated_bus.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+
+#include "mjlib/io/deadline_timer.h"
+
+namespace pt = boost::posix_time;
+
+namespace mjlib {
+namespace multiplex {
+namespace test {
+
+class SimulatedBus::Impl {
+ public:
+  // The host is party 0, and nodes are numbered from 1.
+  static constexpr int kHost = 0;
+
+  class Node : public micro::AsyncStream {
+   public:
+    Node(Impl* parent, int party) : parent_(parent), party_(party) {}
+    ~Node() override {}
+
+    void AsyncReadSome(const base::string_span& buffer,
+                       const micro::SizeCallback& callback) override {
+      BOOST_ASSERT(!read_callback_.valid());
+      read_buffer_ = buffer;
+      read_callback_ = callback;
+      MaybeCompleteRead();
+    }
+
+    void AsyncWriteSome(const std::string_view& buffer,
+                        const micro::SizeCallback& callback) override {
+      const ssize_t size = buffer.size();
+      parent_->Transmit(party_, std::string(buffer), [callback, size]() {
+          callback({}, size);
+        });
+    }
+
+    void Receive(const std::string& data) {
+      inbound_ += data;
+      MaybeCompleteRead();
+    }
+
+   private:
+    void MaybeCompleteRead() {
+      if (!read_callback_.valid() || inbound_.empty()) { return; }
+
+      const ssize_t size = std::min<ssize_t>(
+          read_buffer_.size(), inbound_.size());
+      std::memcpy(read_buffer_.data(), inbound_.data(), size);
+      inbound_.erase(0, size);
+
+      auto callback = read_callback_;
+      read_callback_ = {};
+      read_buffer_ = {};
+      parent_->service_.post([callback, size]() {
+          callback({}, size);
+        });
+    }
+
+    Impl* const parent_;
+    const int party_;
+    std::string inbound_;
+    base::string_span read_buffer_;
+    micro::SizeCallback read_callback_;
+  };
+
+  Impl(boost::asio::io_service& service, const Options& options)
+      : service_(service),
+        options_(options),
+        start_(now()),
+        busy_end_(start_) {
+    ready_.push_back(start_);
+  }
+
+  micro::AsyncStream* AddNode() {
+    nodes_.emplace_back(
+        std::make_unique<Node>(this, static_cast<int>(nodes_.size()) + 1));
+    ready_.push_back(now());
+    return nodes_.back().get();
+  }
+
+  pt::ptime now() const {
+    return boost::asio::use_service<io::VirtualDeadlineTimerServiceHolder>(
+        service_).now();
+  }
+
+  double utilization() const {
+    const double elapsed_us = (now() - start_).total_microseconds();
+    if (elapsed_us <= 0.0) { return 0.0; }
+    return stats_.busy.total_microseconds() / elapsed_us;
+  }
+
+  void async_read_some(io::MutableBufferSequence buffers,
+                       io::ReadHandler handler) {
+    BOOST_ASSERT(!read_handler_);
+    read_buffers_ = buffers;
+    read_handler_ = handler;
+    MaybeCompleteRead();
+  }
+
+  void async_write_some(io::ConstBufferSequence buffers,
+                        io::WriteHandler handler) {
+    const auto size = boost::asio::buffer_size(buffers);
+    std::string data(size, '\0');
+    boost::asio::buffer_copy(boost::asio::buffer(data), buffers);
+    Transmit(kHost, std::move(data), [handler, size]() {
+        handler(base::error_code(), size);
+      });
+  }
+
+  void cancel() {
+    if (read_handler_) {
+      service_.post(std::bind(read_handler_,
+                              boost::asio::error::operation_aborted, 0));
+      read_handler_ = {};
+    }
+  }
+
+  boost::asio::io_service& service_;
+  const Options options_;
+  Stats stats_;
+
+ private:
+  struct Transmission {
+    Transmission(boost::asio::io_service& service) : timer(service) {}
+
+    int party = 0;
+    pt::ptime start;
+    pt::ptime end;
+    std::string data;
+    bool collided = false;
+    std::function<void ()> done;
+    io::DeadlineTimer timer;
+  };
+
+  using TransmissionPtr = std::shared_ptr<Transmission>;
+
+  void Transmit(int party, std::string data, std::function<void ()> done) {
+    auto transmission = std::make_shared<Transmission>(service_);
+    transmission->party = party;
+    transmission->done = std::move(done);
+
+    // A UART sends one thing at a time, and a party which is not
+    // already driving the bus has to turn its driver on first.
+    auto start = std::max(now(), ready_[party]);
+    if (last_driver_ != party) { start += options_.turnaround; }
+    last_driver_ = party;
+
+    const auto duration = pt::microseconds(
+        static_cast<int64_t>(
+            std::ceil(data.size() * 10.0 * 1e6 / options_.baud_rate)));
+    transmission->start = start;
+    transmission->end = start + duration;
+    transmission->data = std::move(data);
+    ready_[party] = transmission->end;
+
+    // Nobody listens before talking, so anything which overlaps is
+    // lost.
+    for (auto& other : active_) {
+      if (other->party == party) { continue; }
+      if (other->start < transmission->end &&
+          transmission->start < other->end) {
+        if (!transmission->collided) { stats_.collisions++; }
+        transmission->collided = true;
+        other->collided = true;
+      }
+    }
+
+    if (transmission->end > busy_end_) {
+      stats_.busy += transmission->end - std::max(start, busy_end_);
+      busy_end_ = transmission->end;
+    }
+    stats_.writes++;
+    stats_.bytes += transmission->data.size();
+
+    active_.push_back(transmission);
+    transmission->timer.expires_at(transmission->end);
+    transmission->timer.async_wait(
+        std::bind(&Impl::HandleEnd, this, transmission));
+  }
+
+  void HandleEnd(TransmissionPtr transmission) {
+    active_.remove(transmission);
+
+    if (transmission->collided) {
+      // Receivers get something, but it won't even look like a
+      // frame header.
+      for (auto& c : transmission->data) { c ^= 0x55; }
+    }
+
+    // Everyone but the sender hears it, servos included.
+    if (transmission->party != kHost) {
+      inbound_ += transmission->data;
+      MaybeCompleteRead();
+    }
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      if (static_cast<int>(i) + 1 == transmission->party) { continue; }
+      nodes_[i]->Receive(transmission->data);
+    }
+
+    service_.post(transmission->done);
+  }
+
+  void MaybeCompleteRead() {
+    if (!read_handler_ || inbound_.empty()) { return; }
+
+    const auto size = boost::asio::buffer_copy(
+        read_buffers_, boost::asio::buffer(inbound_));
+    inbound_.erase(0, size);
+
+    auto handler = read_handler_;
+    read_handler_ = {};
+    service_.post(std::bind(handler, base::error_code(), size));
+  }
+
+  std::vector<std::unique_ptr<Node>> nodes_;
+
+  const pt::ptime start_;
+  pt::ptime busy_end_;
+
+  // When each party will be done with everything it has sent so far.
+  std::vector<pt::ptime> ready_;
+  int last_driver_ = kHost;
+  std::list<TransmissionPtr> active_;
+
+  std::string inbound_;
+  io::MutableBufferSequence read_buffers_;
+  io::ReadHandler read_handler_;
+};
+
+SimulatedBus::SimulatedBus(boost::asio::io_service& service,
+                           const Options& options)
+    : impl_(std::make_unique<Impl>(service, options)) {}
+
+SimulatedBus::~SimulatedBus() {}
+
+micro::AsyncStream* SimulatedBus::AddNode() {
+  return impl_->AddNode();
+}
+
+const SimulatedBus::Stats& SimulatedBus::stats() const {
+  return impl_->stats_;
+}
+
+double SimulatedBus::utilization() const {
+  return impl_->utilization();
+}
+
+pt::ptime SimulatedBus::now() const {
+  return impl_->now();
+}
+
+boost::asio::io_service& SimulatedBus::get_io_service() {
+  return impl_->service_;
+}
+
+void SimulatedBus::async_read_some(io::MutableBufferSequence buffers,
+                                   io::ReadHandler handler) {
+  impl_->async_read_some(buffers, handler);
+}
+
+void SimulatedBus::async_write_some(io::ConstBufferSequence buffers,
+                                    io::WriteHandler handler) {
+  impl_->async_write_some(buffers, handler);
+}
+
+void SimulatedBus::cancel() {
+  impl_->cancel();
+}
+
+}
+}
+}
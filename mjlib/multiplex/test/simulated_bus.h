@@ -0,0 +1,90 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "mjlib/io/async_stream.h"
+#include "mjlib/micro/async_stream.h"
+
+namespace mjlib {
+namespace multiplex {
+namespace test {
+
+/// Like MicroBus, connects a single host side io::AsyncStream to any
+/// number of micro::AsyncStreams, but models the timing of a half
+/// duplex RS-485 bus.
+///
+/// Each write occupies the bus for as long as its bytes would take
+/// at the configured baud rate, and is delivered to every other
+/// party, and completed, only once its last byte is on the wire.  A
+/// party which was not the last to transmit must first wait out the
+/// turnaround time to enable its driver.  Transmissions which
+/// overlap in time are a collision, and all parties receive garbage
+/// in place of either.
+///
+/// All timing uses io::DeadlineTimer, and thus whichever
+/// VirtualDeadlineTimerService is installed on the io_service.
+class SimulatedBus : public io::AsyncStream {
+ public:
+  struct Options {
+    double baud_rate = 3000000;
+    boost::posix_time::time_duration turnaround =
+        boost::posix_time::microseconds(10);
+
+    Options() {}
+  };
+
+  SimulatedBus(boost::asio::io_service&, const Options& = Options());
+  ~SimulatedBus() override;
+
+  micro::AsyncStream* AddNode();
+
+  struct Stats {
+    uint64_t writes = 0;
+    uint64_t bytes = 0;
+    uint64_t collisions = 0;
+
+    /// The total time during which at least one party was
+    /// transmitting.
+    boost::posix_time::time_duration busy;
+  };
+
+  const Stats& stats() const;
+
+  /// @return the fraction of time since construction that the bus
+  /// has been busy.
+  double utilization() const;
+
+  /// @return the current time, as seen by io::DeadlineTimer.
+  boost::posix_time::ptime now() const;
+
+  boost::asio::io_service& get_io_service() override;
+  void async_read_some(io::MutableBufferSequence, io::ReadHandler) override;
+  void async_write_some(io::ConstBufferSequence, io::WriteHandler) override;
+  void cancel() override;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
+}
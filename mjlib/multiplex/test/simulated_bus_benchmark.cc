@@ -0,0 +1,371 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Runs full command+query cycles from an AsioClient to a set of
+/// MicroServer instances over a SimulatedBus, and reports the cycle
+/// rate, bus utilization and per-servo latency which the bus timing
+/// allows.  All rates and times are in bus time, not wall clock
+/// time.
+///
+/// Unless --wall_clock is given, bus time is simulated, so that long
+/// runs complete as fast as the host can process them.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fail.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/io/deadline_timer.h"
+#include "mjlib/io/virtual_deadline_timer.h"
+#include "mjlib/micro/pool_ptr.h"
+#include "mjlib/multiplex/asio_client.h"
+#include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/micro_server.h"
+#include "mjlib/multiplex/test/simulated_bus.h"
+
+namespace base = mjlib::base;
+namespace io = mjlib::io;
+namespace micro = mjlib::micro;
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+using namespace mjlib::multiplex;
+
+namespace {
+struct Options {
+  int servos = 12;
+  int cycles = 200;
+  int max_in_flight = 1;
+  bool group = false;
+  bool packed = false;
+
+  double baud_rate = 3000000;
+  double turnaround_us = 10;
+  double timeout_us = 2000;
+
+  // Slack added to each reply slot in group mode.
+  double slot_guard_us = 5;
+
+  // If non-zero, the client's per-servo stats are printed and reset
+  // this often, in bus time.
+  double stats_period_s = 0.0;
+
+  // Run the bus against the real clock rather than simulated time.
+  bool wall_clock = false;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(servos));
+    a->Visit(MJ_NVP(cycles));
+    a->Visit(MJ_NVP(max_in_flight));
+    a->Visit(MJ_NVP(group));
+    a->Visit(MJ_NVP(packed));
+    a->Visit(MJ_NVP(baud_rate));
+    a->Visit(MJ_NVP(turnaround_us));
+    a->Visit(MJ_NVP(timeout_us));
+    a->Visit(MJ_NVP(slot_guard_us));
+    a->Visit(MJ_NVP(stats_period_s));
+    a->Visit(MJ_NVP(wall_clock));
+  }
+};
+
+/// A register file sized like the status and command registers of a
+/// typical servo.
+class Server : public MicroServer::Server {
+ public:
+  uint32_t Write(MicroServer::Register reg,
+                 const MicroServer::Value& value) override {
+    if (reg >= kNumRegisters) { return 1; }
+    values_[reg] = std::visit([](auto v) { return static_cast<float>(v); },
+                              value);
+    return 0;
+  }
+
+  MicroServer::ReadResult Read(
+      MicroServer::Register reg, size_t type_index) const override {
+    if (reg >= kNumRegisters) { return static_cast<uint32_t>(1); }
+    const float value = values_[reg];
+    switch (type_index) {
+      case 0: return MicroServer::Value(static_cast<int8_t>(value));
+      case 1: return MicroServer::Value(static_cast<int16_t>(value));
+      case 2: return MicroServer::Value(static_cast<int32_t>(value));
+      case 3: return MicroServer::Value(value);
+    }
+    return static_cast<uint32_t>(2);
+  }
+
+ private:
+  static constexpr uint32_t kNumRegisters = 0x30;
+  float values_[kNumRegisters] = {};
+};
+
+struct Node {
+  Node(micro::Pool* pool, test::SimulatedBus* bus, uint8_t id)
+      : timer(bus->get_io_service()),
+        dut(pool, bus->AddNode(), [&]() {
+            MicroServer::Options options;
+            options.default_id = id;
+            // Room for a broadcast frame commanding every servo.
+            options.buffer_size = 512;
+            options.reply_delay = [this](uint32_t delay_us,
+                                         const micro::VoidCallback& callback) {
+              timer.expires_from_now(pt::microseconds(delay_us));
+              timer.async_wait([callback](const base::error_code&) {
+                  callback();
+                });
+            };
+            return options;
+          }()) {
+    dut.Start(&server);
+  }
+
+  Server server;
+  io::DeadlineTimer timer;
+  MicroServer dut;
+};
+
+double Percentile(std::vector<double>* values, double fraction) {
+  if (values->empty()) { return 0.0; }
+  const size_t index = std::min(
+      values->size() - 1,
+      static_cast<size_t>(fraction * values->size()));
+  std::nth_element(values->begin(), values->begin() + index, values->end());
+  return (*values)[index];
+}
+
+class Benchmark {
+ public:
+  Benchmark(const Options& options)
+      : options_(options),
+        timers_(options.wall_clock ? nullptr :
+                io::SimulatedTimerService::Install(service_)),
+        bus_(service_, [&]() {
+            test::SimulatedBus::Options bus_options;
+            bus_options.baud_rate = options.baud_rate;
+            bus_options.turnaround = pt::microseconds(
+                static_cast<int64_t>(options.turnaround_us));
+            return bus_options;
+          }()),
+        client_(&bus_, [&]() {
+            AsioClient::Options client_options;
+            client_options.max_in_flight = options.max_in_flight;
+            client_options.timeout = pt::microseconds(
+                static_cast<int64_t>(options.timeout_us));
+            return client_options;
+          }()),
+        latencies_us_(options.servos) {
+    for (int i = 0; i < options_.servos; i++) {
+      nodes_.emplace_back(std::make_unique<Node>(&pool_, &bus_, i + 1));
+    }
+
+    // A position command followed by a query of mode, position,
+    // velocity, torque, voltage, temperature and fault.
+    request_.WriteSingle(0x000, MicroServer::Value(static_cast<int8_t>(10)));
+    request_.WriteMultiple(0x020, {
+        MicroServer::Value(0.5f),
+        MicroServer::Value(0.0f),
+        MicroServer::Value(3.0f),
+      });
+    if (options_.packed) {
+      RegisterPreset query;
+      query.Add(0x000, 0);
+      query.AddRange(0x001, 3, 1);
+      query.AddRange(0x00d, 3, 0);
+      request_.ReadPacked(query);
+    } else {
+      request_.ReadSingle(0x000, 0);
+      request_.ReadMultiple(0x001, 3, 1);
+      request_.ReadMultiple(0x00d, 3, 0);
+    }
+
+    // The values take 10 bytes.  Otherwise each is named in its own
+    // 2 byte reply subframe, while packed there is a single 7 byte
+    // header.  Every slot after the first has to wait out a
+    // turnaround.
+    const int payload_bytes = 10 + (options_.packed ? 7 : 7 * 2);
+    const double reply_bytes =
+        Frame(1, false, 0, std::string(payload_bytes, '\0')).encode().size();
+    slot_us_ = static_cast<uint32_t>(
+        std::ceil(reply_bytes * 10.0 / options_.baud_rate * 1e6 +
+                  options_.turnaround_us + options_.slot_guard_us));
+
+    group_request_.SetReplySlot(slot_us_);
+    for (int i = 0; i < options_.servos; i++) {
+      group_request_.Add(i + 1, request_);
+    }
+  }
+
+  void Run() {
+    start_ = bus_.now();
+    last_stats_ = start_;
+    const auto real_start = std::chrono::steady_clock::now();
+    StartCycle();
+    if (timers_) {
+      timers_->Run();
+    } else {
+      service_.run();
+    }
+    const double real_elapsed_s = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - real_start).count();
+
+    const double elapsed_s = (bus_.now() - start_).total_microseconds() / 1e6;
+    const auto& stats = bus_.stats();
+
+    std::cout << "servos: " << options_.servos << "\n"
+              << "mode: " << (options_.group ? "group" : "individual") << "\n"
+              << "packed: " << (options_.packed ? "true" : "false") << "\n"
+              << "cycles: " << cycles_ << "\n"
+              << "errors: " << errors_ << "\n"
+              << "collisions: " << stats.collisions << "\n"
+              << "bus_elapsed_s: " << elapsed_s << "\n"
+              << "real_elapsed_s: " << real_elapsed_s << "\n"
+              << "cycles_per_s: " << cycles_ / elapsed_s << "\n"
+              << "utilization: " << bus_.utilization() << "\n"
+              << "bytes_per_cycle: "
+              << static_cast<double>(stats.bytes) / cycles_ << "\n";
+    if (options_.group) {
+      std::cout << "slot_us: " << slot_us_ << "\n";
+    }
+
+    std::cout << "latency_us: p50 p90 p99 max\n";
+    for (int i = 0; i < options_.servos; i++) {
+      auto& values = latencies_us_[i];
+      std::cout << "  servo " << std::setw(3) << (i + 1) << ":"
+                << " " << Percentile(&values, 0.50)
+                << " " << Percentile(&values, 0.90)
+                << " " << Percentile(&values, 0.99)
+                << " " << Percentile(&values, 1.0) << "\n";
+    }
+  }
+
+ private:
+  void StartCycle() {
+    cycle_start_ = bus_.now();
+
+    if (options_.stats_period_s > 0.0 &&
+        (cycle_start_ - last_stats_).total_microseconds() >=
+        options_.stats_period_s * 1e6) {
+      last_stats_ = cycle_start_;
+      std::cout << "client stats at " << (cycle_start_ - start_) << "\n";
+      client_.WriteStats(std::cout);
+      client_.ResetStats();
+    }
+
+    if (options_.group) {
+      outstanding_ = 1;
+      client_.AsyncGroup(
+          group_request_,
+          std::bind(&Benchmark::HandleGroupReply, this,
+                    std::placeholders::_1, std::placeholders::_2));
+      return;
+    }
+
+    outstanding_ = options_.servos;
+    for (int i = 0; i < options_.servos; i++) {
+      client_.AsyncRegister(
+          i + 1, request_,
+          std::bind(&Benchmark::HandleReply, this, i,
+                    std::placeholders::_1, std::placeholders::_2));
+    }
+  }
+
+  double SinceCycleStartUs() const {
+    return (bus_.now() - cycle_start_).total_microseconds();
+  }
+
+  void HandleGroupReply(const base::error_code& ec, const GroupReply& reply) {
+    if (ec) { errors_++; }
+
+    // The client only reports once every slot is over, so that is the
+    // latency each servo sees.
+    const double latency_us = SinceCycleStartUs();
+    for (const auto& pair : reply) {
+      if (pair.second.size() != 7) { errors_++; }
+      latencies_us_.at(pair.first - 1).push_back(latency_us);
+    }
+
+    FinishRequest();
+  }
+
+  void HandleReply(int index, const base::error_code& ec,
+                   const RegisterReply& reply) {
+    if (ec || reply.size() != 7) {
+      errors_++;
+    } else {
+      latencies_us_.at(index).push_back(SinceCycleStartUs());
+    }
+
+    FinishRequest();
+  }
+
+  void FinishRequest() {
+    outstanding_--;
+    if (outstanding_ != 0) { return; }
+
+    cycles_++;
+    if (cycles_ < options_.cycles) {
+      StartCycle();
+    }
+  }
+
+  const Options options_;
+  boost::asio::io_service service_;
+  io::SimulatedTimerService* const timers_;
+  micro::SizedPool<65536> pool_;
+  test::SimulatedBus bus_;
+  std::vector<std::unique_ptr<Node>> nodes_;
+  AsioClient client_;
+
+  RegisterRequest request_;
+  GroupRequest group_request_;
+  uint32_t slot_us_ = 0;
+
+  pt::ptime start_;
+  pt::ptime cycle_start_;
+  pt::ptime last_stats_;
+  int outstanding_ = 0;
+  int cycles_ = 0;
+  int errors_ = 0;
+
+  std::vector<std::vector<double>> latencies_us_;
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  Benchmark benchmark{options};
+  benchmark.Run();
+
+  return 0;
+}
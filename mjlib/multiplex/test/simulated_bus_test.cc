@@ -0,0 +1,228 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/multiplex/test/simulated_bus.h"
+
+#include <functional>
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/io/virtual_deadline_timer.h"
+#include "mjlib/micro/pool_ptr.h"
+#include "mjlib/multiplex/asio_client.h"
+#include "mjlib/multiplex/frame.h"
+#include "mjlib/multiplex/micro_server.h"
+
+namespace base = mjlib::base;
+namespace io = mjlib::io;
+namespace micro = mjlib::micro;
+namespace pt = boost::posix_time;
+using namespace mjlib::multiplex;
+
+namespace {
+class Server : public MicroServer::Server {
+ public:
+  uint32_t Write(MicroServer::Register, const MicroServer::Value&) override {
+    return 0;
+  }
+
+  MicroServer::ReadResult Read(
+      MicroServer::Register reg, size_t) const override {
+    return MicroServer::Value(static_cast<int32_t>(reg));
+  }
+};
+
+test::SimulatedBus::Options MakeOptions() {
+  test::SimulatedBus::Options options;
+  options.baud_rate = 1000000;
+  options.turnaround = pt::microseconds(20);
+  return options;
+}
+}
+
+BOOST_AUTO_TEST_CASE(SimulatedBusTransactionTest) {
+  boost::asio::io_service service;
+  micro::SizedPool<> pool;
+  test::SimulatedBus bus{service, MakeOptions()};
+
+  Server server;
+  MicroServer node{&pool, bus.AddNode(), MicroServer::Options()};
+  node.Start(&server);
+
+  AsioClient dut(&bus);
+  RegisterRequest request;
+  request.ReadSingle(5, 2);
+
+  const auto start = bus.now();
+  int done = 0;
+  dut.AsyncRegister(1, request, [&](const base::error_code& ec,
+                                    const RegisterReply& reply) {
+      BOOST_TEST(!ec);
+      BOOST_TEST((reply.at(5) ==
+                  Format::ReadResult(Format::Value(int32_t(5)))));
+      done++;
+    });
+  service.run();
+  BOOST_TEST(done == 1);
+
+  const auto request_size =
+      Frame(0, true, 1, std::string(request.buffer())).encode().size();
+  const auto reply_size =
+      Frame(1, false, 0, std::string(6, '\0')).encode().size();
+
+  const auto& stats = bus.stats();
+  BOOST_TEST(stats.writes == 2);
+  BOOST_TEST(stats.bytes == request_size + reply_size);
+  BOOST_TEST(stats.collisions == 0);
+
+  // Each byte takes 10us at 1Mbaud.
+  const auto busy_us = (request_size + reply_size) * 10;
+  BOOST_TEST(stats.busy.total_microseconds() == busy_us);
+
+  // The reply can't arrive before both frames and the servo's
+  // turnaround are done.
+  BOOST_TEST((bus.now() - start).total_microseconds() >= busy_us + 20);
+  BOOST_TEST(bus.utilization() > 0.0);
+  BOOST_TEST(bus.utilization() <= 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(SimulatedBusCollisionTest) {
+  boost::asio::io_service service;
+  test::SimulatedBus bus{service, MakeOptions()};
+
+  auto* const node1 = bus.AddNode();
+  auto* const node2 = bus.AddNode();
+
+  // Both nodes talk at once.
+  const std::string data1 =
+      Frame(1, false, 0, "first").encode();
+  const std::string data2 =
+      Frame(2, false, 0, "second").encode();
+  int write_done = 0;
+  node1->AsyncWriteSome(data1, [&](const micro::error_code& ec, ssize_t) {
+      BOOST_TEST(!ec);
+      write_done++;
+    });
+  node2->AsyncWriteSome(data2, [&](const micro::error_code& ec, ssize_t) {
+      BOOST_TEST(!ec);
+      write_done++;
+    });
+
+  char received[256] = {};
+  size_t received_size = 0;
+  std::function<void ()> start_read = [&]() {
+    bus.async_read_some(
+        boost::asio::buffer(received + received_size,
+                            sizeof(received) - received_size),
+        [&](const base::error_code& ec, size_t size) {
+          BOOST_TEST(!ec);
+          received_size += size;
+          if (received_size < data1.size() + data2.size()) {
+            start_read();
+          }
+        });
+  };
+  start_read();
+
+  service.run();
+  BOOST_TEST(write_done == 2);
+  BOOST_TEST(bus.stats().collisions == 1);
+
+  // What arrived is the right length, but garbage.
+  BOOST_TEST(received_size == data1.size() + data2.size());
+  const std::string result(received, received_size);
+  BOOST_TEST(result.find(data1) == std::string::npos);
+  BOOST_TEST(result.find(data2) == std::string::npos);
+}
+
+namespace {
+struct SoakResult {
+  int replies = 0;
+  int errors = 0;
+  test::SimulatedBus::Stats stats;
+  pt::time_duration elapsed;
+};
+
+SoakResult RunSoak(pt::time_duration duration) {
+  boost::asio::io_service service;
+  auto* const timers = io::SimulatedTimerService::Install(service);
+  micro::SizedPool<> pool;
+  test::SimulatedBus bus{service, MakeOptions()};
+
+  Server server;
+  MicroServer node1{&pool, bus.AddNode(), MicroServer::Options()};
+  node1.Start(&server);
+  MicroServer node2{&pool, bus.AddNode(), [&]() {
+      MicroServer::Options options;
+      options.default_id = 2;
+      return options;
+    }()};
+  node2.Start(&server);
+
+  // The servos reply as soon as they can, so a request written
+  // while another is in flight collides with that reply.
+  AsioClient::Options client_options;
+  client_options.max_in_flight = 1;
+  AsioClient dut(&bus, client_options);
+  RegisterRequest request;
+  request.ReadMultiple(5, 3, 2);
+
+  const auto start = bus.now();
+  const auto end = start + duration;
+  SoakResult result;
+
+  // Keep a request queued for each servo, so that they take turns
+  // on the bus.
+  std::function<void (int)> issue = [&](int id) {
+    if (bus.now() >= end) { return; }
+    dut.AsyncRegister(id, request, [&, id](const base::error_code& ec,
+                                           const RegisterReply& reply) {
+        if (ec || reply.size() != 3) {
+          result.errors++;
+        } else {
+          result.replies++;
+        }
+        issue(id);
+      });
+  };
+  issue(1);
+  issue(2);
+
+  timers->Run();
+
+  result.stats = bus.stats();
+  result.elapsed = bus.now() - start;
+  return result;
+}
+}
+
+BOOST_AUTO_TEST_CASE(SimulatedBusDeterministicTest) {
+  // Ten seconds of bus time runs in a small fraction of that, and
+  // gives exactly the same result each time.
+  const auto result1 = RunSoak(pt::seconds(10));
+  const auto result2 = RunSoak(pt::seconds(10));
+
+  BOOST_TEST(result1.replies > 10000);
+  BOOST_TEST(result1.errors == 0);
+  BOOST_TEST(result1.elapsed >= pt::seconds(10));
+  BOOST_TEST(result1.elapsed < pt::seconds(11));
+
+  BOOST_TEST(result1.replies == result2.replies);
+  BOOST_TEST(result1.errors == result2.errors);
+  BOOST_TEST(result1.stats.writes == result2.stats.writes);
+  BOOST_TEST(result1.stats.bytes == result2.stats.bytes);
+  BOOST_TEST(result1.stats.collisions == result2.stats.collisions);
+  BOOST_TEST((result1.stats.busy == result2.stats.busy));
+  BOOST_TEST((result1.elapsed == result2.elapsed));
+}
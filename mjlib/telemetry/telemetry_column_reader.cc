@@ -0,0 +1,230 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_column_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "mjlib/base/system_error.h"
+
+namespace mjlib {
+namespace telemetry {
+
+namespace {
+using FT = TelemetryFormat::FieldType;
+
+constexpr char kManifestHeader[] = "TCOL0001";
+
+struct TypeInfo {
+  FT type;
+  const char* name;
+  size_t size;
+};
+
+constexpr TypeInfo kTypes[] = {
+  { FT::kBool, "bool", 1 },
+  { FT::kInt8, "int8", 1 },
+  { FT::kUInt8, "uint8", 1 },
+  { FT::kInt16, "int16", 2 },
+  { FT::kUInt16, "uint16", 2 },
+  { FT::kInt32, "int32", 4 },
+  { FT::kUInt32, "uint32", 4 },
+  { FT::kInt64, "int64", 8 },
+  { FT::kUInt64, "uint64", 8 },
+  { FT::kFloat32, "float32", 4 },
+  { FT::kFloat64, "float64", 8 },
+  { FT::kPtime, "ptime", 8 },
+  { FT::kEnum, "enum", 4 },
+};
+
+const TypeInfo* FindType(std::string_view name) {
+  for (const auto& info : kTypes) {
+    if (name == info.name) { return &info; }
+  }
+  return nullptr;
+}
+
+class Mapping {
+ public:
+  Mapping(const std::string& filename, size_t size) : size_(size) {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw base::system_error::syserrno("opening " + filename);
+    }
+
+    struct stat st = {};
+    if (::fstat(fd, &st) < 0) {
+      ::close(fd);
+      throw base::system_error::syserrno("stat " + filename);
+    }
+    if (static_cast<uint64_t>(st.st_size) != size) {
+      ::close(fd);
+      throw base::system_error::einval(
+          "column is the wrong size: " + filename);
+    }
+
+    if (size_) {
+      data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        ::close(fd);
+        throw base::system_error::syserrno("mapping " + filename);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~Mapping() {
+    if (data_) { ::munmap(data_, size_); }
+  }
+
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  const void* data() const { return data_; }
+
+ private:
+  void* data_ = nullptr;
+  const size_t size_;
+};
+}
+
+class TelemetryColumnReader::Impl {
+ public:
+  Impl(const std::string& directory) : directory_(directory) {
+    const auto manifest_name = directory_ + "/MANIFEST";
+    std::ifstream manifest(manifest_name);
+    if (!manifest) {
+      throw base::system_error::syserrno("opening " + manifest_name);
+    }
+
+    std::string line;
+    if (!std::getline(manifest, line) || line != kManifestHeader) {
+      throw base::system_error::einval("not a column MANIFEST: " +
+                                       manifest_name);
+    }
+
+    while (std::getline(manifest, line)) {
+      if (line.empty()) { continue; }
+      ParseLine(line);
+    }
+
+    for (auto& record : records_) {
+      record.timestamps = static_cast<const int64_t*>(
+          Map(record, "@timestamp", sizeof(int64_t)));
+      for (auto& column : record.columns) {
+        column.data = Map(record, column.name, column.size);
+      }
+    }
+  }
+
+  std::string directory_;
+  std::vector<Record> records_;
+
+ private:
+  void ParseLine(const std::string& line) {
+    std::istringstream istr(line);
+    std::string kind;
+    istr >> kind;
+
+    if (kind == "record") {
+      Record record;
+      istr >> record.name >> record.count;
+      if (!istr) { Corrupt(line); }
+      records_.push_back(std::move(record));
+      return;
+    }
+
+    if (records_.empty()) { Corrupt(line); }
+    auto& record = records_.back();
+
+    if (kind == "column") {
+      Column column;
+      std::string type;
+      istr >> column.name >> type;
+      const auto* info = FindType(type);
+      if (!istr || !info) { Corrupt(line); }
+      column.type = info->type;
+      column.size = info->size;
+      record.columns.push_back(std::move(column));
+    } else if (kind == "enum") {
+      std::string name;
+      uint32_t value = 0;
+      std::string value_name;
+      istr >> name >> value >> value_name;
+      if (!istr || record.columns.empty() ||
+          record.columns.back().name != name) {
+        Corrupt(line);
+      }
+      record.columns.back().enum_values.emplace_back(value, value_name);
+    } else {
+      Corrupt(line);
+    }
+  }
+
+  const void* Map(const Record& record, const std::string& name,
+                  size_t size) {
+    mappings_.push_back(std::make_unique<Mapping>(
+        directory_ + "/" + record.name + "/" + name, size * record.count));
+    return mappings_.back()->data();
+  }
+
+  static void Corrupt(const std::string& line) {
+    throw base::system_error::einval("corrupt MANIFEST line: " + line);
+  }
+
+  std::vector<std::unique_ptr<Mapping>> mappings_;
+};
+
+TelemetryColumnReader::TelemetryColumnReader(const std::string& directory)
+    : impl_(std::make_unique<Impl>(directory)) {}
+
+TelemetryColumnReader::~TelemetryColumnReader() {}
+
+const std::vector<TelemetryColumnReader::Record>&
+TelemetryColumnReader::records() const {
+  return impl_->records_;
+}
+
+const TelemetryColumnReader::Record* TelemetryColumnReader::FindRecord(
+    std::string_view name) const {
+  for (const auto& record : impl_->records_) {
+    if (record.name == name) { return &record; }
+  }
+  return nullptr;
+}
+
+const TelemetryColumnReader::Column*
+TelemetryColumnReader::Record::FindColumn(std::string_view name) const {
+  for (const auto& column : columns) {
+    if (column.name == name) { return &column; }
+  }
+  return nullptr;
+}
+
+std::string_view TelemetryColumnReader::TypeName(FT type) {
+  for (const auto& info : kTypes) {
+    if (info.type == type) { return info.name; }
+  }
+  return {};
+}
+
+}
+}
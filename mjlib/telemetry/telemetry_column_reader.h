@@ -0,0 +1,92 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mjlib/base/assert.h"
+#include "mjlib/telemetry/telemetry_format.h"
+
+namespace mjlib {
+namespace telemetry {
+
+/// Memory maps a directory written by TelemetryColumnWriter.
+///
+/// Only the MANIFEST is parsed.  Column data is paged in by the
+/// operating system as it is accessed, and remains valid for the life
+/// of this instance.
+class TelemetryColumnReader {
+ public:
+  /// Throws base::system_error if @p directory has no valid MANIFEST
+  /// or any column is missing or the wrong size.
+  explicit TelemetryColumnReader(const std::string& directory);
+  ~TelemetryColumnReader();
+
+  struct Column {
+    std::string name;
+
+    /// One of the scalar types, or kPtime or kEnum.
+    TelemetryFormat::FieldType type = TelemetryFormat::FieldType::kFinal;
+
+    /// The size of each value in bytes.
+    size_t size = 0;
+
+    /// Record::count values, or nullptr if there are none.
+    const void* data = nullptr;
+
+    std::vector<std::pair<uint32_t, std::string>> enum_values;
+
+    template <typename T>
+    const T* values() const {
+      MJ_ASSERT(sizeof(T) == size);
+      return static_cast<const T*>(data);
+    }
+  };
+
+  struct Record {
+    std::string name;
+    size_t count = 0;
+
+    /// Microseconds since the epoch, or INT64_MIN if a block had no
+    /// timestamp.
+    const int64_t* timestamps = nullptr;
+
+    std::vector<Column> columns;
+
+    /// @return the column named @p name, or nullptr.
+    const Column* FindColumn(std::string_view name) const;
+  };
+
+  const std::vector<Record>& records() const;
+
+  /// @return the record named @p name, or nullptr.
+  const Record* FindRecord(std::string_view name) const;
+
+  /// @return the name used for @p type in a MANIFEST, or an empty
+  /// string if it cannot be a column.
+  static std::string_view TypeName(TelemetryFormat::FieldType type);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
@@ -0,0 +1,257 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_column_writer.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include "mjlib/base/system_error.h"
+#include "mjlib/telemetry/telemetry_column_reader.h"
+#include "mjlib/telemetry/telemetry_decode_plan.h"
+
+namespace pt = boost::posix_time;
+
+namespace mjlib {
+namespace telemetry {
+
+namespace {
+constexpr size_t kBufferSize = 1 << 16;
+constexpr int64_t kNoTimestamp = std::numeric_limits<int64_t>::min();
+
+const pt::ptime kEpoch{boost::gregorian::date(1970, 1, 1)};
+
+struct FileCloser {
+  void operator()(FILE* file) const { ::fclose(file); }
+};
+
+using FilePtr = std::unique_ptr<FILE, FileCloser>;
+
+void MakeDirectory(const std::string& name) {
+  if (::mkdir(name.c_str(), 0777) < 0 && errno != EEXIST) {
+    throw base::system_error::syserrno("creating " + name);
+  }
+}
+
+/// One output file, which values are appended to in large writes.
+class ColumnFile {
+ public:
+  ColumnFile(const std::string& filename)
+      : filename_(filename),
+        file_(::fopen(filename.c_str(), "wb")),
+        buffer_(new char[kBufferSize]) {
+    if (!file_) {
+      throw base::system_error::syserrno("opening " + filename);
+    }
+  }
+
+  void Append(const char* data, size_t size) {
+    if (position_ + size > kBufferSize) { Flush(); }
+    std::memcpy(&buffer_[position_], data, size);
+    position_ += size;
+  }
+
+  void Flush() {
+    if (position_ &&
+        ::fwrite(&buffer_[0], position_, 1, file_.get()) != 1) {
+      throw base::system_error::syserrno("writing " + filename_);
+    }
+    position_ = 0;
+  }
+
+  void Close() {
+    Flush();
+    if (::fclose(file_.release()) != 0) {
+      throw base::system_error::syserrno("closing " + filename_);
+    }
+  }
+
+ private:
+  const std::string filename_;
+  FilePtr file_;
+  std::unique_ptr<char[]> buffer_;
+  size_t position_ = 0;
+};
+
+struct Record {
+  Record(const std::string& name_in, const std::string& schema_in)
+      : name(name_in),
+        schema(schema_in),
+        plan(schema),
+        row(plan.row_size()) {}
+
+  std::string name;
+  std::string schema;
+  TelemetryDecodePlan plan;
+  std::vector<char> row;
+  uint64_t count = 0;
+
+  std::unique_ptr<ColumnFile> timestamps;
+
+  // One for each of plan.fields().
+  std::vector<std::unique_ptr<ColumnFile>> columns;
+};
+}
+
+class TelemetryColumnWriter::Impl {
+ public:
+  Impl(const std::string& directory, const Options& options)
+      : directory_(directory),
+        options_(options) {
+    MakeDirectory(directory_);
+  }
+
+  ~Impl() {
+    // There is nobody to report a failure to here.
+    try {
+      Close();
+    } catch (base::system_error&) {
+    }
+  }
+
+  void Write(TelemetryLogReader& log) {
+    MJ_ASSERT(!closed_);
+
+    // Map this log's identifiers to our records.
+    std::map<TelemetryLogReader::Identifier, Record*> identifiers;
+    for (const auto& schema : log.schemas()) {
+      if (!Wanted(schema.name)) { continue; }
+      identifiers[schema.identifier] = GetRecord(schema.name, schema.schema);
+    }
+
+    log.Seek(pt::ptime());
+    while (auto item = log.Read()) {
+      const auto it = identifiers.find(item->identifier);
+      if (it == identifiers.end()) { continue; }
+      Append(it->second, *item);
+    }
+  }
+
+  void Close() {
+    if (closed_) { return; }
+    closed_ = true;
+
+    for (auto& record : records_) {
+      record->timestamps->Close();
+      for (auto& column : record->columns) { column->Close(); }
+    }
+
+    // The MANIFEST is written last, so that a directory which has
+    // one is complete.
+    const auto filename = directory_ + "/MANIFEST";
+    FilePtr manifest(::fopen(filename.c_str(), "w"));
+    if (!manifest) {
+      throw base::system_error::syserrno("opening " + filename);
+    }
+    std::string text = "TCOL0001\n";
+    for (const auto& record : records_) {
+      text += "record " + record->name + " " +
+          std::to_string(record->count) + "\n";
+      for (const auto& field : record->plan.fields()) {
+        text += "column " + field.name + " " +
+            std::string(TelemetryColumnReader::TypeName(field.type)) + "\n";
+        for (const auto& value : field.enum_values) {
+          text += "enum " + field.name + " " + std::to_string(value.first) +
+              " " + value.second + "\n";
+        }
+      }
+    }
+    if (::fwrite(text.data(), text.size(), 1, manifest.get()) != 1 ||
+        ::fclose(manifest.release()) != 0) {
+      throw base::system_error::syserrno("writing " + filename);
+    }
+  }
+
+ private:
+  bool Wanted(const std::string& name) const {
+    if (options_.names.empty()) { return true; }
+    return std::find(options_.names.begin(), options_.names.end(), name) !=
+        options_.names.end();
+  }
+
+  Record* GetRecord(const std::string& name, const std::string& schema) {
+    for (auto& record : records_) {
+      if (record->name != name) { continue; }
+      if (record->schema != schema) {
+        throw base::system_error::einval(
+            "record has a different schema in each log: " + name);
+      }
+      return record.get();
+    }
+
+    // Names become directories and MANIFEST tokens.
+    if (name.empty() || name[0] == '.' ||
+        name.find_first_of("/ \t\r\n") != std::string::npos) {
+      throw base::system_error::einval("unsupported record name: " + name);
+    }
+
+    auto record = std::make_unique<Record>(name, schema);
+    const auto record_directory = directory_ + "/" + name;
+    MakeDirectory(record_directory);
+    record->timestamps =
+        std::make_unique<ColumnFile>(record_directory + "/@timestamp");
+    for (const auto& field : record->plan.fields()) {
+      record->columns.push_back(
+          std::make_unique<ColumnFile>(record_directory + "/" + field.name));
+    }
+
+    records_.push_back(std::move(record));
+    return records_.back().get();
+  }
+
+  void Append(Record* record, const TelemetryLogReader::Item& item) {
+    record->plan.Decode(item.data, record->row.data());
+
+    const int64_t timestamp = item.timestamp.is_special() ?
+        kNoTimestamp :
+        (item.timestamp - kEpoch).total_microseconds();
+    record->timestamps->Append(
+        reinterpret_cast<const char*>(&timestamp), sizeof(timestamp));
+
+    const auto& fields = record->plan.fields();
+    for (size_t i = 0; i < fields.size(); i++) {
+      record->columns[i]->Append(&record->row[fields[i].offset],
+                                 fields[i].size);
+    }
+    record->count++;
+  }
+
+  const std::string directory_;
+  const Options options_;
+  std::vector<std::unique_ptr<Record>> records_;
+  bool closed_ = false;
+};
+
+TelemetryColumnWriter::TelemetryColumnWriter(const std::string& directory,
+                                             const Options& options)
+    : impl_(std::make_unique<Impl>(directory, options)) {}
+
+TelemetryColumnWriter::~TelemetryColumnWriter() {}
+
+void TelemetryColumnWriter::Write(TelemetryLogReader& log) {
+  impl_->Write(log);
+}
+
+void TelemetryColumnWriter::Close() {
+  impl_->Close();
+}
+
+}
+}
@@ -0,0 +1,81 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mjlib/telemetry/telemetry_log_reader.h"
+
+namespace mjlib {
+namespace telemetry {
+
+/// Converts telemetry logs into a directory of columns, which can be
+/// memory mapped and used without any decoding.
+///
+/// Directory
+///  * MANIFEST
+///  * <record>/@timestamp
+///  * <record>/<field> for each leaf field of the record's schema
+///
+/// Every column file is a packed array with one little-endian value
+/// per data block of that record, in log order.  @timestamp holds
+/// int64_t microseconds since the epoch, or INT64_MIN for blocks which
+/// had none.  Fields are named and typed as by TelemetryDecodePlan.
+///
+/// MANIFEST is text, with one item per line:
+///  * TCOL0001
+///  * record <name> <count>
+///  * column <field> <type>
+///  * enum <field> <value> <name>
+///
+/// column and enum lines belong to the record line which precedes
+/// them.  <type> is one of bool, int8, uint8, int16, uint16, int32,
+/// uint32, int64, uint64, float32, float64, ptime (int64_t
+/// microseconds since the epoch) or enum (uint32_t).
+class TelemetryColumnWriter {
+ public:
+  struct Options {
+    /// If non-empty, only records with these names are written.
+    std::vector<std::string> names;
+
+    Options() {}
+  };
+
+  /// Throws base::system_error if @p directory cannot be created.
+  TelemetryColumnWriter(const std::string& directory,
+                        const Options& = Options());
+
+  /// Closes the columns if that has not been done already.
+  ~TelemetryColumnWriter();
+
+  /// Append every data block in @p log.  Several logs may be added,
+  /// so long as records with the same name have the same schema.
+  ///
+  /// Throws base::system_error on any error.
+  void Write(TelemetryLogReader& log);
+
+  /// Flush all columns and write the MANIFEST.  No further logs may
+  /// be added.
+  void Close();
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
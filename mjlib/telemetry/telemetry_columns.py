@@ -0,0 +1,122 @@
+#!/usr/bin/python3 -B
+
+# Copyright 2019 Josh Pieper, jjp@pobox.com.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+'''Memory map a directory of columns written by telemetry_columns_tool.
+
+Each column is returned as a memoryview of native values, which can
+be indexed directly, or wrapped without a copy with
+numpy.frombuffer(column, dtype=numpy.float32) and the like.
+
+  records = telemetry_columns.load('cols')
+  velocity = records['servo_stats'].columns['velocity']
+'''
+
+import mmap
+import os
+import sys
+
+
+_FORMATS = {
+    'bool' : '?',
+    'int8' : 'b',
+    'uint8' : 'B',
+    'int16' : 'h',
+    'uint16' : 'H',
+    'int32' : 'i',
+    'uint32' : 'I',
+    'int64' : 'q',
+    'uint64' : 'Q',
+    'float32' : 'f',
+    'float64' : 'd',
+    'ptime' : 'q',
+    'enum' : 'I',
+}
+
+# Microseconds since the epoch for records which had no timestamp.
+NO_TIMESTAMP = -(2 ** 63)
+
+
+class Record:
+    def __init__(self, name, count):
+        self.name = name
+        self.count = count
+
+        # Microseconds since the epoch, or NO_TIMESTAMP.
+        self.timestamp = None
+
+        # field name -> memoryview
+        self.columns = {}
+
+        # field name -> MANIFEST type name
+        self.types = {}
+
+        # field name -> {value: name}
+        self.enums = {}
+
+
+def _map(filename, format, count):
+    with open(filename, 'rb') as f:
+        size = os.fstat(f.fileno()).st_size
+        if size != count * _size(format):
+            raise RuntimeError('column is the wrong size: ' + filename)
+        if size == 0:
+            return memoryview(bytes()).cast(format)
+        return memoryview(
+            mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)).cast(format)
+
+
+def _size(format):
+    return memoryview(bytes(8)).cast(format).itemsize
+
+
+def load(directory):
+    '''Return a dict of record name to Record.'''
+
+    if sys.byteorder != 'little':
+        raise RuntimeError('columns can only be mapped on little endian hosts')
+
+    with open(os.path.join(directory, 'MANIFEST')) as f:
+        lines = f.read().splitlines()
+
+    if not lines or lines[0] != 'TCOL0001':
+        raise RuntimeError('not a column MANIFEST: ' + directory)
+
+    result = {}
+    record = None
+    for line in lines[1:]:
+        if not line:
+            continue
+        fields = line.split(' ')
+        if fields[0] == 'record':
+            record = Record(fields[1], int(fields[2]))
+            result[record.name] = record
+        elif fields[0] == 'column':
+            record.types[fields[1]] = fields[2]
+        elif fields[0] == 'enum':
+            record.enums.setdefault(fields[1], {})[int(fields[2])] = fields[3]
+        else:
+            raise RuntimeError('corrupt MANIFEST line: ' + line)
+
+    for record in result.values():
+        record_dir = os.path.join(directory, record.name)
+        record.timestamp = _map(
+            os.path.join(record_dir, '@timestamp'), 'q', record.count)
+        for name, type_name in record.types.items():
+            record.columns[name] = _map(
+                os.path.join(record_dir, name), _FORMATS[type_name],
+                record.count)
+
+    return result
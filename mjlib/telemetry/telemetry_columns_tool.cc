@@ -0,0 +1,104 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Converts one or more telemetry logs into a directory of memory
+/// mappable columns, as described in telemetry_column_writer.h.
+///
+///   telemetry_columns_tool --output cols log1.log [log2.log ...]
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/base/system_error.h"
+#include "mjlib/base/tokenizer.h"
+#include "mjlib/telemetry/telemetry_column_writer.h"
+#include "mjlib/telemetry/telemetry_log_reader.h"
+
+namespace base = mjlib::base;
+namespace po = boost::program_options;
+namespace telemetry = mjlib::telemetry;
+
+namespace {
+struct Options {
+  std::string output;
+
+  // A comma separated list of records to export.  All are exported
+  // if empty.
+  std::string names;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(output));
+    a->Visit(MJ_NVP(names));
+  }
+};
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  std::vector<std::string> logs;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()
+      ("help,h", "display usage message")
+      ("log", po::value(&logs), "telemetry log to convert")
+      ;
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::positional_options_description positional;
+  positional.add("log", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).
+            options(desc).positional(positional).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || logs.empty() || options.output.empty()) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  telemetry::TelemetryColumnWriter::Options writer_options;
+  for (base::Tokenizer tokenizer(options.names, ",");
+       !tokenizer.remaining().empty();) {
+    const auto name = tokenizer.next();
+    if (!name.empty()) { writer_options.names.push_back(std::string(name)); }
+  }
+
+  try {
+    const auto start = std::chrono::steady_clock::now();
+    telemetry::TelemetryColumnWriter writer(options.output, writer_options);
+    for (const auto& log : logs) {
+      telemetry::TelemetryLogReader reader(log);
+      writer.Write(reader);
+    }
+    writer.Close();
+    std::cout << "wrote " << options.output << " in "
+              << std::chrono::duration<double>(
+                  std::chrono::steady_clock::now() - start).count()
+              << " s\n";
+  } catch (base::system_error& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
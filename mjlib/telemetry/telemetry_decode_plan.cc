@@ -0,0 +1,464 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_decode_plan.h"
+
+#include "mjlib/base/system_error.h"
+
+namespace mjlib {
+namespace telemetry {
+
+namespace {
+using TF = TelemetryFormat;
+using FT = TF::FieldType;
+
+// Objects can nest, but nothing we log comes anywhere near this.
+constexpr int kMaxDepth = 64;
+
+void Corrupt(const char* message) {
+  throw base::system_error::einval(message);
+}
+
+class SchemaParser {
+ public:
+  SchemaParser(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T Read() {
+    T result = {};
+    std::memcpy(&result, Take(sizeof(result)).data(), sizeof(result));
+    return result;
+  }
+
+  std::string_view ReadString() {
+    return Take(Read<uint32_t>());
+  }
+
+  std::string_view Take(size_t size) {
+    if (size > data_.size()) { Corrupt("truncated telemetry schema"); }
+    const auto result = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return result;
+  }
+
+ private:
+  std::string_view data_;
+};
+
+size_t ScalarSize(FT type) {
+  switch (type) {
+    case FT::kBool:
+    case FT::kInt8:
+    case FT::kUInt8: {
+      return 1;
+    }
+    case FT::kInt16:
+    case FT::kUInt16: {
+      return 2;
+    }
+    case FT::kInt32:
+    case FT::kUInt32:
+    case FT::kFloat32:
+    case FT::kEnum: {
+      return 4;
+    }
+    case FT::kInt64:
+    case FT::kUInt64:
+    case FT::kFloat64:
+    case FT::kPtime: {
+      return 8;
+    }
+    case FT::kFinal:
+    case FT::kString:
+    case FT::kPair:
+    case FT::kArray:
+    case FT::kVector:
+    case FT::kObject:
+    case FT::kOptional: {
+      break;
+    }
+  }
+  return 0;
+}
+}
+
+class TelemetryDecodePlan::Impl {
+ public:
+  Impl(std::string_view schema) {
+    SchemaParser parser(schema);
+    parser.Read<uint32_t>();  // SchemaFlags
+    CompileObject(parser, "", false, 0);
+    row_size_ = Align(row_size_, 8);
+  }
+
+  void Decode(std::string_view data, char* row) const {
+    const char* const end = Run(0, ops_.size(), data.data(),
+                                data.data() + data.size(), row);
+    if (end != data.data() + data.size()) {
+      Corrupt("telemetry record is longer than its schema");
+    }
+  }
+
+  struct Op {
+    enum Kind {
+      kCopy,
+      kString,
+      kOptional,
+      kVector,
+    };
+
+    Kind kind = kCopy;
+
+    // kCopy: the number of bytes copied.  kVector: the wire size of
+    // each element if they are all the same, otherwise 0.
+    size_t size = 0;
+
+    // Where in the row the value, the size, or the present flag goes.
+    size_t offset = 0;
+
+    // kOptional: the part of the row to clear when absent.
+    size_t clear_begin = 0;
+    size_t clear_end = 0;
+
+    // kOptional and kVector: the index after the nested operations.
+    size_t end = 0;
+  };
+
+  std::vector<Op> ops_;
+  std::vector<Field> fields_;
+  size_t row_size_ = 0;
+
+ private:
+  static size_t Align(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  /// Run the operations [begin, end) against the record at @p in.  If
+  /// @p row is nullptr, the values are skipped rather than stored.
+  ///
+  /// @return the first unconsumed byte of the record
+  const char* Run(size_t begin, size_t end,
+                  const char* in, const char* in_end, char* row) const {
+    auto take = [&](uint64_t size) {
+      if (size > static_cast<uint64_t>(in_end - in)) {
+        Corrupt("truncated telemetry record");
+      }
+      const char* const result = in;
+      in += size;
+      return result;
+    };
+    auto read_u32 = [&]() {
+      uint32_t result = 0;
+      std::memcpy(&result, take(sizeof(result)), sizeof(result));
+      return result;
+    };
+
+    size_t i = begin;
+    while (i < end) {
+      const Op& op = ops_[i];
+      switch (op.kind) {
+        case Op::kCopy: {
+          const char* const value = take(op.size);
+          if (row) { std::memcpy(row + op.offset, value, op.size); }
+          i++;
+          break;
+        }
+        case Op::kString: {
+          const uint32_t size = read_u32();
+          take(size);
+          if (row) { std::memcpy(row + op.offset, &size, sizeof(size)); }
+          i++;
+          break;
+        }
+        case Op::kOptional: {
+          const bool present = *take(1) != 0;
+          if (row) {
+            row[op.offset] = present;
+            if (!present) {
+              std::memset(row + op.clear_begin, 0,
+                          op.clear_end - op.clear_begin);
+            }
+          }
+          // When present, the contents follow inline.
+          i = present ? (i + 1) : op.end;
+          break;
+        }
+        case Op::kVector: {
+          const uint32_t size = read_u32();
+          if (row) { std::memcpy(row + op.offset, &size, sizeof(size)); }
+          if (op.size) {
+            take(static_cast<uint64_t>(size) * op.size);
+          } else {
+            for (uint32_t j = 0; j < size; j++) {
+              in = Run(i + 1, op.end, in, in_end, nullptr);
+            }
+          }
+          i = op.end;
+          break;
+        }
+      }
+    }
+    return in;
+  }
+
+  static std::string Join(const std::string& prefix, std::string_view name) {
+    if (prefix.empty()) { return std::string(name); }
+    return prefix + "." + std::string(name);
+  }
+
+  void CompileObject(SchemaParser& parser, const std::string& prefix,
+                     bool skip, int depth) {
+    if (depth > kMaxDepth) { Corrupt("telemetry schema nested too deeply"); }
+
+    parser.Read<uint32_t>();  // ObjectFlags
+    while (true) {
+      parser.Read<uint32_t>();  // FieldFlags
+      const auto name = parser.ReadString();
+      const auto type = static_cast<FT>(parser.Read<uint32_t>());
+      if (type == FT::kFinal) { return; }
+      CompileField(parser, type, Join(prefix, name), skip, depth + 1);
+    }
+  }
+
+  /// Add the operations for one field.  When @p skip is true, the
+  /// field is within a vector, and is only ever skipped over.
+  void CompileField(SchemaParser& parser, FT type, const std::string& name,
+                    bool skip, int depth) {
+    if (depth > kMaxDepth) { Corrupt("telemetry schema nested too deeply"); }
+
+    switch (type) {
+      case FT::kBool:
+      case FT::kInt8:
+      case FT::kUInt8:
+      case FT::kInt16:
+      case FT::kUInt16:
+      case FT::kInt32:
+      case FT::kUInt32:
+      case FT::kInt64:
+      case FT::kUInt64:
+      case FT::kFloat32:
+      case FT::kFloat64:
+      case FT::kPtime: {
+        AddScalar(name, type, skip);
+        break;
+      }
+      case FT::kEnum: {
+        std::vector<std::pair<uint32_t, std::string>> values;
+        const auto nvalues = parser.Read<uint32_t>();
+        for (uint32_t i = 0; i < nvalues; i++) {
+          const auto value = parser.Read<uint32_t>();
+          values.emplace_back(value, std::string(parser.ReadString()));
+        }
+        AddScalar(name, type, skip);
+        if (!skip) { fields_.back().enum_values = std::move(values); }
+        break;
+      }
+      case FT::kString: {
+        Op op;
+        op.kind = Op::kString;
+        op.offset = skip ? 0 : AddField(name + ".size", FT::kUInt32);
+        AddOp(op);
+        break;
+      }
+      case FT::kPair: {
+        CompileField(parser, ReadType(parser), name + ".first",
+                     skip, depth + 1);
+        CompileField(parser, ReadType(parser), name + ".second",
+                     skip, depth + 1);
+        break;
+      }
+      case FT::kArray: {
+        const auto nelements = parser.Read<uint32_t>();
+        if (nelements >
+            static_cast<uint32_t>(TF::BlockOffsets::kMaxBlockSize)) {
+          Corrupt("corrupt telemetry schema array size");
+        }
+        // The element schema only appears once, so it is compiled
+        // once per element from the same place.
+        const SchemaParser element_start = parser;
+        for (uint32_t i = 0; i < nelements; i++) {
+          parser = element_start;
+          CompileField(parser, ReadType(parser),
+                       name + "[" + std::to_string(i) + "]",
+                       skip, depth + 1);
+        }
+        if (nelements == 0) {
+          // Still consume the element schema, but emit nothing.
+          const auto fields_size = fields_.size();
+          const auto ops_size = ops_.size();
+          const auto row_size = row_size_;
+          const auto barrier = barrier_;
+          CompileField(parser, ReadType(parser), name, true, depth + 1);
+          fields_.resize(fields_size);
+          ops_.resize(ops_size);
+          row_size_ = row_size;
+          barrier_ = barrier;
+        }
+        break;
+      }
+      case FT::kVector: {
+        Op op;
+        op.kind = Op::kVector;
+        op.offset = skip ? 0 : AddField(name + ".size", FT::kUInt32);
+        const size_t index = AddOp(op);
+        barrier_ = ops_.size();
+
+        CompileField(parser, ReadType(parser), name, true, depth + 1);
+
+        // Elements made only of scalars can be skipped in one step.
+        size_t element_size = 0;
+        for (size_t i = index + 1; i < ops_.size(); i++) {
+          if (ops_[i].kind != Op::kCopy) {
+            element_size = 0;
+            break;
+          }
+          element_size += ops_[i].size;
+        }
+        if (element_size) {
+          ops_.resize(index + 1);
+          ops_[index].size = element_size;
+        }
+        ops_[index].end = ops_.size();
+        barrier_ = ops_.size();
+        break;
+      }
+      case FT::kObject: {
+        CompileObject(parser, name, skip, depth + 1);
+        break;
+      }
+      case FT::kOptional: {
+        Op op;
+        op.kind = Op::kOptional;
+        op.offset = skip ? 0 : AddField(name + ".present", FT::kBool);
+        const size_t index = AddOp(op);
+        barrier_ = ops_.size();
+
+        const size_t clear_begin = row_size_;
+        CompileField(parser, ReadType(parser), name, skip, depth + 1);
+
+        ops_[index].clear_begin = clear_begin;
+        ops_[index].clear_end = row_size_;
+        ops_[index].end = ops_.size();
+        barrier_ = ops_.size();
+        break;
+      }
+      case FT::kFinal:
+      default: {
+        Corrupt("corrupt telemetry schema field type");
+      }
+    }
+  }
+
+  static FT ReadType(SchemaParser& parser) {
+    return static_cast<FT>(parser.Read<uint32_t>());
+  }
+
+  size_t AddField(const std::string& name, FT type) {
+    Field field;
+    field.name = name;
+    field.type = type;
+    field.size = ScalarSize(type);
+    field.offset = Align(row_size_, field.size);
+    row_size_ = field.offset + field.size;
+    fields_.push_back(std::move(field));
+    return fields_.back().offset;
+  }
+
+  void AddScalar(const std::string& name, FT type, bool skip) {
+    Op op;
+    op.kind = Op::kCopy;
+    op.size = ScalarSize(type);
+    op.offset = skip ? 0 : AddField(name, type);
+
+    // Values which land immediately after the previous one, with no
+    // padding, are folded into the same copy.
+    if (ops_.size() > barrier_ && ops_.back().kind == Op::kCopy &&
+        (skip || ops_.back().offset + ops_.back().size == op.offset)) {
+      ops_.back().size += op.size;
+      return;
+    }
+    AddOp(op);
+  }
+
+  size_t AddOp(const Op& op) {
+    ops_.push_back(op);
+    return ops_.size() - 1;
+  }
+
+  // Operations before this index may not be merged with new ones,
+  // because they are on the other side of a nested range.
+  size_t barrier_ = 0;
+};
+
+TelemetryDecodePlan::TelemetryDecodePlan(std::string_view schema)
+    : impl_(std::make_unique<Impl>(schema)) {}
+
+TelemetryDecodePlan::~TelemetryDecodePlan() {}
+
+TelemetryDecodePlan::TelemetryDecodePlan(TelemetryDecodePlan&&) = default;
+
+TelemetryDecodePlan& TelemetryDecodePlan::operator=(
+    TelemetryDecodePlan&&) = default;
+
+const std::vector<TelemetryDecodePlan::Field>&
+TelemetryDecodePlan::fields() const {
+  return impl_->fields_;
+}
+
+const TelemetryDecodePlan::Field* TelemetryDecodePlan::FindField(
+    std::string_view name) const {
+  for (const auto& field : impl_->fields_) {
+    if (field.name == name) { return &field; }
+  }
+  return nullptr;
+}
+
+size_t TelemetryDecodePlan::row_size() const {
+  return impl_->row_size_;
+}
+
+void TelemetryDecodePlan::Decode(std::string_view data, char* row) const {
+  impl_->Decode(data, row);
+}
+
+double TelemetryDecodePlan::GetDouble(const char* row, const Field& field) {
+  switch (field.type) {
+    case FT::kBool: { return Get<uint8_t>(row, field) != 0; }
+    case FT::kInt8: { return Get<int8_t>(row, field); }
+    case FT::kUInt8: { return Get<uint8_t>(row, field); }
+    case FT::kInt16: { return Get<int16_t>(row, field); }
+    case FT::kUInt16: { return Get<uint16_t>(row, field); }
+    case FT::kInt32: { return Get<int32_t>(row, field); }
+    case FT::kUInt32: { return Get<uint32_t>(row, field); }
+    case FT::kInt64: { return Get<int64_t>(row, field); }
+    case FT::kUInt64: { return Get<uint64_t>(row, field); }
+    case FT::kFloat32: { return Get<float>(row, field); }
+    case FT::kFloat64: { return Get<double>(row, field); }
+    case FT::kPtime: { return Get<int64_t>(row, field); }
+    case FT::kEnum: { return Get<uint32_t>(row, field); }
+    case FT::kFinal:
+    case FT::kString:
+    case FT::kPair:
+    case FT::kArray:
+    case FT::kVector:
+    case FT::kObject:
+    case FT::kOptional: {
+      break;
+    }
+  }
+  return 0.0;
+}
+
+}
+}
@@ -0,0 +1,111 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mjlib/telemetry/telemetry_format.h"
+
+namespace mjlib {
+namespace telemetry {
+
+/// Decodes binary telemetry records into a fixed layout "row" of
+/// native values, one per leaf field of the schema.
+///
+/// The schema is walked once on construction and flattened into a
+/// list of operations, so decoding a record does no parsing and no
+/// allocation.  Runs of scalars which are laid out identically on the
+/// wire and in the row are decoded with a single copy.
+///
+/// Leaf fields are named with their path from the top level object,
+/// separated by '.'.  Array elements are suffixed with "[N]", and the
+/// members of a pair with ".first" and ".second".
+///
+/// Values without a fixed size have no place in a row:
+///  * optional: a kBool field named "<name>.present" precedes the
+///    contents, which are zero when absent
+///  * string and vector: only a kUInt32 field named "<name>.size" is
+///    decoded
+///
+/// TelemetrySchemaReader can be used for those records where the
+/// contents of strings or vectors are required.
+class TelemetryDecodePlan {
+ public:
+  using FieldType = TelemetryFormat::FieldType;
+
+  /// Compile @p schema, as produced by TelemetryWriteArchive::schema().
+  ///
+  /// Throws base::system_error if it is malformed.
+  explicit TelemetryDecodePlan(std::string_view schema);
+  ~TelemetryDecodePlan();
+
+  TelemetryDecodePlan(TelemetryDecodePlan&&);
+  TelemetryDecodePlan& operator=(TelemetryDecodePlan&&);
+
+  struct Field {
+    std::string name;
+
+    /// One of the scalar types, or kPtime (int64_t microseconds since
+    /// the epoch) or kEnum (uint32_t).
+    FieldType type = FieldType::kFinal;
+
+    /// Where the value is found within a row.  It is aligned to its
+    /// own size.
+    size_t offset = 0;
+    size_t size = 0;
+
+    /// For kEnum fields, the name of each value.
+    std::vector<std::pair<uint32_t, std::string>> enum_values;
+  };
+
+  const std::vector<Field>& fields() const;
+
+  /// @return the field named @p name, or nullptr if there is none.
+  const Field* FindField(std::string_view name) const;
+
+  /// @return the size of a row in bytes.
+  size_t row_size() const;
+
+  /// Decode the record @p data into @p row, which must be at least
+  /// row_size() bytes long.
+  ///
+  /// Throws base::system_error if the record does not match the
+  /// schema, in which case @p row is partially updated.
+  void Decode(std::string_view data, char* row) const;
+
+  template <typename T>
+  static T Get(const char* row, const Field& field) {
+    T result = {};
+    std::memcpy(&result, row + field.offset, sizeof(result));
+    return result;
+  }
+
+  /// @return the value of @p field converted to a double, whatever its
+  /// type.
+  static double GetDouble(const char* row, const Field& field);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
@@ -0,0 +1,128 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "mjlib/base/string_span.h"
+
+namespace mjlib {
+namespace telemetry {
+
+/// Encodes one binary telemetry record, as produced by
+/// TelemetryWriteArchive, relative to the previous record of the same
+/// structure.
+///
+/// Delta
+///  * uint32_t size of the record
+///  * ceil(ceil(size / 4) / 8) bytes of bitmap, where bit (i % 8) of
+///    byte (i / 8) is set if the i'th 4 byte word of the record
+///    changed
+///  * each changed word in order, the last of which may be shorter
+///    than 4 bytes if the record is not a multiple of 4 long
+///
+/// Words are used rather than fields so that no schema is needed on
+/// either end.  Most fields in our structures are 4 byte scalars, so
+/// the two usually coincide.
+struct TelemetryDelta {
+  static constexpr std::size_t kWordSize = 4;
+  static constexpr std::size_t kHeaderSize = sizeof(uint32_t);
+
+  static constexpr std::size_t BitmapSize(std::size_t record_size) {
+    return ((record_size + kWordSize - 1) / kWordSize + 7) / 8;
+  }
+
+  /// @return the largest possible delta for a record of the given
+  /// size.
+  static constexpr std::size_t MaxSize(std::size_t record_size) {
+    return kHeaderSize + BitmapSize(record_size) + record_size;
+  }
+
+  /// Write the delta from @p previous to @p record and update
+  /// @p previous to match @p record.
+  ///
+  /// @p output must not overlap @p previous.  It may overlap
+  /// @p record, so long as it starts at least kHeaderSize +
+  /// BitmapSize(size) bytes before it, in which case @p record is
+  /// overwritten.
+  ///
+  /// @return the number of bytes written to @p output
+  static std::size_t Encode(const char* record, std::size_t size,
+                            char* previous, char* output) {
+    const uint32_t size_u32 = size;
+    std::memcpy(output, &size_u32, sizeof(size_u32));
+
+    char* const bitmap = output + kHeaderSize;
+    const std::size_t bitmap_size = BitmapSize(size);
+    std::memset(bitmap, 0, bitmap_size);
+
+    // Each changed word is copied to previous before being written
+    // out, so it does not matter if the output has caught up to it.
+    char* out = bitmap + bitmap_size;
+    for (std::size_t offset = 0, word = 0; offset < size;
+         offset += kWordSize, word++) {
+      const std::size_t this_size =
+          (size - offset) < kWordSize ? (size - offset) : kWordSize;
+      if (std::memcmp(record + offset, previous + offset, this_size) == 0) {
+        continue;
+      }
+      bitmap[word / 8] |= (1 << (word % 8));
+      std::memcpy(previous + offset, record + offset, this_size);
+      std::memcpy(out, previous + offset, this_size);
+      out += this_size;
+    }
+    return out - output;
+  }
+
+  /// Apply a delta produced by Encode to @p record, which must hold
+  /// the previous record.
+  ///
+  /// @return false if the delta is malformed or was made for a record
+  /// of a different size, in which case @p record may have been
+  /// partially updated
+  static bool Apply(std::string_view delta, const base::string_span& record) {
+    if (delta.size() < kHeaderSize) { return false; }
+    uint32_t size = 0;
+    std::memcpy(&size, delta.data(), sizeof(size));
+    if (size != static_cast<std::size_t>(record.size())) { return false; }
+
+    const std::size_t bitmap_size = BitmapSize(size);
+    if (delta.size() < kHeaderSize + bitmap_size) { return false; }
+
+    const char* const bitmap = delta.data() + kHeaderSize;
+    const char* in = bitmap + bitmap_size;
+    const char* const end = delta.data() + delta.size();
+    for (std::size_t offset = 0, word = 0; offset < size;
+         offset += kWordSize, word++) {
+      if ((bitmap[word / 8] & (1 << (word % 8))) == 0) { continue; }
+      const std::size_t this_size =
+          (size - offset) < kWordSize ? (size - offset) : kWordSize;
+      if (static_cast<std::size_t>(end - in) < this_size) { return false; }
+      std::memcpy(record.data() + offset, in, this_size);
+      in += this_size;
+    }
+    return in == end;
+  }
+
+  static bool Apply(std::string_view delta, std::string* record) {
+    return Apply(delta, base::string_span(record->data(), record->size()));
+  }
+};
+
+}
+}
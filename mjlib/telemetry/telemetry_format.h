@@ -48,6 +48,7 @@
 ///   1 - BlockSchema
 ///   2 - BlockData
 ///   3 - BlockIndex
+///   4 - BlockCompressed
 ///
 /// BlockSchema
 ///  * uint32_t identifier
@@ -60,17 +61,32 @@
 ///  * uint16_t BlockDataFlags
 ///  * DataObject
 ///
+/// BlockCompressed
+///  * uint32_t BlockCompressedFlags
+///  * N Block s, all BlockData, compressed together with the "snappy"
+///    algorithm in its raw unframed format.  See base/snappy.h.
+///
+/// The BlockData within a BlockCompressed have no position of their
+/// own, so they omit kPreviousOffset, and any position which would
+/// refer to one of them refers to the BlockCompressed instead.
+///
 /// BlockIndex
 ///  * uint32_t BlockIndexFlags
+///  * (optional) BlockIndexFlags specific data
 ///  * uint32_t num_elements
 ///  * N BlockIndexRecord s
-///  * uint32_t size of this BlockIndex
+///  * uint32_t size of this BlockIndex, including the block header
 ///  * 8 byte constant TLOGIDEX
 ///
 /// BlockIndexRecord
 ///  * uint32_t identifier
 ///  * uint64_t schema position
-///  * uint64_t last data position
+///  * uint64_t last data position (0 if none)
+///  * (optional) BlockIndexFlags specific data
+///
+/// Positions are measured from the start of the file.  Since every
+/// BlockIndex ends with its size and a constant, the last one in a
+/// file can be found by reading backwards from the end.
 ///
 /// Schema
 ///  * uint32_t SchemaFlags
@@ -173,11 +189,15 @@ struct TelemetryFormat {
     kBlockSchema = 1,
     kBlockData = 2,
     kBlockIndex = 3,
+    kBlockCompressed = 4,
   };
 
   enum BlockSchemaFlags {
   };
 
+  enum BlockCompressedFlags {
+  };
+
   enum BlockDataFlags {
     // The following flags define optional fields which will be
     // present after the flags field and before the data itself.  If
@@ -195,13 +215,32 @@ struct TelemetryFormat {
     ///   * uint32_t
     kSchemaCRC = 1 << 1,
 
+    /// The time at which this record was captured.
+    ///   * int64_t microseconds since epoch
+    kTimestamp = 1 << 2,
+
 
     // The following flags do not require that additional data be stored.
 
-    /// The DataObject is compressed with the "snappy" compression algorithm.
+    /// The DataObject is compressed with the "snappy" compression
+    /// algorithm, in its raw unframed format.  See base/snappy.h.
     kSnappy = 1 << 8,
   };
 
+  enum BlockIndexFlags {
+    /// The position of the previous BlockIndex in the file, or 0 if
+    /// this is the first.  Present after the flags field.
+    ///
+    ///   * uint64_t
+    kPreviousIndex = 1 << 0,
+
+    /// The timestamp of the last data block, or INT64_MIN if it had
+    /// none.  Present at the end of each BlockIndexRecord.
+    ///
+    ///   * int64_t microseconds since epoch
+    kIndexTimestamp = 1 << 1,
+  };
+
   enum SchemaFlags {
   };
 
@@ -346,7 +385,7 @@ class TelemetryReadStream {
     uint32_t value = 0;
     do {
       value = Read<uint32_t>();
-      result |= (value & 0x7fffffff) << position;
+      result |= static_cast<uint64_t>(value & 0x7fffffff) << position;
       position += 31;
     } while (value >= 0x80000000);
 
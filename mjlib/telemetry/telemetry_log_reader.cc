@@ -0,0 +1,467 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_log_reader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include "mjlib/base/snappy.h"
+#include "mjlib/base/system_error.h"
+#include "mjlib/telemetry/telemetry_format.h"
+
+namespace pt = boost::posix_time;
+
+namespace mjlib {
+namespace telemetry {
+
+namespace {
+using TF = TelemetryFormat;
+
+constexpr char kIndexTrailer[] = "TLOGIDEX";
+constexpr uint64_t kHeaderSize = 8;
+constexpr uint64_t kBlockHeaderSize = 6;
+constexpr uint64_t kIndexTrailerSize = sizeof(uint32_t) + 8;
+constexpr int64_t kNoTimestamp = std::numeric_limits<int64_t>::min();
+
+struct FileCloser {
+  void operator()(FILE* file) const { ::fclose(file); }
+};
+
+using FilePtr = std::unique_ptr<FILE, FileCloser>;
+
+const pt::ptime kEpoch{boost::gregorian::date(1970, 1, 1)};
+
+pt::ptime FromMicroseconds(int64_t value) {
+  if (value == kNoTimestamp) { return {}; }
+  return kEpoch + pt::microseconds(value);
+}
+
+int64_t ToMicroseconds(pt::ptime time) {
+  if (time.is_special()) { return kNoTimestamp; }
+  return (time - kEpoch).total_microseconds();
+}
+
+/// Like TelemetryReadStream, but throws when a block is shorter than
+/// its contents claim, rather than asserting.
+class BlockParser {
+ public:
+  BlockParser(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T Read() {
+    T result = {};
+    std::memcpy(&result, Take(sizeof(result)).data(), sizeof(result));
+    return result;
+  }
+
+  uint64_t ReadVarint() {
+    uint64_t result = 0;
+    int position = 0;
+    uint32_t value = 0;
+    do {
+      if (position >= 64) { Corrupt(); }
+      value = Read<uint32_t>();
+      result |= static_cast<uint64_t>(value & 0x7fffffff) << position;
+      position += 31;
+    } while (value >= 0x80000000);
+    return result;
+  }
+
+  std::string_view ReadString() {
+    return Take(Read<uint32_t>());
+  }
+
+  std::string_view Take(size_t size) {
+    if (size > data_.size()) { Corrupt(); }
+    const auto result = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return result;
+  }
+
+  std::string_view remaining() const { return data_; }
+
+ private:
+  static void Corrupt() {
+    throw base::system_error::einval("corrupt telemetry log block");
+  }
+
+  std::string_view data_;
+};
+}
+
+class TelemetryLogReader::Impl {
+ public:
+  Impl(const std::string& filename)
+      : file_(::fopen(filename.c_str(), "rb")) {
+    if (!file_) {
+      throw base::system_error::syserrno("opening " + filename);
+    }
+
+    char header[kHeaderSize] = {};
+    if (::fread(header, sizeof(header), 1, file_.get()) != 1 ||
+        std::memcmp(header, TF::kHeader, sizeof(header)) != 0) {
+      throw base::system_error::einval("not a telemetry log: " + filename);
+    }
+
+    ::fseeko(file_.get(), 0, SEEK_END);
+    file_size_ = ::ftello(file_.get());
+    file_position_ = file_size_;
+
+    if (!ReadIndices()) {
+      checkpoints_.clear();
+      Scan();
+    }
+
+    position_ = kHeaderSize;
+  }
+
+  std::optional<Item> Read(std::optional<Identifier> identifier) {
+    while (true) {
+      if (run_index_ < run_.size()) {
+        last_run_index_ = run_index_;
+        auto item = ParseData(run_[run_index_++]);
+        if (identifier && item.identifier != *identifier) { continue; }
+        return item;
+      }
+
+      const auto maybe_block = ReadBlock(position_);
+      if (!maybe_block) { return {}; }
+      const auto& block = *maybe_block;
+      position_ = block.next;
+
+      if (block.type == TF::BlockType::kBlockCompressed) {
+        ParseRun(block);
+        continue;
+      }
+      if (block.type != TF::BlockType::kBlockData) { continue; }
+      auto item = ParseData(block);
+      if (identifier && item.identifier != *identifier) { continue; }
+      last_run_index_ = {};
+      return item;
+    }
+  }
+
+  void Seek(std::optional<Identifier> identifier, pt::ptime timestamp) {
+    const int64_t target = ToMicroseconds(timestamp);
+
+    // Find the first index by which a matching block had been
+    // written.  The one before it was written earlier still, so
+    // scanning can start there.
+    auto reached = [&](const Checkpoint& checkpoint) {
+      for (const auto& pair : checkpoint.records) {
+        if (identifier && pair.first != *identifier) { continue; }
+        const auto& record = pair.second;
+        if (record.last_data_position != 0 &&
+            record.timestamp >= target) {
+          return true;
+        }
+      }
+      return false;
+    };
+    const auto it = std::partition_point(
+        checkpoints_.begin(), checkpoints_.end(),
+        [&](const auto& checkpoint) { return !reached(checkpoint); });
+    position_ = (it == checkpoints_.begin()) ?
+        kHeaderSize : std::prev(it)->position;
+    run_.clear();
+    run_index_ = 0;
+
+    while (true) {
+      const auto maybe_item = Read(identifier);
+      if (!maybe_item) { return; }
+      if (timestamp.is_not_a_date_time() ||
+          (!maybe_item->timestamp.is_not_a_date_time() &&
+           maybe_item->timestamp >= timestamp)) {
+        // Put the item back, so that it is the next one read.
+        if (last_run_index_) {
+          run_index_ = *last_run_index_;
+        } else {
+          position_ = maybe_item->position;
+        }
+        return;
+      }
+    }
+  }
+
+  std::vector<Schema> schemas_;
+  std::map<std::string, Identifier, std::less<>> identifiers_;
+
+  struct IndexRecord {
+    uint64_t schema_position = 0;
+    uint64_t last_data_position = 0;
+    int64_t timestamp = kNoTimestamp;
+  };
+
+  struct Checkpoint {
+    uint64_t position = 0;
+    std::map<Identifier, IndexRecord> records;
+  };
+
+  std::vector<Checkpoint> checkpoints_;
+
+ private:
+  struct Block {
+    TF::BlockType type = {};
+    uint64_t position = 0;
+    uint64_t next = 0;
+    std::string data;
+  };
+
+  /// @return the block at @p position, or an empty optional if the
+  /// file ends before the block does.
+  std::optional<Block> ReadBlock(uint64_t position) {
+    if (position + kBlockHeaderSize > file_size_) { return {}; }
+    SeekFile(position);
+
+    char header[kBlockHeaderSize] = {};
+    if (!RawRead(header, sizeof(header))) { return {}; }
+
+    uint16_t type = 0;
+    uint32_t size = 0;
+    std::memcpy(&type, &header[0], sizeof(type));
+    std::memcpy(&size, &header[2], sizeof(size));
+    if (size > static_cast<uint32_t>(TF::BlockOffsets::kMaxBlockSize)) {
+      throw base::system_error::einval("corrupt telemetry log block");
+    }
+    if (position + kBlockHeaderSize + size > file_size_) { return {}; }
+
+    Block result;
+    result.type = static_cast<TF::BlockType>(type);
+    result.position = position;
+    result.next = position + kBlockHeaderSize + size;
+    result.data.resize(size);
+    if (size && !RawRead(&result.data[0], size)) { return {}; }
+    return result;
+  }
+
+  Item ParseData(const Block& block) {
+    BlockParser parser(block.data);
+    Item result;
+    result.position = block.position;
+    result.identifier = parser.Read<uint32_t>();
+    result.flags = parser.Read<uint16_t>();
+    if (result.flags & TF::kPreviousOffset) { parser.ReadVarint(); }
+    if (result.flags & TF::kSchemaCRC) { parser.Read<uint32_t>(); }
+    if (result.flags & TF::kTimestamp) {
+      result.timestamp = FromMicroseconds(parser.Read<int64_t>());
+    }
+    if (result.flags & TF::kSnappy) {
+      if (!base::SnappyUncompress(parser.remaining(), &result.data)) {
+        throw base::system_error::einval("corrupt compressed data block");
+      }
+    } else {
+      result.data = std::string(parser.remaining());
+    }
+    return result;
+  }
+
+  /// Replace run_ with the data blocks compressed within @p block.
+  void ParseRun(const Block& block) {
+    BlockParser parser(block.data);
+    parser.Read<uint32_t>();  // BlockCompressedFlags
+    if (!base::SnappyUncompress(parser.remaining(), &run_data_)) {
+      throw base::system_error::einval("corrupt compressed block");
+    }
+
+    run_.clear();
+    run_index_ = 0;
+    BlockParser run_parser(run_data_);
+    while (!run_parser.remaining().empty()) {
+      Block inner;
+      inner.type = static_cast<TF::BlockType>(run_parser.Read<uint16_t>());
+      const auto size = run_parser.Read<uint32_t>();
+      inner.data = std::string(run_parser.Take(size));
+      if (inner.type != TF::BlockType::kBlockData) {
+        throw base::system_error::einval("corrupt compressed block");
+      }
+      // The blocks within have no position of their own.
+      inner.position = block.position;
+      inner.next = block.next;
+      run_.push_back(std::move(inner));
+    }
+  }
+
+  void AddSchema(const Block& block) {
+    BlockParser parser(block.data);
+    Schema schema;
+    schema.identifier = parser.Read<uint32_t>();
+    parser.Read<uint32_t>();  // BlockSchemaFlags
+    schema.name = std::string(parser.ReadString());
+    schema.schema = std::string(parser.remaining());
+
+    identifiers_[schema.name] = schema.identifier;
+    schemas_.push_back(std::move(schema));
+  }
+
+  Checkpoint ParseIndex(const Block& block, uint64_t* previous) {
+    BlockParser parser(block.data);
+    Checkpoint result;
+    result.position = block.position;
+
+    const auto flags = parser.Read<uint32_t>();
+    *previous = 0;
+    if (flags & TF::kPreviousIndex) { *previous = parser.Read<uint64_t>(); }
+
+    const auto num_elements = parser.Read<uint32_t>();
+    for (uint32_t i = 0; i < num_elements; i++) {
+      const auto identifier = parser.Read<uint32_t>();
+      auto& record = result.records[identifier];
+      record.schema_position = parser.Read<uint64_t>();
+      record.last_data_position = parser.Read<uint64_t>();
+      if (flags & TF::kIndexTimestamp) {
+        record.timestamp = parser.Read<int64_t>();
+      }
+    }
+    return result;
+  }
+
+  /// Follow the chain of indices back from the end of the file.
+  ///
+  /// @return false if the file does not end with an index
+  bool ReadIndices() {
+    if (file_size_ < kHeaderSize + kBlockHeaderSize + kIndexTrailerSize) {
+      return false;
+    }
+    SeekFile(file_size_ - kIndexTrailerSize);
+    char trailer[kIndexTrailerSize] = {};
+    if (!RawRead(trailer, sizeof(trailer)) ||
+        std::memcmp(&trailer[4], kIndexTrailer, 8) != 0) {
+      return false;
+    }
+    uint32_t size = 0;
+    std::memcpy(&size, trailer, sizeof(size));
+    if (size > file_size_ - kHeaderSize) { return false; }
+
+    uint64_t position = file_size_ - size;
+    while (true) {
+      const auto maybe_block = ReadBlock(position);
+      if (!maybe_block || maybe_block->type != TF::BlockType::kBlockIndex) {
+        return false;
+      }
+      uint64_t previous = 0;
+      checkpoints_.push_back(ParseIndex(*maybe_block, &previous));
+      if (previous == 0) { break; }
+      if (previous >= position) { return false; }
+      position = previous;
+    }
+    std::reverse(checkpoints_.begin(), checkpoints_.end());
+
+    for (const auto& pair : checkpoints_.back().records) {
+      const auto maybe_block = ReadBlock(pair.second.schema_position);
+      if (!maybe_block || maybe_block->type != TF::BlockType::kBlockSchema) {
+        return false;
+      }
+      AddSchema(*maybe_block);
+    }
+    return true;
+  }
+
+  /// Find every schema and index the slow way.
+  void Scan() {
+    schemas_.clear();
+    identifiers_.clear();
+
+    uint64_t position = kHeaderSize;
+    while (true) {
+      const auto maybe_block = ReadBlock(position);
+      if (!maybe_block) { break; }
+      position = maybe_block->next;
+
+      if (maybe_block->type == TF::BlockType::kBlockSchema) {
+        AddSchema(*maybe_block);
+      } else if (maybe_block->type == TF::BlockType::kBlockIndex) {
+        uint64_t previous = 0;
+        checkpoints_.push_back(ParseIndex(*maybe_block, &previous));
+      }
+    }
+  }
+
+  void SeekFile(uint64_t position) {
+    if (position == file_position_) { return; }
+    ::fseeko(file_.get(), position, SEEK_SET);
+    file_position_ = position;
+  }
+
+  bool RawRead(char* data, size_t size) {
+    if (::fread(data, size, 1, file_.get()) != 1) {
+      // Leave the stream somewhere well defined.
+      file_position_ = std::numeric_limits<uint64_t>::max();
+      return false;
+    }
+    file_position_ += size;
+    return true;
+  }
+
+  FilePtr file_;
+  uint64_t file_size_ = 0;
+  uint64_t file_position_ = 0;
+
+  // The position of the next block to be read from the file.
+  uint64_t position_ = 0;
+
+  // The data blocks of the last BlockCompressed read, and the index
+  // of the next one to be returned by Read().
+  std::string run_data_;
+  std::vector<Block> run_;
+  size_t run_index_ = 0;
+
+  // Where in run_ the item last returned by Read() came from, if it
+  // came from a run at all.
+  std::optional<size_t> last_run_index_;
+};
+
+TelemetryLogReader::TelemetryLogReader(const std::string& filename)
+    : impl_(std::make_unique<Impl>(filename)) {}
+
+TelemetryLogReader::~TelemetryLogReader() {}
+
+const std::vector<TelemetryLogReader::Schema>&
+TelemetryLogReader::schemas() const {
+  return impl_->schemas_;
+}
+
+std::optional<TelemetryLogReader::Identifier>
+TelemetryLogReader::FindIdentifier(std::string_view name) const {
+  const auto it = impl_->identifiers_.find(name);
+  if (it == impl_->identifiers_.end()) { return {}; }
+  return it->second;
+}
+
+std::optional<TelemetryLogReader::Item> TelemetryLogReader::Read() {
+  return impl_->Read({});
+}
+
+std::optional<TelemetryLogReader::Item> TelemetryLogReader::Read(
+    Identifier identifier) {
+  return impl_->Read(identifier);
+}
+
+void TelemetryLogReader::Seek(pt::ptime timestamp) {
+  impl_->Seek({}, timestamp);
+}
+
+void TelemetryLogReader::Seek(Identifier identifier, pt::ptime timestamp) {
+  impl_->Seek(identifier, timestamp);
+}
+
+size_t TelemetryLogReader::index_count() const {
+  return impl_->checkpoints_.size();
+}
+
+}
+}
@@ -0,0 +1,102 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace mjlib {
+namespace telemetry {
+
+/// Reads a TLOG0002 file as described in telemetry_format.h, such as
+/// is written by TelemetryLogWriter.
+///
+/// On construction, the chain of BlockIndex records is followed
+/// backwards from the end of the file.  Seeks then binary search
+/// those indices and only scan forward from the nearest one, so
+/// their cost does not depend upon the size of the file.  A file
+/// which was never closed has no final index, and is scanned once
+/// in its entirety instead.
+class TelemetryLogReader {
+ public:
+  using Identifier = uint32_t;
+
+  /// Throws base::system_error if @p filename cannot be opened or is
+  /// not a TLOG0002 file.
+  TelemetryLogReader(const std::string& filename);
+  ~TelemetryLogReader();
+
+  struct Schema {
+    Identifier identifier = 0;
+    std::string name;
+
+    /// As produced by TelemetryWriteArchive::schema().
+    std::string schema;
+  };
+
+  const std::vector<Schema>& schemas() const;
+
+  /// @return the identifier of the schema named @p name, if any.
+  std::optional<Identifier> FindIdentifier(std::string_view name) const;
+
+  struct Item {
+    Identifier identifier = 0;
+    uint16_t flags = 0;
+
+    /// not_a_date_time if the block had none.
+    boost::posix_time::ptime timestamp;
+
+    /// The position of the block within the file, or of the
+    /// BlockCompressed which held it.
+    uint64_t position = 0;
+
+    /// As produced by TelemetryWriteArchive::Serialize(), and
+    /// decompressed if the block was kSnappy.
+    std::string data;
+  };
+
+  /// @return the next data block, or an empty optional at the end of
+  /// the file.
+  std::optional<Item> Read();
+
+  /// @return the next data block with the given identifier.
+  std::optional<Item> Read(Identifier);
+
+  /// Position the reader so that the next Read() returns the first
+  /// data block with a timestamp at or after @p timestamp.  If
+  /// @p timestamp is not_a_date_time, seek to the start of the file.
+  void Seek(boost::posix_time::ptime timestamp);
+
+  /// Like Seek(ptime), but only considering data blocks with the
+  /// given identifier.  If @p timestamp is not_a_date_time, seek to
+  /// the first such block.
+  void Seek(Identifier, boost::posix_time::ptime timestamp);
+
+  /// @return the number of BlockIndex records found.
+  size_t index_count() const;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
@@ -0,0 +1,277 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_log_writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/snappy.h"
+#include "mjlib/base/system_error.h"
+
+namespace pt = boost::posix_time;
+
+namespace mjlib {
+namespace telemetry {
+
+namespace {
+using TF = TelemetryFormat;
+
+constexpr char kIndexTrailer[] = "TLOGIDEX";
+
+struct FileCloser {
+  void operator()(FILE* file) const { ::fclose(file); }
+};
+
+using FilePtr = std::unique_ptr<FILE, FileCloser>;
+
+int64_t ToMicroseconds(pt::ptime time) {
+  if (time.is_special()) { return std::numeric_limits<int64_t>::min(); }
+  return (time - pt::ptime(boost::gregorian::date(1970, 1, 1))).
+      total_microseconds();
+}
+
+constexpr size_t kBlockHeaderSize = 6;
+
+void FormatBlockHeader(TF::BlockType type, std::string_view data,
+                       char* header) {
+  if (data.size() > static_cast<size_t>(TF::BlockOffsets::kMaxBlockSize)) {
+    throw base::system_error::einval("block too large");
+  }
+  const uint16_t type_u16 = static_cast<uint16_t>(type);
+  const uint32_t size = data.size();
+  std::memcpy(&header[0], &type_u16, sizeof(type_u16));
+  std::memcpy(&header[2], &size, sizeof(size));
+}
+}
+
+class TelemetryLogWriter::Impl {
+ public:
+  Impl(const std::string& filename, const Options& options)
+      : options_(options),
+        file_(::fopen(filename.c_str(), "wb")) {
+    if (!file_) {
+      throw base::system_error::syserrno("opening " + filename);
+    }
+    RawWrite(TF::kHeader);
+  }
+
+  ~Impl() {
+    // There is nobody to report a failure to here.
+    try {
+      Close();
+    } catch (base::system_error&) {
+    }
+  }
+
+  Identifier WriteSchema(std::string_view name, std::string_view schema) {
+    // A pending run must start where it was promised to.
+    WriteRun();
+
+    const Identifier identifier = next_identifier_++;
+
+    base::FastOStringStream ostr;
+    TelemetryWriteStream stream(ostr);
+    stream.Write(identifier);
+    stream.Write(static_cast<uint32_t>(0));  // BlockSchemaFlags
+    stream.WriteString(name);
+    stream.RawWrite(schema.data(), schema.size());
+
+    auto& record = records_[identifier];
+    record.schema_position = position_;
+    WriteBlock(TF::BlockType::kBlockSchema, ostr.view());
+
+    return identifier;
+  }
+
+  void WriteData(Identifier identifier, pt::ptime timestamp,
+                 std::string_view data) {
+    const auto it = records_.find(identifier);
+    if (it == records_.end()) {
+      throw base::system_error::einval("unknown identifier");
+    }
+    auto& record = it->second;
+
+    // Blocks in a compressed run have no position of their own to
+    // measure an offset from.
+    uint16_t flags = options_.compress ? 0 : TF::kPreviousOffset;
+    if (!timestamp.is_not_a_date_time()) { flags |= TF::kTimestamp; }
+
+    buffer_.data()->clear();
+    TelemetryWriteStream stream(buffer_);
+    stream.Write(identifier);
+    stream.Write(flags);
+    if (flags & TF::kPreviousOffset) {
+      stream.WriteVarint(record.last_data_position == 0 ? 0 :
+                         position_ - record.last_data_position);
+    }
+    if (flags & TF::kTimestamp) {
+      stream.Write(ToMicroseconds(timestamp));
+    }
+    stream.RawWrite(data.data(), data.size());
+
+    record.timestamp = timestamp;
+    if (!options_.compress) {
+      record.last_data_position = position_;
+      WriteBlock(TF::BlockType::kBlockData, buffer_.view());
+      return;
+    }
+
+    // Nothing else is written while a run is being gathered, so the
+    // run will start wherever the file ends now.
+    if (!file_) {
+      throw base::system_error::einval("log is closed");
+    }
+    char header[kBlockHeaderSize] = {};
+    FormatBlockHeader(TF::BlockType::kBlockData, buffer_.view(), header);
+    run_.write({header, sizeof(header)});
+    run_.write(buffer_.view());
+    record.last_data_position = position_;
+
+    if (run_.data()->size() >= options_.compress_size) {
+      WriteRun();
+    }
+  }
+
+  void Flush() {
+    WriteRun();
+    ::fflush(file_.get());
+  }
+
+  void Close() {
+    if (!file_) { return; }
+    WriteRun();
+    WriteIndex();
+    file_.reset();
+  }
+
+  const Options options_;
+  uint64_t position_ = 0;
+
+ private:
+  struct Record {
+    uint64_t schema_position = 0;
+    uint64_t last_data_position = 0;
+    pt::ptime timestamp;
+  };
+
+  void WriteBlock(TF::BlockType type, std::string_view data) {
+    if (!file_) {
+      throw base::system_error::einval("log is closed");
+    }
+    char header[kBlockHeaderSize] = {};
+    FormatBlockHeader(type, data, header);
+    RawWrite({header, sizeof(header)});
+    RawWrite(data);
+
+    if (type != TF::BlockType::kBlockIndex) {
+      since_index_ += sizeof(header) + data.size();
+      if (since_index_ >= options_.index_interval) {
+        WriteIndex();
+      }
+    }
+  }
+
+  void WriteRun() {
+    if (run_.data()->empty()) { return; }
+
+    compressed_.data()->clear();
+    TelemetryWriteStream stream(compressed_);
+    stream.Write(static_cast<uint32_t>(0));  // BlockCompressedFlags
+    compressor_.Compress(run_.view(), compressed_);
+    run_.data()->clear();
+
+    WriteBlock(TF::BlockType::kBlockCompressed, compressed_.view());
+  }
+
+  void WriteIndex() {
+    base::FastOStringStream ostr;
+    TelemetryWriteStream stream(ostr);
+    stream.Write(static_cast<uint32_t>(
+                     TF::kPreviousIndex | TF::kIndexTimestamp));
+    stream.Write(last_index_position_);
+    stream.Write(static_cast<uint32_t>(records_.size()));
+    for (const auto& pair : records_) {
+      stream.Write(pair.first);
+      stream.Write(pair.second.schema_position);
+      stream.Write(pair.second.last_data_position);
+      stream.Write(ToMicroseconds(pair.second.timestamp));
+    }
+    const uint32_t total_size =
+        ostr.data()->size() + 6 + sizeof(uint32_t) + sizeof(kIndexTrailer) - 1;
+    stream.Write(total_size);
+    stream.RawWrite(kIndexTrailer, sizeof(kIndexTrailer) - 1);
+
+    last_index_position_ = position_;
+    since_index_ = 0;
+    WriteBlock(TF::BlockType::kBlockIndex, ostr.view());
+  }
+
+  void RawWrite(std::string_view data) {
+    if (data.empty()) { return; }
+    if (::fwrite(data.data(), data.size(), 1, file_.get()) != 1) {
+      throw base::system_error::syserrno("writing log");
+    }
+    position_ += data.size();
+  }
+
+  FilePtr file_;
+  Identifier next_identifier_ = 1;
+  std::map<Identifier, Record> records_;
+
+  uint64_t last_index_position_ = 0;
+  uint64_t since_index_ = 0;
+
+  base::FastOStringStream buffer_;
+
+  // The data blocks of the compressed run being gathered.
+  base::FastOStringStream run_;
+  base::SnappyCompressor compressor_;
+  base::FastOStringStream compressed_;
+};
+
+TelemetryLogWriter::TelemetryLogWriter(const std::string& filename,
+                                       const Options& options)
+    : impl_(std::make_unique<Impl>(filename, options)) {}
+
+TelemetryLogWriter::~TelemetryLogWriter() {}
+
+TelemetryLogWriter::Identifier TelemetryLogWriter::WriteSchema(
+    std::string_view name, std::string_view schema) {
+  return impl_->WriteSchema(name, schema);
+}
+
+void TelemetryLogWriter::WriteData(Identifier identifier,
+                                   pt::ptime timestamp,
+                                   std::string_view data) {
+  impl_->WriteData(identifier, timestamp, data);
+}
+
+void TelemetryLogWriter::Flush() {
+  impl_->Flush();
+}
+
+void TelemetryLogWriter::Close() {
+  impl_->Close();
+}
+
+uint64_t TelemetryLogWriter::position() const {
+  return impl_->position_;
+}
+
+}
+}
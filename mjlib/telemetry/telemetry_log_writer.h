@@ -0,0 +1,105 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "mjlib/telemetry/telemetry_archive.h"
+
+namespace mjlib {
+namespace telemetry {
+
+/// Writes a TLOG0002 file as described in telemetry_format.h.
+///
+/// Each data block records the offset of the previous block with the
+/// same identifier, and optionally a timestamp.  Every
+/// Options::index_interval bytes, and when the file is closed, a
+/// BlockIndex is written which lists the schema and last data block
+/// of every identifier, along with the position of the previous
+/// BlockIndex.  TelemetryLogReader uses these to seek without
+/// scanning the file.
+class TelemetryLogWriter {
+ public:
+  using Identifier = uint32_t;
+
+  struct Options {
+    /// Write an index after at least this many bytes of other blocks.
+    uint64_t index_interval = 1 << 20;
+
+    /// Gather data blocks into runs and write each run as one
+    /// snappy compressed BlockCompressed.  Snappy only finds
+    /// redundancy within what it is given at once, so successive
+    /// samples of a record compress far better together than one at
+    /// a time.
+    bool compress = false;
+
+    /// When compressing, write a run once it holds at least this
+    /// many bytes.  Flush() and any other block end a run early.
+    uint32_t compress_size = 1 << 16;
+
+    Options() {}
+  };
+
+  /// Throws base::system_error if @p filename cannot be created.
+  TelemetryLogWriter(const std::string& filename,
+                     const Options& = Options());
+
+  /// Closes the file if that has not been done already.
+  ~TelemetryLogWriter();
+
+  /// Write a schema block for records named @p name.
+  ///
+  /// @param schema is as produced by TelemetryWriteArchive::schema()
+  /// @return the identifier to use for data blocks of this schema
+  Identifier WriteSchema(std::string_view name, std::string_view schema);
+
+  template <typename Serializable>
+  Identifier WriteSchema(std::string_view name) {
+    return WriteSchema(
+        name, TelemetryWriteArchive<Serializable>::schema());
+  }
+
+  /// Write a data block.
+  ///
+  /// @param timestamp is omitted from the block if it is
+  /// not_a_date_time.  TelemetryLogReader can only seek by time if
+  /// timestamps are non-decreasing.
+  /// @param data is as produced by TelemetryWriteArchive::Serialize()
+  void WriteData(Identifier, boost::posix_time::ptime timestamp,
+                 std::string_view data);
+
+  /// Flush any buffered blocks, including a partial compressed run,
+  /// to the operating system.
+  void Flush();
+
+  /// Write a final index and close the file.  No further blocks may
+  /// be written.
+  void Close();
+
+  /// @return the number of bytes written so far.
+  uint64_t position() const;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}
+}
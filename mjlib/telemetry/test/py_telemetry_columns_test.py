@@ -0,0 +1,85 @@
+#!/usr/bin/python3 -B
+
+# Copyright 2019 Josh Pieper, jjp@pobox.com.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+import os
+import struct
+import tempfile
+import unittest
+
+
+import mjlib.telemetry.telemetry_columns as tc
+
+
+MANIFEST = '''TCOL0001
+record servo_stats 3
+column mode enum
+enum mode 0 stopped
+enum mode 9 position
+column velocity float32
+column pid[1] float64
+record empty 0
+column value int8
+'''
+
+
+class TelemetryColumnsTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        root = self.dir.name
+
+        def write(name, data):
+            path = os.path.join(root, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, 'wb') as f:
+                f.write(data)
+
+        write('MANIFEST', MANIFEST.encode('utf8'))
+        write('servo_stats/@timestamp', struct.pack('<3q', 10, 20, -(2 ** 63)))
+        write('servo_stats/mode', struct.pack('<3I', 0, 9, 9))
+        write('servo_stats/velocity', struct.pack('<3f', 0.5, 1.5, -2.0))
+        write('servo_stats/pid[1]', struct.pack('<3d', 1.0, 2.0, 3.0))
+        write('empty/@timestamp', bytes())
+        write('empty/value', bytes())
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def test_load(self):
+        records = tc.load(self.dir.name)
+        self.assertEqual(sorted(records.keys()), ['empty', 'servo_stats'])
+
+        stats = records['servo_stats']
+        self.assertEqual(stats.count, 3)
+        self.assertEqual(list(stats.timestamp), [10, 20, tc.NO_TIMESTAMP])
+        self.assertEqual(list(stats.columns['mode']), [0, 9, 9])
+        self.assertEqual(stats.enums['mode'][9], 'position')
+        self.assertEqual(list(stats.columns['velocity']), [0.5, 1.5, -2.0])
+        self.assertEqual(stats.columns['pid[1]'][2], 3.0)
+        self.assertEqual(stats.types['velocity'], 'float32')
+
+        self.assertEqual(len(records['empty'].columns['value']), 0)
+
+    def test_wrong_size(self):
+        with open(os.path.join(self.dir.name, 'servo_stats/velocity'),
+                  'ab') as f:
+            f.write(bytes(1))
+        with self.assertRaises(RuntimeError):
+            tc.load(self.dir.name)
+
+
+if __name__ == '__main__':
+    unittest.main()
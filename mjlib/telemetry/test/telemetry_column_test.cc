@@ -0,0 +1,213 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_column_reader.h"
+#include "mjlib/telemetry/telemetry_column_writer.h"
+
+#include <ftw.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
+#include <limits>
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/base/system_error.h"
+#include "mjlib/base/visitor.h"
+#include "mjlib/telemetry/telemetry_log_reader.h"
+#include "mjlib/telemetry/telemetry_log_writer.h"
+
+using namespace mjlib::telemetry;
+namespace pt = boost::posix_time;
+
+namespace {
+std::string TempPath(const std::string& name) {
+  return "/tmp/mjlib_telemetry_column_test_" +
+      std::to_string(::getpid()) + "_" + name;
+}
+
+int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+  return ::remove(path);
+}
+
+enum class ColumnMode {
+  kIdle = 0,
+  kRunning = 3,
+};
+
+auto ColumnModeMapper = []() {
+  return std::map<ColumnMode, const char*>{
+    {ColumnMode::kIdle, "idle"},
+    {ColumnMode::kRunning, "running"},
+  };
+};
+
+struct ColumnStats {
+  ColumnMode mode = ColumnMode::kIdle;
+  uint16_t raw = 0;
+  float velocity = 0.0f;
+  std::array<double, 2> pid = {};
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_ENUM(mode, ColumnModeMapper));
+    a->Visit(MJ_NVP(raw));
+    a->Visit(MJ_NVP(velocity));
+    a->Visit(MJ_NVP(pid));
+  }
+};
+
+struct ColumnOther {
+  int8_t value = 0;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(value));
+  }
+};
+
+const pt::ptime kStart{boost::gregorian::date(2019, 6, 1), pt::hours(12)};
+const pt::ptime kEpoch{boost::gregorian::date(1970, 1, 1)};
+
+/// Write a log with @p count stats records starting from @p first.
+void WriteLog(const std::string& filename, int first, int count) {
+  TelemetryLogWriter dut(filename);
+  const auto other_id = dut.WriteSchema<ColumnOther>("other");
+  const auto stats_id = dut.WriteSchema<ColumnStats>("servo_stats");
+
+  for (int i = first; i < first + count; i++) {
+    ColumnStats stats;
+    stats.mode = (i % 2) ? ColumnMode::kRunning : ColumnMode::kIdle;
+    stats.raw = i;
+    stats.velocity = 0.5f * i;
+    stats.pid = {{ 1.0 * i, -1.0 * i }};
+    // The final record has no timestamp.
+    const auto timestamp = (i + 1 == first + count) ?
+        pt::ptime() : kStart + pt::milliseconds(i);
+    dut.WriteData(stats_id, timestamp,
+                  TelemetryWriteArchive<ColumnStats>::Serialize(&stats));
+
+    ColumnOther other;
+    other.value = -i;
+    dut.WriteData(other_id, kStart,
+                  TelemetryWriteArchive<ColumnOther>::Serialize(&other));
+  }
+}
+
+struct Fixture {
+  Fixture()
+      : log1(TempPath("1.log")),
+        log2(TempPath("2.log")),
+        directory(TempPath("columns")) {
+    WriteLog(log1, 0, 100);
+    WriteLog(log2, 100, 50);
+  }
+
+  ~Fixture() {
+    ::remove(log1.c_str());
+    ::remove(log2.c_str());
+    ::nftw(directory.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  std::string log1;
+  std::string log2;
+  std::string directory;
+};
+}
+
+BOOST_FIXTURE_TEST_CASE(TelemetryColumnTest, Fixture) {
+  {
+    TelemetryColumnWriter dut(directory);
+    TelemetryLogReader reader1(log1);
+    dut.Write(reader1);
+    TelemetryLogReader reader2(log2);
+    dut.Write(reader2);
+    dut.Close();
+  }
+
+  TelemetryColumnReader dut(directory);
+  BOOST_TEST(dut.records().size() == 2);
+
+  const auto* stats = dut.FindRecord("servo_stats");
+  BOOST_TEST_REQUIRE(stats != nullptr);
+  BOOST_TEST(stats->count == 150);
+  BOOST_TEST(stats->columns.size() == 5);
+
+  const auto* mode = stats->FindColumn("mode");
+  const auto* raw = stats->FindColumn("raw");
+  const auto* velocity = stats->FindColumn("velocity");
+  const auto* pid1 = stats->FindColumn("pid[1]");
+  BOOST_TEST_REQUIRE(mode != nullptr);
+  BOOST_TEST_REQUIRE(raw != nullptr);
+  BOOST_TEST_REQUIRE(velocity != nullptr);
+  BOOST_TEST_REQUIRE(pid1 != nullptr);
+  BOOST_TEST(stats->FindColumn("missing") == nullptr);
+
+  BOOST_TEST((mode->type == TelemetryFormat::FieldType::kEnum));
+  BOOST_TEST_REQUIRE(mode->enum_values.size() == 2);
+  BOOST_TEST(mode->enum_values[1].first == 3);
+  BOOST_TEST(mode->enum_values[1].second == "running");
+  BOOST_TEST((velocity->type == TelemetryFormat::FieldType::kFloat32));
+
+  for (int i = 0; i < 150; i++) {
+    BOOST_TEST(mode->values<uint32_t>()[i] == ((i % 2) ? 3u : 0u));
+    BOOST_TEST(raw->values<uint16_t>()[i] == i);
+    BOOST_TEST(velocity->values<float>()[i] == 0.5f * i);
+    BOOST_TEST(pid1->values<double>()[i] == -1.0 * i);
+
+    const int64_t expected_timestamp = (i == 99 || i == 149) ?
+        std::numeric_limits<int64_t>::min() :
+        (kStart + pt::milliseconds(i) - kEpoch).total_microseconds();
+    BOOST_TEST(stats->timestamps[i] == expected_timestamp);
+  }
+
+  const auto* other = dut.FindRecord("other");
+  BOOST_TEST_REQUIRE(other != nullptr);
+  BOOST_TEST(other->count == 150);
+  BOOST_TEST(other->FindColumn("value")->values<int8_t>()[120] == -120);
+}
+
+BOOST_FIXTURE_TEST_CASE(TelemetryColumnNamesTest, Fixture) {
+  {
+    TelemetryColumnWriter::Options options;
+    options.names.push_back("other");
+    TelemetryColumnWriter dut(directory, options);
+    TelemetryLogReader reader(log1);
+    dut.Write(reader);
+    // Closed by the destructor.
+  }
+
+  TelemetryColumnReader dut(directory);
+  BOOST_TEST(dut.records().size() == 1);
+  BOOST_TEST(dut.FindRecord("servo_stats") == nullptr);
+  BOOST_TEST_REQUIRE(dut.FindRecord("other") != nullptr);
+  BOOST_TEST(dut.FindRecord("other")->count == 100);
+}
+
+BOOST_FIXTURE_TEST_CASE(TelemetryColumnTruncatedTest, Fixture) {
+  {
+    TelemetryColumnWriter dut(directory);
+    TelemetryLogReader reader(log1);
+    dut.Write(reader);
+  }
+
+  BOOST_TEST_REQUIRE(::truncate((directory + "/servo_stats/velocity").c_str(),
+                                10) == 0);
+  BOOST_CHECK_THROW(TelemetryColumnReader{directory},
+                    mjlib::base::system_error);
+
+  BOOST_CHECK_THROW(TelemetryColumnReader{directory + "/missing"},
+                    mjlib::base::system_error);
+}
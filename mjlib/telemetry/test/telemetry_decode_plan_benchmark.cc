@@ -0,0 +1,302 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// @file
+///
+/// Compares decoding every record of a "servo_stats" telemetry log
+/// with TelemetrySchemaReader against a TelemetryDecodePlan.  Unless
+/// a log is given, one is written first with records shaped like
+/// moteus's BldcServo::Status.
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "mjlib/base/fast_stream.h"
+#include "mjlib/base/pid.h"
+#include "mjlib/base/program_options_archive.h"
+#include "mjlib/telemetry/telemetry_archive.h"
+#include "mjlib/telemetry/telemetry_decode_plan.h"
+#include "mjlib/telemetry/telemetry_log_reader.h"
+#include "mjlib/telemetry/telemetry_log_writer.h"
+#include "mjlib/telemetry/telemetry_util.h"
+
+namespace base = mjlib::base;
+namespace pt = boost::posix_time;
+namespace po = boost::program_options;
+namespace telemetry = mjlib::telemetry;
+
+namespace {
+struct Options {
+  int records = 1000000;
+  std::string log;
+  std::string name = "servo_stats";
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(records));
+    a->Visit(MJ_NVP(log));
+    a->Visit(MJ_NVP(name));
+  }
+};
+
+enum class Mode {
+  kStopped,
+  kFault,
+  kEnabling,
+  kCalibrating,
+  kCalibrationComplete,
+  kPwm,
+  kVoltage,
+  kVoltageFoc,
+  kCurrent,
+  kPosition,
+};
+
+auto ModeMapper = []() {
+  return std::map<Mode, const char*>{
+    {Mode::kStopped, "stopped"},
+    {Mode::kFault, "fault"},
+    {Mode::kEnabling, "enabling"},
+    {Mode::kCalibrating, "calibrating"},
+    {Mode::kCalibrationComplete, "calib_complete"},
+    {Mode::kPwm, "pwm"},
+    {Mode::kVoltage, "voltage"},
+    {Mode::kVoltageFoc, "voltage_foc"},
+    {Mode::kCurrent, "current"},
+    {Mode::kPosition, "position"},
+  };
+};
+
+enum class Fault {
+  kSuccess,
+  kOverVoltage,
+};
+
+auto FaultMapper = []() {
+  return std::map<Fault, const char*>{
+    {Fault::kSuccess, "success"},
+    {Fault::kOverVoltage, "over_voltage"},
+  };
+};
+
+/// The same fields as moteus's BldcServo::Status.
+struct ServoStats {
+  Mode mode = Mode::kStopped;
+  Fault fault = Fault::kSuccess;
+
+  uint16_t adc1_raw = 0;
+  uint16_t adc2_raw = 0;
+  uint16_t adc3_raw = 0;
+  uint16_t position_raw = 0;
+  uint16_t fet_temp_raw = 0;
+
+  uint16_t adc1_offset = 2048;
+  uint16_t adc2_offset = 2048;
+
+  float cur1_A = 0.0f;
+  float cur2_A = 0.0f;
+  float bus_V = 0.0f;
+  float filt_bus_V = 0.0f;
+  uint16_t position = 0;
+  float fet_temp_C = 0.0f;
+
+  float electrical_theta = 0.0f;
+
+  float d_A = 0.0f;
+  float q_A = 0.0f;
+
+  int32_t unwrapped_position_raw = 0;
+  float unwrapped_position = 0.0f;
+  float velocity = 0.0f;
+
+  base::PID::State pid_d;
+  base::PID::State pid_q;
+  base::PID::State pid_position;
+
+  float control_position = 0.0f;
+  bool position_set = false;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_ENUM(mode, ModeMapper));
+    a->Visit(MJ_ENUM(fault, FaultMapper));
+
+    a->Visit(MJ_NVP(adc1_raw));
+    a->Visit(MJ_NVP(adc2_raw));
+    a->Visit(MJ_NVP(adc3_raw));
+    a->Visit(MJ_NVP(position_raw));
+    a->Visit(MJ_NVP(fet_temp_raw));
+
+    a->Visit(MJ_NVP(adc1_offset));
+    a->Visit(MJ_NVP(adc2_offset));
+
+    a->Visit(MJ_NVP(cur1_A));
+    a->Visit(MJ_NVP(cur2_A));
+    a->Visit(MJ_NVP(bus_V));
+    a->Visit(MJ_NVP(filt_bus_V));
+    a->Visit(MJ_NVP(position));
+    a->Visit(MJ_NVP(fet_temp_C));
+    a->Visit(MJ_NVP(electrical_theta));
+
+    a->Visit(MJ_NVP(d_A));
+    a->Visit(MJ_NVP(q_A));
+
+    a->Visit(MJ_NVP(unwrapped_position_raw));
+    a->Visit(MJ_NVP(unwrapped_position));
+    a->Visit(MJ_NVP(velocity));
+
+    a->Visit(MJ_NVP(pid_d));
+    a->Visit(MJ_NVP(pid_q));
+    a->Visit(MJ_NVP(pid_position));
+
+    a->Visit(MJ_NVP(control_position));
+    a->Visit(MJ_NVP(position_set));
+  }
+};
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+void WriteLog(const std::string& filename, int records) {
+  telemetry::TelemetryLogWriter writer(filename);
+  const auto id = writer.WriteSchema<ServoStats>("servo_stats");
+
+  const pt::ptime start{boost::gregorian::date(2019, 6, 1)};
+  ServoStats stats;
+  stats.mode = Mode::kPosition;
+  stats.pid_d.desired = 0.0f;
+  stats.pid_q.desired = 0.0f;
+  stats.pid_position.desired = 0.0f;
+  for (int i = 0; i < records; i++) {
+    stats.adc1_raw = 2000 + (i % 100);
+    stats.position_raw = i & 0xffff;
+    stats.bus_V = 24.0f + 0.01f * std::sin(i * 0.01f);
+    stats.velocity = std::cos(i * 0.001f);
+    stats.unwrapped_position_raw = i;
+    stats.pid_position.error = 0.001f * (i % 1000);
+    writer.WriteData(id, start + pt::microseconds(i * 250),
+                     telemetry::TelemetryWriteArchive<ServoStats>::Serialize(
+                         &stats));
+  }
+}
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  po::options_description desc("Allowable options");
+  desc.add_options()("help,h", "display usage message");
+  base::ProgramOptionsArchive(&desc).Accept(&options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << desc;
+    return 1;
+  }
+
+  std::string filename = options.log;
+  const bool temporary = filename.empty();
+  if (temporary) {
+    filename = "/tmp/telemetry_decode_plan_benchmark_" +
+        std::to_string(::getpid()) + ".log";
+    const auto start = std::chrono::steady_clock::now();
+    WriteLog(filename, options.records);
+    std::cout << "wrote " << options.records << " records in "
+              << Seconds(start) << " s\n";
+  }
+
+  telemetry::TelemetryLogReader reader(filename);
+  const auto maybe_id = reader.FindIdentifier(options.name);
+  if (!maybe_id) {
+    std::cerr << "no schema named " << options.name << "\n";
+    return 1;
+  }
+
+  std::string schema;
+  for (const auto& item : reader.schemas()) {
+    if (item.identifier == *maybe_id) { schema = item.schema; }
+  }
+
+  // Load everything first, so that only decoding is measured.
+  std::vector<std::string> records;
+  {
+    const auto start = std::chrono::steady_clock::now();
+    while (auto item = reader.Read(*maybe_id)) {
+      records.push_back(std::move(item->data));
+    }
+    std::cout << "read " << records.size() << " records in "
+              << Seconds(start) << " s\n";
+  }
+  if (temporary) { ::remove(filename.c_str()); }
+  if (records.empty()) { return 1; }
+
+  const double count = records.size();
+
+  {
+    base::FastOStringStream out;
+    size_t total_size = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& record : records) {
+      base::FastIStringStream schema_istr(schema);
+      telemetry::TelemetryReadStream schema_stream(schema_istr);
+      base::FastIStringStream data_istr(record);
+      telemetry::TelemetryReadStream data_stream(data_istr);
+      out.data()->clear();
+      telemetry::TelemetrySchemaReader(
+          schema_stream, &data_stream, out).Read();
+      total_size += out.data()->size();
+    }
+    const double elapsed = Seconds(start);
+    std::cout << "TelemetrySchemaReader: " << elapsed << " s  "
+              << elapsed / count * 1e9 << " ns/record  "
+              << "(" << total_size / count << " bytes of text/record)\n";
+  }
+
+  {
+    const auto compile_start = std::chrono::steady_clock::now();
+    telemetry::TelemetryDecodePlan plan(schema);
+    const double compile_s = Seconds(compile_start);
+
+    std::vector<char> row(plan.row_size());
+    double sum = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& record : records) {
+      plan.Decode(record, row.data());
+      // Touch every field, as anything consuming the rows would.
+      for (const auto& field : plan.fields()) {
+        sum += telemetry::TelemetryDecodePlan::GetDouble(row.data(), field);
+      }
+    }
+    const double elapsed = Seconds(start);
+    std::cout << "TelemetryDecodePlan: " << elapsed << " s  "
+              << elapsed / count * 1e9 << " ns/record  "
+              << "(" << plan.fields().size() << " fields, compiled in "
+              << compile_s * 1e6 << " us, checksum " << sum << ")\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,184 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_decode_plan.h"
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/base/system_error.h"
+#include "mjlib/base/visitor.h"
+#include "mjlib/telemetry/telemetry_archive.h"
+
+using namespace mjlib::telemetry;
+
+namespace {
+enum class PlanMode {
+  kStopped = 0,
+  kPosition = 7,
+};
+
+auto PlanModeMapper = []() {
+  return std::map<PlanMode, const char*>{
+    {PlanMode::kStopped, "stopped"},
+    {PlanMode::kPosition, "position"},
+  };
+};
+
+struct PlanSub {
+  uint16_t raw = 0;
+  float value = 0.0f;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(raw));
+    a->Visit(MJ_NVP(value));
+  }
+};
+
+struct PlanTest {
+  PlanMode mode = PlanMode::kStopped;
+  uint8_t u8 = 0;
+  int32_t i32 = 0;
+  std::array<float, 3> array = {};
+  std::pair<int16_t, double> pair = {};
+  std::vector<std::vector<int32_t>> vecvec;
+  std::string str;
+  std::optional<PlanSub> optional;
+  PlanSub sub;
+  bool flag = false;
+  std::vector<PlanSub> vecobj;
+  int64_t i64 = 0;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_ENUM(mode, PlanModeMapper));
+    a->Visit(MJ_NVP(u8));
+    a->Visit(MJ_NVP(i32));
+    a->Visit(MJ_NVP(array));
+    a->Visit(MJ_NVP(pair));
+    a->Visit(MJ_NVP(vecvec));
+    a->Visit(MJ_NVP(str));
+    a->Visit(MJ_NVP(optional));
+    a->Visit(MJ_NVP(sub));
+    a->Visit(MJ_NVP(flag));
+    a->Visit(MJ_NVP(vecobj));
+    a->Visit(MJ_NVP(i64));
+  }
+};
+
+double Value(const TelemetryDecodePlan& plan, const std::vector<char>& row,
+             const std::string& name) {
+  const auto* field = plan.FindField(name);
+  BOOST_TEST_REQUIRE(field != nullptr, name);
+  return TelemetryDecodePlan::GetDouble(row.data(), *field);
+}
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDecodePlanFieldsTest) {
+  TelemetryDecodePlan dut(TelemetryWriteArchive<PlanTest>::schema());
+
+  std::vector<std::string> names;
+  for (const auto& field : dut.fields()) {
+    names.push_back(field.name);
+    BOOST_TEST(field.offset % field.size == 0);
+    BOOST_TEST(field.offset + field.size <= dut.row_size());
+  }
+
+  const std::vector<std::string> expected = {
+    "mode", "u8", "i32", "array[0]", "array[1]", "array[2]",
+    "pair.first", "pair.second", "vecvec.size", "str.size",
+    "optional.present", "optional.raw", "optional.value",
+    "sub.raw", "sub.value", "flag", "vecobj.size", "i64",
+  };
+  BOOST_TEST(names == expected, boost::test_tools::per_element());
+
+  const auto& mode = *dut.FindField("mode");
+  BOOST_TEST((mode.type == TelemetryFormat::FieldType::kEnum));
+  BOOST_TEST_REQUIRE(mode.enum_values.size() == 2);
+  BOOST_TEST(mode.enum_values[1].first == 7);
+  BOOST_TEST(mode.enum_values[1].second == "position");
+
+  BOOST_TEST(dut.FindField("missing") == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDecodePlanDecodeTest) {
+  TelemetryDecodePlan dut(TelemetryWriteArchive<PlanTest>::schema());
+  std::vector<char> row(dut.row_size());
+
+  PlanTest data;
+  data.mode = PlanMode::kPosition;
+  data.u8 = 200;
+  data.i32 = -12345;
+  data.array = {{ 1.5f, 2.5f, 3.5f }};
+  data.pair = { -3, 0.125 };
+  data.vecvec = { { 1, 2, 3 }, { 4 } };
+  data.str = "hello";
+  data.optional = PlanSub{ 9, 4.0f };
+  data.sub = PlanSub{ 17, -2.0f };
+  data.flag = true;
+  data.vecobj = { PlanSub{}, PlanSub{} };
+  data.i64 = -(1ll << 40);
+
+  dut.Decode(TelemetryWriteArchive<PlanTest>::Serialize(&data), row.data());
+
+  BOOST_TEST(Value(dut, row, "mode") == 7);
+  BOOST_TEST(Value(dut, row, "u8") == 200);
+  BOOST_TEST(Value(dut, row, "i32") == -12345);
+  BOOST_TEST(Value(dut, row, "array[0]") == 1.5);
+  BOOST_TEST(Value(dut, row, "array[2]") == 3.5);
+  BOOST_TEST(Value(dut, row, "pair.first") == -3);
+  BOOST_TEST(Value(dut, row, "pair.second") == 0.125);
+  BOOST_TEST(Value(dut, row, "vecvec.size") == 2);
+  BOOST_TEST(Value(dut, row, "str.size") == 5);
+  BOOST_TEST(Value(dut, row, "optional.present") == 1);
+  BOOST_TEST(Value(dut, row, "optional.raw") == 9);
+  BOOST_TEST(Value(dut, row, "optional.value") == 4.0);
+  BOOST_TEST(Value(dut, row, "sub.raw") == 17);
+  BOOST_TEST(Value(dut, row, "sub.value") == -2.0);
+  BOOST_TEST(Value(dut, row, "flag") == 1);
+  BOOST_TEST(Value(dut, row, "vecobj.size") == 2);
+  BOOST_TEST(Value(dut, row, "i64") == -(1ll << 40));
+
+  BOOST_TEST(TelemetryDecodePlan::Get<int32_t>(
+                 row.data(), *dut.FindField("i32")) == -12345);
+
+  // An absent optional clears whatever was there before.
+  data.optional = {};
+  data.i64 = 5;
+  dut.Decode(TelemetryWriteArchive<PlanTest>::Serialize(&data), row.data());
+  BOOST_TEST(Value(dut, row, "optional.present") == 0);
+  BOOST_TEST(Value(dut, row, "optional.raw") == 0);
+  BOOST_TEST(Value(dut, row, "optional.value") == 0);
+  BOOST_TEST(Value(dut, row, "sub.raw") == 17);
+  BOOST_TEST(Value(dut, row, "i64") == 5);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDecodePlanCorruptTest) {
+  TelemetryDecodePlan dut(TelemetryWriteArchive<PlanTest>::schema());
+  std::vector<char> row(dut.row_size());
+
+  PlanTest data;
+  data.vecvec = { { 1, 2 } };
+  const auto record = TelemetryWriteArchive<PlanTest>::Serialize(&data);
+
+  BOOST_CHECK_THROW(dut.Decode(record.substr(0, record.size() - 1),
+                               row.data()),
+                    mjlib::base::system_error);
+  BOOST_CHECK_THROW(dut.Decode(record + "x", row.data()),
+                    mjlib::base::system_error);
+
+  const auto schema = TelemetryWriteArchive<PlanTest>::schema();
+  BOOST_CHECK_THROW(TelemetryDecodePlan(schema.substr(0, schema.size() - 1)),
+                    mjlib::base::system_error);
+}
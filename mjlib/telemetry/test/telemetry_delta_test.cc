@@ -0,0 +1,95 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_delta.h"
+
+#include <boost/test/auto_unit_test.hpp>
+
+using namespace mjlib::telemetry;
+
+namespace {
+std::string Encode(const std::string& record, std::string* previous) {
+  std::string result(TelemetryDelta::MaxSize(record.size()), '\0');
+  const auto size = TelemetryDelta::Encode(
+      record.data(), record.size(), &(*previous)[0], &result[0]);
+  result.resize(size);
+  return result;
+}
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaTest) {
+  // 10 bytes, so the last word is short.
+  const std::string first = "abcdefghij";
+  std::string previous = first;
+  std::string host = first;
+
+  {
+    const auto delta = Encode(first, &previous);
+    BOOST_TEST(delta == std::string("\x0a\x00\x00\x00\x00", 5));
+    BOOST_TEST(TelemetryDelta::Apply(delta, &host));
+    BOOST_TEST(host == first);
+  }
+
+  {
+    const std::string second = "abcdEFghiJ";
+    const auto delta = Encode(second, &previous);
+    BOOST_TEST(delta == std::string("\x0a\x00\x00\x00\x06" "EFgh" "iJ", 11));
+    BOOST_TEST(previous == second);
+    BOOST_TEST(TelemetryDelta::Apply(delta, &host));
+    BOOST_TEST(host == second);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaInPlaceTest) {
+  // The delta may be written over the top of the record it is made
+  // from, so long as it starts far enough ahead.
+  std::string previous(100, 'a');
+  std::string host = previous;
+  std::string updated = previous;
+  for (size_t i = 0; i < updated.size(); i += 3) { updated[i] = 'b'; }
+
+  const size_t offset = TelemetryDelta::kHeaderSize +
+      TelemetryDelta::BitmapSize(updated.size());
+  std::string buffer = std::string(offset, '\0') + updated;
+  const auto size = TelemetryDelta::Encode(
+      &buffer[offset], updated.size(), &previous[0], &buffer[0]);
+  BOOST_TEST(previous == updated);
+
+  BOOST_TEST(TelemetryDelta::Apply(std::string_view(buffer.data(), size),
+                                   &host));
+  BOOST_TEST(host == updated);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryDeltaMalformedTest) {
+  std::string host = "abcdefghij";
+
+  // Too short for the header.
+  BOOST_TEST(!TelemetryDelta::Apply(std::string("\x0a\x00", 2), &host));
+
+  // For a different size of record.
+  BOOST_TEST(!TelemetryDelta::Apply(std::string("\x08\x00\x00\x00\x00", 5),
+                                    &host));
+
+  // Missing the bitmap.
+  BOOST_TEST(!TelemetryDelta::Apply(std::string("\x0a\x00\x00\x00", 4),
+                                    &host));
+
+  // Missing a changed word.
+  BOOST_TEST(!TelemetryDelta::Apply(std::string("\x0a\x00\x00\x00\x03" "EFgh",
+                                                9), &host));
+
+  // Trailing garbage.
+  BOOST_TEST(!TelemetryDelta::Apply(std::string("\x0a\x00\x00\x00\x00" "x",
+                                                6), &host));
+}
@@ -0,0 +1,278 @@
+// Copyright 2019 Josh Pieper, jjp@pobox.com.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjlib/telemetry/telemetry_log_reader.h"
+#include "mjlib/telemetry/telemetry_log_writer.h"
+
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
+
+#include <boost/test/auto_unit_test.hpp>
+
+#include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/visitor.h"
+#include "mjlib/telemetry/telemetry_archive.h"
+
+using namespace mjlib::telemetry;
+namespace base = mjlib::base;
+namespace pt = boost::posix_time;
+
+namespace {
+std::string TempFile(const std::string& name) {
+  return "/tmp/mjlib_telemetry_log_test_" +
+      std::to_string(::getpid()) + "_" + name;
+}
+
+struct Stats {
+  int32_t count = 0;
+  float position = 0.0f;
+  float velocity = 0.0f;
+  std::array<float, 12> pid = {};
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(count));
+    a->Visit(MJ_NVP(position));
+    a->Visit(MJ_NVP(velocity));
+    a->Visit(MJ_NVP(pid));
+  }
+};
+
+struct Fault {
+  uint8_t code = 0;
+
+  template <typename Archive>
+  void Serialize(Archive* a) {
+    a->Visit(MJ_NVP(code));
+  }
+};
+
+const pt::ptime kStart{boost::gregorian::date(2019, 6, 1), pt::hours(12)};
+
+Stats Decode(const std::string& data) {
+  Stats result;
+  base::BufferReadStream stream(data);
+  TelemetrySimpleReadArchive<Stats>::Deserialize(&result, stream);
+  return result;
+}
+
+struct Fixture {
+  Fixture(const std::string& name, bool close = true, bool compress = false)
+      : filename(TempFile(name)) {
+    TelemetryLogWriter::Options options;
+    // Small enough that there are many indices.
+    options.index_interval = 4096;
+    options.compress = compress;
+    TelemetryLogWriter dut(filename, options);
+
+    stats_id = dut.WriteSchema<Stats>("servo_stats");
+    fault_id = dut.WriteSchema<Fault>("fault");
+
+    // One stats record every 2ms, and a fault every 100ms.
+    for (int i = 0; i < kCount; i++) {
+      Stats stats;
+      stats.count = i;
+      stats.position = 0.01f * i;
+      dut.WriteData(stats_id, kStart + pt::milliseconds(2 * i),
+                    TelemetryWriteArchive<Stats>::Serialize(&stats));
+      if ((i % 50) == 0) {
+        Fault fault;
+        fault.code = i / 50;
+        dut.WriteData(fault_id, kStart + pt::milliseconds(2 * i),
+                      TelemetryWriteArchive<Fault>::Serialize(&fault));
+      }
+    }
+
+    if (!close) {
+      // Simulate a process which died before the file was closed.
+      dut.Flush();
+      const auto size = dut.position();
+      dut.Close();
+      BOOST_TEST_REQUIRE(::truncate(filename.c_str(), size) == 0);
+    }
+
+    size = dut.position();
+  }
+
+  ~Fixture() {
+    ::remove(filename.c_str());
+  }
+
+  static constexpr int kCount = 10000;
+
+  const std::string filename;
+  uint64_t size = 0;
+  uint32_t stats_id = 0;
+  uint32_t fault_id = 0;
+};
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogReadAllTest) {
+  Fixture fixture("read_all");
+  TelemetryLogReader dut(fixture.filename);
+
+  BOOST_TEST(dut.index_count() > 10);
+  BOOST_TEST_REQUIRE(dut.schemas().size() == 2);
+  BOOST_TEST(dut.schemas()[0].name == "servo_stats");
+  BOOST_TEST(dut.schemas()[0].schema ==
+             TelemetryWriteArchive<Stats>::schema());
+  BOOST_TEST(dut.schemas()[1].name == "fault");
+  BOOST_TEST(*dut.FindIdentifier("servo_stats") == fixture.stats_id);
+  BOOST_TEST(*dut.FindIdentifier("fault") == fixture.fault_id);
+  BOOST_TEST(!dut.FindIdentifier("missing"));
+
+  int stats_count = 0;
+  int fault_count = 0;
+  while (auto item = dut.Read()) {
+    if (item->identifier == fixture.stats_id) {
+      const auto stats = Decode(item->data);
+      BOOST_TEST(stats.count == stats_count);
+      BOOST_TEST((item->timestamp ==
+                  kStart + pt::milliseconds(2 * stats_count)));
+      stats_count++;
+    } else {
+      BOOST_TEST(item->identifier == fixture.fault_id);
+      fault_count++;
+    }
+  }
+  BOOST_TEST(stats_count == Fixture::kCount);
+  BOOST_TEST(fault_count == Fixture::kCount / 50);
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogSeekTest) {
+  Fixture fixture("seek");
+  TelemetryLogReader dut(fixture.filename);
+
+  // Land exactly on a record.
+  dut.Seek(kStart + pt::milliseconds(10000));
+  {
+    const auto item = dut.Read(fixture.stats_id);
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(Decode(item->data).count == 5000);
+  }
+
+  // And between records.
+  dut.Seek(kStart + pt::microseconds(3001));
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(Decode(item->data).count == 2);
+  }
+
+  // Only faults are considered here, so the next fault is found.
+  dut.Seek(fixture.fault_id, kStart + pt::milliseconds(10002));
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(item->identifier == fixture.fault_id);
+    BOOST_TEST((item->timestamp == kStart + pt::milliseconds(10100)));
+  }
+
+  // The first record of an identifier.
+  dut.Seek(fixture.fault_id, pt::ptime());
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(item->identifier == fixture.fault_id);
+    BOOST_TEST((item->timestamp == kStart));
+  }
+
+  // Back to the very start.
+  dut.Seek(pt::ptime());
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(Decode(item->data).count == 0);
+  }
+
+  // And past the end.
+  dut.Seek(kStart + pt::hours(1));
+  BOOST_TEST(!dut.Read());
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogUnclosedTest) {
+  Fixture fixture("unclosed", false);
+  TelemetryLogReader dut(fixture.filename);
+
+  BOOST_TEST(dut.schemas().size() == 2);
+  BOOST_TEST(dut.index_count() > 10);
+
+  dut.Seek(fixture.stats_id, kStart + pt::milliseconds(19998));
+  const auto item = dut.Read();
+  BOOST_TEST_REQUIRE(!!item);
+  BOOST_TEST(Decode(item->data).count == Fixture::kCount - 1);
+  BOOST_TEST(!dut.Read());
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogCompressedTest) {
+  Fixture plain("plain");
+  Fixture fixture("compressed", true, true);
+  // Successive records are compressed together, so the redundancy
+  // between them is removed too.
+  BOOST_TEST(fixture.size * 4 < plain.size);
+
+  TelemetryLogReader dut(fixture.filename);
+  BOOST_TEST(dut.index_count() > 1);
+  int count = 0;
+  while (auto item = dut.Read(fixture.stats_id)) {
+    BOOST_TEST(Decode(item->data).count == count);
+    BOOST_TEST((item->timestamp == kStart + pt::milliseconds(2 * count)));
+    count++;
+  }
+  BOOST_TEST(count == Fixture::kCount);
+
+  // Seeking lands on records in the middle of a run.
+  dut.Seek(kStart + pt::milliseconds(10000));
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(Decode(item->data).count == 5000);
+  }
+
+  dut.Seek(kStart + pt::microseconds(3001));
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(Decode(item->data).count == 2);
+    const auto next = dut.Read();
+    BOOST_TEST_REQUIRE(!!next);
+    BOOST_TEST(Decode(next->data).count == 3);
+  }
+
+  dut.Seek(fixture.fault_id, kStart + pt::milliseconds(10002));
+  {
+    const auto item = dut.Read();
+    BOOST_TEST_REQUIRE(!!item);
+    BOOST_TEST(item->identifier == fixture.fault_id);
+    BOOST_TEST((item->timestamp == kStart + pt::milliseconds(10100)));
+  }
+
+  dut.Seek(kStart + pt::hours(1));
+  BOOST_TEST(!dut.Read());
+}
+
+BOOST_AUTO_TEST_CASE(TelemetryLogCompressedUnclosedTest) {
+  // Flush() writes the partial run, so nothing is lost.
+  Fixture fixture("compressed_unclosed", false, true);
+  TelemetryLogReader dut(fixture.filename);
+
+  BOOST_TEST(dut.schemas().size() == 2);
+  dut.Seek(fixture.stats_id, kStart + pt::milliseconds(19998));
+  const auto item = dut.Read();
+  BOOST_TEST_REQUIRE(!!item);
+  BOOST_TEST(Decode(item->data).count == Fixture::kCount - 1);
+  BOOST_TEST(!dut.Read());
+}
@@ -293,7 +293,18 @@ class BldcServo::Impl {
     std::swap(current_data_, next_data_);
   }
 
-  Status status() const { return status_; }
+  Status status() const {
+    // status_ is written from the update ISR, so it is copied with
+    // that interrupt masked.  An update which comes due in the
+    // meantime is held pending, and runs as soon as the copy is done.
+    // Before Start() there is no ISR to race with.
+    if (!timer_) { return status_; }
+
+    NVIC_DisableIRQ(pwm_irqn_);
+    const Status result = status_;
+    NVIC_EnableIRQ(pwm_irqn_);
+    return result;
+  }
 
   const Config& config() const { return config_; }
 
@@ -359,10 +370,11 @@ class BldcServo::Impl {
 
     // NOTE: We don't use IrqCallbackTable here because we need the
     // absolute minimum latency possible.
-    const auto irqn = FindUpdateIrq(timer_);
-    NVIC_SetVector(irqn, reinterpret_cast<uint32_t>(&Impl::GlobalInterrupt));
-    HAL_NVIC_SetPriority(irqn, 0, 0);
-    NVIC_EnableIRQ(irqn);
+    pwm_irqn_ = FindUpdateIrq(timer_);
+    NVIC_SetVector(pwm_irqn_,
+                   reinterpret_cast<uint32_t>(&Impl::GlobalInterrupt));
+    HAL_NVIC_SetPriority(pwm_irqn_, 0, 0);
+    NVIC_EnableIRQ(pwm_irqn_);
 
     // Reinitialize the counter and update all registers.
     timer_->EGR |= TIM_EGR_UG;
@@ -1031,6 +1043,7 @@ class BldcServo::Impl {
   TIM_TypeDef* timer_ = nullptr;
   volatile uint32_t* timer_sr_ = nullptr;
   volatile uint32_t* timer_cr1_ = nullptr;
+  IRQn_Type pwm_irqn_ = {};
   TIM_TypeDef* control_timer_ = nullptr;
   ADC_TypeDef* const adc1_ = ADC1;
   ADC_TypeDef* const adc2_ = ADC2;
@@ -383,6 +383,8 @@ class BldcServo {
   void Start();
   void Command(const CommandData&);
 
+  /// Return a consistent copy of the status, which the control
+  /// interrupt updates in the background.
   Status status() const;
   const Config& config() const;
   const Motor& motor() const;
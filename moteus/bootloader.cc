@@ -16,9 +16,8 @@
 
 #include <string_view>
 
-#include <boost/crc.hpp>
-
 #include "mjlib/base/buffer_stream.h"
+#include "mjlib/base/crc_ccitt.h"
 #include "mjlib/base/tokenizer.h"
 #include "mjlib/multiplex/format.h"
 #include "mjlib/multiplex/stream.h"
@@ -26,6 +25,10 @@
 namespace {
 using mjlib::multiplex::Format;
 
+// Speed doesn't matter here, but flash does, so we use the smallest
+// table.
+using Crc = mjlib::base::CrcCcittT<mjlib::base::CrcCcittMethod::kNibble>;
+
 template <typename T>
 uint32_t u32(T value) {
   return static_cast<uint32_t>(value);
@@ -261,7 +264,7 @@ class BootloaderServer {
     buffer_stream.write(response_.view());
 
     // Calculate the CRC and write it out.
-    boost::crc_ccitt_type crc;
+    Crc crc;
     crc.process_bytes(out_frame_.data, buffer_stream.offset());
     write_stream.Write<uint16_t>(crc.checksum());
 
@@ -335,7 +338,7 @@ class BootloaderServer {
     }
 
     // Verify the checksum.
-    boost::crc_ccitt_type crc;
+    Crc crc;
     crc.process_bytes(frame_.data, frame_.pos - 2);
     const uint16_t expected_crc = crc.checksum();
 
@@ -55,7 +55,7 @@ int main(void) {
   // for millisecond turnover.
   MillisecondTimer timer;
 
-  micro::SizedPool<12288> pool;
+  micro::SizedPool<13824> pool;
 
   Stm32F446AsyncUart rs485(&pool, &timer, []() {
       Stm32F446AsyncUart::Options options;
@@ -66,7 +66,25 @@ int main(void) {
       return options;
     }());
 
-  multiplex::MicroServer multiplex_protocol(&pool, &rs485, {});
+  // Replies to broadcast frames wait here for their slot.
+  struct ReplyDelay {
+    uint32_t start_us = 0;
+    uint32_t delay_us = 0;
+    micro::VoidCallback callback;
+  } reply_delay;
+
+  multiplex::MicroServer multiplex_protocol(&pool, &rs485, [&]() {
+      multiplex::MicroServer::Options options;
+      // Enough to hold a broadcast frame which commands many servos.
+      options.buffer_size = 512;
+      options.reply_delay = [&reply_delay, &timer](
+          uint32_t delay_us, const micro::VoidCallback& callback) {
+        reply_delay.start_us = timer.read_us();
+        reply_delay.delay_us = delay_us;
+        reply_delay.callback = callback;
+      };
+      return options;
+    }());
 
   micro::AsyncStream* serial = multiplex_protocol.MakeTunnel(1);
 
@@ -100,6 +118,13 @@ int main(void) {
     rs485.Poll();
     moteus_controller.Poll();
 
+    if (reply_delay.callback.valid() &&
+        (timer.read_us() - reply_delay.start_us) >= reply_delay.delay_us) {
+      auto callback = reply_delay.callback;
+      reply_delay.callback = {};
+      callback();
+    }
+
     const auto new_time = timer.read_ms();
 
     if (new_time != old_time) {
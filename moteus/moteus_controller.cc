@@ -14,6 +14,8 @@
 
 #include "moteus/moteus_controller.h"
 
+#include <algorithm>
+
 #include "mjlib/base/limit.h"
 
 #include "moteus/math.h"
@@ -66,34 +68,6 @@ Value ScaleMapping(float value,
   return Value(static_cast<int8_t>(0));
 }
 
-Value ScalePosition(float value, size_t type) {
-  return ScaleMapping(value, 0.01f, 0.001f, 0.00001f, type);
-}
-
-Value ScaleVelocity(float value, size_t type) {
-  return ScaleMapping(value, 0.1f, 0.001f, 0.00001f, type);
-}
-
-Value ScaleTemperature(float value, size_t type) {
-  return ScaleMapping(value, 1.0f, 0.1f, 0.001f, type);
-}
-
-Value ScalePwm(float value, size_t type) {
-  return ScaleMapping(value, 1.0f / 127.0f, 1.0f / 32767.0f,
-                      1.0f / 2147483647.0f,
-                      type);
-}
-
-Value ScaleCurrent(float value, size_t type) {
-  // For now, current and temperature have identical scaling.
-  return ScaleTemperature(value, type);
-}
-
-Value ScaleVoltage(float value, size_t type) {
-  // For now, voltage and current have identical scaling.
-  return ScaleCurrent(value, type);
-}
-
 int8_t ReadIntMapping(Value value) {
   return std::visit([](auto a) {
       return static_cast<int8_t>(a);
@@ -138,27 +112,6 @@ float ReadScaleMapping(Value value,
   return std::visit(ValueScaler{int8_scale, int16_scale, int32_scale}, value);
 }
 
-float ReadPwm(Value value) {
-  return ReadScaleMapping(value, 1.0f / 127.0f, 1.0f / 32767.0f,
-                          1.0f / 2147483647.0f);
-}
-
-float ReadVoltage(Value value) {
-  return ReadScaleMapping(value, 1.0f, 0.1f, 0.001f);
-}
-
-float ReadPosition(Value value) {
-  return ReadScaleMapping(value, 0.01f, 0.001f, 0.00001f);
-}
-
-float ReadVelocity(Value value) {
-  return ReadScaleMapping(value, 0.1f, 0.001f, 0.00001f);
-}
-
-float ReadCurrent(Value value) {
-  return ReadScaleMapping(value, 1.0f, 0.1f, 0.001f);
-}
-
 enum class Register {
   kMode = 0x000,
   kPosition = 0x001,
@@ -235,6 +188,221 @@ enum class Register {
   kRegisterMapVersion = 0x103,
   kMultiplexId = 0x104,
 };
+
+/// How a register's value is mapped to and from each of the types
+/// which can be used on the wire.
+enum class Scale : uint8_t {
+  kInt,
+  kInt32Only,
+  kPwm,
+  kPosition,
+  kVelocity,
+  kTemperature,
+  kCurrent,
+  kVoltage,
+};
+
+struct ScaleFactors {
+  float int8_scale;
+  float int16_scale;
+  float int32_scale;
+};
+
+constexpr ScaleFactors GetScaleFactors(Scale scale) {
+  switch (scale) {
+    case Scale::kPwm: {
+      return {1.0f / 127.0f, 1.0f / 32767.0f, 1.0f / 2147483647.0f};
+    }
+    case Scale::kPosition: {
+      return {0.01f, 0.001f, 0.00001f};
+    }
+    case Scale::kVelocity: {
+      return {0.1f, 0.001f, 0.00001f};
+    }
+    case Scale::kTemperature:
+    case Scale::kCurrent:
+    case Scale::kVoltage: {
+      // For now, temperature, current and voltage have identical
+      // scaling.
+      return {1.0f, 0.1f, 0.001f};
+    }
+    case Scale::kInt:
+    case Scale::kInt32Only: {
+      break;
+    }
+  }
+  return {1.0f, 1.0f, 1.0f};
+}
+
+inline multiplex::MicroServer::ReadResult ScaleRead(
+    Scale scale, float value, size_t type) {
+  switch (scale) {
+    case Scale::kInt: {
+      return IntMapping(value, type);
+    }
+    case Scale::kInt32Only: {
+      if (type == 2) { return Value(static_cast<int32_t>(value)); }
+      return static_cast<uint32_t>(1);
+    }
+    default: {
+      break;
+    }
+  }
+  const auto factors = GetScaleFactors(scale);
+  return ScaleMapping(value, factors.int8_scale, factors.int16_scale,
+                      factors.int32_scale, type);
+}
+
+inline float ScaleWrite(Scale scale, const Value& value) {
+  if (scale == Scale::kInt || scale == Scale::kInt32Only) {
+    return ReadIntMapping(value);
+  }
+  const auto factors = GetScaleFactors(scale);
+  return ReadScaleMapping(value, factors.int8_scale, factors.int16_scale,
+                          factors.int32_scale);
+}
+
+/// Everything which is visible through the register interface.
+struct RegisterData {
+  BldcServo::Status status;
+  BldcServo::CommandData command;
+  bool command_valid = false;
+};
+
+struct RegisterDefinition {
+  Register reg;
+  Scale scale;
+
+  /// nullptr if the register cannot be read.
+  float (*read)(const RegisterData&);
+
+  /// nullptr if the register cannot be written.  Otherwise, returns 0
+  /// on success or an error code.
+  uint32_t (*write)(RegisterData&, float);
+};
+
+#define MOTEUS_READ(field)                                              \
+  [](const RegisterData& d) { return static_cast<float>(d.field); }
+
+#define MOTEUS_WRITE(field)                                             \
+  [](RegisterData& d, float value) -> uint32_t {                        \
+    d.field = value;                                                    \
+    return 0;                                                           \
+  }
+
+/// Every register, sorted by address.
+constexpr RegisterDefinition kRegisters[] = {
+  { Register::kMode, Scale::kInt,
+    [](const RegisterData& d) {
+      return static_cast<float>(static_cast<int8_t>(d.status.mode));
+    },
+    [](RegisterData& d, float value) -> uint32_t {
+      const auto new_mode_int = static_cast<int8_t>(value);
+      if (new_mode_int > static_cast<int8_t>(BldcServo::Mode::kNumModes)) {
+        return 3;
+      }
+      d.command_valid = true;
+      const auto new_mode = static_cast<BldcServo::Mode>(new_mode_int);
+      if (new_mode != d.command.mode) {
+        d.command = {};
+      }
+      d.command.mode = new_mode;
+      return 0;
+    } },
+  { Register::kPosition, Scale::kPosition,
+    MOTEUS_READ(status.unwrapped_position), nullptr },
+  { Register::kVelocity, Scale::kVelocity,
+    MOTEUS_READ(status.velocity), nullptr },
+  { Register::kTemperature, Scale::kTemperature,
+    MOTEUS_READ(status.fet_temp_C), nullptr },
+  { Register::kQCurrent, Scale::kCurrent,
+    MOTEUS_READ(status.q_A), nullptr },
+  { Register::kDCurrent, Scale::kCurrent,
+    MOTEUS_READ(status.d_A), nullptr },
+  { Register::kVoltage, Scale::kVoltage,
+    MOTEUS_READ(status.bus_V), nullptr },
+  { Register::kFault, Scale::kInt,
+    [](const RegisterData& d) {
+      return static_cast<float>(static_cast<int>(d.status.fault));
+    },
+    nullptr },
+
+  { Register::kPwmPhaseA, Scale::kPwm,
+    MOTEUS_READ(command.pwm.a), MOTEUS_WRITE(command.pwm.a) },
+  { Register::kPwmPhaseB, Scale::kPwm,
+    MOTEUS_READ(command.pwm.b), MOTEUS_WRITE(command.pwm.b) },
+  { Register::kPwmPhaseC, Scale::kPwm,
+    MOTEUS_READ(command.pwm.c), MOTEUS_WRITE(command.pwm.c) },
+
+  { Register::kVoltagePhaseA, Scale::kVoltage,
+    MOTEUS_READ(command.phase_v.a), MOTEUS_WRITE(command.phase_v.a) },
+  { Register::kVoltagePhaseB, Scale::kVoltage,
+    MOTEUS_READ(command.phase_v.b), MOTEUS_WRITE(command.phase_v.b) },
+  { Register::kVoltagePhaseC, Scale::kVoltage,
+    MOTEUS_READ(command.phase_v.c), MOTEUS_WRITE(command.phase_v.c) },
+
+  { Register::kVFocTheta, Scale::kPwm,
+    [](const RegisterData& d) { return d.command.theta / kPi; },
+    [](RegisterData& d, float value) -> uint32_t {
+      d.command.theta = value * kPi;
+      return 0;
+    } },
+  { Register::kVFocVoltage, Scale::kVoltage,
+    MOTEUS_READ(command.voltage), MOTEUS_WRITE(command.voltage) },
+
+  { Register::kCommandQCurrent, Scale::kCurrent,
+    MOTEUS_READ(command.i_q_A), MOTEUS_WRITE(command.i_q_A) },
+  { Register::kCommandDCurrent, Scale::kCurrent,
+    MOTEUS_READ(command.i_d_A), MOTEUS_WRITE(command.i_d_A) },
+
+  { Register::kCommandPosition, Scale::kPosition,
+    MOTEUS_READ(command.position), MOTEUS_WRITE(command.position) },
+  { Register::kCommandVelocity, Scale::kVelocity,
+    MOTEUS_READ(command.velocity), MOTEUS_WRITE(command.velocity) },
+  { Register::kCommandPositionMaxCurrent, Scale::kCurrent,
+    MOTEUS_READ(command.max_current), MOTEUS_WRITE(command.max_current) },
+  { Register::kCommandStopPosition, Scale::kPosition,
+    MOTEUS_READ(command.stop_position), MOTEUS_WRITE(command.stop_position) },
+  { Register::kCommandFeedforwardCurrent, Scale::kCurrent,
+    MOTEUS_READ(command.feedforward_A), MOTEUS_WRITE(command.feedforward_A) },
+  { Register::kCommandKpScale, Scale::kPwm,
+    MOTEUS_READ(command.kp_scale), MOTEUS_WRITE(command.kp_scale) },
+  { Register::kCommandKdScale, Scale::kPwm,
+    MOTEUS_READ(command.kd_scale), MOTEUS_WRITE(command.kd_scale) },
+
+  { Register::kModelNumber, Scale::kInt32Only,
+    [](const RegisterData&) {
+      return static_cast<float>(MOTEUS_MODEL_NUMBER);
+    },
+    nullptr },
+  { Register::kSerialNumber, Scale::kInt, nullptr, nullptr },
+  { Register::kRegisterMapVersion, Scale::kInt, nullptr, nullptr },
+  { Register::kMultiplexId, Scale::kInt, nullptr, nullptr },
+};
+
+#undef MOTEUS_WRITE
+#undef MOTEUS_READ
+
+constexpr bool RegistersSorted() {
+  for (size_t i = 1; i < sizeof(kRegisters) / sizeof(*kRegisters); i++) {
+    if (kRegisters[i].reg <= kRegisters[i - 1].reg) { return false; }
+  }
+  return true;
+}
+
+static_assert(RegistersSorted(), "kRegisters must be sorted by address");
+
+constexpr const RegisterDefinition* kRegistersEnd =
+    kRegisters + sizeof(kRegisters) / sizeof(*kRegisters);
+
+/// @return the first definition at or after @p reg.
+const RegisterDefinition* LowerBoundRegister(uint32_t reg) {
+  return std::lower_bound(
+      kRegisters, kRegistersEnd, reg,
+      [](const RegisterDefinition& def, uint32_t value) {
+        return static_cast<uint32_t>(def.reg) < value;
+      });
+}
 }
 
 class MoteusController::Impl : public multiplex::MicroServer::Server {
@@ -285,9 +453,9 @@ class MoteusController::Impl : public multiplex::MicroServer::Server {
 
   void Poll() {
     // Check to see if we have a command to send out.
-    if (command_valid_) {
-      command_valid_ = false;
-      bldc_.Command(command_);
+    if (data_.command_valid) {
+      data_.command_valid = false;
+      bldc_.Command(data_.command);
     }
   }
 
@@ -298,214 +466,94 @@ class MoteusController::Impl : public multiplex::MicroServer::Server {
 
   uint32_t Write(multiplex::MicroServer::Register reg,
                  const multiplex::MicroServer::Value& value) override {
-    switch (static_cast<Register>(reg)) {
-      case Register::kMode: {
-        const auto new_mode_int = ReadIntMapping(value);
-        if (new_mode_int > static_cast<int8_t>(BldcServo::Mode::kNumModes)) {
-          return 3;
-        }
-        command_valid_ = true;
-        const auto new_mode = static_cast<BldcServo::Mode>(new_mode_int);
-        if (new_mode != command_.mode) {
-          command_ = {};
-        }
-        command_.mode = new_mode;
-        return 0;
-      }
-
-      case Register::kPwmPhaseA: {
-        command_.pwm.a = ReadPwm(value);
-        return 0;
-      }
-      case Register::kPwmPhaseB: {
-        command_.pwm.b = ReadPwm(value);
-        return 0;
-      }
-      case Register::kPwmPhaseC: {
-        command_.pwm.c = ReadPwm(value);
-        return 0;
-      }
-      case Register::kVoltagePhaseA: {
-        command_.phase_v.a = ReadVoltage(value);
-        return 0;
-      }
-      case Register::kVoltagePhaseB: {
-        command_.phase_v.b = ReadVoltage(value);
-        return 0;
-      }
-      case Register::kVoltagePhaseC: {
-        command_.phase_v.c = ReadVoltage(value);
-        return 0;
-      }
-      case Register::kVFocTheta: {
-        command_.theta = ReadPwm(value) * kPi;
-        return 0;
-      }
-      case Register::kVFocVoltage: {
-        command_.voltage = ReadVoltage(value);
-        return 0;
-      }
-      case Register::kCommandQCurrent: {
-        command_.i_q_A = ReadCurrent(value);
-        return 0;
-      }
-      case Register::kCommandDCurrent: {
-        command_.i_d_A = ReadCurrent(value);
-        return 0;
-      }
-      case Register::kCommandPosition: {
-        command_.position = ReadPosition(value);
-        return 0;
-      }
-      case Register::kCommandVelocity: {
-        command_.velocity = ReadVelocity(value);
-        return 0;
-      }
-      case Register::kCommandPositionMaxCurrent: {
-        command_.max_current = ReadCurrent(value);
-        return 0;
-      }
-      case Register::kCommandStopPosition: {
-        command_.stop_position = ReadCurrent(value);
-        return 0;
-      }
-      case Register::kCommandFeedforwardCurrent: {
-        command_.feedforward_A = ReadCurrent(value);
-        return 0;
-      }
-      case Register::kCommandKpScale: {
-        command_.kp_scale = ReadPwm(value);
-        return 0;
-      }
-      case Register::kCommandKdScale: {
-        command_.kd_scale = ReadPwm(value);
-        return 0;
-      }
+    const auto* const def = LowerBoundRegister(reg);
+    if (def == kRegistersEnd || static_cast<uint32_t>(def->reg) != reg) {
+      // An unknown register.
+      return 1;
+    }
+    return WriteRegister(*def, value);
+  }
 
-      case Register::kPosition:
-      case Register::kVelocity:
-      case Register::kTemperature:
-      case Register::kQCurrent:
-      case Register::kDCurrent:
-      case Register::kVoltage:
-      case Register::kFault:
-      case Register::kModelNumber:
-      case Register::kSerialNumber:
-      case Register::kRegisterMapVersion:
-      case Register::kMultiplexId: {
-        // Not writeable
-        return 2;
-      }
+  void WriteMultiple(multiplex::MicroServer::Register start,
+                     const multiplex::MicroServer::Value* values,
+                     size_t count, uint32_t* errors) override {
+    // Walk the table alongside the range, rather than searching for
+    // every register.
+    const auto* def = LowerBoundRegister(start);
+    for (size_t i = 0; i < count; i++) {
+      const uint32_t reg = start + i;
+      while (def != kRegistersEnd && static_cast<uint32_t>(def->reg) < reg) {
+        ++def;
+      }
+      errors[i] =
+          (def != kRegistersEnd && static_cast<uint32_t>(def->reg) == reg) ?
+          WriteRegister(*def, values[i]) : 1;
     }
+  }
 
-    // If we got here, then we had an unknown register.
-    return 1;
+  void StartFrame() override {
+    // Every register read in this frame is served from the same copy
+    // of the status, so that a reply is self consistent.  The copy
+    // is taken on the first read, so that frames which only write
+    // don't mask the update interrupt at all.
+    status_valid_ = false;
   }
 
   multiplex::MicroServer::ReadResult Read(
       multiplex::MicroServer::Register reg,
       size_t type) const override {
-    switch (static_cast<Register>(reg)) {
-      case Register::kMode: {
-        return IntMapping(static_cast<int8_t>(bldc_.status().mode), type);
-      }
-      case Register::kPosition: {
-        return ScalePosition(bldc_.status().unwrapped_position, type);
-      }
-      case Register::kVelocity: {
-        return ScaleVelocity(bldc_.status().velocity, type);
-      }
-      case Register::kTemperature: {
-        return ScaleTemperature(bldc_.status().fet_temp_C, type);
-      }
-      case Register::kQCurrent: {
-        return ScaleCurrent(bldc_.status().q_A, type);
-      }
-      case Register::kDCurrent: {
-        return ScaleCurrent(bldc_.status().d_A, type);
-      }
-      case Register::kVoltage: {
-        return ScaleVoltage(bldc_.status().bus_V, type);
-      }
-      case Register::kFault: {
-        return IntMapping(bldc_.status().fault, type);
-      }
+    const auto* const def = LowerBoundRegister(reg);
+    if (def == kRegistersEnd || static_cast<uint32_t>(def->reg) != reg) {
+      return static_cast<uint32_t>(1);
+    }
+    return ReadRegister(*def, type);
+  }
 
-      case Register::kPwmPhaseA: {
-        return ScalePwm(command_.pwm.a, type);
-      }
-      case Register::kPwmPhaseB: {
-        return ScalePwm(command_.pwm.b, type);
-      }
-      case Register::kPwmPhaseC: {
-        return ScalePwm(command_.pwm.c, type);
-      }
-      case Register::kVoltagePhaseA: {
-        return ScaleVoltage(command_.phase_v.a, type);
-      }
-      case Register::kVoltagePhaseB: {
-        return ScaleVoltage(command_.phase_v.b, type);
-      }
-      case Register::kVoltagePhaseC: {
-        return ScaleVoltage(command_.phase_v.c, type);
-      }
-      case Register::kVFocTheta: {
-        return ScalePwm(command_.theta / kPi, type);
-      }
-      case Register::kVFocVoltage: {
-        return ScaleVoltage(command_.voltage, type);
-      }
-      case Register::kCommandQCurrent: {
-        return ScaleCurrent(command_.i_q_A, type);
-      }
-      case Register::kCommandDCurrent: {
-        return ScaleCurrent(command_.i_d_A, type);
-      }
-      case Register::kCommandPosition: {
-        return ScalePosition(command_.position, type);
-      }
-      case Register::kCommandVelocity: {
-        return ScaleVelocity(command_.velocity, type);
-      }
-      case Register::kCommandPositionMaxCurrent: {
-        return ScaleCurrent(command_.max_current, type);
-      }
-      case Register::kCommandStopPosition: {
-        return ScalePosition(command_.stop_position, type);
-      }
-      case Register::kCommandFeedforwardCurrent: {
-        return ScaleCurrent(command_.feedforward_A, type);
-      }
-      case Register::kCommandKpScale: {
-        return ScalePwm(command_.kp_scale, type);
-      }
-      case Register::kCommandKdScale: {
-        return ScalePwm(command_.kd_scale, type);
-      }
+  void ReadMultiple(multiplex::MicroServer::Register start, size_t count,
+                    size_t type,
+                    multiplex::MicroServer::ReadResult* results) const override {
+    const auto* def = LowerBoundRegister(start);
+    for (size_t i = 0; i < count; i++) {
+      const uint32_t reg = start + i;
+      while (def != kRegistersEnd && static_cast<uint32_t>(def->reg) < reg) {
+        ++def;
+      }
+      results[i] =
+          (def != kRegistersEnd && static_cast<uint32_t>(def->reg) == reg) ?
+          ReadRegister(*def, type) :
+          multiplex::MicroServer::ReadResult(static_cast<uint32_t>(1));
+    }
+  }
 
-      case Register::kModelNumber: {
-        if (type == 2) {
-          return Value(static_cast<int32_t>(MOTEUS_MODEL_NUMBER));
-        }
-        break;
-      }
-      case Register::kSerialNumber:
-      case Register::kRegisterMapVersion:
-      case Register::kMultiplexId: {
-        break;
-      }
+  uint32_t WriteRegister(const RegisterDefinition& def,
+                         const multiplex::MicroServer::Value& value) {
+    if (def.write == nullptr) {
+      // Not writeable.
+      return 2;
     }
+    return def.write(data_, ScaleWrite(def.scale, value));
+  }
 
-    // If we made it here, then we had an unknown register.
-    return static_cast<uint32_t>(1);
+  multiplex::MicroServer::ReadResult ReadRegister(
+      const RegisterDefinition& def, size_t type) const {
+    if (def.read == nullptr) {
+      return static_cast<uint32_t>(1);
+    }
+    if (!status_valid_) {
+      data_.status = bldc_.status();
+      status_valid_ = true;
+    }
+    return ScaleRead(def.scale, def.read(data_), type);
   }
 
   AS5047 as5047_;
   Drv8323 drv8323_;
   BldcServo bldc_;
 
-  bool command_valid_ = false;
-  BldcServo::CommandData command_;
+  // The status in here is a snapshot of bldc_.status() taken at the
+  // first register read of each frame.
+  mutable RegisterData data_;
+  mutable bool status_valid_ = false;
 };
 
 MoteusController::MoteusController(micro::Pool* pool,